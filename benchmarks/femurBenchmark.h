@@ -0,0 +1,274 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurBenchmark_h
+#define femurBenchmark_h
+
+#include "itkMultiThreaderBase.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace femur {
+namespace benchmark {
+/**
+ * A small Google Benchmark style harness, so the suite builds with ITK alone.
+ *
+ *   void BM_Filter(State & state)
+ *   {
+ *     ... untimed setup ...
+ *     while ( state.KeepRunning() ) { ... timed work ... }
+ *     state.SetItemsProcessed(voxelsPerIteration);
+ *   }
+ *   FEMUR_BENCHMARK(BM_Filter);
+ *
+ * Every benchmark is run at each requested thread count. The report gives the median
+ * time of one iteration, the throughput in items (voxels) per second and the scaling
+ * efficiency, throughput over single thread throughput divided by the thread count.
+ */
+
+/** Command line options shared by every benchmark */
+struct Options
+{
+  itk::SizeValueType            Size        = 128;
+  std::vector< unsigned int >   Threads     = {1, 2, 4, 8};
+  unsigned int                  Iterations  = 5;
+  std::string                   Filter;
+};
+
+class State
+{
+public:
+  State(const Options & options, unsigned int threads, double argument)
+    : m_Options(options), m_Threads(threads), m_Argument(argument)
+  {}
+
+  /** True while iterations remain. Each call ends the previous iteration's timing. */
+  bool KeepRunning()
+  {
+    const Clock::time_point now = Clock::now();
+    if ( m_Running )
+    {
+      m_Times.push_back(std::chrono::duration< double >(now - m_Start).count() - m_Paused);
+    }
+    m_Running = m_Times.size() < m_Options.Iterations;
+    m_Paused = 0.0;
+    m_Start = Clock::now();
+    return m_Running;
+  }
+
+  /** Exclude per iteration setup from the timing */
+  void PauseTiming()
+  {
+    m_PauseStart = Clock::now();
+  }
+
+  void ResumeTiming()
+  {
+    m_Paused += std::chrono::duration< double >(Clock::now() - m_PauseStart).count();
+  }
+
+  /** Items, usually voxels, processed by one iteration */
+  void SetItemsProcessed(double items)
+  {
+    m_Items = items;
+  }
+
+  /** Limit a filter to the thread count of this run */
+  template< typename TFilter >
+  void Configure(TFilter * filter) const
+  {
+    filter->SetNumberOfWorkUnits(m_Threads);
+    filter->GetMultiThreader()->SetMaximumNumberOfThreads(m_Threads);
+  }
+
+  unsigned int Threads() const { return m_Threads; }
+  itk::SizeValueType Size() const { return m_Options.Size; }
+  double Argument() const { return m_Argument; }
+  double Items() const { return m_Items; }
+
+  double MedianSeconds() const
+  {
+    if ( m_Times.empty() )
+    {
+      return 0.0;
+    }
+    std::vector< double > times = m_Times;
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  const Options &         m_Options;
+  unsigned int            m_Threads;
+  double                  m_Argument;
+  double                  m_Items = 0.0;
+  bool                    m_Running = false;
+  double                  m_Paused = 0.0;
+  Clock::time_point       m_Start;
+  Clock::time_point       m_PauseStart;
+  std::vector< double >   m_Times;
+};
+
+struct Benchmark
+{
+  std::string                       Name;
+  std::function< void(State &) >    Function;
+  std::vector< double >             Arguments;  /* Run once per argument, or once if empty */
+};
+
+inline std::vector< Benchmark > & Registry()
+{
+  static std::vector< Benchmark > benchmarks;
+  return benchmarks;
+}
+
+struct Registrar
+{
+  Registrar(const std::string & name, std::function< void(State &) > function, std::vector< double > arguments = {})
+  {
+    Registry().push_back({name, function, arguments});
+  }
+};
+
+/** Parse --size, --threads, --iterations and --filter. Exits with usage on anything else. */
+inline Options ParseOptions(int argc, char * argv[])
+{
+  Options options;
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string argument = argv[i];
+    if ( i + 1 >= argc )
+    {
+      std::cerr << "Usage: " << argv[0] << " [--size N] [--threads 1,2,4] [--iterations N] [--filter substring]" << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+    const std::string value = argv[++i];
+    if ( argument == "--size" )
+    {
+      options.Size = std::strtoul(value.c_str(), nullptr, 10);
+    }
+    else if ( argument == "--iterations" )
+    {
+      options.Iterations = std::max(1, std::atoi(value.c_str()));
+    }
+    else if ( argument == "--filter" )
+    {
+      options.Filter = value;
+    }
+    else if ( argument == "--threads" )
+    {
+      options.Threads.clear();
+      std::istringstream list(value);
+      std::string item;
+      while ( std::getline(list, item, ',') )
+      {
+        options.Threads.push_back(std::max(1, std::atoi(item.c_str())));
+      }
+    }
+    else
+    {
+      std::cerr << "Unknown option " << argument << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+  }
+  return options;
+}
+
+/** Run every registered benchmark matching the filter and print the report */
+inline int RunBenchmarks(const Options & options, std::ostream & os = std::cout)
+{
+  os << "Volume " << options.Size << "^3, " << options.Iterations << " iterations" << std::endl;
+  os << std::left << std::setw(44) << "Benchmark" << std::right
+     << std::setw(8) << "Threads" << std::setw(14) << "Median [ms]"
+     << std::setw(16) << "Mvoxels/s" << std::setw(12) << "Efficiency" << std::endl;
+
+  for (const Benchmark & benchmark : Registry())
+  {
+    std::vector< double > arguments = benchmark.Arguments;
+    if ( arguments.empty() )
+    {
+      arguments.push_back(0.0);
+    }
+
+    for (double argument : arguments)
+    {
+      std::ostringstream name;
+      name << benchmark.Name;
+      if ( !benchmark.Arguments.empty() )
+      {
+        name << "/" << argument;
+      }
+      if ( !options.Filter.empty() && name.str().find(options.Filter) == std::string::npos )
+      {
+        continue;
+      }
+
+      double baseThroughput = 0.0;
+      unsigned int baseThreads = 0;
+      for (unsigned int threads : options.Threads)
+      {
+        itk::MultiThreaderBase::SetGlobalDefaultNumberOfThreads(threads);
+        State state(options, threads, argument);
+        benchmark.Function(state);
+
+        const double seconds = state.MedianSeconds();
+        const double throughput = seconds > 0.0 ? state.Items() / seconds : 0.0;
+        if ( baseThreads == 0 )
+        {
+          baseThroughput = throughput;
+          baseThreads = threads;
+        }
+        const double efficiency = baseThroughput > 0.0
+          ? (throughput / baseThroughput) * baseThreads / threads : 0.0;
+
+        os << std::left << std::setw(44) << name.str() << std::right
+           << std::setw(8) << threads
+           << std::setw(14) << std::fixed << std::setprecision(3) << seconds * 1e3
+           << std::setw(16) << std::setprecision(2) << throughput / 1e6
+           << std::setw(12) << std::setprecision(2) << efficiency << std::endl;
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+} /* end namespace benchmark */
+} /* end namespace femur */
+
+#define FEMUR_BENCHMARK_CONCAT_(a, b) a##b
+#define FEMUR_BENCHMARK_CONCAT(a, b) FEMUR_BENCHMARK_CONCAT_(a, b)
+
+/** Register a benchmark function */
+#define FEMUR_BENCHMARK(function) \
+  static femur::benchmark::Registrar FEMUR_BENCHMARK_CONCAT(femurBenchmark, __LINE__)(#function, function)
+
+/** Register a benchmark function run once per value, e.g. per sigma */
+#define FEMUR_BENCHMARK_ARGUMENTS(function, ...) \
+  static femur::benchmark::Registrar FEMUR_BENCHMARK_CONCAT(femurBenchmark, __LINE__)(#function, function, {__VA_ARGS__})
+
+#endif /* femurBenchmark_h */
@@ -0,0 +1,330 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/**
+ * Microbenchmarks of the hot kernels on synthetic volumes.
+ *
+ *   FemurBenchmarks [--size 128] [--threads 1,2,4,8] [--iterations 5] [--filter Hessian]
+ *
+ * Each benchmark times one kernel in isolation, with its inputs prepared outside the
+ * timed loop, and is repeated at every thread count to show how well it scales.
+ */
+#include "femurBenchmark.h"
+#include "femurPipeline.h"
+
+#include "itkImageRegionIteratorWithIndex.h"
+
+#include <cmath>
+#include <random>
+
+namespace {
+
+using femur::benchmark::State;
+using femur::HUImageType;
+using femur::LabelImageType;
+using femur::SheetnessImageType;
+using femur::EigenValueImageType;
+
+using MultiScaleHessianFilterType = itk::MultiScaleHessianEnhancementImageFilter< HUImageType, SheetnessImageType >;
+using HessianFilterType           = MultiScaleHessianFilterType::HessianFilterType;
+using HessianImageType            = HessianFilterType::OutputImageType;
+using EigenAnalysisFilterType     = MultiScaleHessianFilterType::EigenAnalysisFilterType;
+using EstimationFilterType        = itk::CalgaryEigenToMeasureParameterEstimationFilter< EigenValueImageType >;
+using CalgaryFilterType           = itk::CalgaryEigenToMeasureImageFilter< EigenValueImageType, SheetnessImageType >;
+using MaximumAbsoluteFilterType   = itk::MaximumAbsoluteValueImageFilter< SheetnessImageType >;
+
+/** Cube of side size with 0.5 mm voxels */
+template< typename TImage >
+typename TImage::Pointer AllocateVolume(itk::SizeValueType size)
+{
+  typename TImage::RegionType region;
+  region.SetSize(typename TImage::SizeType{{size, size, size}});
+
+  typename TImage::SpacingType spacing;
+  spacing.Fill(0.5);
+
+  typename TImage::Pointer image = TImage::New();
+  image->SetRegions(region);
+  image->SetSpacing(spacing);
+  image->Allocate();
+  return image;
+}
+
+/** A noisy shell of cortical bone around a marrow filled cylinder, in HU */
+HUImageType::Pointer MakeHUVolume(itk::SizeValueType size)
+{
+  HUImageType::Pointer image = AllocateVolume< HUImageType >(size);
+
+  std::mt19937 generator(42);
+  std::normal_distribution< double > noise(0.0, 40.0);
+  const double centre = 0.5 * size;
+  const double radius = 0.3 * size;
+  const double thickness = std::max(2.0, 0.05 * size);
+
+  itk::ImageRegionIteratorWithIndex< HUImageType > it(image, image->GetLargestPossibleRegion());
+  for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+  {
+    const HUImageType::IndexType index = it.GetIndex();
+    const double r = std::hypot(index[0] - centre, index[1] - centre);
+    double value = r < radius ? 100.0 : 0.0;
+    value += 1200.0 * std::exp(-std::pow((r - radius) / thickness, 2));
+    it.Set(static_cast< femur::HUPixelType >(value + noise(generator)));
+  }
+  return image;
+}
+
+/** A sheetness like field in [-1, 1] */
+SheetnessImageType::Pointer MakeSheetnessVolume(itk::SizeValueType size, double phase)
+{
+  SheetnessImageType::Pointer image = AllocateVolume< SheetnessImageType >(size);
+
+  itk::ImageRegionIteratorWithIndex< SheetnessImageType > it(image, image->GetLargestPossibleRegion());
+  for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+  {
+    const SheetnessImageType::IndexType index = it.GetIndex();
+    it.Set(static_cast< float >(std::sin(0.2 * index[0] + phase) * std::cos(0.15 * index[1] + 0.1 * index[2])));
+  }
+  return image;
+}
+
+/** Foreground mark in the middle, background mark on the faces, unlabelled between */
+LabelImageType::Pointer MakeMarks(itk::SizeValueType size)
+{
+  LabelImageType::Pointer image = AllocateVolume< LabelImageType >(size);
+
+  const itk::IndexValueType last = static_cast< itk::IndexValueType >(size) - 1;
+  const itk::IndexValueType low = size / 3;
+  const itk::IndexValueType high = 2 * size / 3;
+
+  itk::ImageRegionIteratorWithIndex< LabelImageType > it(image, image->GetLargestPossibleRegion());
+  for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+  {
+    const LabelImageType::IndexType index = it.GetIndex();
+    bool face = false;
+    bool inside = true;
+    for (unsigned int d = 0; d < femur::ImageDimension; ++d)
+    {
+      face = face || index[d] == 0 || index[d] == last;
+      inside = inside && index[d] >= low && index[d] <= high;
+    }
+    it.Set(face ? 2 : (inside ? 1 : 0));
+  }
+  return image;
+}
+
+EigenValueImageType::Pointer MakeEigenImage(itk::SizeValueType size)
+{
+  HessianFilterType::Pointer hessianFilter = HessianFilterType::New();
+  hessianFilter->SetNormalizeAcrossScale(true);
+  hessianFilter->SetSigma(1.0);
+  hessianFilter->SetInput(MakeHUVolume(size));
+
+  EigenAnalysisFilterType::Pointer eigenAnalysisFilter = EigenAnalysisFilterType::New();
+  eigenAnalysisFilter->SetDimension(femur::ImageDimension);
+  eigenAnalysisFilter->OrderEigenValuesBy(EigenAnalysisFilterType::FunctorType::OrderByMagnitude);
+  eigenAnalysisFilter->SetInput(hessianFilter->GetOutput());
+  eigenAnalysisFilter->Update();
+
+  EigenValueImageType::Pointer output = eigenAnalysisFilter->GetOutput();
+  output->DisconnectPipeline();
+  return output;
+}
+
+double Voxels(const State & state)
+{
+  return std::pow(static_cast< double >(state.Size()), 3);
+}
+
+/** Exposes the stages of the grid cut so they can be timed apart */
+class BenchmarkPeriostealFilter
+  : public itk::PeriostealSegmentationImageFilter< SheetnessImageType, LabelImageType, LabelImageType >
+{
+public:
+  using Self        = BenchmarkPeriostealFilter;
+  using Superclass  = itk::PeriostealSegmentationImageFilter< SheetnessImageType, LabelImageType, LabelImageType >;
+  using Pointer     = itk::SmartPointer< Self >;
+
+  itkNewMacro(Self);
+
+  /** Size the output and allocate the terms */
+  void Prepare()
+  {
+    this->UpdateOutputInformation();
+    this->GetOutput()->SetRequestedRegionToLargestPossibleRegion();
+    this->AllocateOutputs();
+    this->BeforeThreadedGenerateData();
+  }
+
+  /** Data and smoothness terms over the whole volume, split as in GenerateData */
+  void EvaluateTerms()
+  {
+    this->GetMultiThreader()->SetNumberOfWorkUnits(this->GetNumberOfWorkUnits());
+    this->GetMultiThreader()->template ParallelizeImageRegion< femur::ImageDimension >(
+      this->GetOutput()->GetRequestedRegion(),
+      [this](const OutputImageRegionType & region) { this->DynamicThreadedGenerateData(region); },
+      nullptr);
+  }
+
+  void Solve() { this->SolveGraph(); }
+  void ReadOut() { this->ReadOutLabels(); }
+  void Release() { this->ReleaseGraph(); }
+};
+
+BenchmarkPeriostealFilter::Pointer MakePeriostealFilter(const State & state)
+{
+  BenchmarkPeriostealFilter::Pointer filter = BenchmarkPeriostealFilter::New();
+  filter->SetInput(MakeSheetnessVolume(state.Size(), 0.0));
+  filter->SetMask(MakeMarks(state.Size()));
+  filter->SetForegroundLabel(1);
+  filter->SetBackgroundLabel(2);
+  filter->SetLambda(50.0);
+  filter->SetSigma(0.25);
+  state.Configure(filter.GetPointer());
+  return filter;
+}
+
+void GridCutTerms(State & state)
+{
+  BenchmarkPeriostealFilter::Pointer filter = MakePeriostealFilter(state);
+  while ( state.KeepRunning() )
+  {
+    state.PauseTiming();
+    filter->Prepare();
+    state.ResumeTiming();
+
+    filter->EvaluateTerms();
+
+    state.PauseTiming();
+    filter->Release();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(Voxels(state));
+}
+FEMUR_BENCHMARK(GridCutTerms);
+
+void GridCutReadOut(State & state)
+{
+  BenchmarkPeriostealFilter::Pointer filter = MakePeriostealFilter(state);
+  filter->Prepare();
+  filter->EvaluateTerms();
+  filter->Solve();
+  while ( state.KeepRunning() )
+  {
+    filter->ReadOut();
+  }
+  filter->Release();
+  state.SetItemsProcessed(Voxels(state));
+}
+FEMUR_BENCHMARK(GridCutReadOut);
+
+void HessianGaussian(State & state)
+{
+  HessianFilterType::Pointer filter = HessianFilterType::New();
+  filter->SetNormalizeAcrossScale(true);
+  filter->SetSigma(state.Argument());
+  filter->SetInput(MakeHUVolume(state.Size()));
+  state.Configure(filter.GetPointer());
+  while ( state.KeepRunning() )
+  {
+    filter->Modified();
+    filter->Update();
+  }
+  state.SetItemsProcessed(Voxels(state));
+}
+FEMUR_BENCHMARK_ARGUMENTS(HessianGaussian, 0.5, 1.0, 2.0);
+
+void SymmetricEigenAnalysis(State & state)
+{
+  HessianFilterType::Pointer hessianFilter = HessianFilterType::New();
+  hessianFilter->SetSigma(1.0);
+  hessianFilter->SetInput(MakeHUVolume(state.Size()));
+  hessianFilter->Update();
+  HessianImageType::Pointer hessian = hessianFilter->GetOutput();
+  hessian->DisconnectPipeline();
+
+  EigenAnalysisFilterType::Pointer filter = EigenAnalysisFilterType::New();
+  filter->SetDimension(femur::ImageDimension);
+  filter->OrderEigenValuesBy(EigenAnalysisFilterType::FunctorType::OrderByMagnitude);
+  filter->SetInput(hessian);
+  state.Configure(filter.GetPointer());
+  while ( state.KeepRunning() )
+  {
+    filter->Modified();
+    filter->Update();
+  }
+  state.SetItemsProcessed(Voxels(state));
+}
+FEMUR_BENCHMARK(SymmetricEigenAnalysis);
+
+void CalgaryParameterEstimation(State & state)
+{
+  EstimationFilterType::Pointer filter = EstimationFilterType::New();
+  filter->SetFrobeniusNormWeight(0.05);
+  filter->SetInput(MakeEigenImage(state.Size()));
+  state.Configure(filter.GetPointer());
+  while ( state.KeepRunning() )
+  {
+    filter->Modified();
+    filter->Update();
+  }
+  state.SetItemsProcessed(Voxels(state));
+}
+FEMUR_BENCHMARK(CalgaryParameterEstimation);
+
+/** Per voxel cost of CalgaryEigenToMeasureImageFilter::ProcessPixel, with fixed parameters */
+void CalgaryEigenToMeasure(State & state)
+{
+  CalgaryFilterType::ParameterArrayType parameters(2);
+  parameters[0] = 0.5;
+  parameters[1] = 100.0;
+
+  CalgaryFilterType::Pointer filter = CalgaryFilterType::New();
+  filter->SetEnhanceBrightObjects();
+  filter->SetInput(MakeEigenImage(state.Size()));
+  filter->SetParameters(parameters);
+  state.Configure(filter.GetPointer());
+  while ( state.KeepRunning() )
+  {
+    filter->Modified();
+    filter->Update();
+  }
+  state.SetItemsProcessed(Voxels(state));
+}
+FEMUR_BENCHMARK(CalgaryEigenToMeasure);
+
+void MaximumAbsoluteValue(State & state)
+{
+  MaximumAbsoluteFilterType::Pointer filter = MaximumAbsoluteFilterType::New();
+  filter->SetInput1(MakeSheetnessVolume(state.Size(), 0.0));
+  filter->SetInput2(MakeSheetnessVolume(state.Size(), 1.0));
+  state.Configure(filter.GetPointer());
+  while ( state.KeepRunning() )
+  {
+    filter->Modified();
+    filter->Update();
+  }
+  state.SetItemsProcessed(Voxels(state));
+}
+FEMUR_BENCHMARK(MaximumAbsoluteValue);
+
+} /* end namespace */
+
+int main(int argc, char * argv[])
+{
+  return femur::benchmark::RunBenchmarks(femur::benchmark::ParseOptions(argc, argv));
+}
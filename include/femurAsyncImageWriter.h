@@ -0,0 +1,169 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurAsyncImageWriter_h
+#define femurAsyncImageWriter_h
+
+#include "femurImageIO.h"
+#include "femurTrace.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace femur {
+
+/**
+ * Encode and write images on a background thread while computation continues.
+ *
+ * Write grafts the image into a new image object, which holds a reference to the
+ * pixel buffer and has no pipeline behind it, and queues it. The caller must not
+ * change those pixels afterwards; releasing its own pointer or running more filters
+ * on the image is fine. Writes run one at a time in the order they were queued.
+ *
+ * Wait blocks until every queued write is done and reports the ones that failed.
+ * The destructor waits too, so nothing queued is lost when main returns early.
+ */
+class AsyncImageWriter
+{
+public:
+  AsyncImageWriter() = default;
+
+  ~AsyncImageWriter()
+  {
+    this->Wait();
+  }
+
+  AsyncImageWriter(const AsyncImageWriter &) = delete;
+  AsyncImageWriter & operator=(const AsyncImageWriter &) = delete;
+
+  /** Queue image to be written to fileName, as WriteImage would */
+  template< typename TImage >
+  void Write(const TImage * image, const std::string & fileName, double quantizationScale = 0.0)
+  {
+    typename TImage::Pointer shared = TImage::New();
+    shared->Graft(image);
+
+    this->Enqueue(fileName, [shared, fileName, quantizationScale]()
+      {
+        WriteImage(shared.GetPointer(), fileName, quantizationScale);
+      });
+  }
+
+  /** Block until every queued write is done. Returns false if any write failed since the last Wait. */
+  bool Wait()
+  {
+    std::unique_lock< std::mutex > lock(m_Mutex);
+    m_Done.wait(lock, [this]() { return m_Queue.empty() && !m_Busy; });
+    m_Stop = true;
+    lock.unlock();
+    m_Wake.notify_all();
+    if ( m_Thread.joinable() )
+    {
+      m_Thread.join();
+    }
+
+    lock.lock();
+    m_Stop = false;
+    const bool succeeded = m_Failures.empty();
+    for (const std::string & failure : m_Failures)
+    {
+      std::cerr << failure << std::endl;
+    }
+    m_Failures.clear();
+    return succeeded;
+  }
+
+private:
+  void Enqueue(const std::string & fileName, std::function< void() > write)
+  {
+    std::lock_guard< std::mutex > lock(m_Mutex);
+    m_Queue.push_back({fileName, std::move(write)});
+    if ( !m_Thread.joinable() )
+    {
+      m_Thread = std::thread([this]() { this->Run(); });
+    }
+    m_Wake.notify_one();
+  }
+
+  void Run()
+  {
+    std::unique_lock< std::mutex > lock(m_Mutex);
+    while ( true )
+    {
+      m_Wake.wait(lock, [this]() { return m_Stop || !m_Queue.empty(); });
+      if ( m_Queue.empty() )
+      {
+        return;
+      }
+
+      Job job = std::move(m_Queue.front());
+      m_Queue.pop_front();
+      m_Busy = true;
+      lock.unlock();
+
+      std::string failure;
+      try
+      {
+        FEMUR_TRACE_SCOPE("AsyncImageWriter", "Write");
+        job.Write();
+      }
+      catch ( const std::exception & e )
+      {
+        failure = "Writing " + job.FileName + " failed: " + e.what();
+      }
+      catch ( ... )
+      {
+        failure = "Writing " + job.FileName + " failed";
+      }
+
+      lock.lock();
+      if ( !failure.empty() )
+      {
+        m_Failures.push_back(failure);
+      }
+      m_Busy = false;
+      m_Done.notify_all();
+    }
+  }
+
+  struct Job
+  {
+    std::string             FileName;
+    std::function< void() > Write;
+  };
+
+  std::mutex                m_Mutex;
+  std::condition_variable   m_Wake;
+  std::condition_variable   m_Done;
+  std::deque< Job >         m_Queue;
+  std::vector< std::string > m_Failures;
+  std::thread               m_Thread;
+  bool                      m_Busy = false;
+  bool                      m_Stop = false;
+};
+
+} /* end namespace */
+
+#endif /* femurAsyncImageWriter_h */
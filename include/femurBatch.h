@@ -0,0 +1,215 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurBatch_h
+#define femurBatch_h
+
+#include "femurMemoryPlanner.h"
+#include "femurThreadPool.h"
+#include "femurTrace.h"
+#include "itkMacro.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace femur {
+
+/** Positional arguments of one scan, as they would follow the executable's name */
+using ManifestEntry = std::vector< std::string >;
+
+/** Read a manifest: one scan per line, arguments separated by white space.
+ * Blank lines and lines starting with # are skipped. */
+inline std::vector< ManifestEntry > ReadManifest(const std::string & fileName)
+{
+  std::ifstream file(fileName);
+  if ( !file )
+  {
+    itkGenericExceptionMacro(<< "Cannot open manifest " << fileName);
+  }
+
+  std::vector< ManifestEntry > entries;
+  std::string line;
+  while ( std::getline(file, line) )
+  {
+    std::istringstream fields(line);
+    ManifestEntry entry;
+    std::string field;
+    while ( fields >> field )
+    {
+      entry.push_back(field);
+    }
+    if ( !entry.empty() && entry[0][0] != '#' )
+    {
+      entries.push_back(entry);
+    }
+  }
+  return entries;
+}
+
+/** Options of executables that can run a cohort in one process */
+struct BatchOptions
+{
+  std::string   Manifest;
+  unsigned int  Jobs = 1;
+  std::uint64_t PrefetchMemory = std::uint64_t(2) << 30;
+};
+
+/** Handle the batch options and remove them from argv, as ParseCommonOptions does.
+ *
+ *   --manifest <file>   Run every scan listed in file instead of one from the command line
+ *   --jobs <N>          Scans of the manifest run at once, default 1
+ *   --prefetch-memory <size>
+ *                       Cap on images read ahead for coming scans, default 2G, 0 for none
+ *
+ * Exits on a malformed option.
+ */
+inline BatchOptions ParseBatchOptions(int & argc, char * argv[])
+{
+  BatchOptions options;
+
+  int kept = 1;
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string argument = argv[i];
+    if ( argument == "--manifest" || argument == "--jobs" || argument == "--prefetch-memory" )
+    {
+      if ( i + 1 >= argc )
+      {
+        std::cerr << argv[0] << ": " << argument << " needs a value" << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      const std::string value = argv[++i];
+      if ( argument == "--manifest" )
+      {
+        options.Manifest = value;
+      }
+      else if ( argument == "--prefetch-memory" )
+      {
+        options.PrefetchMemory = value == "0" ? 0 : ParseMemorySize(value);
+        if ( options.PrefetchMemory == 0 && value != "0" )
+        {
+          std::cerr << argv[0] << ": --prefetch-memory needs a size such as 2G or 0, got " << value << std::endl;
+          std::exit(EXIT_FAILURE);
+        }
+      }
+      else if ( (options.Jobs = std::strtoul(value.c_str(), nullptr, 10)) == 0 )
+      {
+        std::cerr << argv[0] << ": --jobs needs a positive number, got " << value << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      continue;
+    }
+    argv[kept++] = argv[i];
+  }
+  argc = kept;
+  argv[argc] = nullptr;
+
+  return options;
+}
+
+/** Run scan(entry, worker) for every entry of a manifest, at most jobs at a time.
+ *
+ * worker is in [0, jobs) and never shared by two running scans, so a main can keep
+ * one set of filters per worker and reuse it from scan to scan. Scans share the
+ * process thread pool. A scan that throws or returns nonzero is reported and the
+ * others carry on. Returns EXIT_SUCCESS only if every scan succeeded.
+ *
+ * prefetch(entry) is called for the scan a worker will most likely take next, jobs
+ * entries on, as each scan starts. It should only queue reads, e.g. on an ImagePrefetcher.
+ */
+template< typename TScan, typename TPrefetch >
+int RunManifest(const std::vector< ManifestEntry > & entries, unsigned int jobs, TScan scan, TPrefetch prefetch)
+{
+  const std::size_t nScans = entries.size();
+  jobs = static_cast< unsigned int >(std::max< std::size_t >(1, std::min< std::size_t >(jobs, nScans)));
+  std::cout << "Running " << nScans << " scans, " << jobs << " at a time" << std::endl;
+
+  std::atomic< std::size_t > next(0);
+  std::atomic< std::size_t > failed(0);
+  std::mutex outputMutex;
+
+  RunConcurrently(jobs, [&](std::size_t worker)
+    {
+      for (std::size_t i = next++; i < nScans; i = next++)
+      {
+        const ManifestEntry & entry = entries[i];
+        if ( i + jobs < nScans )
+        {
+          try
+          {
+            prefetch(entries[i + jobs]);
+          }
+          catch (const std::exception &)
+          {
+            /* The scan reads its inputs itself and reports what is wrong with them */
+          }
+        }
+        const auto start = std::chrono::steady_clock::now();
+
+        std::string error;
+        try
+        {
+          FEMUR_TRACE_SCOPE("batch", "scan");
+          if ( scan(entry, static_cast< unsigned int >(worker)) != EXIT_SUCCESS )
+          {
+            error = "returned failure";
+          }
+        }
+        catch (const std::exception & exception)
+        {
+          error = exception.what();
+        }
+
+        const std::chrono::duration< double > elapsed = std::chrono::steady_clock::now() - start;
+        std::lock_guard< std::mutex > lock(outputMutex);
+        std::cout << "[" << i + 1 << "/" << nScans << "] " << entry[0];
+        if ( error.empty() )
+        {
+          std::cout << " done in " << elapsed.count() << "s" << std::endl;
+        }
+        else
+        {
+          ++failed;
+          std::cout << " FAILED: " << error << std::endl;
+        }
+      }
+    });
+
+  std::cout << nScans - failed << " of " << nScans << " scans succeeded" << std::endl;
+  return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** RunManifest without prefetching */
+template< typename TScan >
+int RunManifest(const std::vector< ManifestEntry > & entries, unsigned int jobs, TScan scan)
+{
+  return RunManifest(entries, jobs, scan, [](const ManifestEntry &) {});
+}
+
+} /* end namespace */
+
+#endif /* femurBatch_h */
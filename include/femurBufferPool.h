@@ -0,0 +1,272 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurBufferPool_h
+#define femurBufferPool_h
+
+#include "femurTrace.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define FEMUR_HAVE_MMAP 1
+#include <sys/mman.h>
+#endif
+
+namespace femur {
+
+/**
+ * Process wide pool of large buffers, recycled by size.
+ *
+ * Image temporaries of one scan are mostly the same few sizes: every scale of the
+ * multiscale filter and every grid cut allocates buffers the size of the image.
+ * Freed buffers stay mapped in the pool and the next request of the same size
+ * bucket gets one back, skipping the page faults and zeroing of a fresh mapping.
+ * Fresh buffers are populated when they are mapped, so their cost shows up in the
+ * trace under BufferPool Allocate instead of in the first filter to touch them.
+ *
+ * Buckets are sizes rounded up to a page, or to a 2 MB huge page when huge pages
+ * are on. Free buffers are kept up to the cached byte limit, oldest dropped first.
+ * The pool is off until Configure is called with a limit, and requests below
+ * MinimumBytes always go to the heap.
+ */
+class BufferPool
+{
+public:
+  static constexpr std::size_t MinimumBytes = std::size_t(1) << 20;
+
+  static BufferPool & Instance()
+  {
+    /* Never destroyed, images freed during static destruction still find it */
+    static BufferPool * pool = new BufferPool;
+    return *pool;
+  }
+
+  /** Keep up to maxCachedBytes of free buffers. hugePages asks the kernel to back them with huge pages. */
+  void Configure(std::uint64_t maxCachedBytes, bool hugePages)
+  {
+    std::lock_guard< std::mutex > lock(m_Mutex);
+    m_MaxCachedBytes = maxCachedBytes;
+    m_HugePages = hugePages;
+    this->Trim(m_MaxCachedBytes);
+  }
+
+  bool IsEnabled() const
+  {
+    return m_MaxCachedBytes > 0;
+  }
+
+  /** A buffer of at least bytes, or nullptr if the pool does not serve this size.
+   * zeroed tells whether the buffer is known to hold zeros. */
+  void * Acquire(std::size_t bytes, bool & zeroed)
+  {
+    zeroed = false;
+    if ( !this->IsEnabled() || bytes < MinimumBytes )
+    {
+      return nullptr;
+    }
+
+    const std::size_t size = this->BucketSize(bytes);
+    {
+      std::lock_guard< std::mutex > lock(m_Mutex);
+      for (auto it = m_Free.rbegin(); it != m_Free.rend(); ++it)
+      {
+        if ( it->Bytes == size )
+        {
+          void * buffer = it->Address;
+          m_CachedBytes -= size;
+          m_Free.erase(std::next(it).base());
+          m_Outstanding[buffer] = size;
+          ++m_Reused;
+          return buffer;
+        }
+      }
+    }
+
+    FEMUR_TRACE_SCOPE_ARG("BufferPool", "Allocate", "MB", size / 1048576.0);
+    void * buffer = this->Map(size);
+    if ( buffer == nullptr )
+    {
+      /* Give back what is cached and try once more before failing */
+      {
+        std::lock_guard< std::mutex > lock(m_Mutex);
+        this->Trim(0);
+      }
+      buffer = this->Map(size);
+      if ( buffer == nullptr )
+      {
+        throw std::bad_alloc();
+      }
+    }
+    zeroed = true;
+
+    std::lock_guard< std::mutex > lock(m_Mutex);
+    m_Outstanding[buffer] = size;
+    ++m_Allocated;
+    return buffer;
+  }
+
+  /** Return a buffer. False, and nothing done, if it did not come from Acquire. */
+  bool Release(void * buffer)
+  {
+    std::lock_guard< std::mutex > lock(m_Mutex);
+    auto it = m_Outstanding.find(buffer);
+    if ( it == m_Outstanding.end() )
+    {
+      return false;
+    }
+    const std::size_t size = it->second;
+    m_Outstanding.erase(it);
+
+    m_Free.push_back({buffer, size});
+    m_CachedBytes += size;
+    this->Trim(m_MaxCachedBytes);
+    return true;
+  }
+
+  void Print(std::ostream & os) const
+  {
+    std::lock_guard< std::mutex > lock(m_Mutex);
+    os << "Buffer pool: " << m_Allocated << " buffers mapped, " << m_Reused << " reused, "
+       << m_CachedBytes / 1048576.0 << " MB cached" << std::endl;
+  }
+
+  BufferPool(const BufferPool &) = delete;
+  BufferPool & operator=(const BufferPool &) = delete;
+
+private:
+  struct Block
+  {
+    void *      Address;
+    std::size_t Bytes;
+  };
+
+  BufferPool() = default;
+
+  std::size_t BucketSize(std::size_t bytes) const
+  {
+    const std::size_t granule = m_HugePages ? std::size_t(2) << 20 : std::size_t(4) << 10;
+    return (bytes + granule - 1) / granule * granule;
+  }
+
+  /** Drop the oldest free buffers until at most maxCachedBytes are cached. Needs m_Mutex. */
+  void Trim(std::uint64_t maxCachedBytes)
+  {
+    std::size_t dropped = 0;
+    while ( dropped < m_Free.size() && m_CachedBytes > maxCachedBytes )
+    {
+      this->Unmap(m_Free[dropped].Address, m_Free[dropped].Bytes);
+      m_CachedBytes -= m_Free[dropped].Bytes;
+      ++dropped;
+    }
+    m_Free.erase(m_Free.begin(), m_Free.begin() + dropped);
+  }
+
+  void * Map(std::size_t bytes) const
+  {
+#ifdef FEMUR_HAVE_MMAP
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_POPULATE
+    /* Fault the pages in now unless huge pages are wanted, which madvise has to ask for first */
+    if ( !m_HugePages )
+    {
+      flags |= MAP_POPULATE;
+    }
+#endif
+    void * buffer = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if ( buffer == MAP_FAILED )
+    {
+      return nullptr;
+    }
+#ifdef MADV_HUGEPAGE
+    if ( m_HugePages )
+    {
+      madvise(buffer, bytes, MADV_HUGEPAGE);
+    }
+#endif
+    return buffer;
+#else
+    return std::calloc(bytes, 1);
+#endif
+  }
+
+  void Unmap(void * buffer, std::size_t bytes) const
+  {
+#ifdef FEMUR_HAVE_MMAP
+    munmap(buffer, bytes);
+#else
+    static_cast< void >(bytes);
+    std::free(buffer);
+#endif
+  }
+
+  mutable std::mutex                          m_Mutex;
+  std::uint64_t                               m_MaxCachedBytes = 0;
+  std::uint64_t                               m_CachedBytes = 0;
+  bool                                        m_HugePages = false;
+  std::vector< Block >                        m_Free;
+  std::unordered_map< void *, std::size_t >   m_Outstanding;
+  std::uint64_t                               m_Allocated = 0;
+  std::uint64_t                               m_Reused = 0;
+};
+
+/** Allocator for standard containers that takes large arrays from BufferPool */
+template< typename T >
+class PoolAllocator
+{
+public:
+  using value_type = T;
+
+  PoolAllocator() = default;
+
+  template< typename U >
+  PoolAllocator(const PoolAllocator< U > &) {}
+
+  T * allocate(std::size_t n)
+  {
+    bool zeroed = false;
+    void * buffer = BufferPool::Instance().Acquire(n * sizeof(T), zeroed);
+    return static_cast< T * >(buffer != nullptr ? buffer : ::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T * p, std::size_t)
+  {
+    if ( !BufferPool::Instance().Release(p) )
+    {
+      ::operator delete(p);
+    }
+  }
+
+  template< typename U >
+  bool operator==(const PoolAllocator< U > &) const { return true; }
+
+  template< typename U >
+  bool operator!=(const PoolAllocator< U > &) const { return false; }
+};
+
+} /* end namespace */
+
+#endif /* femurBufferPool_h */
@@ -0,0 +1,449 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurChunkedFormat_h
+#define femurChunkedFormat_h
+
+#include "femurParallelFor.h"
+#include "itkMacro.h"
+#include "itk_zlib.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+/** On-disk layout of chunked intermediates (.fsc)
+ *
+ * The volume is cut into fixed size chunks, up to 3D. Each chunk is deflated on
+ * its own at a fast level, and an index at the start of the file holds the offset
+ * and compressed size of every chunk. Reading a region touches only the chunks it
+ * overlaps. All values are little endian:
+ *
+ *   char[8]   magic "FEMURCH1"
+ *   uint32    dimension (1 to 3)
+ *   uint32    component type, as the reader sees it
+ *   uint32    stored component type, differs when quantized
+ *   uint32    chunk size[3]
+ *   uint64    size[3]
+ *   double    spacing[3], origin[3], direction[9]
+ *   double    quantization scale, stored = round(value * scale), 0 if unused
+ *   uint64    number of chunks
+ *   uint64    offset[n], compressed size[n]
+ *   ...       chunk data, x fastest within a chunk and chunks in x, y, z order
+ */
+namespace femur {
+
+enum class ChunkedComponentType : std::uint32_t
+{
+  UInt8 = 1,
+  Int8,
+  UInt16,
+  Int16,
+  UInt32,
+  Int32,
+  UInt64,
+  Int64,
+  Float32,
+  Float64
+};
+
+inline std::size_t ChunkedComponentSize(ChunkedComponentType type)
+{
+  switch ( type )
+  {
+  case ChunkedComponentType::UInt8:
+  case ChunkedComponentType::Int8:
+    return 1;
+  case ChunkedComponentType::UInt16:
+  case ChunkedComponentType::Int16:
+    return 2;
+  case ChunkedComponentType::UInt32:
+  case ChunkedComponentType::Int32:
+  case ChunkedComponentType::Float32:
+    return 4;
+  case ChunkedComponentType::UInt64:
+  case ChunkedComponentType::Int64:
+  case ChunkedComponentType::Float64:
+    return 8;
+  }
+  itkGenericExceptionMacro(<< "Unknown chunked component type " << static_cast< std::uint32_t >(type));
+}
+
+struct ChunkedHeader
+{
+  std::uint32_t           Dimension = 3;
+  ChunkedComponentType    ComponentType = ChunkedComponentType::Float32;
+  ChunkedComponentType    StoredComponentType = ChunkedComponentType::Float32;
+  std::uint32_t           ChunkSize[3] = {64, 64, 64};
+  std::uint64_t           Size[3] = {1, 1, 1};
+  double                  Spacing[3] = {1, 1, 1};
+  double                  Origin[3] = {0, 0, 0};
+  double                  Direction[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+  double                  QuantizationScale = 0.0;
+  std::vector< std::uint64_t > ChunkOffsets;
+  std::vector< std::uint64_t > ChunkCompressedSizes;
+
+  /** Chunks along each axis */
+  std::uint64_t GetGridSize(unsigned int axis) const
+  {
+    return (Size[axis] + ChunkSize[axis] - 1) / ChunkSize[axis];
+  }
+
+  std::uint64_t GetNumberOfChunks() const
+  {
+    return GetGridSize(0) * GetGridSize(1) * GetGridSize(2);
+  }
+
+  /** First voxel and extent of chunk c along axis */
+  void GetChunk(std::uint64_t c, std::uint64_t start[3], std::uint64_t extent[3]) const
+  {
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+      const std::uint64_t g = c % GetGridSize(i);
+      c /= GetGridSize(i);
+      start[i] = g * ChunkSize[i];
+      extent[i] = std::min< std::uint64_t >(ChunkSize[i], Size[i] - start[i]);
+    }
+  }
+
+  std::size_t GetHeaderSize() const
+  {
+    return 8 + 4 * 3 + 4 * 3 + 8 * 3 + 8 * 15 + 8 + 8 + 16 * GetNumberOfChunks();
+  }
+};
+
+namespace detail {
+
+inline void WriteBytes(std::ostream & out, const void * data, std::size_t size)
+{
+  out.write(static_cast< const char * >(data), size);
+}
+
+inline void ReadBytes(std::istream & in, void * data, std::size_t size)
+{
+  in.read(static_cast< char * >(data), size);
+  if ( !in )
+  {
+    itkGenericExceptionMacro(<< "Truncated chunked file");
+  }
+}
+
+/** Copy the overlap of a chunk and a region between chunk and region buffers */
+template< bool ToRegion >
+void CopyChunkRegion(const std::uint64_t chunkStart[3], const std::uint64_t chunkExtent[3],
+                     const std::uint64_t regionStart[3], const std::uint64_t regionExtent[3],
+                     unsigned char * chunk, unsigned char * region, std::size_t pixelSize)
+{
+  std::uint64_t begin[3], end[3];
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    begin[i] = std::max(chunkStart[i], regionStart[i]);
+    end[i] = std::min(chunkStart[i] + chunkExtent[i], regionStart[i] + regionExtent[i]);
+    if ( begin[i] >= end[i] )
+    {
+      return;
+    }
+  }
+
+  const std::size_t run = (end[0] - begin[0]) * pixelSize;
+  for (std::uint64_t z = begin[2]; z < end[2]; ++z)
+  {
+    for (std::uint64_t y = begin[1]; y < end[1]; ++y)
+    {
+      const std::size_t c = (((z - chunkStart[2]) * chunkExtent[1] + (y - chunkStart[1])) * chunkExtent[0]
+        + (begin[0] - chunkStart[0])) * pixelSize;
+      const std::size_t r = (((z - regionStart[2]) * regionExtent[1] + (y - regionStart[1])) * regionExtent[0]
+        + (begin[0] - regionStart[0])) * pixelSize;
+      if ( ToRegion )
+      {
+        std::memcpy(region + r, chunk + c, run);
+      }
+      else
+      {
+        std::memcpy(chunk + c, region + r, run);
+      }
+    }
+  }
+}
+
+/** Quantize n values to int16, returning how many were out of range and clamped */
+template< typename TReal >
+std::size_t Quantize(const unsigned char * input, unsigned char * output, std::size_t n, double scale)
+{
+  const TReal * in = reinterpret_cast< const TReal * >(input);
+  std::int16_t * out = reinterpret_cast< std::int16_t * >(output);
+  std::size_t clamped = 0;
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    const double v = std::round(static_cast< double >(in[i]) * scale);
+    clamped += v < -32768.0 || v > 32767.0;
+    out[i] = static_cast< std::int16_t >(std::max(-32768.0, std::min(32767.0, v)));
+  }
+  return clamped;
+}
+
+template< typename TReal >
+void Dequantize(const unsigned char * input, unsigned char * output, std::size_t n, double scale)
+{
+  const std::int16_t * in = reinterpret_cast< const std::int16_t * >(input);
+  TReal * out = reinterpret_cast< TReal * >(output);
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    out[i] = static_cast< TReal >(in[i] / scale);
+  }
+}
+
+/** Convert n values between the logical and the stored component type.
+ * Returns how many values quantizing had to clamp. */
+inline std::size_t ConvertComponents(const ChunkedHeader & header, bool toStored,
+                                     const unsigned char * input, unsigned char * output, std::size_t n)
+{
+  if ( header.ComponentType == header.StoredComponentType )
+  {
+    std::memcpy(output, input, n * ChunkedComponentSize(header.ComponentType));
+  }
+  else if ( header.ComponentType == ChunkedComponentType::Float32 )
+  {
+    if ( toStored )
+    {
+      return Quantize< float >(input, output, n, header.QuantizationScale);
+    }
+    Dequantize< float >(input, output, n, header.QuantizationScale);
+  }
+  else if ( header.ComponentType == ChunkedComponentType::Float64 )
+  {
+    if ( toStored )
+    {
+      return Quantize< double >(input, output, n, header.QuantizationScale);
+    }
+    Dequantize< double >(input, output, n, header.QuantizationScale);
+  }
+  else
+  {
+    itkGenericExceptionMacro(<< "Only float volumes can be quantized");
+  }
+  return 0;
+}
+
+} /* end namespace detail */
+
+/** Read the header and chunk index, returning false if the magic does not match */
+inline bool ReadChunkedHeader(std::istream & in, ChunkedHeader & header)
+{
+  char magic[8];
+  in.read(magic, sizeof(magic));
+  if ( !in || std::memcmp(magic, "FEMURCH1", 8) != 0 )
+  {
+    return false;
+  }
+
+  detail::ReadBytes(in, &header.Dimension, 4);
+  detail::ReadBytes(in, &header.ComponentType, 4);
+  detail::ReadBytes(in, &header.StoredComponentType, 4);
+  detail::ReadBytes(in, header.ChunkSize, sizeof(header.ChunkSize));
+  detail::ReadBytes(in, header.Size, sizeof(header.Size));
+  detail::ReadBytes(in, header.Spacing, sizeof(header.Spacing));
+  detail::ReadBytes(in, header.Origin, sizeof(header.Origin));
+  detail::ReadBytes(in, header.Direction, sizeof(header.Direction));
+  detail::ReadBytes(in, &header.QuantizationScale, sizeof(header.QuantizationScale));
+
+  if ( header.Dimension < 1 || header.Dimension > 3
+    || header.ChunkSize[0] == 0 || header.ChunkSize[1] == 0 || header.ChunkSize[2] == 0 )
+  {
+    itkGenericExceptionMacro(<< "Corrupt chunked header");
+  }
+  /* Validates both types */
+  ChunkedComponentSize(header.ComponentType);
+  ChunkedComponentSize(header.StoredComponentType);
+
+  std::uint64_t n;
+  detail::ReadBytes(in, &n, sizeof(n));
+  if ( n != header.GetNumberOfChunks() )
+  {
+    itkGenericExceptionMacro(<< "Chunk index holds " << n << " chunks, expected " << header.GetNumberOfChunks());
+  }
+  header.ChunkOffsets.resize(n);
+  header.ChunkCompressedSizes.resize(n);
+  detail::ReadBytes(in, header.ChunkOffsets.data(), n * sizeof(std::uint64_t));
+  detail::ReadBytes(in, header.ChunkCompressedSizes.data(), n * sizeof(std::uint64_t));
+  return true;
+}
+
+/** Write a whole volume. header describes the volume, the index is filled in.
+ * Returns how many values were outside the int16 range of a quantized file and clamped. */
+inline std::uint64_t WriteChunkedFile(const std::string & fileName, ChunkedHeader & header, const void * data,
+                                      int level, unsigned int threads)
+{
+  std::ofstream out(fileName, std::ios::binary);
+  if ( !out )
+  {
+    itkGenericExceptionMacro(<< "Cannot open " << fileName << " for writing");
+  }
+
+  const std::uint64_t n = header.GetNumberOfChunks();
+  const std::size_t pixelSize = ChunkedComponentSize(header.ComponentType);
+  const std::size_t storedSize = ChunkedComponentSize(header.StoredComponentType);
+  const std::uint64_t regionStart[3] = {0, 0, 0};
+  header.ChunkOffsets.assign(n, 0);
+  header.ChunkCompressedSizes.assign(n, 0);
+
+  /* Index is patched in once the chunk sizes are known */
+  out.seekp(header.GetHeaderSize());
+  std::uint64_t offset = header.GetHeaderSize();
+
+  /* A few chunks per thread at a time so memory stays bounded */
+  const std::uint64_t batch = std::max< std::uint64_t >(1, 4 * threads);
+  std::vector< std::vector< unsigned char > > compressed(batch);
+  std::atomic< std::uint64_t > clamped(0);
+  for (std::uint64_t first = 0; first < n; first += batch)
+  {
+    const std::uint64_t count = std::min(batch, n - first);
+    ParallelFor(count, threads,
+      [&](std::size_t i)
+      {
+        std::uint64_t start[3], extent[3];
+        header.GetChunk(first + i, start, extent);
+        const std::size_t voxels = extent[0] * extent[1] * extent[2];
+
+        std::vector< unsigned char > chunk(voxels * pixelSize);
+        detail::CopyChunkRegion< false >(start, extent, regionStart, header.Size, chunk.data(),
+                                         static_cast< unsigned char * >(const_cast< void * >(data)), pixelSize);
+
+        std::vector< unsigned char > stored(voxels * storedSize);
+        clamped += detail::ConvertComponents(header, true, chunk.data(), stored.data(), voxels);
+
+        uLongf length = compressBound(static_cast< uLong >(stored.size()));
+        compressed[i].resize(length);
+        if ( compress2(compressed[i].data(), &length, stored.data(), static_cast< uLong >(stored.size()), level) != Z_OK )
+        {
+          itkGenericExceptionMacro(<< "Failed to compress chunk " << first + i);
+        }
+        compressed[i].resize(length);
+      });
+
+    for (std::uint64_t i = 0; i < count; ++i)
+    {
+      header.ChunkOffsets[first + i] = offset;
+      header.ChunkCompressedSizes[first + i] = compressed[i].size();
+      detail::WriteBytes(out, compressed[i].data(), compressed[i].size());
+      offset += compressed[i].size();
+    }
+  }
+
+  out.seekp(0);
+  detail::WriteBytes(out, "FEMURCH1", 8);
+  detail::WriteBytes(out, &header.Dimension, 4);
+  detail::WriteBytes(out, &header.ComponentType, 4);
+  detail::WriteBytes(out, &header.StoredComponentType, 4);
+  detail::WriteBytes(out, header.ChunkSize, sizeof(header.ChunkSize));
+  detail::WriteBytes(out, header.Size, sizeof(header.Size));
+  detail::WriteBytes(out, header.Spacing, sizeof(header.Spacing));
+  detail::WriteBytes(out, header.Origin, sizeof(header.Origin));
+  detail::WriteBytes(out, header.Direction, sizeof(header.Direction));
+  detail::WriteBytes(out, &header.QuantizationScale, sizeof(header.QuantizationScale));
+  detail::WriteBytes(out, &n, sizeof(n));
+  detail::WriteBytes(out, header.ChunkOffsets.data(), n * sizeof(std::uint64_t));
+  detail::WriteBytes(out, header.ChunkCompressedSizes.data(), n * sizeof(std::uint64_t));
+
+  if ( !out )
+  {
+    itkGenericExceptionMacro(<< "Failed writing " << fileName);
+  }
+  return clamped;
+}
+
+/** Read the region [start, start + extent) into output, touching only the chunks it overlaps */
+inline void ReadChunkedRegion(const std::string & fileName, const ChunkedHeader & header,
+                              const std::uint64_t start[3], const std::uint64_t extent[3],
+                              void * output, unsigned int threads)
+{
+  std::ifstream in(fileName, std::ios::binary);
+  if ( !in )
+  {
+    itkGenericExceptionMacro(<< "Cannot open " << fileName);
+  }
+
+  /* Chunks overlapping the region, read serially and inflated in parallel */
+  std::uint64_t first[3], last[3];
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    first[i] = start[i] / header.ChunkSize[i];
+    last[i] = (start[i] + extent[i] - 1) / header.ChunkSize[i];
+  }
+
+  std::vector< std::uint64_t > chunks;
+  for (std::uint64_t z = first[2]; z <= last[2]; ++z)
+  {
+    for (std::uint64_t y = first[1]; y <= last[1]; ++y)
+    {
+      for (std::uint64_t x = first[0]; x <= last[0]; ++x)
+      {
+        chunks.push_back((z * header.GetGridSize(1) + y) * header.GetGridSize(0) + x);
+      }
+    }
+  }
+
+  /* Read a few chunks per thread, inflate them in parallel, then the next few, so only
+   * those compressed chunks are held at once */
+  const std::size_t pixelSize = ChunkedComponentSize(header.ComponentType);
+  const std::size_t storedSize = ChunkedComponentSize(header.StoredComponentType);
+  const std::size_t batch = std::max< std::size_t >(1, 4 * threads);
+  std::vector< std::vector< unsigned char > > compressed(std::min(batch, chunks.size()));
+  for (std::size_t begin = 0; begin < chunks.size(); begin += batch)
+  {
+    const std::size_t count = std::min(batch, chunks.size() - begin);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      compressed[i].resize(header.ChunkCompressedSizes[chunks[begin + i]]);
+      in.seekg(header.ChunkOffsets[chunks[begin + i]]);
+      detail::ReadBytes(in, compressed[i].data(), compressed[i].size());
+    }
+
+    ParallelFor(count, threads,
+      [&](std::size_t i)
+      {
+        const std::uint64_t c = chunks[begin + i];
+        std::uint64_t chunkStart[3], chunkExtent[3];
+        header.GetChunk(c, chunkStart, chunkExtent);
+        const std::size_t voxels = chunkExtent[0] * chunkExtent[1] * chunkExtent[2];
+
+        std::vector< unsigned char > stored(voxels * storedSize);
+        uLongf length = static_cast< uLongf >(stored.size());
+        if ( uncompress(stored.data(), &length, compressed[i].data(), static_cast< uLong >(compressed[i].size())) != Z_OK
+          || length != stored.size() )
+        {
+          itkGenericExceptionMacro(<< "Corrupt chunk " << c << " in " << fileName);
+        }
+
+        std::vector< unsigned char > chunk(voxels * pixelSize);
+        detail::ConvertComponents(header, false, stored.data(), chunk.data(), voxels);
+        detail::CopyChunkRegion< true >(chunkStart, chunkExtent, start, extent, chunk.data(),
+                                        static_cast< unsigned char * >(output), pixelSize);
+      });
+  }
+}
+
+} /* end namespace */
+
+#endif /* femurChunkedFormat_h */
@@ -0,0 +1,204 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurCommandLine_h
+#define femurCommandLine_h
+
+#include "femurTrace.h"
+#include "femurPerfCounters.h"
+#include "femurThreadPool.h"
+#include "femurBufferPool.h"
+#include "femurMemoryPlanner.h"
+#include "itkMultiThreaderBase.h"
+#include "itkWorkStealingMultiThreader.h"
+#include "itkPooledImageContainer.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+namespace femur {
+
+/** Choose the threads every filter, loop and solver of the process runs on.
+ *
+ *   stealing   femur::ThreadPool, shared by ITK filters, our loops and the GridCut solver
+ *   itk        ITK's own thread pool
+ *   tbb        ITK's TBB threader, if ITK was built with it
+ *   platform   a new thread per work unit
+ *
+ * Only the stealing pool parks workers while GridCut solves, with the others the
+ * solver's threads come on top. threads = 0 keeps ITK's default, which follows
+ * ITK_GLOBAL_DEFAULT_NUMBER_OF_THREADS. Returns false for an unknown pool.
+ */
+inline bool ConfigureThreading(unsigned int threads, std::string pool)
+{
+  if ( threads == 0 )
+  {
+    threads = itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads();
+  }
+  itk::MultiThreaderBase::SetGlobalMaximumNumberOfThreads(threads);
+  itk::MultiThreaderBase::SetGlobalDefaultNumberOfThreads(threads);
+
+  if ( pool == "tbb" )
+  {
+#ifdef ITK_USE_TBB
+    itk::MultiThreaderBase::SetGlobalDefaultThreader(itk::MultiThreaderBase::ThreaderTypeFromString("TBB"));
+    return true;
+#else
+    std::cerr << "ITK was built without TBB, using the work stealing pool" << std::endl;
+    pool = "stealing";
+#endif
+  }
+
+  if ( pool == "itk" )
+  {
+    itk::MultiThreaderBase::SetGlobalDefaultThreader(itk::MultiThreaderBase::ThreaderTypeFromString("POOL"));
+  }
+  else if ( pool == "platform" )
+  {
+    itk::MultiThreaderBase::SetGlobalDefaultThreader(itk::MultiThreaderBase::ThreaderTypeFromString("PLATFORM"));
+  }
+  else if ( pool == "stealing" )
+  {
+    ThreadPool::Instance().SetNumberOfThreads(threads);
+    itk::WorkStealingMultiThreaderFactory::RegisterOneFactory();
+  }
+  else
+  {
+    return false;
+  }
+  return true;
+}
+
+/** Recycle image and solver buffers through BufferPool, keeping up to maxCachedBytes free.
+ *
+ * Must run before the first image is created, images made earlier keep heap buffers.
+ */
+inline void ConfigureBufferPool(std::uint64_t maxCachedBytes, bool hugePages)
+{
+  BufferPool::Instance().Configure(maxCachedBytes, hugePages);
+  itk::PooledImageContainerFactory::RegisterOneFactory();
+  if ( Tracer::Instance().IsEnabled() )
+  {
+    std::atexit([]() { BufferPool::Instance().Print(std::cout); });
+  }
+}
+
+/** Handle the options every executable accepts and remove them from argv.
+ *
+ *   --trace <file.json>   Write a Chrome trace of the run to file.json
+ *   --perf <file.json>    Count cycles, instructions and cache misses per stage, see PerfCounters
+ *   --threads <N>         Threads for the whole process, default all cores
+ *   --pool <type>         stealing (default), itk, tbb or platform, see ConfigureThreading
+ *   --buffer-pool <size>  Recycle image buffers, keeping up to size (e.g. 4G) of them free, default off
+ *   --huge-pages          Back pooled buffers with huge pages, turns on a 4G pool if --buffer-pool is not given
+ *
+ * Positional arguments are left in order, so argc checks after this call see only them.
+ * Exits on a malformed option, as the usage message of the caller would.
+ */
+inline void ParseCommonOptions(int & argc, char * argv[])
+{
+  unsigned int threads = 0;
+  std::string pool = "stealing";
+  std::uint64_t bufferPool = 0;
+  bool hugePages = false;
+
+  int kept = 1;
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string argument = argv[i];
+    if ( argument == "--threads" || argument == "--pool" )
+    {
+      if ( i + 1 >= argc )
+      {
+        std::cerr << argv[0] << ": " << argument << " needs a value" << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      const std::string value = argv[++i];
+      if ( argument == "--pool" )
+      {
+        pool = value;
+      }
+      else if ( (threads = std::strtoul(value.c_str(), nullptr, 10)) == 0 )
+      {
+        std::cerr << argv[0] << ": --threads needs a positive number, got " << value << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      continue;
+    }
+    if ( argument == "--buffer-pool" )
+    {
+      if ( i + 1 >= argc || (bufferPool = ParseMemorySize(argv[i + 1])) == 0 )
+      {
+        std::cerr << argv[0] << ": --buffer-pool needs a size such as 4G" << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      ++i;
+      continue;
+    }
+    if ( argument == "--huge-pages" )
+    {
+      hugePages = true;
+      continue;
+    }
+    if ( argument == "--perf" )
+    {
+      if ( i + 1 >= argc )
+      {
+        std::cerr << argv[0] << ": --perf needs a file name" << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      /* Before ConfigureThreading, so the pool threads inherit the counters. The report
+       * is written even when no counter opens, with the seconds of every stage. */
+      PerfCounters::Instance().Start(argv[++i]);
+      std::atexit([]() { PerfCounters::Instance().Stop(); });
+      continue;
+    }
+    if ( argument == "--trace" )
+    {
+      if ( i + 1 >= argc )
+      {
+        std::cerr << argv[0] << ": --trace needs a file name" << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      Tracer::Instance().Start(argv[++i]);
+      /* Written on any exit from main, including the usage and error returns */
+      std::atexit([]() { Tracer::Instance().Stop(); });
+      continue;
+    }
+    argv[kept++] = argv[i];
+  }
+  argc = kept;
+  argv[argc] = nullptr;
+
+  if ( !ConfigureThreading(threads, pool) )
+  {
+    std::cerr << argv[0] << ": unknown --pool " << pool << ", expected stealing, itk, tbb or platform" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+
+  if ( bufferPool > 0 || hugePages )
+  {
+    ConfigureBufferPool(bufferPool > 0 ? bufferPool : std::uint64_t(4) << 30, hugePages);
+  }
+}
+
+} /* end namespace */
+
+#endif /* femurCommandLine_h */
@@ -0,0 +1,226 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurConfiguration_h
+#define femurConfiguration_h
+
+#include "itkMacro.h"
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace femur {
+/** \class Configuration
+ * \brief Key/value parameters read from an INI style text file
+ *
+ * Lines have the form `key = value`. A line `[section]` prefixes every following
+ * key with `section.`, so `lambda` under `[periosteal]` is read as `periosteal.lambda`.
+ * Text after `#` or `;` is a comment. Lists are comma or whitespace separated.
+ *
+ * Every key that is read is remembered so that typos in the file can be reported
+ * with WarnUnusedKeys( ).
+ */
+class Configuration
+{
+public:
+  using MapType = std::map< std::string, std::string >;
+
+  Configuration() {}
+
+  /** Read a file, throwing an itk::ExceptionObject on parse errors */
+  void Read(const std::string & fileName)
+  {
+    std::ifstream file(fileName);
+    if ( !file )
+    {
+      itkGenericExceptionMacro(<< "Cannot open configuration file " << fileName);
+    }
+    this->Read(file, fileName);
+  }
+
+  /** Read configuration text from a stream. name is only used in error messages. */
+  void Read(std::istream & stream, const std::string & name)
+  {
+    std::string line, section;
+    unsigned int lineNumber = 0;
+    while ( std::getline(stream, line) )
+    {
+      ++lineNumber;
+      line = Trim(line.substr(0, line.find_first_of("#;")));
+      if ( line.empty() )
+      {
+        continue;
+      }
+
+      if ( line.front() == '[' )
+      {
+        if ( line.back() != ']' )
+        {
+          itkGenericExceptionMacro(<< name << ":" << lineNumber << ": unterminated section " << line);
+        }
+        section = Trim(line.substr(1, line.size() - 2));
+        continue;
+      }
+
+      const std::string::size_type equals = line.find('=');
+      if ( equals == std::string::npos )
+      {
+        itkGenericExceptionMacro(<< name << ":" << lineNumber << ": expected key = value, got " << line);
+      }
+
+      std::string key = Trim(line.substr(0, equals));
+      if ( !section.empty() )
+      {
+        key = section + "." + key;
+      }
+      this->Set(key, Trim(line.substr(equals + 1)));
+    }
+  }
+
+  void Set(const std::string & key, const std::string & value)
+  {
+    m_Values[key] = value;
+  }
+
+  bool Has(const std::string & key) const
+  {
+    return m_Values.count(key) > 0;
+  }
+
+  std::string GetString(const std::string & key, const std::string & defaultValue) const
+  {
+    m_UsedKeys.insert(key);
+    auto it = m_Values.find(key);
+    return it == m_Values.end() ? defaultValue : it->second;
+  }
+
+  double GetDouble(const std::string & key, double defaultValue) const
+  {
+    return this->Convert< double >(key, defaultValue);
+  }
+
+  int GetInt(const std::string & key, int defaultValue) const
+  {
+    return this->Convert< int >(key, defaultValue);
+  }
+
+  bool GetBool(const std::string & key, bool defaultValue) const
+  {
+    const std::string value = this->GetString(key, defaultValue ? "1" : "0");
+    if ( value == "1" || value == "true" || value == "yes" || value == "on" )
+    {
+      return true;
+    }
+    if ( value == "0" || value == "false" || value == "no" || value == "off" )
+    {
+      return false;
+    }
+    itkGenericExceptionMacro(<< "Cannot convert " << key << " = " << value << " to a boolean");
+  }
+
+  template< typename T >
+  std::vector< T > GetArray(const std::string & key, const std::vector< T > & defaultValue) const
+  {
+    if ( !this->Has(key) )
+    {
+      m_UsedKeys.insert(key);
+      return defaultValue;
+    }
+
+    std::string value = this->GetString(key, "");
+    for (auto & c : value)
+    {
+      if ( c == ',' )
+      {
+        c = ' ';
+      }
+    }
+
+    std::vector< T > array;
+    std::istringstream stream(value);
+    T element;
+    while ( stream >> element )
+    {
+      array.push_back(element);
+    }
+    if ( !stream.eof() )
+    {
+      itkGenericExceptionMacro(<< "Cannot convert " << key << " = " << value << " to a list");
+    }
+    return array;
+  }
+
+  /** Print every key in the file that was never read */
+  void WarnUnusedKeys(std::ostream & os = std::cerr) const
+  {
+    for (const auto & kv : m_Values)
+    {
+      if ( m_UsedKeys.count(kv.first) == 0 )
+      {
+        os << "Warning: unused configuration key " << kv.first << std::endl;
+      }
+    }
+  }
+
+  const MapType & GetValues() const
+  {
+    return m_Values;
+  }
+
+private:
+  template< typename T >
+  T Convert(const std::string & key, T defaultValue) const
+  {
+    if ( !this->Has(key) )
+    {
+      m_UsedKeys.insert(key);
+      return defaultValue;
+    }
+
+    const std::string value = this->GetString(key, "");
+    std::istringstream stream(value);
+    T converted;
+    if ( !(stream >> converted) || !(stream >> std::ws).eof() )
+    {
+      itkGenericExceptionMacro(<< "Cannot convert " << key << " = " << value);
+    }
+    return converted;
+  }
+
+  static std::string Trim(const std::string & s)
+  {
+    const std::string whitespace = " \t\r\n";
+    const std::string::size_type first = s.find_first_not_of(whitespace);
+    if ( first == std::string::npos )
+    {
+      return "";
+    }
+    return s.substr(first, s.find_last_not_of(whitespace) - first + 1);
+  }
+
+  MapType                         m_Values;
+  mutable std::set< std::string > m_UsedKeys;
+}; // end class
+} /* end namespace */
+
+#endif /* femurConfiguration_h */
@@ -0,0 +1,90 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurConnectedComponents_h
+#define femurConnectedComponents_h
+
+#include "itkImage.h"
+#include "itkKeepLargestComponentsImageFilter.h"
+
+namespace femur {
+
+/** Label the nonzero objects of image and keep the largest numberOfObjects.
+ *
+ * Kept voxels are set to insideValue and everything else to outsideValue.
+ */
+template< typename TInputImage, typename TOutputImage = TInputImage >
+typename TOutputImage::Pointer
+KeepLargestObjects(const TInputImage * image, int numberOfObjects,
+                   typename TOutputImage::PixelType insideValue, typename TOutputImage::PixelType outsideValue,
+                   itk::SizeValueType * objectCount = nullptr)
+{
+  using KeepFilterType = itk::KeepLargestComponentsImageFilter< TInputImage, TOutputImage >;
+
+  typename KeepFilterType::Pointer keeper = KeepFilterType::New();
+  keeper->SetInput(image);
+  keeper->SetNumberOfObjects(numberOfObjects);
+  keeper->FillHolesOff();
+  keeper->SetInsideValue(insideValue);
+  keeper->SetOutsideValue(outsideValue);
+  keeper->Update();
+
+  if ( objectCount != nullptr )
+  {
+    *objectCount = keeper->GetObjectCount();
+  }
+
+  typename TOutputImage::Pointer output = keeper->GetOutput();
+  output->DisconnectPipeline();
+  return output;
+}
+
+/** Keep the largest foreground objects of a binary image, then fill background holes.
+ * Returns a 0/1 image. Both steps run as one pass of KeepLargestComponentsImageFilter. */
+template< typename TImage >
+typename TImage::Pointer
+KeepLargestComponents(const TImage * segmentation, int numberOfObjects,
+                      itk::SizeValueType * foregroundCount = nullptr, itk::SizeValueType * backgroundCount = nullptr)
+{
+  using KeepFilterType = itk::KeepLargestComponentsImageFilter< TImage, TImage >;
+
+  typename KeepFilterType::Pointer keeper = KeepFilterType::New();
+  keeper->SetInput(segmentation);
+  keeper->SetNumberOfObjects(numberOfObjects);
+  keeper->FillHolesOn();
+  keeper->SetInsideValue(1);
+  keeper->SetOutsideValue(0);
+  keeper->Update();
+
+  if ( foregroundCount != nullptr )
+  {
+    *foregroundCount = keeper->GetObjectCount();
+  }
+  if ( backgroundCount != nullptr )
+  {
+    *backgroundCount = keeper->GetBackgroundObjectCount();
+  }
+
+  typename TImage::Pointer output = keeper->GetOutput();
+  output->DisconnectPipeline();
+  return output;
+}
+
+} /* end namespace */
+
+#endif /* femurConnectedComponents_h */
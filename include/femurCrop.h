@@ -0,0 +1,121 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurCrop_h
+#define femurCrop_h
+
+#include "itkImage.h"
+#include "itkImageAlgorithm.h"
+#include "itkImageScanlineConstIterator.h"
+#include "itkRegionOfInterestImageFilter.h"
+
+#include <algorithm>
+
+namespace femur {
+
+/** Smallest region holding every voxel of image whose value satisfies predicate, grown by
+ * padding and kept inside the image. Images with no such voxel give the whole image. */
+template< typename TImage, typename TPredicate >
+typename TImage::RegionType
+BoundingRegion(const TImage * image, TPredicate predicate, itk::IndexValueType padding)
+{
+  using RegionType = typename TImage::RegionType;
+  using IndexType = typename TImage::IndexType;
+
+  const RegionType largest = image->GetLargestPossibleRegion();
+  IndexType lower = largest.GetUpperIndex();
+  IndexType upper = largest.GetIndex();
+  bool found = false;
+
+  itk::ImageScanlineConstIterator< TImage > it(image, largest);
+  while ( !it.IsAtEnd() )
+  {
+    while ( !it.IsAtEndOfLine() )
+    {
+      if ( predicate(it.Get()) )
+      {
+        const IndexType index = it.GetIndex();
+        for ( unsigned int d = 0; d < TImage::ImageDimension; ++d )
+        {
+          lower[d] = std::min(lower[d], index[d]);
+          upper[d] = std::max(upper[d], index[d]);
+        }
+        found = true;
+      }
+      ++it;
+    }
+    it.NextLine();
+  }
+
+  if ( !found )
+  {
+    return largest;
+  }
+
+  RegionType region;
+  region.SetIndex(lower);
+  region.SetUpperIndex(upper);
+  region.PadByRadius(padding);
+  region.Crop(largest);
+  return region;
+}
+
+/** Bounding region of the nonzero voxels of image, see BoundingRegion */
+template< typename TImage >
+typename TImage::RegionType
+NonzeroBoundingRegion(const TImage * image, itk::IndexValueType padding)
+{
+  return BoundingRegion(image, [](typename TImage::PixelType value) { return value != 0; }, padding);
+}
+
+/** The part of image inside region, indexed from zero with the origin moved onto it.
+ * The grid cut filters index their graphs from zero, which this gives them. */
+template< typename TImage >
+typename TImage::Pointer
+CropImage(const TImage * image, const typename TImage::RegionType & region)
+{
+  using CropFilterType = itk::RegionOfInterestImageFilter< TImage, TImage >;
+
+  typename CropFilterType::Pointer crop = CropFilterType::New();
+  crop->SetInput(image);
+  crop->SetRegionOfInterest(region);
+  crop->Update();
+
+  typename TImage::Pointer output = crop->GetOutput();
+  output->DisconnectPipeline();
+  return output;
+}
+
+/** Undo CropImage: an image with the grid of reference holding crop at region and fill elsewhere */
+template< typename TImage >
+typename TImage::Pointer
+UncropImage(const TImage * crop, const typename TImage::RegionType & region,
+            const itk::ImageBase< TImage::ImageDimension > * reference, typename TImage::PixelType fill)
+{
+  typename TImage::Pointer output = TImage::New();
+  output->CopyInformation(reference);
+  output->SetRegions(reference->GetLargestPossibleRegion());
+  output->Allocate();
+  output->FillBuffer(fill);
+  itk::ImageAlgorithm::Copy(crop, output.GetPointer(), crop->GetLargestPossibleRegion(), region);
+  return output;
+}
+
+} /* end namespace */
+
+#endif /* femurCrop_h */
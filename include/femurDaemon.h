@@ -0,0 +1,442 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurDaemon_h
+#define femurDaemon_h
+
+#include "femurConfiguration.h"
+
+#include "itkDataObject.h"
+#include "itkMacro.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace femur {
+/**
+ * Job server for SegmentationDaemon.
+ *
+ * A client connects to a Unix domain socket, writes a request in configuration
+ * syntax (`stage = periosteal`, `input = ...`, `periosteal.lambda = 50`, ...) and
+ * shuts down its write side. The server answers with one line per event:
+ *
+ *   QUEUED             waiting for a free job slot
+ *   STATUS <text>      progress of a running job
+ *   DONE <seconds>     job finished
+ *   ERROR <message>    job failed or the request was malformed
+ *
+ * and closes the connection. At most Jobs requests run at once, the others wait.
+ * A request must arrive within DaemonRequestTimeout, and connections beyond
+ * Jobs + DaemonMaxWaiting are turned away with an ERROR.
+ */
+
+/** Counting semaphore bounding the number of running jobs */
+class JobSlots
+{
+public:
+  explicit JobSlots(unsigned int slots) : m_Free(slots) {}
+
+  /** Take a slot if one is free, without waiting */
+  bool TryAcquire()
+  {
+    std::lock_guard< std::mutex > lock(m_Mutex);
+    if ( m_Free == 0 || m_Stopped )
+    {
+      return false;
+    }
+    --m_Free;
+    return true;
+  }
+
+  /** Wait for a slot and take it. Returns false, without a slot, once Stop was called. */
+  bool Acquire()
+  {
+    std::unique_lock< std::mutex > lock(m_Mutex);
+    m_Condition.wait(lock, [this]() { return m_Free > 0 || m_Stopped; });
+    if ( m_Stopped )
+    {
+      return false;
+    }
+    --m_Free;
+    return true;
+  }
+
+  void Release()
+  {
+    {
+      std::lock_guard< std::mutex > lock(m_Mutex);
+      ++m_Free;
+    }
+    m_Condition.notify_one();
+  }
+
+  /** Wake every waiter empty handed and hand out no more slots */
+  void Stop()
+  {
+    {
+      std::lock_guard< std::mutex > lock(m_Mutex);
+      m_Stopped = true;
+    }
+    m_Condition.notify_all();
+  }
+
+private:
+  std::mutex              m_Mutex;
+  std::condition_variable m_Condition;
+  unsigned int            m_Free;
+  bool                    m_Stopped = false;
+};
+
+/** Time a client has to send its whole request */
+constexpr std::chrono::seconds DaemonRequestTimeout(30);
+
+/** Connections allowed to wait for a job slot on top of the running ones */
+constexpr unsigned int DaemonMaxWaiting = 64;
+
+/** Images kept between jobs, least recently used dropped first.
+ *
+ * Keys name what was computed from what, e.g. a file name and its modification time,
+ * so a changed file is read again rather than served stale.
+ */
+class ImageCache
+{
+public:
+  explicit ImageCache(std::size_t capacity) : m_Capacity(capacity) {}
+
+  /** Cached image for key, or compute(), cached under key */
+  template< typename TImage, typename TCompute >
+  typename TImage::Pointer Get(const std::string & key, TCompute compute)
+  {
+    {
+      std::lock_guard< std::mutex > lock(m_Mutex);
+      for (auto it = m_Entries.begin(); it != m_Entries.end(); ++it)
+      {
+        if ( it->first == key )
+        {
+          m_Entries.splice(m_Entries.begin(), m_Entries, it);
+          if ( TImage * image = dynamic_cast< TImage * >(it->second.GetPointer()) )
+          {
+            return image;
+          }
+          break;
+        }
+      }
+    }
+
+    /* Computed outside the lock, two jobs asking at once may both compute it */
+    typename TImage::Pointer image = compute();
+    std::lock_guard< std::mutex > lock(m_Mutex);
+    m_Entries.remove_if([&key](const EntryType & entry) { return entry.first == key; });
+    m_Entries.emplace_front(key, image.GetPointer());
+    while ( m_Entries.size() > m_Capacity )
+    {
+      m_Entries.pop_back();
+    }
+    return image;
+  }
+
+  /** Key of a file that changes whenever the file does */
+  static std::string FileKey(const std::string & fileName)
+  {
+    struct stat status;
+    if ( stat(fileName.c_str(), &status) != 0 )
+    {
+      itkGenericExceptionMacro(<< "Cannot open " << fileName);
+    }
+    std::ostringstream key;
+    key << fileName << "@" << status.st_mtime << ":" << status.st_size;
+    return key.str();
+  }
+
+private:
+  using EntryType = std::pair< std::string, itk::DataObject::Pointer >;
+
+  std::mutex              m_Mutex;
+  std::list< EntryType >  m_Entries;
+  std::size_t             m_Capacity;
+};
+
+namespace detail {
+/** Set by SIGINT and SIGTERM, polled by the accept loop */
+inline std::atomic< bool > & DaemonStopRequested()
+{
+  static std::atomic< bool > stop(false);
+  return stop;
+}
+
+inline void RequestDaemonStop(int)
+{
+  DaemonStopRequested() = true;
+}
+
+/** Bound how long a blocking send to a client that stopped reading may take */
+inline void SetSendTimeout(int fd, std::chrono::seconds timeout)
+{
+  timeval value;
+  value.tv_sec = static_cast< time_t >(timeout.count());
+  value.tv_usec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &value, sizeof(value));
+}
+
+inline bool SendLine(int fd, const std::string & line)
+{
+  const std::string data = line + "\n";
+  std::size_t sent = 0;
+  while ( sent < data.size() )
+  {
+    const ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if ( n <= 0 )
+    {
+      return false;
+    }
+    sent += static_cast< std::size_t >(n);
+  }
+  return true;
+}
+
+/** Everything the client sends until it shuts down its write side, which must happen
+ * within timeout, or stop is requested */
+inline std::string ReceiveAll(int fd, std::chrono::seconds timeout)
+{
+  using Clock = std::chrono::steady_clock;
+  const Clock::time_point deadline = Clock::now() + timeout;
+
+  std::string data;
+  char buffer[4096];
+  for (;;)
+  {
+    const auto remaining = std::chrono::duration_cast< std::chrono::milliseconds >(deadline - Clock::now()).count();
+    if ( DaemonStopRequested() )
+    {
+      itkGenericExceptionMacro(<< "Daemon is stopping");
+    }
+    if ( remaining <= 0 )
+    {
+      itkGenericExceptionMacro(<< "No complete request within " << timeout.count() << "s");
+    }
+
+    /* Wake up regularly to notice a stop request */
+    pollfd pending = {fd, POLLIN, 0};
+    const int ready = poll(&pending, 1, static_cast< int >(std::min< long long >(remaining, 500)));
+    if ( ready < 0 && errno != EINTR )
+    {
+      itkGenericExceptionMacro(<< "Cannot read request: " << std::strerror(errno));
+    }
+    if ( ready <= 0 )
+    {
+      continue;
+    }
+
+    const ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if ( n < 0 )
+    {
+      if ( errno == EINTR )
+      {
+        continue;
+      }
+      itkGenericExceptionMacro(<< "Cannot read request: " << std::strerror(errno));
+    }
+    if ( n == 0 )
+    {
+      return data;
+    }
+    data.append(buffer, static_cast< std::size_t >(n));
+  }
+}
+} /* end namespace detail */
+
+/** Reports progress of a running job back to its client */
+using StatusFunction = std::function< void(const std::string &) >;
+
+/** Runs one parsed request. Throws to report an error. */
+using JobFunction = std::function< void(const Configuration &, const StatusFunction &) >;
+
+/** Serve requests on socketPath until SIGINT, SIGTERM or a `stage = shutdown` request.
+ * Running jobs are finished before returning. */
+inline void
+RunDaemon(const std::string & socketPath, unsigned int jobs, const JobFunction & runJob)
+{
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if ( socketPath.size() >= sizeof(address.sun_path) )
+  {
+    itkGenericExceptionMacro(<< "Socket path " << socketPath << " is too long");
+  }
+  std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+  /* Only a stale socket, left behind by a daemon that is gone, may be replaced */
+  struct stat existing;
+  if ( lstat(socketPath.c_str(), &existing) == 0 )
+  {
+    if ( !S_ISSOCK(existing.st_mode) )
+    {
+      itkGenericExceptionMacro(<< socketPath << " exists and is not a socket, not replacing it");
+    }
+    const int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    const bool live = probe >= 0 && connect(probe, reinterpret_cast< sockaddr * >(&address), sizeof(address)) == 0;
+    if ( probe >= 0 )
+    {
+      close(probe);
+    }
+    if ( live )
+    {
+      itkGenericExceptionMacro(<< "A daemon is already listening on " << socketPath);
+    }
+  }
+
+  const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ( listener < 0 )
+  {
+    itkGenericExceptionMacro(<< "Cannot create socket: " << std::strerror(errno));
+  }
+  unlink(socketPath.c_str());
+  if ( bind(listener, reinterpret_cast< sockaddr * >(&address), sizeof(address)) != 0 || listen(listener, 64) != 0 )
+  {
+    const std::string reason = std::strerror(errno);
+    close(listener);
+    itkGenericExceptionMacro(<< "Cannot listen on " << socketPath << ": " << reason);
+  }
+
+  std::signal(SIGINT, detail::RequestDaemonStop);
+  std::signal(SIGTERM, detail::RequestDaemonStop);
+
+  JobSlots slots(jobs);
+  std::atomic< unsigned int > connections(0);
+  std::atomic< unsigned long > nextId(0);
+
+  std::cout << "Listening on " << socketPath << " with " << jobs << " job slots" << std::endl;
+  while ( !detail::DaemonStopRequested() )
+  {
+    /* Wake up regularly to notice a stop request */
+    pollfd pending = {listener, POLLIN, 0};
+    if ( poll(&pending, 1, 500) <= 0 )
+    {
+      continue;
+    }
+    const int client = accept(listener, nullptr, nullptr);
+    if ( client < 0 )
+    {
+      continue;
+    }
+    detail::SetSendTimeout(client, DaemonRequestTimeout);
+
+    /* Every connection holds a thread until its job is done, bound how many there are */
+    if ( connections >= jobs + DaemonMaxWaiting )
+    {
+      detail::SendLine(client, "ERROR Too many connections, try again later");
+      close(client);
+      continue;
+    }
+
+    ++connections;
+    const unsigned long id = nextId++;
+    std::thread([&, client, id]()
+    {
+      try
+      {
+        Configuration request;
+        const std::string received = detail::ReceiveAll(client, DaemonRequestTimeout);
+        std::istringstream text(received);
+        request.Read(text, "request " + std::to_string(id));
+
+        if ( received.empty() )
+        {
+          /* A connection closed without a request, e.g. another daemon checking the socket is live */
+        }
+        else if ( request.GetString("stage", "") == "shutdown" )
+        {
+          std::cout << "[" << id << "] Shutdown requested" << std::endl;
+          detail::DaemonStopRequested() = true;
+          detail::SendLine(client, "DONE 0");
+        }
+        else
+        {
+          if ( !slots.TryAcquire() )
+          {
+            detail::SendLine(client, "QUEUED");
+            if ( !slots.Acquire() )
+            {
+              itkGenericExceptionMacro(<< "Daemon is stopping");
+            }
+          }
+
+          const auto start = std::chrono::steady_clock::now();
+          try
+          {
+            std::cout << "[" << id << "] Running " << request.GetString("stage", "") << std::endl;
+            runJob(request, [client](const std::string & status) { detail::SendLine(client, "STATUS " + status); });
+            slots.Release();
+          }
+          catch (...)
+          {
+            slots.Release();
+            throw;
+          }
+
+          const double seconds = std::chrono::duration< double >(std::chrono::steady_clock::now() - start).count();
+          std::cout << "[" << id << "] Done in " << seconds << "s" << std::endl;
+          detail::SendLine(client, "DONE " + std::to_string(seconds));
+        }
+      }
+      catch (const std::exception & e)
+      {
+        std::string message = e.what();
+        std::replace(message.begin(), message.end(), '\n', ' ');
+        std::cout << "[" << id << "] Error: " << message << std::endl;
+        detail::SendLine(client, "ERROR " + message);
+      }
+      close(client);
+      --connections;
+    }).detach();
+  }
+
+  /* Queued requests are turned away, running ones finish, reads give up within a poll */
+  std::cout << "Stopping, waiting for " << connections << " connections" << std::endl;
+  slots.Stop();
+  close(listener);
+  unlink(socketPath.c_str());
+  while ( connections > 0 )
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+}
+
+} /* end namespace */
+
+#endif /* femurDaemon_h */
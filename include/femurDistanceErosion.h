@@ -0,0 +1,70 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurDistanceErosion_h
+#define femurDistanceErosion_h
+
+#include "itkImage.h"
+#include "itkSignedMaurerDistanceMapImageFilter.h"
+#include "itkBinaryThresholdImageFilter.h"
+
+#include <cmath>
+#include <limits>
+
+namespace femur {
+
+/** Erode the voxels of mask equal to foregroundValue by a ball of physical radius.
+ *
+ * Same result as BinaryErodeImageFilter with a Ball of radius/spacing voxels and
+ * the image border treated as foreground, but computed by thresholding one
+ * squared Euclidean distance map. Its cost does not grow with the radius.
+ * Kept voxels are set to the largest pixel value and the rest to zero.
+ */
+template< typename TMaskImage >
+typename TMaskImage::Pointer
+ErodeByDistance(const TMaskImage * mask, typename TMaskImage::PixelType foregroundValue, double radius)
+{
+  using DistanceImageType = itk::Image< float, TMaskImage::ImageDimension >;
+  using DistanceFilterType = itk::SignedMaurerDistanceMapImageFilter< TMaskImage, DistanceImageType >;
+  using ThresholdFilterType = itk::BinaryThresholdImageFilter< DistanceImageType, TMaskImage >;
+
+  /* Foreground voxels are outside the Maurer object, so their distance is to the nearest other voxel */
+  typename DistanceFilterType::Pointer distanceFilter = DistanceFilterType::New();
+  distanceFilter->SetInput(mask);
+  distanceFilter->SetBackgroundValue(foregroundValue);
+  distanceFilter->InsideIsPositiveOff();
+  distanceFilter->SquaredDistanceOn();
+  distanceFilter->UseImageSpacingOn();
+
+  /* A ball of the radius fits wherever the squared distance is strictly larger */
+  const float squaredRadius = static_cast< float >(radius * radius);
+  typename ThresholdFilterType::Pointer thresholder = ThresholdFilterType::New();
+  thresholder->SetInput(distanceFilter->GetOutput());
+  thresholder->SetLowerThreshold(std::nextafter(squaredRadius, std::numeric_limits< float >::max()));
+  thresholder->SetInsideValue(itk::NumericTraits< typename TMaskImage::PixelType >::max());
+  thresholder->SetOutsideValue(itk::NumericTraits< typename TMaskImage::PixelType >::ZeroValue());
+  thresholder->Update();
+
+  typename TMaskImage::Pointer output = thresholder->GetOutput();
+  output->DisconnectPipeline();
+  return output;
+}
+
+} /* end namespace */
+
+#endif /* femurDistanceErosion_h */
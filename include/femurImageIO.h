@@ -0,0 +1,111 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurImageIO_h
+#define femurImageIO_h
+
+#include "itkChunkedImageIOFactory.h"
+#include "itkParallelGzipNiftiImageIOFactory.h"
+#include "femurCrop.h"
+#include "femurTrace.h"
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+
+#include <string>
+
+namespace femur {
+/** Register our image IO factories, the NIfTI one ahead of the one ITK provides.
+ *
+ * Call once at the top of main, before any reader or writer is created.
+ * Calling it again does nothing.
+ */
+inline void RegisterImageIOFactories()
+{
+  static bool registered = false;
+  if ( registered )
+  {
+    return;
+  }
+  registered = true;
+
+  itk::ParallelGzipNiftiImageIOFactory::RegisterOneFactory();
+  itk::ChunkedImageIOFactory::RegisterOneFactory();
+}
+
+/** True if fileName is written as a chunked intermediate */
+inline bool IsChunkedFileName(const std::string & fileName)
+{
+  const std::string ending = ".fsc";
+  return fileName.size() > ending.size()
+    && fileName.compare(fileName.size() - ending.size(), ending.size(), ending) == 0;
+}
+
+/** Write an image. Chunked float images are quantized to int16 when quantizationScale > 0. */
+template< typename TImage >
+void WriteImage(const TImage * image, const std::string & fileName, double quantizationScale = 0.0)
+{
+  FEMUR_TRACE_SCOPE("femur", "WriteImage");
+
+  using WriterType = itk::ImageFileWriter< TImage >;
+
+  typename WriterType::Pointer writer = WriterType::New();
+  if ( IsChunkedFileName(fileName) && quantizationScale > 0.0 )
+  {
+    itk::ChunkedImageIO::Pointer io = itk::ChunkedImageIO::New();
+    io->SetQuantizationScale(quantizationScale);
+    writer->SetImageIO(io);
+  }
+  writer->SetInput(image);
+  writer->SetFileName(fileName);
+  writer->Write();
+}
+
+/** Read only region of a file, as CropImage would cut it from the whole image: indexed from
+ * zero with the origin moved onto the region. Chunked files inflate just the chunks it
+ * overlaps, block gzip NIfTI the members it spans, other formats read what their ImageIO
+ * can stream. */
+template< typename TImage >
+typename TImage::Pointer ReadImageRegion(const std::string & fileName, const typename TImage::RegionType & region)
+{
+  FEMUR_TRACE_SCOPE("femur", "ReadImageRegion");
+
+  using ReaderType = itk::ImageFileReader< TImage >;
+
+  typename ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileName(fileName);
+  reader->UpdateOutputInformation();
+  reader->GetOutput()->SetRequestedRegion(region);
+  reader->GetOutput()->Update();
+
+  typename TImage::Pointer output = reader->GetOutput();
+  output->DisconnectPipeline();
+  if ( output->GetBufferedRegion() != region )
+  {
+    return CropImage(output.GetPointer(), region);
+  }
+
+  /* The buffer holds exactly the region, rebase it without copying */
+  typename TImage::PointType origin;
+  output->TransformIndexToPhysicalPoint(region.GetIndex(), origin);
+  output->SetOrigin(origin);
+  output->SetRegions(typename TImage::RegionType(region.GetSize()));
+  return output;
+}
+} /* end namespace */
+
+#endif /* femurImageIO_h */
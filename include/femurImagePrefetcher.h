@@ -0,0 +1,298 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurImagePrefetcher_h
+#define femurImagePrefetcher_h
+
+#include "femurMemoryPlanner.h"
+#include "femurTrace.h"
+#include "itkDataObject.h"
+#include "itkMemoryMappedImageFileReader.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace femur {
+
+/**
+ * Read images ahead of time on a dedicated I/O thread.
+ *
+ * Prefetch queues a file and returns at once. The I/O thread reads and decodes it,
+ * and pages in memory mapped files, while the caller computes. Read hands over a
+ * prefetched image, waits for one that is being read, and reads anything else
+ * itself, so a prefetch is only ever a hint.
+ *
+ * Prefetched images that have not been read yet are held to maxBytes, estimated
+ * from the headers. The oldest images nobody read are dropped to make room, and a
+ * file that still does not fit is left for Read. maxBytes = 0 turns prefetching off.
+ */
+class ImagePrefetcher
+{
+public:
+  explicit ImagePrefetcher(std::uint64_t maxBytes = 0)
+    : m_MaxBytes(maxBytes)
+  {}
+
+  ~ImagePrefetcher()
+  {
+    {
+      std::lock_guard< std::mutex > lock(m_Mutex);
+      m_Stop = true;
+      m_Queue.clear();
+    }
+    m_Wake.notify_all();
+    if ( m_Thread.joinable() )
+    {
+      m_Thread.join();
+    }
+  }
+
+  ImagePrefetcher(const ImagePrefetcher &) = delete;
+  ImagePrefetcher & operator=(const ImagePrefetcher &) = delete;
+
+  /** Start reading fileName as a TImage in the background */
+  template< typename TImage >
+  void Prefetch(const std::string & fileName)
+  {
+    if ( m_MaxBytes == 0 )
+    {
+      return;
+    }
+
+    std::lock_guard< std::mutex > lock(m_Mutex);
+    if ( m_Entries.count(fileName) > 0 )
+    {
+      return;
+    }
+
+    const std::uint64_t sequence = m_NextSequence++;
+    m_Entries[fileName].Sequence = sequence;
+    m_Queue.push_back({fileName, sequence, sizeof(typename TImage::PixelType),
+                       [fileName]() { return itk::DataObject::Pointer(Load< TImage >(fileName, true).GetPointer()); }});
+    if ( !m_Thread.joinable() )
+    {
+      m_Thread = std::thread([this]() { this->Run(); });
+    }
+    m_Wake.notify_one();
+  }
+
+  /** The image in fileName, prefetched if it was, read now otherwise */
+  template< typename TImage >
+  typename TImage::Pointer Read(const std::string & fileName)
+  {
+    std::unique_lock< std::mutex > lock(m_Mutex);
+    m_Ready.wait(lock, [&]()
+      {
+        auto it = m_Entries.find(fileName);
+        return it == m_Entries.end() || it->second.State != Entry::Loading;
+      });
+
+    auto it = m_Entries.find(fileName);
+    if ( it != m_Entries.end() )
+    {
+      /* A queued read is dropped, reading it here is no slower than waiting for it */
+      itk::DataObject::Pointer image = it->second.Image;
+      m_Bytes -= it->second.Bytes;
+      m_Entries.erase(it);
+
+      typename TImage::Pointer prefetched = dynamic_cast< TImage * >(image.GetPointer());
+      if ( prefetched.IsNotNull() )
+      {
+        return prefetched;
+      }
+    }
+    lock.unlock();
+
+    return Load< TImage >(fileName, false);
+  }
+
+private:
+  struct Entry
+  {
+    enum StateType { Queued, Loading, Ready, Skipped };
+
+    StateType                 State = Queued;
+    std::uint64_t             Sequence = 0;
+    std::uint64_t             Bytes = 0;
+    itk::DataObject::Pointer  Image;
+  };
+
+  struct Job
+  {
+    std::string                                 FileName;
+    std::uint64_t                               Sequence;
+    std::size_t                                 BytesPerVoxel;
+    std::function< itk::DataObject::Pointer() > Load;
+  };
+
+  template< typename TImage >
+  static typename TImage::Pointer Load(const std::string & fileName, bool pageIn)
+  {
+    using ReaderType = itk::MemoryMappedImageFileReader< TImage >;
+
+    typename ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName(fileName);
+    reader->Update();
+
+    typename TImage::Pointer image = reader->GetOutput();
+    image->DisconnectPipeline();
+
+    /* A mapping is only read from disk when touched, touch it here instead of in the first filter */
+    if ( pageIn && reader->GetMemoryMapped() )
+    {
+      const volatile char * bytes = reinterpret_cast< const char * >(image->GetBufferPointer());
+      const std::size_t length = image->GetPixelContainer()->Size() * sizeof(typename TImage::PixelType);
+      char sum = 0;
+      for (std::size_t i = 0; i < length; i += 4096)
+      {
+        sum ^= bytes[i];
+      }
+      static_cast< void >(sum);
+    }
+    return image;
+  }
+
+  /** Entry of job, unless Read took it in the meantime */
+  Entry * FindEntry(const Job & job)
+  {
+    auto it = m_Entries.find(job.FileName);
+    return it != m_Entries.end() && it->second.Sequence == job.Sequence ? &it->second : nullptr;
+  }
+
+  void Run()
+  {
+    std::unique_lock< std::mutex > lock(m_Mutex);
+    while ( true )
+    {
+      m_Wake.wait(lock, [this]() { return m_Stop || !m_Queue.empty(); });
+      if ( m_Stop )
+      {
+        return;
+      }
+
+      Job job = std::move(m_Queue.front());
+      m_Queue.pop_front();
+      Entry * entry = this->FindEntry(job);
+      if ( entry == nullptr )
+      {
+        continue;
+      }
+      entry->State = Entry::Loading;
+      lock.unlock();
+
+      std::uint64_t bytes = 0;
+      try
+      {
+        bytes = ReadNumberOfVoxels(job.FileName) * job.BytesPerVoxel;
+      }
+      catch ( const std::exception & )
+      {
+        bytes = m_MaxBytes + 1;
+      }
+
+      lock.lock();
+      entry = this->FindEntry(job);
+      this->MakeRoom(bytes, entry);
+      if ( m_Bytes + bytes > m_MaxBytes )
+      {
+        entry->State = Entry::Skipped;
+        m_Ready.notify_all();
+        continue;
+      }
+      entry->Bytes = bytes;
+      m_Bytes += bytes;
+      lock.unlock();
+
+      itk::DataObject::Pointer image;
+      try
+      {
+        FEMUR_TRACE_SCOPE("ImagePrefetcher", "Load");
+        image = job.Load();
+      }
+      catch ( const std::exception & )
+      {
+        /* Read reports the error when it reads the file itself */
+      }
+
+      lock.lock();
+      entry = this->FindEntry(job);
+      entry->Image = image;
+      entry->State = image.IsNotNull() ? Entry::Ready : Entry::Skipped;
+      m_Ready.notify_all();
+    }
+  }
+
+  /** Drop the oldest prefetched images nobody read until bytes more fit, sparing keep.
+   * Drops nothing when that would not be enough. */
+  void MakeRoom(std::uint64_t bytes, const Entry * keep)
+  {
+    std::uint64_t droppable = 0;
+    for (const auto & named : m_Entries)
+    {
+      if ( &named.second != keep && named.second.State == Entry::Ready )
+      {
+        droppable += named.second.Bytes;
+      }
+    }
+    if ( bytes > m_MaxBytes || m_Bytes - droppable + bytes > m_MaxBytes )
+    {
+      return;
+    }
+
+    while ( m_Bytes + bytes > m_MaxBytes )
+    {
+      auto oldest = m_Entries.end();
+      for (auto it = m_Entries.begin(); it != m_Entries.end(); ++it)
+      {
+        if ( &it->second != keep && it->second.State == Entry::Ready
+          && (oldest == m_Entries.end() || it->second.Sequence < oldest->second.Sequence) )
+        {
+          oldest = it;
+        }
+      }
+      if ( oldest == m_Entries.end() )
+      {
+        return;
+      }
+      m_Bytes -= oldest->second.Bytes;
+      m_Entries.erase(oldest);
+    }
+  }
+
+  std::uint64_t                   m_MaxBytes;
+  std::uint64_t                   m_Bytes = 0;
+  std::uint64_t                   m_NextSequence = 0;
+  std::map< std::string, Entry >  m_Entries;
+  std::deque< Job >               m_Queue;
+  std::mutex                      m_Mutex;
+  std::condition_variable         m_Wake;
+  std::condition_variable         m_Ready;
+  std::thread                     m_Thread;
+  bool                            m_Stop = false;
+};
+
+} /* end namespace */
+
+#endif /* femurImagePrefetcher_h */
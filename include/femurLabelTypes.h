@@ -0,0 +1,161 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurLabelTypes_h
+#define femurLabelTypes_h
+
+#include "itkImageIOBase.h"
+#include "itkImageIOFactory.h"
+#include "itkImageIORegion.h"
+#include "itkNumericTraits.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace femur {
+
+/** Pixel types label images are read as */
+enum class LabelComponentType
+{
+  UInt8,
+  UInt16
+};
+
+namespace detail {
+
+template< typename T >
+void UpdateLabelRange(const char * buffer, std::size_t count, double & minimum, double & maximum)
+{
+  const T * values = reinterpret_cast< const T * >(buffer);
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    minimum = std::min(minimum, static_cast< double >(values[i]));
+    maximum = std::max(maximum, static_cast< double >(values[i]));
+  }
+}
+
+/** Add the values in buffer, stored as component type of io, to the range */
+inline void UpdateLabelRange(const itk::ImageIOBase * io, const char * buffer, std::size_t count,
+                             double & minimum, double & maximum)
+{
+  switch ( io->GetComponentType() )
+  {
+  case itk::ImageIOBase::INT:       UpdateLabelRange< int >(buffer, count, minimum, maximum); break;
+  case itk::ImageIOBase::UINT:      UpdateLabelRange< unsigned int >(buffer, count, minimum, maximum); break;
+  case itk::ImageIOBase::LONG:      UpdateLabelRange< long >(buffer, count, minimum, maximum); break;
+  case itk::ImageIOBase::ULONG:     UpdateLabelRange< unsigned long >(buffer, count, minimum, maximum); break;
+  case itk::ImageIOBase::LONGLONG:  UpdateLabelRange< long long >(buffer, count, minimum, maximum); break;
+  case itk::ImageIOBase::ULONGLONG: UpdateLabelRange< unsigned long long >(buffer, count, minimum, maximum); break;
+  case itk::ImageIOBase::FLOAT:     UpdateLabelRange< float >(buffer, count, minimum, maximum); break;
+  case itk::ImageIOBase::DOUBLE:    UpdateLabelRange< double >(buffer, count, minimum, maximum); break;
+  default:
+    itkGenericExceptionMacro(<< "Unsupported label component type "
+                             << itk::ImageIOBase::GetComponentTypeAsString(io->GetComponentType()));
+  }
+}
+
+} /* end namespace detail */
+
+/** Bytes of a wide label file read at a time while scanning its range */
+constexpr std::size_t LabelScanSlabBytes = std::size_t(64) << 20;
+
+/** Narrowest label type that holds every label stored in a file.
+ *
+ * 8 and 16 bit files are decided from the header alone. Wider files are
+ * scanned once for their range, since marks are often saved as 32 bit or
+ * float even though they hold a handful of labels. The scan reads the stored
+ * component type in slabs of about LabelScanSlabBytes where the ImageIO can
+ * stream; compressed files, which cannot seek cheaply, are read in one go.
+ */
+inline LabelComponentType SelectLabelComponentType(const std::string & fileName)
+{
+  itk::ImageIOBase::Pointer io = itk::ImageIOFactory::CreateImageIO(fileName.c_str(), itk::ImageIOFactory::ReadMode);
+  if ( io.IsNull() )
+  {
+    itkGenericExceptionMacro(<< "Cannot find an ImageIO for " << fileName);
+  }
+  io->SetFileName(fileName);
+  io->ReadImageInformation();
+
+  if ( io->GetComponentSize() == 1 )
+  {
+    return LabelComponentType::UInt8;
+  }
+  if ( io->GetComponentSize() == 2 )
+  {
+    return LabelComponentType::UInt16;
+  }
+
+  const unsigned int dimensions = io->GetNumberOfDimensions();
+  const unsigned int last = dimensions - 1;
+  const std::size_t slices = io->GetDimensions(last);
+  const std::size_t sliceBytes = io->GetImageSizeInBytes() / std::max< std::size_t >(1, slices);
+  const bool compressed = fileName.size() > 3 && fileName.compare(fileName.size() - 3, 3, ".gz") == 0;
+  const std::size_t slabSlices = io->CanStreamRead() && !compressed
+    ? std::max< std::size_t >(1, LabelScanSlabBytes / std::max< std::size_t >(1, sliceBytes)) : slices;
+
+  itk::ImageIORegion region(dimensions);
+  for (unsigned int i = 0; i < dimensions; ++i)
+  {
+    region.SetIndex(i, 0);
+    region.SetSize(i, io->GetDimensions(i));
+  }
+
+  double minimum = itk::NumericTraits< double >::max();
+  double maximum = itk::NumericTraits< double >::NonpositiveMin();
+  std::vector< char > buffer(std::min(slabSlices, slices) * sliceBytes);
+  for (std::size_t first = 0; first < slices; first += slabSlices)
+  {
+    const std::size_t count = std::min(slabSlices, slices - first);
+    region.SetIndex(last, static_cast< itk::IndexValueType >(first));
+    region.SetSize(last, count);
+    io->SetIORegion(region);
+    io->Read(buffer.data());
+    detail::UpdateLabelRange(io, buffer.data(), count * sliceBytes / io->GetComponentSize(), minimum, maximum);
+  }
+
+  if ( minimum < 0 || maximum > itk::NumericTraits< unsigned short >::max() )
+  {
+    itkGenericExceptionMacro(<< fileName << " has labels in [" << minimum << ", "
+                             << maximum << "], outside of 16 bits");
+  }
+  return maximum <= itk::NumericTraits< unsigned char >::max()
+    ? LabelComponentType::UInt8 : LabelComponentType::UInt16;
+}
+
+/** Call functor with a value of the label pixel type chosen for fileName.
+ *
+ * Lets a main instantiate its work once per label type:
+ *   return DispatchOnLabelType(maskFileName, [&](auto pixel) { return Run< decltype(pixel) >(...); });
+ */
+template< typename TFunctor >
+auto DispatchOnLabelType(const std::string & fileName, TFunctor && functor) -> decltype(functor((unsigned char)0))
+{
+  switch ( SelectLabelComponentType(fileName) )
+  {
+  case LabelComponentType::UInt8:
+    return functor((unsigned char)0);
+  default:
+    return functor((unsigned short)0);
+  }
+}
+
+} /* end namespace */
+
+#endif /* femurLabelTypes_h */
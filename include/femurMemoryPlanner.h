@@ -0,0 +1,300 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurMemoryPlanner_h
+#define femurMemoryPlanner_h
+
+#include "itkImageIOFactory.h"
+#include "itkMacro.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+namespace femur {
+
+/**
+ * How the pipeline stages trade memory for time or accuracy.
+ *
+ * The defaults are what the stages do without a plan. PlanMemory changes them,
+ * one knob at a time, until its estimate of every stage's peak fits the budget.
+ *
+ *   StreamDivisions         pieces the Hessian and eigen analysis are streamed in,
+ *                           each read with a Gaussian halo of StreamHalo slices
+ *   SinglePrecisionHessian  float Hessian tensors instead of double
+ *   CropPeriosteal          solve each periosteal label on the bounding box of its
+ *                           marks plus Padding voxels instead of the whole image
+ *   CropEndosteal           solve the endosteal cut on the bounding box of the
+ *                           periosteal mask, which gives the same result
+ */
+struct MemoryPlan
+{
+  std::uint64_t Budget                  = 0;
+  unsigned int  StreamDivisions         = 10;
+  unsigned int  StreamHalo              = 0;
+  bool          SinglePrecisionHessian  = false;
+  bool          CropPeriosteal          = false;
+  bool          CropEndosteal           = false;
+
+  /* Estimated peak bytes of each stage under this plan. Cropped stages are
+   * estimated for the whole image, their real peak is lower. */
+  std::uint64_t SkinMasksPeak   = 0;
+  std::uint64_t SheetnessPeak   = 0;
+  std::uint64_t PeriostealPeak  = 0;
+  std::uint64_t EndostealPeak   = 0;
+
+  std::uint64_t GetPeak() const
+  {
+    return std::max(std::max(SkinMasksPeak, SheetnessPeak), std::max(PeriostealPeak, EndostealPeak));
+  }
+
+  void Print(std::ostream & os) const;
+};
+
+/* Bytes per voxel held at each stage's peak, from the pixel types the stages use */
+
+/** HU image, threshold, component parents, skin mask, distance map and eroded mask */
+constexpr double SkinMasksBytesPerVoxel = 2 + 1 + 4 + 1 + 4 + 1;
+
+/** Resident while sheetness runs: HU image, both masks, the eigen image the parameter
+ * estimation keeps, the response at the current scale and the running maximum */
+constexpr double SheetnessResidentBytesPerVoxel = 2 + 1 + 1 + 12 + 4 + 4 + 4;
+
+/** One streamed piece: six Hessian components, two float scratch images and the eigenvalues */
+inline double SheetnessPieceBytesPerVoxel(bool singlePrecision)
+{
+  return 6 * (singlePrecision ? 4 : 8) + 8 + 12;
+}
+
+/** The Hessian's Gaussian derivatives reach about this many sigma, within the 0.01
+ * maximum error of DiscreteGaussianDerivativeImageFilter */
+constexpr double HessianHaloSigmas = 4.0;
+
+/** DiscreteGaussianDerivativeImageFilter's default MaximumKernelWidth, which caps the halo */
+constexpr unsigned int HessianMaximumKernelWidth = 32;
+
+/** Voxels HessianGaussianImageFilter pads a requested region by at sigma, along an axis of spacing */
+inline unsigned int HessianHaloRadius(double sigma, double spacing)
+{
+  const double radius = std::ceil(HessianHaloSigmas * sigma / spacing);
+  return static_cast< unsigned int >(std::min(radius, static_cast< double >(HessianMaximumKernelWidth / 2)));
+}
+
+/** Whole image grid cut: sheetness, mask, output, two t-links and six n-links of int
+ * capacities, and the solver's residual capacities and node state */
+constexpr double GridCutBytesPerVoxel = 4 + 1 + 1 + 2 * 4 + 6 * 4 + 6 * 4 + 8;
+
+/** Size and spacing of a 3D image, all PlanMemory needs to know about it */
+struct ImageGeometry
+{
+  std::uint64_t Size[3]    = {1, 1, 1};
+  double        Spacing[3] = {1.0, 1.0, 1.0};
+
+  std::uint64_t GetNumberOfVoxels() const
+  {
+    return Size[0] * Size[1] * Size[2];
+  }
+};
+
+/** Geometry of an image from its header alone */
+inline ImageGeometry ReadImageGeometry(const std::string & fileName)
+{
+  itk::ImageIOBase::Pointer io = itk::ImageIOFactory::CreateImageIO(fileName.c_str(), itk::ImageIOFactory::ReadMode);
+  if ( io.IsNull() )
+  {
+    itkGenericExceptionMacro(<< "Cannot find an ImageIO for " << fileName);
+  }
+  io->SetFileName(fileName);
+  io->ReadImageInformation();
+
+  ImageGeometry geometry;
+  for (unsigned int d = 0; d < io->GetNumberOfDimensions(); ++d)
+  {
+    /* Dimensions beyond the third are folded into it */
+    geometry.Size[std::min(d, 2u)] *= io->GetDimensions(d);
+    if ( d < 3 )
+    {
+      geometry.Spacing[d] = io->GetSpacing(d);
+    }
+  }
+  return geometry;
+}
+
+/** Voxel count of an image from its header alone */
+inline std::uint64_t ReadNumberOfVoxels(const std::string & fileName)
+{
+  return ReadImageGeometry(fileName).GetNumberOfVoxels();
+}
+
+/** Choose a plan for image, whose sheetness goes up to maxSigma. budget = 0 means unlimited.
+ *
+ * Stream divisions go up first since they only cost time, then Hessian precision
+ * drops to float. Pieces are slabs of the slowest axis, each read with the halo
+ * the Gaussian at maxSigma needs on both sides, so thin slabs stop paying off.
+ * Grid cuts are cropped when the whole image does not fit. The plan may still
+ * exceed the budget when every knob is spent, Print says so.
+ */
+inline MemoryPlan PlanMemory(const ImageGeometry & image, double maxSigma, std::uint64_t budget)
+{
+  MemoryPlan plan;
+  plan.Budget = budget;
+  plan.StreamHalo = HessianHaloRadius(maxSigma, image.Spacing[2]);
+
+  const double n = static_cast< double >(image.GetNumberOfVoxels());
+  const std::uint64_t slices = std::max< std::uint64_t >(image.Size[2], 1);
+  const double sliceVoxels = n / static_cast< double >(slices);
+  auto sheetnessPeak = [&](unsigned int divisions, bool singlePrecision)
+    {
+      const std::uint64_t slab = (slices + divisions - 1) / divisions;
+      const std::uint64_t pieceSlices = std::min< std::uint64_t >(slices, slab + 2 * plan.StreamHalo);
+      return static_cast< std::uint64_t >(n * SheetnessResidentBytesPerVoxel
+        + sliceVoxels * pieceSlices * SheetnessPieceBytesPerVoxel(singlePrecision));
+    };
+
+  plan.SkinMasksPeak = static_cast< std::uint64_t >(n * SkinMasksBytesPerVoxel);
+  plan.SheetnessPeak = sheetnessPeak(plan.StreamDivisions, plan.SinglePrecisionHessian);
+  plan.PeriostealPeak = static_cast< std::uint64_t >(n * GridCutBytesPerVoxel);
+  plan.EndostealPeak = plan.PeriostealPeak;
+  if ( budget == 0 )
+  {
+    return plan;
+  }
+
+  constexpr unsigned int MaximumStreamDivisions = 160;
+  while ( plan.SheetnessPeak > budget && !(plan.SinglePrecisionHessian && plan.StreamDivisions >= MaximumStreamDivisions) )
+  {
+    if ( plan.StreamDivisions < MaximumStreamDivisions )
+    {
+      plan.StreamDivisions *= 2;
+    }
+    else
+    {
+      plan.SinglePrecisionHessian = true;
+    }
+    plan.SheetnessPeak = sheetnessPeak(plan.StreamDivisions, plan.SinglePrecisionHessian);
+  }
+
+  /* Once the precision has to drop, fewer divisions may do with it */
+  if ( plan.SinglePrecisionHessian )
+  {
+    while ( plan.StreamDivisions > 10 && sheetnessPeak(plan.StreamDivisions / 2, true) <= budget )
+    {
+      plan.StreamDivisions /= 2;
+    }
+    plan.SheetnessPeak = sheetnessPeak(plan.StreamDivisions, true);
+  }
+
+  plan.CropPeriosteal = plan.PeriostealPeak > budget;
+  plan.CropEndosteal = plan.EndostealPeak > budget;
+  return plan;
+}
+
+inline void MemoryPlan::Print(std::ostream & os) const
+{
+  constexpr double MB = 1024.0 * 1024.0;
+  os << "  Memory plan:" << std::endl;
+  if ( Budget == 0 )
+  {
+    os << "    Budget:                unlimited" << std::endl;
+  }
+  else
+  {
+    os << "    Budget:                " << Budget / MB << " MB" << std::endl;
+  }
+  os << "    Stream divisions:      " << StreamDivisions << ", " << StreamHalo << " halo slices each side" << std::endl;
+  os << "    Hessian precision:     " << (SinglePrecisionHessian ? "float" : "double") << std::endl;
+  os << "    Crop periosteal:       " << (CropPeriosteal ? "yes, labels limited to their marks' box plus padding" : "no") << std::endl;
+  os << "    Crop endosteal:        " << (CropEndosteal ? "yes" : "no") << std::endl;
+  os << "    Skin masks peak:       " << SkinMasksPeak / MB << " MB" << std::endl;
+  os << "    Sheetness peak:        " << SheetnessPeak / MB << " MB" << std::endl;
+  os << "    Periosteal peak:       " << PeriostealPeak / MB << " MB" << (CropPeriosteal ? " before cropping" : "") << std::endl;
+  os << "    Endosteal peak:        " << EndostealPeak / MB << " MB" << (CropEndosteal ? " before cropping" : "") << std::endl;
+
+  const std::uint64_t uncropped = std::max(SkinMasksPeak, SheetnessPeak);
+  if ( Budget > 0 && uncropped > Budget )
+  {
+    os << "    Warning: exceeds the budget by " << (uncropped - Budget) / MB << " MB with every option used" << std::endl;
+  }
+}
+
+/** Parse a size such as 8G, 512M or 1.5T into bytes. Returns 0 on a malformed size. */
+inline std::uint64_t ParseMemorySize(const std::string & text)
+{
+  char * end = nullptr;
+  const double value = std::strtod(text.c_str(), &end);
+  if ( end == text.c_str() || value <= 0 )
+  {
+    return 0;
+  }
+
+  double scale = 1;
+  switch ( *end )
+  {
+  case 'T': case 't': scale *= 1024;
+  /* fall through */
+  case 'G': case 'g': scale *= 1024;
+  /* fall through */
+  case 'M': case 'm': scale *= 1024;
+  /* fall through */
+  case 'K': case 'k': scale *= 1024;
+    ++end;
+    break;
+  default:
+    break;
+  }
+  if ( *end == 'B' || *end == 'b' )
+  {
+    ++end;
+  }
+  return *end == '\0' ? static_cast< std::uint64_t >(value * scale) : 0;
+}
+
+/** Handle --max-memory <size> and remove it from argv, as ParseCommonOptions does.
+ * Returns 0 when the option is absent. Exits on a malformed size. */
+inline std::uint64_t ParseMemoryOption(int & argc, char * argv[])
+{
+  std::uint64_t budget = 0;
+
+  int kept = 1;
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string argument = argv[i];
+    if ( argument == "--max-memory" )
+    {
+      if ( i + 1 >= argc || (budget = ParseMemorySize(argv[i + 1])) == 0 )
+      {
+        std::cerr << argv[0] << ": --max-memory needs a size such as 8G or 512M" << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      ++i;
+      continue;
+    }
+    argv[kept++] = argv[i];
+  }
+  argc = kept;
+  argv[argc] = nullptr;
+
+  return budget;
+}
+
+} /* end namespace */
+
+#endif /* femurMemoryPlanner_h */
@@ -0,0 +1,86 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurNiftiHeader_h
+#define femurNiftiHeader_h
+
+#include <cstdint>
+#include <cstring>
+
+namespace femur {
+
+/** Bytes to read from the start of a file to cover a NIfTI-1 or NIfTI-2 header */
+constexpr std::size_t NiftiHeaderReadSize = 544;
+
+/** The few header fields needed to reach the voxel data of a single file NIfTI */
+struct NiftiHeaderInformation
+{
+  std::size_t VoxOffset;
+  double      Slope;
+  double      Intercept;
+
+  /** True if the NIfTI library would rescale the stored values */
+  bool IsScaled() const
+  {
+    return Slope != 0.0 && (Slope != 1.0 || Intercept != 0.0);
+  }
+};
+
+/** Parse a native byte order single file NIfTI-1 or NIfTI-2 header.
+ *
+ * Returns false for Analyze, .hdr/.img pairs, byte swapped and truncated
+ * headers, all of which are left to the NIfTI library.
+ */
+inline bool ParseNiftiHeader(const unsigned char * header, std::size_t size, NiftiHeaderInformation & info)
+{
+  if ( size < 348 )
+  {
+    return false;
+  }
+
+  std::int32_t sizeofHeader;
+  std::memcpy(&sizeofHeader, header, sizeof(sizeofHeader));
+
+  if ( sizeofHeader == 348 && std::memcmp(header + 344, "n+1", 4) == 0 )
+  {
+    float value;
+    std::memcpy(&value, header + 108, sizeof(value));
+    info.VoxOffset = static_cast< std::size_t >(value);
+    std::memcpy(&value, header + 112, sizeof(value));
+    info.Slope = value;
+    std::memcpy(&value, header + 116, sizeof(value));
+    info.Intercept = value;
+    return true;
+  }
+
+  if ( sizeofHeader == 540 && size >= 540 && std::memcmp(header + 4, "n+2", 4) == 0 )
+  {
+    std::int64_t offset;
+    std::memcpy(&offset, header + 168, sizeof(offset));
+    info.VoxOffset = static_cast< std::size_t >(offset);
+    std::memcpy(&info.Slope, header + 176, sizeof(info.Slope));
+    std::memcpy(&info.Intercept, header + 184, sizeof(info.Intercept));
+    return true;
+  }
+
+  return false;
+}
+
+} /* end namespace */
+
+#endif /* femurNiftiHeader_h */
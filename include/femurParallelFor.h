@@ -0,0 +1,77 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurParallelFor_h
+#define femurParallelFor_h
+
+#include "itkMacro.h"
+#include "itkMultiThreaderBase.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+
+namespace femur {
+
+/** Run func(i) for i in [0, n) on the ITK global threader */
+template< typename TFunction >
+void ParallelFor(std::size_t n, unsigned int threads, TFunction func)
+{
+  if ( n == 0 )
+  {
+    return;
+  }
+  if ( threads <= 1 || n == 1 )
+  {
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      func(i);
+    }
+    return;
+  }
+
+  /* Exceptions cannot cross the threader, so keep the first message and rethrow */
+  std::atomic< bool > failed(false);
+  std::string message;
+  itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+  threader->SetNumberOfWorkUnits(std::min< std::size_t >(threads, n));
+  threader->ParallelizeArray(0, n,
+    [&](itk::SizeValueType i)
+    {
+      try
+      {
+        func(i);
+      }
+      catch (const std::exception & e)
+      {
+        if ( !failed.exchange(true) )
+        {
+          message = e.what();
+        }
+      }
+    }, nullptr);
+
+  if ( failed )
+  {
+    itkGenericExceptionMacro(<< message);
+  }
+}
+
+} /* end namespace */
+
+#endif /* femurParallelFor_h */
@@ -0,0 +1,467 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurParallelGzip_h
+#define femurParallelGzip_h
+
+#include "femurParallelFor.h"
+#include "itkMacro.h"
+#include "itk_zlib.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+/** Block based gzip streams that can be compressed and decompressed in parallel
+ *
+ * The input is cut into blocks of BlockSize bytes and every block is deflated on
+ * its own into a complete gzip member, the same layout pigz --independent and
+ * bgzip use. Concatenated members are a valid gzip file, so gunzip, zlib and the
+ * NIfTI library read our output unchanged.
+ *
+ * Every member we write carries an extra field with subfield id 'F','Z' holding
+ * the compressed size of the member. With it the reader can find every member
+ * without inflating anything and then inflate all members at once. BGZF files
+ * ('B','C' subfield) are indexed the same way. Any other gzip stream is inflated
+ * serially.
+ */
+namespace femur {
+
+constexpr std::size_t ParallelGzipDefaultBlockSize = 1 << 20;
+
+namespace detail {
+
+constexpr unsigned int GzipMemberHeaderSize = 20;
+constexpr unsigned int GzipMemberTrailerSize = 8;
+
+inline void PutUInt32(unsigned char * p, std::uint32_t v)
+{
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+  p[3] = (v >> 24) & 0xff;
+}
+
+inline std::uint32_t GetUInt32(const unsigned char * p)
+{
+  return std::uint32_t(p[0]) | (std::uint32_t(p[1]) << 8) | (std::uint32_t(p[2]) << 16) | (std::uint32_t(p[3]) << 24);
+}
+
+inline std::uint16_t GetUInt16(const unsigned char * p)
+{
+  return std::uint16_t(p[0] | (p[1] << 8));
+}
+
+/** Deflate one block into a complete gzip member carrying its own size */
+inline void DeflateMember(const unsigned char * data, std::size_t size, int level, std::vector< unsigned char > & member)
+{
+  z_stream stream;
+  std::memset(&stream, 0, sizeof(stream));
+  if ( deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK )
+  {
+    itkGenericExceptionMacro(<< "deflateInit2 failed");
+  }
+
+  const uLong bound = deflateBound(&stream, static_cast< uLong >(size));
+  member.resize(GzipMemberHeaderSize + bound + GzipMemberTrailerSize);
+
+  stream.next_in = const_cast< Bytef * >(data);
+  stream.avail_in = static_cast< uInt >(size);
+  stream.next_out = member.data() + GzipMemberHeaderSize;
+  stream.avail_out = static_cast< uInt >(bound);
+  const int status = deflate(&stream, Z_FINISH);
+  const std::size_t compressed = stream.total_out;
+  deflateEnd(&stream);
+  if ( status != Z_STREAM_END )
+  {
+    itkGenericExceptionMacro(<< "deflate failed with status " << status);
+  }
+
+  const std::size_t total = GzipMemberHeaderSize + compressed + GzipMemberTrailerSize;
+  member.resize(total);
+
+  /* ID1 ID2 CM FLG(FEXTRA) MTIME(4) XFL OS(unknown) XLEN(2) SI1 SI2 LEN(2) SIZE(4) */
+  const unsigned char header[14] = { 0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 8, 0, 'F', 'Z' };
+  std::memcpy(member.data(), header, sizeof(header));
+  member[14] = 4;
+  member[15] = 0;
+  PutUInt32(member.data() + 16, static_cast< std::uint32_t >(total));
+
+  unsigned char * trailer = member.data() + GzipMemberHeaderSize + compressed;
+  PutUInt32(trailer, static_cast< std::uint32_t >(crc32(crc32(0L, Z_NULL, 0), data, static_cast< uInt >(size))));
+  PutUInt32(trailer + 4, static_cast< std::uint32_t >(size));
+}
+
+/** Inflate a raw deflate stream into exactly size bytes and check the crc */
+inline void InflateMember(const unsigned char * data, std::size_t compressedSize, unsigned char * output, std::size_t size, std::uint32_t crc)
+{
+  z_stream stream;
+  std::memset(&stream, 0, sizeof(stream));
+  if ( inflateInit2(&stream, -MAX_WBITS) != Z_OK )
+  {
+    itkGenericExceptionMacro(<< "inflateInit2 failed");
+  }
+
+  stream.next_in = const_cast< Bytef * >(data);
+  stream.avail_in = static_cast< uInt >(compressedSize);
+  stream.next_out = output;
+  stream.avail_out = static_cast< uInt >(size);
+  const int status = inflate(&stream, Z_FINISH);
+  const std::size_t produced = stream.total_out;
+  inflateEnd(&stream);
+
+  if ( status != Z_STREAM_END || produced != size )
+  {
+    itkGenericExceptionMacro(<< "Corrupt gzip member (status " << status << ")");
+  }
+  if ( crc32(crc32(0L, Z_NULL, 0), output, static_cast< uInt >(size)) != crc )
+  {
+    itkGenericExceptionMacro(<< "CRC mismatch in gzip member");
+  }
+}
+
+} /* end namespace detail */
+
+/** Compress header followed by data into a block gzip file.
+ *
+ * The header, e.g. a NIfTI header, goes into a member of its own, so neither
+ * buffer is copied to join them. headerSize may be 0.
+ */
+inline void ParallelGzipCompress(const void * header, std::size_t headerSize, const void * data, std::size_t size,
+                                 const std::string & fileName, int level, unsigned int threads,
+                                 std::size_t blockSize = ParallelGzipDefaultBlockSize)
+{
+  std::ofstream out(fileName, std::ios::binary);
+  if ( !out )
+  {
+    itkGenericExceptionMacro(<< "Cannot open " << fileName << " for writing");
+  }
+
+  std::vector< unsigned char > member;
+  if ( headerSize > 0 )
+  {
+    detail::DeflateMember(static_cast< const unsigned char * >(header), headerSize, level, member);
+    out.write(reinterpret_cast< const char * >(member.data()), member.size());
+  }
+
+  const unsigned char * bytes = static_cast< const unsigned char * >(data);
+  const std::size_t nBlocks = headerSize > 0 && size == 0 ? 0 : std::max< std::size_t >(1, (size + blockSize - 1) / blockSize);
+
+  /* Compress a few blocks per thread at a time so memory stays bounded */
+  const std::size_t batch = std::max< std::size_t >(1, 4 * threads);
+  std::vector< std::vector< unsigned char > > members(batch);
+  for (std::size_t first = 0; first < nBlocks; first += batch)
+  {
+    const std::size_t n = std::min(batch, nBlocks - first);
+    ParallelFor(n, threads,
+      [&](std::size_t i)
+      {
+        const std::size_t begin = (first + i) * blockSize;
+        const std::size_t length = std::min(blockSize, size - std::min(size, begin));
+        detail::DeflateMember(bytes + std::min(size, begin), length, level, members[i]);
+      });
+
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      out.write(reinterpret_cast< const char * >(members[i].data()), members[i].size());
+    }
+  }
+
+  out.close();
+  if ( !out )
+  {
+    itkGenericExceptionMacro(<< "Failed writing " << fileName);
+  }
+}
+
+/** Compress a buffer into a block gzip file */
+inline void ParallelGzipCompress(const void * data, std::size_t size, const std::string & fileName,
+                                 int level, unsigned int threads,
+                                 std::size_t blockSize = ParallelGzipDefaultBlockSize)
+{
+  ParallelGzipCompress(nullptr, 0, data, size, fileName, level, threads, blockSize);
+}
+
+/** \class ParallelGzipReader
+ * \brief Random access reads from a gzip file, in parallel when it is indexed
+ *
+ * The compressed file is held in memory. When every member carries its size
+ * (our 'F','Z' subfield or BGZF's 'B','C') the member table is built by hopping
+ * over the headers and Read( ) inflates every member it touches concurrently,
+ * straight into the destination where a member lies inside the requested range.
+ */
+class ParallelGzipReader
+{
+public:
+  struct Member
+  {
+    std::size_t   CompressedOffset;
+    std::size_t   DataOffset;
+    std::size_t   DataSize;
+    std::size_t   UncompressedOffset;
+    std::size_t   UncompressedSize;
+    std::uint32_t CRC;
+  };
+
+  ParallelGzipReader() {}
+
+  void Open(const std::string & fileName)
+  {
+    std::ifstream in(fileName, std::ios::binary | std::ios::ate);
+    if ( !in )
+    {
+      itkGenericExceptionMacro(<< "Cannot open " << fileName);
+    }
+    m_Data.resize(static_cast< std::size_t >(in.tellg()));
+    in.seekg(0);
+    in.read(reinterpret_cast< char * >(m_Data.data()), m_Data.size());
+    if ( !in )
+    {
+      itkGenericExceptionMacro(<< "Failed reading " << fileName);
+    }
+    m_FileName = fileName;
+    this->BuildIndex();
+  }
+
+  /** True if every member could be located without inflating */
+  bool IsIndexed() const
+  {
+    return !m_Members.empty();
+  }
+
+  /** Only meaningful when IsIndexed( ) */
+  std::size_t GetUncompressedSize() const
+  {
+    return m_Members.empty() ? 0 : m_Members.back().UncompressedOffset + m_Members.back().UncompressedSize;
+  }
+
+  const std::vector< Member > & GetMembers() const
+  {
+    return m_Members;
+  }
+
+  /** Copy [offset, offset + size) of the uncompressed stream into output,
+   * returning the number of bytes copied */
+  std::size_t Read(std::size_t offset, void * output, std::size_t size, unsigned int threads) const
+  {
+    if ( this->IsIndexed() )
+    {
+      return this->ReadIndexed(offset, static_cast< unsigned char * >(output), size, threads);
+    }
+    return this->ReadSerial(offset, static_cast< unsigned char * >(output), size);
+  }
+
+private:
+  /** Parse one member header, returning false if it does not carry its size */
+  bool ParseMember(std::size_t offset, Member & member) const
+  {
+    const unsigned char * p = m_Data.data() + offset;
+    const std::size_t available = m_Data.size() - offset;
+    if ( available < 12 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || !(p[3] & 4) )
+    {
+      return false;
+    }
+
+    std::size_t memberSize = 0;
+    const std::size_t xlen = detail::GetUInt16(p + 10);
+    std::size_t position = 12;
+    if ( available < position + xlen )
+    {
+      return false;
+    }
+    for (std::size_t sub = 12; sub + 4 <= 12 + xlen; )
+    {
+      const std::size_t length = detail::GetUInt16(p + sub + 2);
+      if ( sub + 4 + length > 12 + xlen )
+      {
+        /* A subfield running past the extra field, leave the file to serial inflate */
+        return false;
+      }
+      if ( p[sub] == 'F' && p[sub + 1] == 'Z' && length == 4 )
+      {
+        memberSize = detail::GetUInt32(p + sub + 4);
+      }
+      else if ( p[sub] == 'B' && p[sub + 1] == 'C' && length == 2 )
+      {
+        memberSize = std::size_t(detail::GetUInt16(p + sub + 4)) + 1;
+      }
+      sub += 4 + length;
+    }
+    position += xlen;
+
+    /* Skip FNAME, FCOMMENT and FHCRC if present */
+    for (unsigned char flag : { 8, 16 })
+    {
+      if ( p[3] & flag )
+      {
+        while ( position < available && p[position] != 0 )
+        {
+          ++position;
+        }
+        ++position;
+      }
+    }
+    if ( p[3] & 2 )
+    {
+      position += 2;
+    }
+
+    if ( memberSize == 0 || memberSize > available || position + detail::GzipMemberTrailerSize > memberSize )
+    {
+      return false;
+    }
+
+    member.CompressedOffset = offset;
+    member.DataOffset = offset + position;
+    member.DataSize = memberSize - position - detail::GzipMemberTrailerSize;
+    member.CRC = detail::GetUInt32(p + memberSize - 8);
+    member.UncompressedSize = detail::GetUInt32(p + memberSize - 4);
+    return true;
+  }
+
+  void BuildIndex()
+  {
+    m_Members.clear();
+    std::size_t offset = 0;
+    std::size_t uncompressed = 0;
+    while ( offset < m_Data.size() )
+    {
+      Member member;
+      if ( !this->ParseMember(offset, member) )
+      {
+        m_Members.clear();
+        return;
+      }
+      member.UncompressedOffset = uncompressed;
+      uncompressed += member.UncompressedSize;
+      offset += member.DataSize + (member.DataOffset - member.CompressedOffset) + detail::GzipMemberTrailerSize;
+      m_Members.push_back(member);
+    }
+  }
+
+  std::size_t ReadIndexed(std::size_t offset, unsigned char * output, std::size_t size, unsigned int threads) const
+  {
+    const std::size_t end = std::min(offset + size, this->GetUncompressedSize());
+    if ( offset >= end )
+    {
+      return 0;
+    }
+
+    /* Members overlapping [offset, end) */
+    auto first = std::upper_bound(m_Members.begin(), m_Members.end(), offset,
+      [](std::size_t value, const Member & m) { return value < m.UncompressedOffset; }) - 1;
+    auto last = std::lower_bound(m_Members.begin(), m_Members.end(), end,
+      [](const Member & m, std::size_t value) { return m.UncompressedOffset < value; });
+
+    ParallelFor(last - first, threads,
+      [&](std::size_t i)
+      {
+        const Member & m = *(first + i);
+        const std::size_t begin = std::max(offset, m.UncompressedOffset);
+        const std::size_t stop = std::min(end, m.UncompressedOffset + m.UncompressedSize);
+        if ( begin == m.UncompressedOffset && stop == m.UncompressedOffset + m.UncompressedSize )
+        {
+          detail::InflateMember(m_Data.data() + m.DataOffset, m.DataSize, output + (begin - offset), m.UncompressedSize, m.CRC);
+        }
+        else
+        {
+          std::vector< unsigned char > buffer(m.UncompressedSize);
+          detail::InflateMember(m_Data.data() + m.DataOffset, m.DataSize, buffer.data(), m.UncompressedSize, m.CRC);
+          std::memcpy(output + (begin - offset), buffer.data() + (begin - m.UncompressedOffset), stop - begin);
+        }
+      });
+
+    return end - offset;
+  }
+
+  std::size_t ReadSerial(std::size_t offset, unsigned char * output, std::size_t size) const
+  {
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    if ( inflateInit2(&stream, MAX_WBITS + 16) != Z_OK )
+    {
+      itkGenericExceptionMacro(<< "inflateInit2 failed");
+    }
+
+    /* zlib counts input in uInt, so files over 4 GB are fed in pieces */
+    const std::size_t maximumInput = std::numeric_limits< uInt >::max();
+    std::size_t fed = 0;
+
+    std::vector< unsigned char > chunk(ParallelGzipDefaultBlockSize);
+    std::size_t position = 0;
+    std::size_t copied = 0;
+    while ( copied < size )
+    {
+      if ( stream.avail_in == 0 && fed < m_Data.size() )
+      {
+        const std::size_t length = std::min(maximumInput, m_Data.size() - fed);
+        stream.next_in = const_cast< Bytef * >(m_Data.data() + fed);
+        stream.avail_in = static_cast< uInt >(length);
+        fed += length;
+      }
+
+      stream.next_out = chunk.data();
+      stream.avail_out = static_cast< uInt >(chunk.size());
+      const int status = inflate(&stream, Z_NO_FLUSH);
+      if ( status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR )
+      {
+        inflateEnd(&stream);
+        itkGenericExceptionMacro(<< "Corrupt gzip stream in " << m_FileName);
+      }
+
+      const std::size_t produced = chunk.size() - stream.avail_out;
+      const std::size_t begin = std::max(offset, position);
+      const std::size_t stop = std::min(offset + size, position + produced);
+      if ( begin < stop )
+      {
+        std::memcpy(output + (begin - offset), chunk.data() + (begin - position), stop - begin);
+        copied += stop - begin;
+      }
+      position += produced;
+
+      const bool inputLeft = stream.avail_in > 0 || fed < m_Data.size();
+      if ( status == Z_STREAM_END )
+      {
+        /* Concatenated members continue the stream */
+        if ( !inputLeft )
+        {
+          break;
+        }
+        inflateReset(&stream);
+      }
+      else if ( produced == 0 && !inputLeft )
+      {
+        break;
+      }
+    }
+    inflateEnd(&stream);
+    return copied;
+  }
+
+  std::string                  m_FileName;
+  std::vector< unsigned char > m_Data;
+  std::vector< Member >        m_Members;
+}; // end class
+
+} /* end namespace */
+
+#endif /* femurParallelGzip_h */
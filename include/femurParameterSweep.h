@@ -0,0 +1,248 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurParameterSweep_h
+#define femurParameterSweep_h
+
+#include "femurConfiguration.h"
+#include "femurPipeline.h"
+#include "femurThreadPool.h"
+
+#include "itkImageRegionConstIterator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace femur {
+/**
+ * Calibration sweep over the trace weight of the sheetness stage and the lambda and
+ * sigma of the periosteal stage. Inputs are loaded once by the caller. The skin masks
+ * and the Hessian eigenvalue images do not depend on any swept value and are computed
+ * once, the sheetness once per weight. Only the periosteal graph cuts run per grid point,
+ * several at a time.
+ */
+
+/** Grid of a sweep. Every combination of the three lists is run. */
+struct SweepParameters
+{
+  std::vector< double > Weights;
+  std::vector< double > Lambdas;
+  std::vector< double > Sigmas;
+  unsigned int          Jobs = 1;
+
+  /** Lists default to the single value of the stage parameters */
+  void Read(const Configuration & config, const SheetnessParameters & sheetness, const PeriostealParameters & periosteal)
+  {
+    Weights = config.GetArray< double >("sweep.trace_weight", {sheetness.Weight});
+    Lambdas = config.GetArray< double >("sweep.lambda", {periosteal.Lambda});
+    Sigmas  = config.GetArray< double >("sweep.sigma", {periosteal.Sigma});
+    Jobs    = static_cast< unsigned int >(std::max(1, config.GetInt("sweep.jobs", static_cast< int >(Jobs))));
+  }
+
+  void Print(std::ostream & os) const
+  {
+    os << "  Sweep:" << std::endl;
+    os << "    Weights:               ";
+    for (auto v : Weights) { os << v << " "; }
+    os << std::endl;
+    os << "    Lambdas:               ";
+    for (auto v : Lambdas) { os << v << " "; }
+    os << std::endl;
+    os << "    Sigmas:                ";
+    for (auto v : Sigmas) { os << v << " "; }
+    os << std::endl;
+    os << "    Jobs:                  " << Jobs << std::endl;
+  }
+};
+
+/** One row of the results table */
+struct SweepResult
+{
+  double              Weight  = 0.0;
+  double              Lambda  = 0.0;
+  double              Sigma   = 0.0;
+  itk::SizeValueType  Voxels  = 0;
+  double              Dice    = -1.0;  /* -1 without a reference */
+  double              Seconds = 0.0;
+};
+
+/** Why two images do not share one voxel grid (region, spacing, origin and
+ * direction, to ITK's default tolerance of 1e-6 voxels), or empty if they do */
+inline std::string
+DescribeGridMismatch(const itk::ImageBase< ImageDimension > * a, const itk::ImageBase< ImageDimension > * b)
+{
+  constexpr double Tolerance = 1e-6;
+  std::ostringstream why;
+  if ( a->GetLargestPossibleRegion() != b->GetLargestPossibleRegion() )
+  {
+    why << "region " << a->GetLargestPossibleRegion().GetSize() << " at " << a->GetLargestPossibleRegion().GetIndex()
+        << " vs " << b->GetLargestPossibleRegion().GetSize() << " at " << b->GetLargestPossibleRegion().GetIndex();
+    return why.str();
+  }
+  for (unsigned int d = 0; d < ImageDimension; ++d)
+  {
+    const double spacing = a->GetSpacing()[d];
+    if ( std::abs(spacing - b->GetSpacing()[d]) > Tolerance * spacing )
+    {
+      why << "spacing " << a->GetSpacing() << " vs " << b->GetSpacing();
+      return why.str();
+    }
+    if ( std::abs(a->GetOrigin()[d] - b->GetOrigin()[d]) > Tolerance * spacing )
+    {
+      why << "origin " << a->GetOrigin() << " vs " << b->GetOrigin();
+      return why.str();
+    }
+    for (unsigned int e = 0; e < ImageDimension; ++e)
+    {
+      if ( std::abs(a->GetDirection()[d][e] - b->GetDirection()[d][e]) > Tolerance )
+      {
+        why << "direction " << a->GetDirection() << " vs " << b->GetDirection();
+        return why.str();
+      }
+    }
+  }
+  return why.str();
+}
+
+/** Dice coefficient of the nonzero voxels of two label images on the same grid */
+inline double
+ComputeDice(const LabelImageType * a, const LabelImageType * b)
+{
+  if ( a->GetBufferedRegion() != b->GetBufferedRegion() )
+  {
+    itkGenericExceptionMacro(<< "Dice of images with different regions, " << a->GetBufferedRegion().GetSize()
+                             << " vs " << b->GetBufferedRegion().GetSize());
+  }
+  itk::SizeValueType sizeA = 0, sizeB = 0, overlap = 0;
+  itk::ImageRegionConstIterator< LabelImageType > at(a, a->GetBufferedRegion());
+  itk::ImageRegionConstIterator< LabelImageType > bt(b, a->GetBufferedRegion());
+  for ( at.GoToBegin(), bt.GoToBegin(); !at.IsAtEnd(); ++at, ++bt )
+  {
+    const bool inA = at.Get() != 0;
+    const bool inB = bt.Get() != 0;
+    sizeA += inA;
+    sizeB += inB;
+    overlap += inA && inB;
+  }
+  return sizeA + sizeB == 0 ? 1.0 : 2.0 * overlap / static_cast< double >(sizeA + sizeB);
+}
+
+/** Run every grid point and return the results in grid order, weights outermost.
+ *
+ * reference may be null. onResult(result, segmentation) is called once per grid point,
+ * one call at a time, so it can write the segmentation and drop it.
+ */
+template< typename TCallback >
+std::vector< SweepResult >
+RunSweep(const HUImageType * image, const LabelImageType * marks, const LabelImageType * reference,
+         SheetnessParameters sheetnessParameters, PeriostealParameters periostealParameters,
+         const SweepParameters & sweepParameters, TCallback onResult)
+{
+  using Clock = std::chrono::steady_clock;
+
+  std::cout << "Computing skin masks" << std::endl;
+  const SkinMasks masks = ComputeSkinMasks(image, sheetnessParameters);
+
+  std::cout << "Computing eigenvalue images" << std::endl;
+  const std::vector< EigenValueImageType::Pointer > eigenImages = ComputeEigenImages(image, sheetnessParameters);
+
+  const std::size_t pointsPerWeight = sweepParameters.Lambdas.size() * sweepParameters.Sigmas.size();
+  std::vector< SweepResult > results(sweepParameters.Weights.size() * pointsPerWeight);
+  std::mutex callbackMutex;
+
+  for (std::size_t w = 0; w < sweepParameters.Weights.size(); ++w)
+  {
+    sheetnessParameters.Weight = sweepParameters.Weights[w];
+    std::cout << "Computing sheetness for weight " << sheetnessParameters.Weight << std::endl;
+    const SheetnessImageType::Pointer sheetness = ComputeSheetnessFromEigenImages(eigenImages, masks, sheetnessParameters);
+
+    /* Graph cuts of this weight, Jobs at a time. Exceptions cannot leave a worker, so keep the first message. */
+    std::atomic< std::size_t > next(0);
+    std::atomic< bool > failed(false);
+    std::string message;
+    auto worker = [&]()
+    {
+      for (std::size_t j = next++; j < pointsPerWeight && !failed; j = next++)
+      {
+        try
+        {
+          SweepResult & result = results[w * pointsPerWeight + j];
+          result.Weight = sheetnessParameters.Weight;
+          result.Lambda = sweepParameters.Lambdas[j / sweepParameters.Sigmas.size()];
+          result.Sigma = sweepParameters.Sigmas[j % sweepParameters.Sigmas.size()];
+
+          PeriostealParameters parameters = periostealParameters;
+          parameters.Lambda = result.Lambda;
+          parameters.Sigma = result.Sigma;
+
+          /* Each job gets its own image objects over the shared buffers, as filters set their requested regions */
+          SheetnessImageType::Pointer localSheetness = SheetnessImageType::New();
+          localSheetness->Graft(sheetness);
+          LabelImageType::Pointer localMarks = LabelImageType::New();
+          localMarks->Graft(marks);
+
+          const Clock::time_point start = Clock::now();
+          LabelImageType::Pointer segmentation = SegmentPeriosteal(localSheetness, localMarks, parameters);
+          result.Seconds = std::chrono::duration< double >(Clock::now() - start).count();
+
+          itk::ImageRegionConstIterator< LabelImageType > it(segmentation, segmentation->GetBufferedRegion());
+          for ( it.GoToBegin(); !it.IsAtEnd(); ++it )
+          {
+            result.Voxels += it.Get() != 0;
+          }
+          if ( reference != nullptr )
+          {
+            result.Dice = ComputeDice(segmentation, reference);
+          }
+
+          std::lock_guard< std::mutex > lock(callbackMutex);
+          onResult(result, segmentation.GetPointer());
+        }
+        catch (const std::exception & e)
+        {
+          std::lock_guard< std::mutex > lock(callbackMutex);
+          if ( !failed.exchange(true) )
+          {
+            message = e.what();
+          }
+        }
+      }
+    };
+
+    /* Jobs share the thread pool with the filters they run */
+    const std::size_t numberOfJobs = std::min< std::size_t >(sweepParameters.Jobs, pointsPerWeight);
+    RunConcurrently(numberOfJobs, [&](std::size_t) { worker(); });
+
+    if ( failed )
+    {
+      itkGenericExceptionMacro(<< message);
+    }
+  }
+
+  return results;
+}
+
+} /* end namespace */
+
+#endif /* femurParameterSweep_h */
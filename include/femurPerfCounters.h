@@ -0,0 +1,339 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurPerfCounters_h
+#define femurPerfCounters_h
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#define FEMUR_HAVE_PERF_EVENTS 1
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace femur {
+/** \class PerfCounters
+ * \brief Hardware counters per traced stage, read through perf_event_open on Linux
+ *
+ * Start( ) opens cycles, instructions and last level cache miss counters for the whole
+ * process. They are inherited by every thread created afterwards, so call it before the
+ * thread pool starts. From then on each FEMUR_TRACE_SCOPE on the starting thread reads
+ * the counters when it opens and closes, which covers the GenerateData of every filter
+ * and the stages of the pipeline, including the pool threads working for them. Scopes
+ * on other threads are not counted, their work shows in the enclosing stage.
+ *
+ * Counts are inclusive of nested scopes. Low instructions per cycle together with many
+ * cache misses per thousand instructions marks a memory bound stage. Memory bandwidth
+ * is estimated as one cache line per miss, uncore counters need privileges we rarely have.
+ *
+ * Counters that cannot be opened, as in most containers, are reported once and left
+ * out: the stages still get their calls and seconds, and the report has null for the
+ * missing counts. Until Start( ) is called scopes cost one relaxed atomic load.
+ */
+class PerfCounters
+{
+public:
+  enum Counter { Cycles = 0, Instructions, CacheMisses, NumberOfCounters };
+
+  /** Counter values at one point in time */
+  struct Sample
+  {
+    std::int64_t   Time = 0;
+    std::uint64_t  Values[NumberOfCounters] = {};
+  };
+
+  static PerfCounters & Instance()
+  {
+    static PerfCounters counters;
+    return counters;
+  }
+
+  /** Open the counters and write a report to fileName at Stop( ), whether or not any
+   * counter opened. Returns false if none could be opened. */
+  bool Start(const std::string & fileName)
+  {
+    std::lock_guard< std::mutex > lock(m_Mutex);
+    m_FileName = fileName;
+    m_Thread = std::this_thread::get_id();
+    m_Origin = Clock::now();
+
+    bool any = false;
+    for (int counter = 0; counter < NumberOfCounters; ++counter)
+    {
+      m_Files[counter] = this->Open(static_cast< Counter >(counter));
+      any = any || m_Files[counter] >= 0;
+    }
+    m_Enabled.store(true, std::memory_order_relaxed);
+    return any;
+  }
+
+  /** Close the counters, print the summary and write the report. Does nothing if not started. */
+  void Stop()
+  {
+    if ( !m_Enabled.exchange(false) )
+    {
+      return;
+    }
+
+    std::lock_guard< std::mutex > lock(m_Mutex);
+    this->PrintSummary(std::cout);
+    this->WriteReport();
+    for (int & file : m_Files)
+    {
+#ifdef FEMUR_HAVE_PERF_EVENTS
+      if ( file >= 0 )
+      {
+        close(file);
+      }
+#endif
+      file = -1;
+    }
+  }
+
+  /** True if scopes on the calling thread should take samples */
+  bool IsCounting() const
+  {
+    return m_Enabled.load(std::memory_order_relaxed) && std::this_thread::get_id() == m_Thread;
+  }
+
+  /** Current counter values, scaled up where the kernel had to multiplex them */
+  Sample Read() const
+  {
+    Sample sample;
+    sample.Time = std::chrono::duration_cast< std::chrono::microseconds >(Clock::now() - m_Origin).count();
+#ifdef FEMUR_HAVE_PERF_EVENTS
+    for (int counter = 0; counter < NumberOfCounters; ++counter)
+    {
+      /* value, time enabled, time running */
+      std::uint64_t values[3] = {};
+      if ( m_Files[counter] < 0 || read(m_Files[counter], values, sizeof(values)) != sizeof(values) )
+      {
+        continue;
+      }
+      sample.Values[counter] = values[2] > 0 && values[2] < values[1]
+        ? static_cast< std::uint64_t >(static_cast< double >(values[0]) * values[1] / values[2])
+        : values[0];
+    }
+#endif
+    return sample;
+  }
+
+  /** Add the counts between begin and now to the stage category::name */
+  void Record(const char * category, const char * name, const Sample & begin)
+  {
+    const Sample end = this->Read();
+
+    std::string key = *category != '\0' ? std::string(category) + "::" + name : std::string(name);
+    std::lock_guard< std::mutex > lock(m_Mutex);
+    auto found = m_Index.find(key);
+    if ( found == m_Index.end() )
+    {
+      found = m_Index.emplace(key, m_Stages.size()).first;
+      m_Stages.emplace_back();
+      m_Stages.back().Name = key;
+    }
+
+    Stage & stage = m_Stages[found->second];
+    ++stage.Calls;
+    stage.Microseconds += end.Time - begin.Time;
+    for (int counter = 0; counter < NumberOfCounters; ++counter)
+    {
+      /* Multiplexing scales each read separately, never let that make a count negative */
+      if ( end.Values[counter] > begin.Values[counter] )
+      {
+        stage.Values[counter] += end.Values[counter] - begin.Values[counter];
+      }
+    }
+  }
+
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters & operator=(const PerfCounters &) = delete;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr double CacheLineBytes = 64.0;
+
+  struct Stage
+  {
+    std::string    Name;
+    std::uint64_t  Calls = 0;
+    std::int64_t   Microseconds = 0;
+    std::uint64_t  Values[NumberOfCounters] = {};
+  };
+
+  PerfCounters() : m_Enabled(false), m_Origin(Clock::now())
+  {
+    for (int & file : m_Files)
+    {
+      file = -1;
+    }
+  }
+  ~PerfCounters()
+  {
+    this->Stop();
+  }
+
+  static const char * CounterName(int counter)
+  {
+    static const char * names[NumberOfCounters] = { "cycles", "instructions", "llc_misses" };
+    return names[counter];
+  }
+
+  /** File descriptor of a process wide counter, or -1 */
+  int Open(Counter counter) const
+  {
+#ifdef FEMUR_HAVE_PERF_EVENTS
+    static const std::uint64_t configs[NumberOfCounters] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES };
+
+    perf_event_attr attribute;
+    std::memset(&attribute, 0, sizeof(attribute));
+    attribute.type = PERF_TYPE_HARDWARE;
+    attribute.size = sizeof(attribute);
+    attribute.config = configs[counter];
+    attribute.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attribute.inherit = 1;
+    /* User space only, which perf_event_paranoid up to 2 allows without privileges */
+    attribute.exclude_kernel = 1;
+    attribute.exclude_hv = 1;
+
+    const long file = syscall(__NR_perf_event_open, &attribute, 0, -1, -1, 0);
+    if ( file < 0 )
+    {
+      std::cerr << "Hardware counter " << CounterName(counter) << " is not available: "
+                << std::strerror(errno) << std::endl;
+      return -1;
+    }
+    return static_cast< int >(file);
+#else
+    std::cerr << "Hardware counter " << CounterName(counter) << " needs Linux perf events" << std::endl;
+    return -1;
+#endif
+  }
+
+  bool IsOpen(int counter) const
+  {
+    return m_Files[counter] >= 0;
+  }
+
+  void PrintSummary(std::ostream & os) const
+  {
+    os << "Hardware counters per stage (inclusive of nested stages):" << std::endl;
+    os << std::left << std::setw(56) << "  stage" << std::right
+       << std::setw(7) << "calls" << std::setw(10) << "seconds" << std::setw(9) << "Gcycles"
+       << std::setw(7) << "IPC" << std::setw(10) << "LLC MPKI" << std::setw(10) << "est. MB/s" << std::endl;
+    for (const Stage & stage : m_Stages)
+    {
+      const double seconds = stage.Microseconds * 1e-6;
+      os << "  " << std::left << std::setw(54) << stage.Name << std::right << std::fixed
+         << std::setw(7) << stage.Calls << std::setw(10) << std::setprecision(3) << seconds;
+      this->PrintValue(os, 9, 2, this->IsOpen(Cycles), stage.Values[Cycles] * 1e-9);
+      this->PrintValue(os, 7, 2, this->IsOpen(Cycles) && this->IsOpen(Instructions) && stage.Values[Cycles] > 0,
+                       static_cast< double >(stage.Values[Instructions]) / stage.Values[Cycles]);
+      this->PrintValue(os, 10, 2, this->IsOpen(Instructions) && this->IsOpen(CacheMisses) && stage.Values[Instructions] > 0,
+                       1000.0 * stage.Values[CacheMisses] / stage.Values[Instructions]);
+      this->PrintValue(os, 10, 0, this->IsOpen(CacheMisses) && seconds > 0.0,
+                       stage.Values[CacheMisses] * CacheLineBytes / 1048576.0 / seconds);
+      os << std::defaultfloat << std::endl;
+    }
+  }
+
+  static void PrintValue(std::ostream & os, int width, int precision, bool available, double value)
+  {
+    if ( available )
+    {
+      os << std::setw(width) << std::setprecision(precision) << value;
+    }
+    else
+    {
+      os << std::setw(width) << "-";
+    }
+  }
+
+  /** Unavailable counters are written as null */
+  void WriteReport() const
+  {
+    std::ofstream file(m_FileName);
+    file << "{\"counters\":[";
+    for (int counter = 0; counter < NumberOfCounters; ++counter)
+    {
+      file << (counter > 0 ? "," : "") << "\"" << CounterName(counter) << "\"";
+    }
+    file << "],\"stages\":[";
+    bool first = true;
+    for (const Stage & stage : m_Stages)
+    {
+      file << (first ? "\n" : ",\n");
+      first = false;
+      file << "{\"name\":\"" << stage.Name << "\",\"calls\":" << stage.Calls
+           << ",\"seconds\":" << stage.Microseconds * 1e-6;
+      for (int counter = 0; counter < NumberOfCounters; ++counter)
+      {
+        file << ",\"" << CounterName(counter) << "\":";
+        if ( this->IsOpen(counter) )
+        {
+          file << stage.Values[counter];
+        }
+        else
+        {
+          file << "null";
+        }
+      }
+      const double seconds = stage.Microseconds * 1e-6;
+      file << ",\"estimated_bandwidth_mb_s\":";
+      if ( this->IsOpen(CacheMisses) && seconds > 0.0 )
+      {
+        file << stage.Values[CacheMisses] * CacheLineBytes / 1048576.0 / seconds;
+      }
+      else
+      {
+        file << "null";
+      }
+      file << "}";
+    }
+    file << "\n]}\n";
+  }
+
+  std::atomic< bool >                         m_Enabled;
+  Clock::time_point                           m_Origin;
+  std::thread::id                             m_Thread;
+  int                                         m_Files[NumberOfCounters];
+  std::string                                 m_FileName;
+  mutable std::mutex                          m_Mutex;
+  std::vector< Stage >                        m_Stages;
+  std::map< std::string, std::size_t >        m_Index;
+};
+
+} /* end namespace */
+
+#endif /* femurPerfCounters_h */
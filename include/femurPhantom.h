@@ -0,0 +1,244 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurPhantom_h
+#define femurPhantom_h
+
+#include "femurPipeline.h"
+
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkMath.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace femur {
+/**
+ * A synthetic proximal femur for reproducible performance runs.
+ *
+ * The bone is the union of a shaft (a capped cylinder along z) and a head (a sphere
+ * set off medially), lying in a cylinder of soft tissue surrounded by air. A second,
+ * smaller bone stands in for the pelvis. Voxels less than CorticalThickness below the
+ * bone surface are cortical, deeper ones trabecular. Trabecular bone gets a plate like
+ * texture and the whole volume Gaussian noise.
+ */
+struct PhantomParameters
+{
+  itk::SizeValueType  Size[ImageDimension]  = {128, 128, 192};
+  double              Spacing               = 0.5;    /* mm, isotropic */
+  double              NoiseSD               = 40.0;   /* HU */
+  unsigned int        Seed                  = 1;
+
+  double              CorticalThickness     = 2.0;    /* mm */
+  double              AirHU                 = -1000.0;
+  double              SoftTissueHU          = 40.0;
+  double              CorticalHU            = 1400.0;
+  double              TrabecularHU          = 250.0;
+  double              TrabecularContrast    = 150.0;
+};
+
+/** Gaussian noise that is the same with every standard library.
+ *
+ * mt19937's output is fixed by the standard but std::normal_distribution's
+ * transform is not, so the phantom, and the Dice a baseline stores for it, would
+ * change with the toolchain. This is the Box-Muller transform of mt19937's output.
+ */
+class PhantomNoise
+{
+public:
+  PhantomNoise(unsigned int seed, double sd) : m_Generator(seed), m_SD(sd) {}
+
+  double operator()()
+  {
+    if ( m_HasSpare )
+    {
+      m_HasSpare = false;
+      return m_Spare;
+    }
+    /* Uniform in (0, 1), never 0 so the logarithm stays finite */
+    const double u1 = (static_cast< double >(m_Generator()) + 0.5) / 4294967296.0;
+    const double u2 = (static_cast< double >(m_Generator()) + 0.5) / 4294967296.0;
+    const double radius = m_SD * std::sqrt(-2.0 * std::log(u1));
+    const double angle = 2.0 * itk::Math::pi * u2;
+    m_Spare = radius * std::sin(angle);
+    m_HasSpare = true;
+    return radius * std::cos(angle);
+  }
+
+private:
+  std::mt19937  m_Generator;
+  double        m_SD;
+  double        m_Spare = 0.0;
+  bool          m_HasSpare = false;
+};
+
+/** Labels of the ground truth image */
+constexpr LabelPixelType PhantomCorticalLabel   = 1;
+constexpr LabelPixelType PhantomCancellousLabel = 2;
+
+/** Labels of the mark image, as PeriostealSegmentation expects them */
+constexpr LabelPixelType PhantomFemurMark       = 1;
+constexpr LabelPixelType PhantomOtherBoneMark   = 2;
+
+struct Phantom
+{
+  HUImageType::Pointer     Image;
+  LabelImageType::Pointer  Marks;
+  LabelImageType::Pointer  Truth;
+};
+
+/** Depth below the surface of the union of shapes, in mm. Negative outside. */
+struct PhantomGeometry
+{
+  double Extent[ImageDimension];
+
+  explicit PhantomGeometry(const PhantomParameters & parameters)
+  {
+    for (unsigned int d = 0; d < ImageDimension; ++d)
+    {
+      Extent[d] = parameters.Size[d] * parameters.Spacing;
+    }
+  }
+
+  double MinExtent() const
+  {
+    return std::min(Extent[0], Extent[1]);
+  }
+
+  /** Radius of the soft tissue cylinder */
+  double BodyDepth(const double x[ImageDimension]) const
+  {
+    return 0.47 * MinExtent() - std::hypot(x[0] - 0.5 * Extent[0], x[1] - 0.5 * Extent[1]);
+  }
+
+  double FemurDepth(const double x[ImageDimension]) const
+  {
+    /* Shaft, capped below the head and above the bottom face */
+    const double shaftRadius = 0.12 * MinExtent();
+    const double sx = 0.55 * Extent[0];
+    const double sy = 0.5 * Extent[1];
+    const double shaft = std::min({shaftRadius - std::hypot(x[0] - sx, x[1] - sy),
+                                   x[2] - 0.1 * Extent[2], 0.75 * Extent[2] - x[2]});
+
+    /* Head, overlapping the top of the shaft */
+    const double headRadius = 0.17 * MinExtent();
+    const double head = headRadius - std::sqrt(std::pow(x[0] - (sx - 0.12 * MinExtent()), 2)
+                                               + std::pow(x[1] - sy, 2)
+                                               + std::pow(x[2] - 0.75 * Extent[2], 2));
+    return std::max(shaft, head);
+  }
+
+  double OtherBoneDepth(const double x[ImageDimension]) const
+  {
+    const double radius = 0.1 * MinExtent();
+    return radius - std::sqrt(std::pow(x[0] - 0.16 * Extent[0], 2)
+                              + std::pow(x[1] - 0.5 * Extent[1], 2)
+                              + std::pow(x[2] - 0.85 * Extent[2], 2));
+  }
+};
+
+/** Build the CT like image, its marks and the ground truth segmentation */
+inline Phantom MakePhantom(const PhantomParameters & parameters)
+{
+  FEMUR_TRACE_SCOPE("femur", "MakePhantom");
+
+  HUImageType::RegionType region;
+  HUImageType::SpacingType spacing;
+  for (unsigned int d = 0; d < ImageDimension; ++d)
+  {
+    region.SetSize(d, parameters.Size[d]);
+    spacing[d] = parameters.Spacing;
+  }
+
+  Phantom phantom;
+  phantom.Image = HUImageType::New();
+  phantom.Marks = LabelImageType::New();
+  phantom.Truth = LabelImageType::New();
+  phantom.Image->SetRegions(region);
+  phantom.Marks->SetRegions(region);
+  phantom.Truth->SetRegions(region);
+  phantom.Image->SetSpacing(spacing);
+  phantom.Marks->SetSpacing(spacing);
+  phantom.Truth->SetSpacing(spacing);
+  phantom.Image->Allocate();
+  phantom.Marks->Allocate();
+  phantom.Truth->Allocate();
+
+  const PhantomGeometry geometry(parameters);
+  const double thickness = parameters.CorticalThickness;
+  const double period = 4.0 * thickness;
+  const double limit = static_cast< double >(itk::NumericTraits< HUPixelType >::max());
+
+  PhantomNoise noise(parameters.Seed, parameters.NoiseSD);
+
+  itk::ImageRegionIteratorWithIndex< HUImageType > it(phantom.Image, region);
+  itk::ImageRegionIterator< LabelImageType > mt(phantom.Marks, region);
+  itk::ImageRegionIterator< LabelImageType > tt(phantom.Truth, region);
+  for (; !it.IsAtEnd(); ++it, ++mt, ++tt)
+  {
+    const HUImageType::IndexType index = it.GetIndex();
+    double x[ImageDimension];
+    for (unsigned int d = 0; d < ImageDimension; ++d)
+    {
+      x[d] = (index[d] + 0.5) * parameters.Spacing;
+    }
+
+    const double body = geometry.BodyDepth(x);
+    const double femur = geometry.FemurDepth(x);
+    const double other = geometry.OtherBoneDepth(x);
+    const double bone = std::max(femur, other);
+
+    double value = body < 0.0 ? parameters.AirHU : parameters.SoftTissueHU;
+    LabelPixelType truth = 0;
+    if ( bone >= 0.0 && bone < thickness )
+    {
+      value = parameters.CorticalHU;
+      truth = femur >= 0.0 ? PhantomCorticalLabel : 0;
+    }
+    else if ( bone >= thickness )
+    {
+      const double plates = std::sin(2.0 * itk::Math::pi * x[0] / period) * std::sin(2.0 * itk::Math::pi * x[2] / period);
+      value = parameters.TrabecularHU + parameters.TrabecularContrast * plates;
+      truth = femur >= 0.0 ? PhantomCancellousLabel : 0;
+    }
+    value = std::max(-limit, std::min(limit, value + noise()));
+    it.Set(static_cast< HUPixelType >(value));
+    tt.Set(truth);
+
+    /* Marks sit well inside each bone, on every fourth slice, as drawn by hand */
+    LabelPixelType mark = 0;
+    if ( index[2] % 4 == 0 )
+    {
+      if ( femur >= 2.0 * thickness )
+      {
+        mark = PhantomFemurMark;
+      }
+      else if ( other >= 2.0 * thickness )
+      {
+        mark = PhantomOtherBoneMark;
+      }
+    }
+    mt.Set(mark);
+  }
+
+  return phantom;
+}
+} /* end namespace */
+
+#endif /* femurPhantom_h */
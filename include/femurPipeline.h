@@ -0,0 +1,528 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurPipeline_h
+#define femurPipeline_h
+
+#include "femurConfiguration.h"
+#include "femurConnectedComponents.h"
+#include "femurCrop.h"
+#include "femurDistanceErosion.h"
+#include "femurMemoryPlanner.h"
+#include "femurTrace.h"
+
+#include "itkImage.h"
+#include "itkImageRegionIterator.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkMultiScaleHessianEnhancementImageFilter.h"
+#include "itkMaximumAbsoluteValueImageFilter.h"
+#include "itkCalgaryEigenToMeasureImageFilter.h"
+#include "itkCalgaryEigenToMeasureParameterEstimationFilter.h"
+#include "itkPeriostealSegmentationImageFilter.h"
+#include "itkBatchedPeriostealSegmentationImageFilter.h"
+#include "itkEndostealSegmentationImageFilter.h"
+#include "itkBinaryThresholdImageFilter.h"
+#include "itkImageMaskSpatialObject.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+namespace femur {
+/**
+ * Stages of the segmentation pipeline, as run by Sheetness2, PeriostealSegmentation
+ * and EndostealSegmentation. Each stage takes its inputs in memory and returns a new
+ * image disconnected from the filters that produced it, so stages can be chained
+ * without touching the disk.
+ */
+
+/** Image types shared by every stage */
+constexpr unsigned int ImageDimension = 3;
+using HUPixelType         = short;
+using HUImageType         = itk::Image< HUPixelType, ImageDimension >;
+using MaskPixelType       = unsigned char;
+using MaskImageType       = itk::Image< MaskPixelType, ImageDimension >;
+using SheetnessPixelType  = float;
+using SheetnessImageType  = itk::Image< SheetnessPixelType, ImageDimension >;
+using LabelPixelType      = unsigned char;
+using LabelImageType      = itk::Image< LabelPixelType, ImageDimension >;
+
+/** Parameters of the skin mask and sheetness stages. Defaults follow scripts/sheetness.py */
+struct SheetnessParameters
+{
+  bool    EnhanceBrightObjects  = true;
+  int     NumberOfSigma         = 2;
+  double  MinSigma              = 0.5;
+  double  MaxSigma              = 1.0;
+  double  LowThreshold          = -400.0;
+  double  HighThreshold         = 1200.0;
+  double  Weight                = 0.05;
+
+  void Read(const Configuration & config)
+  {
+    EnhanceBrightObjects  = config.GetBool("sheetness.enhance_bright", EnhanceBrightObjects);
+    NumberOfSigma         = config.GetInt("sheetness.number_of_sigma", NumberOfSigma);
+    MinSigma              = config.GetDouble("sheetness.min_sigma", MinSigma);
+    MaxSigma              = config.GetDouble("sheetness.max_sigma", MaxSigma);
+    LowThreshold          = config.GetDouble("sheetness.air_threshold", LowThreshold);
+    HighThreshold         = config.GetDouble("sheetness.metal_threshold", HighThreshold);
+    Weight                = config.GetDouble("sheetness.trace_weight", Weight);
+  }
+
+  void Print(std::ostream & os) const
+  {
+    os << "  Sheetness:" << std::endl;
+    os << "    EnhanceBrightObjects:  " << EnhanceBrightObjects << std::endl;
+    os << "    NumberOfSigma:         " << NumberOfSigma << std::endl;
+    os << "    Minimum Sigma:         " << MinSigma << std::endl;
+    os << "    Maximum Sigma:         " << MaxSigma << std::endl;
+    os << "    Low Threshold:         " << LowThreshold << std::endl;
+    os << "    High Threshold:        " << HighThreshold << std::endl;
+    os << "    Weight:                " << Weight << std::endl;
+  }
+};
+
+/** Parameters of the periosteal stage. Defaults follow scripts/periosteal_segmentation.py */
+struct PeriostealParameters
+{
+  double              Lambda        = 50.0;
+  double              Sigma         = 0.25;
+  int                 ConnFilter    = 1;
+  std::vector< int >  Labels        = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+  std::vector< int >  BatchedLabels = {};
+  int                 Padding       = 5;
+
+  void Read(const Configuration & config)
+  {
+    Lambda        = config.GetDouble("periosteal.lambda", Lambda);
+    Sigma         = config.GetDouble("periosteal.sigma", Sigma);
+    ConnFilter    = config.GetInt("periosteal.conn_filter", ConnFilter);
+    Labels        = config.GetArray< int >("periosteal.labels", Labels);
+    BatchedLabels = config.GetArray< int >("periosteal.batch_labels", BatchedLabels);
+    Padding       = config.GetInt("periosteal.batch_padding", Padding);
+  }
+
+  void Print(std::ostream & os) const
+  {
+    os << "  Periosteal:" << std::endl;
+    os << "    Lambda:                " << Lambda << std::endl;
+    os << "    Sigma:                 " << Sigma << std::endl;
+    os << "    ConnFilter:            " << ConnFilter << std::endl;
+    os << "    Labels:                ";
+    for (auto l : Labels) { os << l << " "; }
+    os << std::endl;
+    os << "    Batched Labels:        ";
+    for (auto l : BatchedLabels) { os << l << " "; }
+    os << std::endl;
+    os << "    Batch Padding:         " << Padding << std::endl;
+  }
+};
+
+/** Parameters of the endosteal stage */
+struct EndostealParameters
+{
+  double  Lambda          = 50.0;
+  double  Sigma           = 0.25;
+  double  LowerThreshold  = 1;
+  double  UpperThreshold  = 2;
+  int     CorticalLabel   = 1;
+  int     CancellousLabel = 2;
+  int     BackgroundLabel = 0;
+  double  MinDistance     = 1.0;
+  double  MaxDistance     = 2.0;
+
+  void Read(const Configuration & config)
+  {
+    Lambda          = config.GetDouble("endosteal.lambda", Lambda);
+    Sigma           = config.GetDouble("endosteal.sigma", Sigma);
+    LowerThreshold  = config.GetDouble("endosteal.lower_threshold", LowerThreshold);
+    UpperThreshold  = config.GetDouble("endosteal.upper_threshold", UpperThreshold);
+    CorticalLabel   = config.GetInt("endosteal.cortical_label", CorticalLabel);
+    CancellousLabel = config.GetInt("endosteal.cancellous_label", CancellousLabel);
+    BackgroundLabel = config.GetInt("endosteal.background_label", BackgroundLabel);
+    MinDistance     = config.GetDouble("endosteal.min_distance", MinDistance);
+    MaxDistance     = config.GetDouble("endosteal.max_distance", MaxDistance);
+  }
+
+  void Print(std::ostream & os) const
+  {
+    os << "  Endosteal:" << std::endl;
+    os << "    Lambda:                " << Lambda << std::endl;
+    os << "    Sigma:                 " << Sigma << std::endl;
+    os << "    Lower Thresh:          " << LowerThreshold << std::endl;
+    os << "    Upper Thresh:          " << UpperThreshold << std::endl;
+    os << "    CorticalLabel:         " << CorticalLabel << std::endl;
+    os << "    CancellousLabel:       " << CancellousLabel << std::endl;
+    os << "    BackgroundLabel:       " << BackgroundLabel << std::endl;
+    os << "    Min Distance:          " << MinDistance << std::endl;
+    os << "    Max Distance:          " << MaxDistance << std::endl;
+  }
+};
+
+/** Output of the skin mask stage */
+struct SkinMasks
+{
+  MaskImageType::Pointer Skin;
+  MaskImageType::Pointer Eroded;
+};
+
+/** Body mask and eroded body mask used to restrict the sheetness computation */
+inline SkinMasks
+ComputeSkinMasks(const HUImageType * image, const SheetnessParameters & parameters)
+{
+  FEMUR_TRACE_SCOPE("femur", "ComputeSkinMasks");
+
+  using ThresholdFilterType = itk::BinaryThresholdImageFilter< HUImageType, MaskImageType >;
+
+  ThresholdFilterType::Pointer thresholder = ThresholdFilterType::New();
+  thresholder->SetInput(image);
+  thresholder->SetLowerThreshold(parameters.LowThreshold);
+  thresholder->SetUpperThreshold(parameters.HighThreshold);
+  thresholder->SetInsideValue(0);
+  thresholder->SetOutsideValue(1);
+  thresholder->Update();
+
+  /* The body is everything but the largest air component */
+  MaskImageType::Pointer skin = KeepLargestObjects< MaskImageType >(thresholder->GetOutput(), 1, 0, 255);
+
+  SkinMasks masks;
+  masks.Skin = skin;
+  masks.Eroded = ErodeByDistance< MaskImageType >(thresholder->GetOutput(), 0, parameters.MaxSigma);
+  return masks;
+}
+
+/** ComputeSheetness with Hessian tensors of THessianReal components */
+template< typename THessianReal >
+SheetnessImageType::Pointer
+ComputeSheetnessAtPrecision(const HUImageType * image, const SkinMasks & masks, const SheetnessParameters & parameters,
+                            unsigned int streamDivisions)
+{
+  using MultiScaleHessianFilterType = itk::MultiScaleHessianEnhancementImageFilter< HUImageType, SheetnessImageType, THessianReal >;
+  using CalgaryEigenToMeasureImageFilterType = itk::CalgaryEigenToMeasureImageFilter< typename MultiScaleHessianFilterType::EigenValueImageType, SheetnessImageType >;
+  using CalgaryEigenToMeasureParameterEstimationFilterType = itk::CalgaryEigenToMeasureParameterEstimationFilter< typename MultiScaleHessianFilterType::EigenValueImageType >;
+  using MaskSpatialObject = itk::ImageMaskSpatialObject< ImageDimension >;
+
+  MaskSpatialObject::Pointer skinMaskSpatialObject = MaskSpatialObject::New();
+  skinMaskSpatialObject->SetImage(masks.Skin);
+
+  MaskSpatialObject::Pointer erodedMaskSpatialObject = MaskSpatialObject::New();
+  erodedMaskSpatialObject->SetImage(masks.Eroded);
+
+  typename MultiScaleHessianFilterType::Pointer multiScaleFilter = MultiScaleHessianFilterType::New();
+  typename MultiScaleHessianFilterType::SigmaArrayType sigmaArray = MultiScaleHessianFilterType::GenerateLogarithmicSigmaArray(
+    parameters.MinSigma, parameters.MaxSigma, parameters.NumberOfSigma);
+
+  typename CalgaryEigenToMeasureParameterEstimationFilterType::Pointer estimationFilter = CalgaryEigenToMeasureParameterEstimationFilterType::New();
+  estimationFilter->SetMask(erodedMaskSpatialObject);
+  estimationFilter->SetFrobeniusNormWeight(parameters.Weight);
+  estimationFilter->SetNumberOfStreamDivisions(streamDivisions);
+
+  typename CalgaryEigenToMeasureImageFilterType::Pointer calgaryFilter = CalgaryEigenToMeasureImageFilterType::New();
+  calgaryFilter->SetMask(skinMaskSpatialObject);
+  if ( parameters.EnhanceBrightObjects )
+  {
+    calgaryFilter->SetEnhanceBrightObjects();
+  }
+  else
+  {
+    calgaryFilter->SetEnhanceDarkObjects();
+  }
+
+  multiScaleFilter->SetInput(image);
+  multiScaleFilter->SetEigenToMeasureImageFilter(calgaryFilter);
+  multiScaleFilter->SetEigenToMeasureParameterEstimationFilter(estimationFilter);
+  multiScaleFilter->SetSigmaArray(sigmaArray);
+  multiScaleFilter->Update();
+
+  SheetnessImageType::Pointer output = multiScaleFilter->GetOutput();
+  output->DisconnectPipeline();
+  return output;
+}
+
+/** Multiscale Calgary sheetness of the HU image, streamed and at the precision plan asks for */
+inline SheetnessImageType::Pointer
+ComputeSheetness(const HUImageType * image, const SkinMasks & masks, const SheetnessParameters & parameters,
+                 const MemoryPlan & plan = MemoryPlan())
+{
+  FEMUR_TRACE_SCOPE("femur", "ComputeSheetness");
+
+  if ( plan.SinglePrecisionHessian )
+  {
+    return ComputeSheetnessAtPrecision< float >(image, masks, parameters, plan.StreamDivisions);
+  }
+  return ComputeSheetnessAtPrecision< double >(image, masks, parameters, plan.StreamDivisions);
+}
+
+/** Hessian eigenvalues at one sigma, ordered as the Calgary measure expects */
+using EigenValueImageType = itk::MultiScaleHessianEnhancementImageFilter< HUImageType, SheetnessImageType >::EigenValueImageType;
+
+/** Eigenvalue images at every sigma of the sheetness stage.
+ * They do not depend on the trace weight, so a sweep over weights computes them once. */
+inline std::vector< EigenValueImageType::Pointer >
+ComputeEigenImages(const HUImageType * image, const SheetnessParameters & parameters)
+{
+  FEMUR_TRACE_SCOPE("femur", "ComputeEigenImages");
+
+  using MultiScaleHessianFilterType = itk::MultiScaleHessianEnhancementImageFilter< HUImageType, SheetnessImageType >;
+  using HessianFilterType = MultiScaleHessianFilterType::HessianFilterType;
+  using EigenAnalysisFilterType = MultiScaleHessianFilterType::EigenAnalysisFilterType;
+
+  MultiScaleHessianFilterType::SigmaArrayType sigmaArray = MultiScaleHessianFilterType::GenerateLogarithmicSigmaArray(
+    parameters.MinSigma, parameters.MaxSigma, parameters.NumberOfSigma);
+
+  std::vector< EigenValueImageType::Pointer > eigenImages;
+  for (unsigned int i = 0; i < sigmaArray.GetSize(); ++i)
+  {
+    HessianFilterType::Pointer hessianFilter = HessianFilterType::New();
+    hessianFilter->SetNormalizeAcrossScale(true);
+    hessianFilter->SetSigma(sigmaArray[i]);
+    hessianFilter->SetInput(image);
+
+    EigenAnalysisFilterType::Pointer eigenAnalysisFilter = EigenAnalysisFilterType::New();
+    eigenAnalysisFilter->SetDimension(ImageDimension);
+    eigenAnalysisFilter->OrderEigenValuesBy(EigenAnalysisFilterType::FunctorType::OrderByMagnitude);
+    eigenAnalysisFilter->SetInput(hessianFilter->GetOutput());
+    eigenAnalysisFilter->Update();
+
+    EigenValueImageType::Pointer eigenImage = eigenAnalysisFilter->GetOutput();
+    eigenImage->DisconnectPipeline();
+    eigenImages.push_back(eigenImage);
+  }
+  return eigenImages;
+}
+
+/** Same result as ComputeSheetness, starting from the eigenvalue images of ComputeEigenImages */
+inline SheetnessImageType::Pointer
+ComputeSheetnessFromEigenImages(const std::vector< EigenValueImageType::Pointer > & eigenImages,
+                                const SkinMasks & masks, const SheetnessParameters & parameters)
+{
+  FEMUR_TRACE_SCOPE("femur", "ComputeSheetnessFromEigenImages");
+
+  using CalgaryEigenToMeasureImageFilterType = itk::CalgaryEigenToMeasureImageFilter< EigenValueImageType, SheetnessImageType >;
+  using CalgaryEigenToMeasureParameterEstimationFilterType = itk::CalgaryEigenToMeasureParameterEstimationFilter< EigenValueImageType >;
+  using MaximumAbsoluteValueFilterType = itk::MaximumAbsoluteValueImageFilter< SheetnessImageType >;
+  using MaskSpatialObject = itk::ImageMaskSpatialObject< ImageDimension >;
+
+  MaskSpatialObject::Pointer skinMaskSpatialObject = MaskSpatialObject::New();
+  skinMaskSpatialObject->SetImage(masks.Skin);
+
+  MaskSpatialObject::Pointer erodedMaskSpatialObject = MaskSpatialObject::New();
+  erodedMaskSpatialObject->SetImage(masks.Eroded);
+
+  SheetnessImageType::Pointer output;
+  for (const EigenValueImageType::Pointer & eigenImage : eigenImages)
+  {
+    CalgaryEigenToMeasureParameterEstimationFilterType::Pointer estimationFilter = CalgaryEigenToMeasureParameterEstimationFilterType::New();
+    estimationFilter->SetMask(erodedMaskSpatialObject);
+    estimationFilter->SetFrobeniusNormWeight(parameters.Weight);
+    estimationFilter->SetInput(eigenImage);
+
+    CalgaryEigenToMeasureImageFilterType::Pointer calgaryFilter = CalgaryEigenToMeasureImageFilterType::New();
+    calgaryFilter->SetMask(skinMaskSpatialObject);
+    if ( parameters.EnhanceBrightObjects )
+    {
+      calgaryFilter->SetEnhanceBrightObjects();
+    }
+    else
+    {
+      calgaryFilter->SetEnhanceDarkObjects();
+    }
+    calgaryFilter->SetInput(estimationFilter->GetOutput());
+    calgaryFilter->SetParametersInput(estimationFilter->GetParametersOutput());
+    calgaryFilter->Update();
+
+    SheetnessImageType::Pointer response = calgaryFilter->GetOutput();
+    response->DisconnectPipeline();
+    if ( output.IsNull() )
+    {
+      output = response;
+      continue;
+    }
+
+    /* Maximum response over scales */
+    MaximumAbsoluteValueFilterType::Pointer maximumFilter = MaximumAbsoluteValueFilterType::New();
+    maximumFilter->SetInput1(output);
+    maximumFilter->SetInput2(response);
+    maximumFilter->Update();
+    output = maximumFilter->GetOutput();
+    output->DisconnectPipeline();
+  }
+  return output;
+}
+
+/** Copy value into output wherever segmentation is nonzero and output has not been claimed yet */
+inline void
+MergeLabel(LabelImageType * output, const LabelImageType * segmentation, LabelPixelType value)
+{
+  FEMUR_TRACE_SCOPE("femur", "MergeLabel");
+
+  itk::ImageRegionIterator< LabelImageType > ot(output, output->GetBufferedRegion());
+  itk::ImageRegionConstIterator< LabelImageType > st(segmentation, output->GetBufferedRegion());
+  for ( ot.GoToBegin(), st.GoToBegin(); !ot.IsAtEnd(); ++ot, ++st )
+  {
+    if ( st.Get() != 0 && ot.Get() == 0 )
+    {
+      ot.Set(value);
+    }
+  }
+}
+
+/** Periosteal segmentation of every label, combined into one label image.
+ * Labels are merged in order and earlier labels win overlaps. When plan.CropPeriosteal is set each
+ * label is cut inside the padded box of its marks instead of over the whole image. */
+inline LabelImageType::Pointer
+SegmentPeriosteal(const SheetnessImageType * sheetness, const LabelImageType * marks, const PeriostealParameters & parameters,
+                  const MemoryPlan & plan = MemoryPlan())
+{
+  FEMUR_TRACE_SCOPE("femur", "SegmentPeriosteal");
+
+  using PeriostealSegmentationFilterType = itk::PeriostealSegmentationImageFilter< SheetnessImageType, LabelImageType, LabelImageType >;
+  using BatchedPeriostealSegmentationFilterType = itk::BatchedPeriostealSegmentationImageFilter< SheetnessImageType, LabelImageType, LabelImageType >;
+
+  LabelImageType::Pointer output = LabelImageType::New();
+  output->CopyInformation(marks);
+  output->SetRegions(marks->GetLargestPossibleRegion());
+  output->Allocate();
+  output->FillBuffer(0);
+
+  for (auto label : parameters.Labels)
+  {
+    std::cout << "  Periosteal label " << label << std::endl;
+    if ( plan.CropPeriosteal )
+    {
+      BatchedPeriostealSegmentationFilterType::Pointer filter = BatchedPeriostealSegmentationFilterType::New();
+      filter->SetLambda(parameters.Lambda);
+      filter->SetSigma(parameters.Sigma);
+      filter->SetBackgroundLabel(0);
+      filter->SetLabels(BatchedPeriostealSegmentationFilterType::LabelArrayType{static_cast< LabelPixelType >(label)});
+      filter->SetPadding(parameters.Padding);
+      filter->SetInput(sheetness);
+      filter->SetMask(marks);
+      filter->Update();
+      std::cout << "    Max Flow: " << filter->GetMaxFlow() << std::endl;
+
+      LabelImageType::Pointer segmentation = KeepLargestComponents(filter->GetOutput(), parameters.ConnFilter);
+      MergeLabel(output, segmentation, static_cast< LabelPixelType >(label));
+      continue;
+    }
+
+    PeriostealSegmentationFilterType::Pointer filter = PeriostealSegmentationFilterType::New();
+    filter->SetLambda(parameters.Lambda);
+    filter->SetSigma(parameters.Sigma);
+    filter->SetForegroundLabel(label);
+    filter->SetBackgroundLabel(0);
+    filter->SetInput(sheetness);
+    filter->SetMask(marks);
+    filter->Update();
+    std::cout << "    Max Flow: " << filter->GetMaxFlow() << std::endl;
+
+    LabelImageType::Pointer segmentation = KeepLargestComponents(filter->GetOutput(), parameters.ConnFilter);
+    MergeLabel(output, segmentation, static_cast< LabelPixelType >(label));
+  }
+
+  if ( !parameters.BatchedLabels.empty() )
+  {
+    std::cout << "  Periosteal batched labels" << std::endl;
+    BatchedPeriostealSegmentationFilterType::LabelArrayType labels(
+      parameters.BatchedLabels.begin(), parameters.BatchedLabels.end());
+
+    BatchedPeriostealSegmentationFilterType::Pointer filter = BatchedPeriostealSegmentationFilterType::New();
+    filter->SetLambda(parameters.Lambda);
+    filter->SetSigma(parameters.Sigma);
+    filter->SetBackgroundLabel(0);
+    filter->SetLabels(labels);
+    filter->SetPadding(parameters.Padding);
+    filter->SetInput(sheetness);
+    filter->SetMask(marks);
+    filter->Update();
+    std::cout << "    Max Flow: " << filter->GetMaxFlow() << std::endl;
+
+    /* The batched output already holds label values */
+    itk::ImageRegionIterator< LabelImageType > ot(output, output->GetBufferedRegion());
+    itk::ImageRegionConstIterator< LabelImageType > st(filter->GetOutput(), output->GetBufferedRegion());
+    for ( ot.GoToBegin(), st.GoToBegin(); !ot.IsAtEnd(); ++ot, ++st )
+    {
+      if ( ot.Get() == 0 )
+      {
+        ot.Set(st.Get());
+      }
+    }
+  }
+
+  return output;
+}
+
+/** Endosteal segmentation inside the periosteal labels selected by the thresholds.
+ * When plan.CropEndosteal is set the cut runs on the bounding box of the selected labels only. Voxels
+ * outside the labels are tied to the background with no smoothness edges, so the result is unchanged. */
+inline LabelImageType::Pointer
+SegmentEndosteal(const SheetnessImageType * input, const LabelImageType * periosteal, const EndostealParameters & parameters,
+                 const MemoryPlan & plan = MemoryPlan())
+{
+  FEMUR_TRACE_SCOPE("femur", "SegmentEndosteal");
+
+  using BinaryThresholdFilterType = itk::BinaryThresholdImageFilter< LabelImageType, MaskImageType >;
+  using EndostealSegmentationFilterType = itk::EndostealSegmentationImageFilter< SheetnessImageType, MaskImageType, LabelImageType >;
+
+  BinaryThresholdFilterType::Pointer thresh = BinaryThresholdFilterType::New();
+  thresh->SetLowerThreshold( parameters.LowerThreshold );
+  thresh->SetUpperThreshold( parameters.UpperThreshold );
+  thresh->SetOutsideValue( 0 );
+  thresh->SetInsideValue( 1 );
+  thresh->SetInput( periosteal );
+
+  SheetnessImageType::ConstPointer sheetness = input;
+  MaskImageType::Pointer mask = thresh->GetOutput();
+  MaskImageType::RegionType cropRegion = periosteal->GetLargestPossibleRegion();
+  if ( plan.CropEndosteal )
+  {
+    thresh->Update();
+    mask->DisconnectPipeline();
+    cropRegion = NonzeroBoundingRegion(mask.GetPointer(), 1);
+    std::cout << "    Cropped to " << cropRegion.GetSize() << " at " << cropRegion.GetIndex() << std::endl;
+    sheetness = CropImage(input, cropRegion);
+    mask = CropImage(mask.GetPointer(), cropRegion);
+  }
+
+  EndostealSegmentationFilterType::Pointer filter = EndostealSegmentationFilterType::New();
+  filter->SetLambda(parameters.Lambda);
+  filter->SetSigma(parameters.Sigma);
+  filter->SetCorticalLabel(parameters.CorticalLabel);
+  filter->SetCancellousLabel(parameters.CancellousLabel);
+  filter->SetBackgroundLabel(parameters.BackgroundLabel);
+  filter->SetMinDistance(parameters.MinDistance);
+  filter->SetMaxDistance(parameters.MaxDistance);
+  filter->SetInput(sheetness);
+  filter->SetMask(mask);
+  filter->Update();
+  std::cout << "    Max Flow: " << filter->GetMaxFlow() << std::endl;
+
+  LabelImageType::Pointer output = filter->GetOutput();
+  output->DisconnectPipeline();
+  if ( !plan.CropEndosteal )
+  {
+    return output;
+  }
+
+  /* Outside the mask the filter leaves 0, not BackgroundLabel, and so does the cropped path */
+  return UncropImage(output.GetPointer(), cropRegion, periosteal, LabelPixelType(0));
+}
+
+} /* end namespace */
+
+#endif /* femurPipeline_h */
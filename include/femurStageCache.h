@@ -0,0 +1,350 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurStageCache_h
+#define femurStageCache_h
+
+#include "femurPipeline.h"
+#include "femurImageIO.h"
+#include "femurTrace.h"
+#include "itkMemoryMappedImageFileReader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+namespace femur {
+
+/** Key of a stage output: a 64 bit FNV-1a hash of everything the output depends on.
+ *
+ * Fields are added one by one. Strings and vectors carry their length, so
+ * different field lists never hash the same bytes.
+ */
+class StageKey
+{
+public:
+  StageKey & Add(const void * data, std::size_t size)
+  {
+    const unsigned char * bytes = static_cast< const unsigned char * >(data);
+    for (std::size_t i = 0; i < size; ++i)
+    {
+      m_Hash = (m_Hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return *this;
+  }
+
+  template< typename T, typename = typename std::enable_if< std::is_arithmetic< T >::value >::type >
+  StageKey & Add(T value)
+  {
+    return this->Add(&value, sizeof(value));
+  }
+
+  StageKey & Add(const std::string & value)
+  {
+    this->Add(static_cast< std::uint64_t >(value.size()));
+    return this->Add(value.data(), value.size());
+  }
+
+  StageKey & Add(const char * value)
+  {
+    return this->Add(std::string(value));
+  }
+
+  template< typename T >
+  StageKey & Add(const std::vector< T > & values)
+  {
+    this->Add(static_cast< std::uint64_t >(values.size()));
+    for (const T & value : values)
+    {
+      this->Add(value);
+    }
+    return *this;
+  }
+
+  /** Chain the key of an input stage */
+  StageKey & Add(const StageKey & input)
+  {
+    return this->Add(input.m_Hash);
+  }
+
+  std::uint64_t GetHash() const
+  {
+    return m_Hash;
+  }
+
+  /** 16 hex digits */
+  std::string ToString() const
+  {
+    char text[17];
+    std::snprintf(text, sizeof(text), "%016llx", static_cast< unsigned long long >(m_Hash));
+    return text;
+  }
+
+private:
+  std::uint64_t m_Hash = 14695981039346656037ULL;
+};
+
+/** Key of the contents of a file, whatever its name or time stamp */
+inline StageKey HashFile(const std::string & fileName)
+{
+  FEMUR_TRACE_SCOPE("femur", "HashFile");
+
+  std::ifstream file(fileName, std::ios::binary);
+  if ( !file )
+  {
+    itkGenericExceptionMacro(<< "Cannot open " << fileName);
+  }
+
+  StageKey key;
+  std::vector< char > buffer(1 << 20);
+  while ( file )
+  {
+    file.read(buffer.data(), buffer.size());
+    key.Add(buffer.data(), static_cast< std::size_t >(file.gcount()));
+  }
+  return key;
+}
+
+/** Bumped whenever a stage changes what it computes, orphaning older cache entries */
+constexpr std::uint32_t StageCacheVersion = 1;
+
+/* Keys of the pipeline stages. Each takes only the parameters its stage reads, so a
+ * change to a later stage leaves the earlier entries valid. */
+
+inline StageKey SkinMaskKey(const StageKey & input, const SheetnessParameters & parameters)
+{
+  return StageKey().Add("skin").Add(StageCacheVersion).Add(input)
+    .Add(parameters.LowThreshold).Add(parameters.HighThreshold);
+}
+
+inline StageKey ErodedMaskKey(const StageKey & input, const SheetnessParameters & parameters)
+{
+  return StageKey().Add("eroded").Add(StageCacheVersion).Add(input)
+    .Add(parameters.LowThreshold).Add(parameters.HighThreshold).Add(parameters.MaxSigma);
+}
+
+inline StageKey SheetnessKey(const StageKey & input, const SheetnessParameters & parameters)
+{
+  return StageKey().Add("sheetness").Add(StageCacheVersion).Add(input)
+    .Add(SkinMaskKey(input, parameters)).Add(ErodedMaskKey(input, parameters))
+    .Add(parameters.EnhanceBrightObjects).Add(parameters.NumberOfSigma)
+    .Add(parameters.MinSigma).Add(parameters.MaxSigma).Add(parameters.Weight);
+}
+
+inline StageKey PeriostealKey(const StageKey & sheetness, const StageKey & marks, const PeriostealParameters & parameters)
+{
+  return StageKey().Add("periosteal").Add(StageCacheVersion).Add(sheetness).Add(marks)
+    .Add(parameters.Lambda).Add(parameters.Sigma).Add(parameters.ConnFilter)
+    .Add(parameters.Labels).Add(parameters.BatchedLabels).Add(parameters.Padding);
+}
+
+inline StageKey EndostealKey(const StageKey & sheetness, const StageKey & periosteal, const EndostealParameters & parameters)
+{
+  return StageKey().Add("endosteal").Add(StageCacheVersion).Add(sheetness).Add(periosteal)
+    .Add(parameters.Lambda).Add(parameters.Sigma)
+    .Add(parameters.LowerThreshold).Add(parameters.UpperThreshold)
+    .Add(parameters.CorticalLabel).Add(parameters.CancellousLabel).Add(parameters.BackgroundLabel)
+    .Add(parameters.MinDistance).Add(parameters.MaxDistance);
+}
+
+/**
+ * Directory of stage outputs, one <stage>_<key>.nii per output.
+ *
+ * Entries are written under a temporary name and renamed into place, so processes
+ * sharing the directory never see a partial file. Reading an entry refreshes its
+ * time stamp, and after every store the least recently used entries are removed
+ * until the directory is within its size. A default constructed cache is disabled:
+ * nothing is found and nothing is stored.
+ */
+class StageCache
+{
+public:
+  StageCache() = default;
+
+  StageCache(const std::string & directory, std::uint64_t maximumSize)
+    : m_Directory(directory),
+      m_MaximumSize(maximumSize)
+  {
+    if ( mkdir(m_Directory.c_str(), 0777) != 0 && errno != EEXIST )
+    {
+      itkGenericExceptionMacro(<< "Cannot create cache directory " << m_Directory);
+    }
+  }
+
+  bool IsEnabled() const
+  {
+    return !m_Directory.empty();
+  }
+
+  std::string GetFileName(const StageKey & key, const std::string & stage) const
+  {
+    return m_Directory + "/" + stage + "_" + key.ToString() + ".nii";
+  }
+
+  /** The cached output, or nullptr */
+  template< typename TImage >
+  typename TImage::Pointer Load(const StageKey & key, const std::string & stage) const
+  {
+    if ( !this->IsEnabled() )
+    {
+      return nullptr;
+    }
+    const std::string fileName = this->GetFileName(key, stage);
+    if ( access(fileName.c_str(), R_OK) != 0 )
+    {
+      return nullptr;
+    }
+
+    FEMUR_TRACE_SCOPE("femur", "StageCache::Load");
+    using ReaderType = itk::MemoryMappedImageFileReader< TImage >;
+    typename ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName(fileName);
+    try
+    {
+      reader->Update();
+    }
+    catch (const itk::ExceptionObject & exception)
+    {
+      std::cerr << "Dropping unreadable cache entry " << fileName << ": " << exception.GetDescription() << std::endl;
+      std::remove(fileName.c_str());
+      return nullptr;
+    }
+    utime(fileName.c_str(), nullptr);
+
+    std::cout << "  Reusing cached " << stage << " " << key.ToString() << std::endl;
+    typename TImage::Pointer output = reader->GetOutput();
+    output->DisconnectPipeline();
+    return output;
+  }
+
+  /** Add an output, then evict down to the maximum size */
+  template< typename TImage >
+  void Store(const StageKey & key, const std::string & stage, const TImage * image)
+  {
+    if ( !this->IsEnabled() )
+    {
+      return;
+    }
+
+    FEMUR_TRACE_SCOPE("femur", "StageCache::Store");
+    static std::atomic< unsigned int > counter(0);
+    const std::string fileName = this->GetFileName(key, stage);
+    const std::string temporary = m_Directory + "/tmp_" + std::to_string(getpid()) + "_"
+      + std::to_string(counter++) + "_" + key.ToString() + ".nii";
+    try
+    {
+      WriteImage(image, temporary);
+    }
+    catch (const itk::ExceptionObject & exception)
+    {
+      /* The cache is an optimization, a full disk must not fail the run */
+      std::cerr << "Cannot cache " << stage << ": " << exception.GetDescription() << std::endl;
+      std::remove(temporary.c_str());
+      return;
+    }
+    if ( std::rename(temporary.c_str(), fileName.c_str()) != 0 )
+    {
+      std::remove(temporary.c_str());
+      return;
+    }
+    this->Evict(fileName);
+  }
+
+  /** Load the output of a stage, or compute it with compute() and store it */
+  template< typename TImage, typename TCompute >
+  typename TImage::Pointer GetOrCompute(const StageKey & key, const std::string & stage, TCompute compute)
+  {
+    typename TImage::Pointer output = this->Load< TImage >(key, stage);
+    if ( output.IsNull() )
+    {
+      output = compute();
+      this->Store(key, stage, output.GetPointer());
+    }
+    return output;
+  }
+
+  /** Remove least recently used entries until the directory fits, never keep */
+  void Evict(const std::string & keep = "") const
+  {
+    struct Entry
+    {
+      std::string   FileName;
+      std::uint64_t Size;
+      time_t        Time;
+    };
+
+    DIR * directory = opendir(m_Directory.c_str());
+    if ( directory == nullptr )
+    {
+      return;
+    }
+    std::vector< Entry > entries;
+    std::uint64_t total = 0;
+    while ( const dirent * item = readdir(directory) )
+    {
+      const std::string name = item->d_name;
+      struct stat status;
+      const std::string fileName = m_Directory + "/" + name;
+      if ( name.size() < 4 || name.compare(name.size() - 4, 4, ".nii") != 0
+        || stat(fileName.c_str(), &status) != 0 || !S_ISREG(status.st_mode) )
+      {
+        continue;
+      }
+      total += status.st_size;
+      /* Files being written by other processes count towards the size but are theirs to rename */
+      if ( name.compare(0, 4, "tmp_") != 0 && fileName != keep )
+      {
+        entries.push_back({fileName, static_cast< std::uint64_t >(status.st_size), status.st_mtime});
+      }
+    }
+    closedir(directory);
+
+    std::sort(entries.begin(), entries.end(), [](const Entry & a, const Entry & b) { return a.Time < b.Time; });
+    for (const Entry & entry : entries)
+    {
+      if ( total <= m_MaximumSize )
+      {
+        break;
+      }
+      if ( std::remove(entry.FileName.c_str()) == 0 )
+      {
+        total -= entry.Size;
+      }
+    }
+  }
+
+private:
+  std::string   m_Directory;
+  std::uint64_t m_MaximumSize = 0;
+};
+
+} /* end namespace */
+
+#endif /* femurStageCache_h */
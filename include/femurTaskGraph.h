@@ -0,0 +1,164 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurTaskGraph_h
+#define femurTaskGraph_h
+
+#include "femurThreadPool.h"
+#include "femurTrace.h"
+#include "itkMacro.h"
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace femur {
+
+/**
+ * Steps of one scan and the steps each needs first, run with as much overlap as
+ * the dependencies allow.
+ *
+ * Run starts every step without dependencies side by side through RunConcurrently,
+ * so they share the process thread pool. A finishing step starts, side by side,
+ * the steps it was the last dependency of. Nothing blocks on a condition, which
+ * keeps a pool of one thread, or a graph run inside a pool job, from deadlocking.
+ *
+ * Steps running at once must not touch the same pipeline objects. Steps that read
+ * one image should each take their own image object over its buffer, see ShareImage.
+ *
+ * When a step throws, the steps depending on it are skipped, the others finish,
+ * and Run rethrows the first exception.
+ */
+class TaskGraph
+{
+public:
+  using TaskId = std::size_t;
+
+  /** Add a step run after all of dependencies. name is used for tracing and must outlive Run. */
+  TaskId Add(const char * name, std::function< void() > task, std::initializer_list< TaskId > dependencies = {})
+  {
+    const TaskId id = m_Tasks.size();
+    m_Tasks.push_back(Task{name, std::move(task), {}, dependencies.size()});
+    for (TaskId dependency : dependencies)
+    {
+      if ( dependency >= id )
+      {
+        itkGenericExceptionMacro(<< "Task " << name << " depends on a task added after it");
+      }
+      m_Tasks[dependency].Dependents.push_back(id);
+    }
+    return id;
+  }
+
+  /** Run every step once. The graph can be run again afterwards. */
+  void Run()
+  {
+    m_Remaining.reset(new std::atomic< std::size_t >[m_Tasks.size()]);
+    std::vector< TaskId > roots;
+    for (TaskId id = 0; id < m_Tasks.size(); ++id)
+    {
+      m_Remaining[id] = m_Tasks[id].NumberOfDependencies;
+      if ( m_Tasks[id].NumberOfDependencies == 0 )
+      {
+        roots.push_back(id);
+      }
+    }
+    m_Exception = nullptr;
+
+    this->RunAll(roots);
+
+    if ( m_Exception )
+    {
+      std::rethrow_exception(m_Exception);
+    }
+  }
+
+private:
+  struct Task
+  {
+    const char *              Name;
+    std::function< void() >   Function;
+    std::vector< TaskId >     Dependents;
+    std::size_t               NumberOfDependencies;
+  };
+
+  void RunAll(const std::vector< TaskId > & ids)
+  {
+    if ( ids.size() == 1 )
+    {
+      this->Execute(ids[0]);
+      return;
+    }
+    RunConcurrently(ids.size(), [this, &ids](std::size_t i) { this->Execute(ids[i]); });
+  }
+
+  void Execute(TaskId id)
+  {
+    const Task & task = m_Tasks[id];
+    try
+    {
+      TraceScope scope("TaskGraph", task.Name);
+      task.Function();
+    }
+    catch ( ... )
+    {
+      std::lock_guard< std::mutex > lock(m_ExceptionMutex);
+      if ( !m_Exception )
+      {
+        m_Exception = std::current_exception();
+      }
+      return;
+    }
+
+    std::vector< TaskId > ready;
+    for (TaskId dependent : task.Dependents)
+    {
+      if ( --m_Remaining[dependent] == 0 )
+      {
+        ready.push_back(dependent);
+      }
+    }
+    if ( !ready.empty() )
+    {
+      this->RunAll(ready);
+    }
+  }
+
+  std::vector< Task >                               m_Tasks;
+  std::unique_ptr< std::atomic< std::size_t >[] >   m_Remaining;
+  std::exception_ptr                                m_Exception;
+  std::mutex                                        m_ExceptionMutex;
+};
+
+/** A new image object over the buffer of image, with no pipeline behind it.
+ * Lets steps that run at once read one image without sharing its requested region. */
+template< typename TImage >
+typename TImage::Pointer ShareImage(const TImage * image)
+{
+  typename TImage::Pointer shared = TImage::New();
+  shared->Graft(image);
+  return shared;
+}
+
+} /* end namespace */
+
+#endif /* femurTaskGraph_h */
@@ -0,0 +1,460 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurThreadPool_h
+#define femurThreadPool_h
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace femur {
+/**
+ * Process wide work stealing thread pool.
+ *
+ * Every ITK filter reaches it through WorkStealingMultiThreader and our own parallel
+ * loops through ParallelFor, so nested parallelism, e.g. a filter inside a sweep job,
+ * shares one set of threads instead of multiplying them. Each worker owns a deque:
+ * it pushes and pops its own work at the back and steals from the front of the
+ * others. A thread waiting on a loop runs queued tasks of that loop and of the loops
+ * nested in it until the loop is done. It never picks up unrelated work, such as
+ * another scan's job or a filter of another job, which could hold it far longer than
+ * the loop it waits on and nest its waits without limit.
+ *
+ * The GridCut solver starts threads of its own. It takes a ThreadReservation for
+ * them, which parks that many workers until the solve is over.
+ *
+ * The pool is idle until SetNumberOfThreads is called. Until then ParallelFor runs
+ * serially and reservations grant whatever they ask for.
+ */
+class ThreadPool
+{
+public:
+  static ThreadPool & Instance()
+  {
+    static ThreadPool pool;
+    return pool;
+  }
+
+  ~ThreadPool()
+  {
+    this->Stop();
+  }
+
+  /** Threads that run work, counting the caller of ParallelFor. Starts threads - 1 workers.
+   * Only call while no work is running. */
+  void SetNumberOfThreads(unsigned int threads)
+  {
+    this->Stop();
+
+    m_NumberOfThreads = std::max(1u, threads);
+    m_Stop = false;
+    m_Reserved = 0;
+    m_Queues.clear();
+    for (unsigned int i = 0; i + 1 < m_NumberOfThreads; ++i)
+    {
+      m_Queues.emplace_back(new Queue);
+    }
+    for (unsigned int i = 0; i < m_Queues.size(); ++i)
+    {
+      m_Workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+    m_Started = true;
+  }
+
+  unsigned int GetNumberOfThreads() const
+  {
+    return m_NumberOfThreads;
+  }
+
+  bool IsStarted() const
+  {
+    return m_Started;
+  }
+
+  /** Run func(i) for i in [0, n) on at most maximumConcurrency threads, the caller
+   * included. Returns when all are done and rethrows the first exception thrown. */
+  template< typename TFunction >
+  void ParallelFor(std::size_t n, unsigned int maximumConcurrency, TFunction && func)
+  {
+    if ( n == 0 )
+    {
+      return;
+    }
+
+    struct Loop : LoopNode
+    {
+      std::atomic< std::size_t >  Next{0};
+      std::atomic< std::size_t >  Done{0};
+      std::atomic< bool >         Failed{false};
+      std::exception_ptr          Error;
+      std::mutex                  Mutex;
+      std::condition_variable     Finished;
+    };
+    std::shared_ptr< Loop > loop = std::make_shared< Loop >();
+    loop->Parent = CurrentLoop();
+
+    /* Tasks that start after the last index is claimed return without touching func */
+    typename std::remove_reference< TFunction >::type * body = &func;
+    std::function< void() > run = [loop, n, body]()
+    {
+      for (std::size_t i = loop->Next++; i < n; i = loop->Next++)
+      {
+        if ( !loop->Failed )
+        {
+          /* Loops started by func(i) are nested in this one */
+          std::shared_ptr< const LoopNode > outer = CurrentLoop();
+          CurrentLoop() = loop;
+          try
+          {
+            (*body)(i);
+          }
+          catch (...)
+          {
+            if ( !loop->Failed.exchange(true) )
+            {
+              loop->Error = std::current_exception();
+            }
+          }
+          CurrentLoop() = std::move(outer);
+        }
+        if ( ++loop->Done == n )
+        {
+          std::lock_guard< std::mutex > lock(loop->Mutex);
+          loop->Finished.notify_all();
+        }
+      }
+    };
+
+    const std::size_t concurrency = std::min< std::size_t >({n, std::max(1u, maximumConcurrency), m_Queues.size() + 1});
+    for (std::size_t t = 1; t < concurrency; ++t)
+    {
+      this->Push(Task{run, loop});
+    }
+    run();
+
+    /* Help with the loops nested in this one until the indices other threads claimed are done */
+    while ( loop->Done < n )
+    {
+      if ( !this->RunOne(loop.get()) )
+      {
+        std::unique_lock< std::mutex > lock(loop->Mutex);
+        loop->Finished.wait_for(lock, std::chrono::microseconds(200), [&]() { return loop->Done >= n; });
+      }
+    }
+
+    if ( loop->Error )
+    {
+      std::rethrow_exception(loop->Error);
+    }
+  }
+
+  /** Park up to threads workers for a caller that runs threads of its own.
+   * Returns how many were parked. Without a running pool, grants all of them. */
+  unsigned int Reserve(unsigned int threads)
+  {
+    std::lock_guard< std::mutex > lock(m_Mutex);
+    if ( !m_Started )
+    {
+      return threads;
+    }
+    const unsigned int granted = std::min< unsigned int >(threads, m_Queues.size() - m_Reserved);
+    m_Reserved += granted;
+    return granted;
+  }
+
+  void Release(unsigned int threads)
+  {
+    {
+      std::lock_guard< std::mutex > lock(m_Mutex);
+      if ( !m_Started )
+      {
+        return;
+      }
+      m_Reserved -= std::min(threads, m_Reserved);
+    }
+    m_Wake.notify_all();
+  }
+
+private:
+  /** A parallel loop and the loop whose index started it */
+  struct LoopNode
+  {
+    std::shared_ptr< const LoopNode > Parent;
+
+    bool IsWithin(const LoopNode * ancestor) const
+    {
+      for (const LoopNode * node = this; node != nullptr; node = node->Parent.get())
+      {
+        if ( node == ancestor )
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+  };
+
+  /** Work of one loop */
+  struct Task
+  {
+    std::function< void() >           Run;
+    std::shared_ptr< const LoopNode > Loop;
+  };
+
+  struct Queue
+  {
+    std::mutex          Mutex;
+    std::deque< Task >  Tasks;
+  };
+
+  ThreadPool() = default;
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool & operator=(const ThreadPool &) = delete;
+
+  /** Index of the calling thread's queue in this pool, or -1 */
+  int WorkerIndex() const
+  {
+    return CurrentPool() == this ? CurrentIndex() : -1;
+  }
+
+  static const ThreadPool *& CurrentPool()
+  {
+    static thread_local const ThreadPool * pool = nullptr;
+    return pool;
+  }
+
+  static int & CurrentIndex()
+  {
+    static thread_local int index = -1;
+    return index;
+  }
+
+  /** Loop whose index the calling thread is running, if any */
+  static std::shared_ptr< const LoopNode > & CurrentLoop()
+  {
+    static thread_local std::shared_ptr< const LoopNode > loop;
+    return loop;
+  }
+
+  /** Take the first task from it (or the last when fromBack) that belongs to within or a loop nested
+   * in it, any task when within is null */
+  bool Take(Queue & queue, const LoopNode * within, bool fromBack, Task & task)
+  {
+    std::lock_guard< std::mutex > lock(queue.Mutex);
+    const std::size_t size = queue.Tasks.size();
+    for (std::size_t k = 0; k < size; ++k)
+    {
+      const std::size_t i = fromBack ? size - 1 - k : k;
+      if ( within == nullptr || queue.Tasks[i].Loop->IsWithin(within) )
+      {
+        task = std::move(queue.Tasks[i]);
+        queue.Tasks.erase(queue.Tasks.begin() + i);
+        --m_Pending;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Push(Task task)
+  {
+    const int self = this->WorkerIndex();
+    const std::size_t q = self >= 0 ? self : m_NextQueue++ % m_Queues.size();
+    {
+      std::lock_guard< std::mutex > lock(m_Queues[q]->Mutex);
+      m_Queues[q]->Tasks.push_back(std::move(task));
+    }
+    ++m_Pending;
+
+    /* Taking the lock orders the push before a worker's check of m_Pending */
+    bool reserved;
+    {
+      std::lock_guard< std::mutex > lock(m_Mutex);
+      reserved = m_Reserved > 0;
+    }
+    /* A parked worker could swallow a single notification */
+    if ( reserved )
+    {
+      m_Wake.notify_all();
+    }
+    else
+    {
+      m_Wake.notify_one();
+    }
+  }
+
+  /** Own work newest first, then the oldest work of the others. A waiter passes the loop
+   * it waits on as within and only gets work of that loop or of loops nested in it. */
+  bool Pop(Task & task, const LoopNode * within)
+  {
+    const int self = this->WorkerIndex();
+    const std::size_t count = m_Queues.size();
+    if ( self >= 0 && this->Take(*m_Queues[self], within, true, task) )
+    {
+      return true;
+    }
+
+    const std::size_t start = self >= 0 ? self + 1 : m_NextQueue.load();
+    for (std::size_t k = 0; k < count; ++k)
+    {
+      const std::size_t q = (start + k) % count;
+      if ( static_cast< int >(q) != self && this->Take(*m_Queues[q], within, false, task) )
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool RunOne(const LoopNode * within = nullptr)
+  {
+    if ( m_Queues.empty() )
+    {
+      return false;
+    }
+    Task task;
+    if ( !this->Pop(task, within) )
+    {
+      return false;
+    }
+    task.Run();
+    return true;
+  }
+
+  /** The highest numbered workers give way to reservations */
+  bool IsParked(unsigned int index) const
+  {
+    return index + m_Reserved >= m_Queues.size();
+  }
+
+  void WorkerLoop(unsigned int index)
+  {
+    CurrentPool() = this;
+    CurrentIndex() = static_cast< int >(index);
+    while ( true )
+    {
+      {
+        std::unique_lock< std::mutex > lock(m_Mutex);
+        m_Wake.wait(lock, [&]() { return m_Stop || (m_Pending > 0 && !this->IsParked(index)); });
+        if ( m_Stop )
+        {
+          return;
+        }
+      }
+      this->RunOne();
+    }
+  }
+
+  void Stop()
+  {
+    if ( !m_Started )
+    {
+      return;
+    }
+    {
+      std::lock_guard< std::mutex > lock(m_Mutex);
+      m_Stop = true;
+    }
+    m_Wake.notify_all();
+    for (std::thread & worker : m_Workers)
+    {
+      worker.join();
+    }
+    m_Workers.clear();
+    m_Started = false;
+  }
+
+  std::vector< std::unique_ptr< Queue > > m_Queues;
+  std::vector< std::thread >              m_Workers;
+  std::mutex                              m_Mutex;
+  std::condition_variable                 m_Wake;
+  std::atomic< std::size_t >              m_Pending{0};
+  std::atomic< std::size_t >              m_NextQueue{0};
+  unsigned int                            m_NumberOfThreads = 1;
+  unsigned int                            m_Reserved = 0;
+  bool                                    m_Stop = false;
+  bool                                    m_Started = false;
+};
+
+/** Parks pool workers while the holder runs threads of its own, e.g. the GridCut solver */
+class ThreadReservation
+{
+public:
+  /** Ask for extra threads on top of the calling one */
+  explicit ThreadReservation(unsigned int extraThreads)
+    : m_Granted(ThreadPool::Instance().Reserve(extraThreads))
+  {}
+
+  ~ThreadReservation()
+  {
+    ThreadPool::Instance().Release(m_Granted);
+  }
+
+  ThreadReservation(const ThreadReservation &) = delete;
+  ThreadReservation & operator=(const ThreadReservation &) = delete;
+
+  /** Threads the holder may run, itself included */
+  unsigned int GetNumberOfThreads() const
+  {
+    return m_Granted + 1;
+  }
+
+private:
+  unsigned int m_Granted;
+};
+
+/** Run func(i) for i in [0, n) side by side, e.g. independent jobs.
+ * Uses the pool when it runs, so jobs share its threads, and one thread per job otherwise. */
+template< typename TFunction >
+void RunConcurrently(std::size_t n, TFunction func)
+{
+  ThreadPool & pool = ThreadPool::Instance();
+  if ( pool.IsStarted() )
+  {
+    pool.ParallelFor(n, static_cast< unsigned int >(n), func);
+    return;
+  }
+
+  std::vector< std::thread > threads;
+  for (std::size_t i = 1; i < n; ++i)
+  {
+    threads.emplace_back(func, i);
+  }
+  if ( n > 0 )
+  {
+    func(0);
+  }
+  for (std::thread & thread : threads)
+  {
+    thread.join();
+  }
+}
+
+} /* end namespace */
+
+#endif /* femurThreadPool_h */
@@ -0,0 +1,224 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef femurTrace_h
+#define femurTrace_h
+
+#include "femurPerfCounters.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace femur {
+/** \class Tracer
+ * \brief Records timed spans and writes them as Chrome trace-event JSON
+ *
+ * Spans are recorded with FEMUR_TRACE_SCOPE. Until Start( ) is called a scope costs
+ * one relaxed atomic load. Each thread appends to its own buffer under that buffer's
+ * lock, which only Stop( ) ever contends for. Load the file in chrome://tracing or
+ * https://ui.perfetto.dev.
+ */
+class Tracer
+{
+public:
+  /** One complete ("ph":"X") event */
+  struct Event
+  {
+    const char *  Category;
+    const char *  Name;
+    const char *  ArgumentName;
+    double        Argument;
+    std::int64_t  Start;
+    std::int64_t  Duration;
+  };
+
+  static Tracer & Instance()
+  {
+    static Tracer tracer;
+    return tracer;
+  }
+
+  /** Start recording. Events are written to fileName by Stop( ). */
+  void Start(const std::string & fileName)
+  {
+    std::lock_guard< std::mutex > lock(m_Mutex);
+    m_FileName = fileName;
+    m_Origin = Clock::now();
+    m_Enabled.store(true, std::memory_order_relaxed);
+  }
+
+  /** Stop recording and write every event recorded so far. Does nothing if not started.
+   * Scopes still open on other threads, e.g. detached ones at exit, are dropped when
+   * they close rather than appended while their buffer is written. */
+  void Stop()
+  {
+    if ( !m_Enabled.exchange(false) )
+    {
+      return;
+    }
+
+    std::lock_guard< std::mutex > lock(m_Mutex);
+    std::ofstream file(m_FileName);
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (const std::unique_ptr< ThreadBuffer > & buffer : m_Buffers)
+    {
+      std::lock_guard< std::mutex > bufferLock(buffer->Mutex);
+      for (const Event & event : buffer->Events)
+      {
+        file << (first ? "\n" : ",\n");
+        first = false;
+        file << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->ThreadId
+             << ",\"ts\":" << event.Start << ",\"dur\":" << event.Duration
+             << ",\"cat\":\"" << event.Category << "\",\"name\":\"";
+        if ( *event.Category != '\0' )
+        {
+          file << event.Category << "::";
+        }
+        file << event.Name << "\"";
+        if ( event.ArgumentName != nullptr )
+        {
+          file << ",\"args\":{\"" << event.ArgumentName << "\":" << event.Argument << "}";
+        }
+        file << "}";
+      }
+    }
+    file << "\n]}\n";
+  }
+
+  bool IsEnabled() const
+  {
+    return m_Enabled.load(std::memory_order_relaxed);
+  }
+
+  /** Microseconds since Start( ) */
+  std::int64_t Now() const
+  {
+    return std::chrono::duration_cast< std::chrono::microseconds >(Clock::now() - m_Origin).count();
+  }
+
+  void Record(const Event & event)
+  {
+    thread_local ThreadBuffer * buffer = nullptr;
+    if ( buffer == nullptr )
+    {
+      std::lock_guard< std::mutex > lock(m_Mutex);
+      m_Buffers.emplace_back(new ThreadBuffer);
+      buffer = m_Buffers.back().get();
+      buffer->ThreadId = static_cast< unsigned int >(m_Buffers.size());
+    }
+
+    /* Checked under the buffer's lock, so once Stop( ) has written a buffer nothing more is added */
+    std::lock_guard< std::mutex > lock(buffer->Mutex);
+    if ( m_Enabled.load(std::memory_order_relaxed) )
+    {
+      buffer->Events.push_back(event);
+    }
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  /** Buffers outlive their threads, as thread pools may finish before Stop( ) */
+  struct ThreadBuffer
+  {
+    std::mutex            Mutex;
+    unsigned int          ThreadId = 0;
+    std::vector< Event >  Events;
+  };
+
+  Tracer() : m_Enabled(false), m_Origin(Clock::now()) {}
+  ~Tracer()
+  {
+    this->Stop();
+  }
+
+  std::atomic< bool >                           m_Enabled;
+  Clock::time_point                             m_Origin;
+  std::string                                   m_FileName;
+  std::mutex                                    m_Mutex;
+  std::vector< std::unique_ptr< ThreadBuffer > > m_Buffers;
+};
+
+/** Records the lifetime of the scope as one event. category and name must be string
+ * literals or otherwise outlive the tracer, e.g. GetNameOfClass( ). While PerfCounters
+ * runs, scopes on its thread also add their hardware counts to the stage of that name. */
+class TraceScope
+{
+public:
+  TraceScope(const char * category, const char * name, const char * argumentName = nullptr, double argument = 0.0)
+    : m_Enabled(Tracer::Instance().IsEnabled()),
+      m_Counting(PerfCounters::Instance().IsCounting())
+  {
+    m_Event.Category = category;
+    m_Event.Name = name;
+    if ( m_Enabled )
+    {
+      m_Event.ArgumentName = argumentName;
+      m_Event.Argument = argument;
+      m_Event.Start = Tracer::Instance().Now();
+    }
+    if ( m_Counting )
+    {
+      m_Sample = PerfCounters::Instance().Read();
+    }
+  }
+
+  ~TraceScope()
+  {
+    if ( m_Counting )
+    {
+      PerfCounters::Instance().Record(m_Event.Category, m_Event.Name, m_Sample);
+    }
+    if ( m_Enabled )
+    {
+      m_Event.Duration = Tracer::Instance().Now() - m_Event.Start;
+      Tracer::Instance().Record(m_Event);
+    }
+  }
+
+  TraceScope(const TraceScope &) = delete;
+  TraceScope & operator=(const TraceScope &) = delete;
+
+private:
+  bool                  m_Enabled;
+  bool                  m_Counting;
+  Tracer::Event         m_Event;
+  PerfCounters::Sample  m_Sample;
+};
+
+} /* end namespace */
+
+#define FEMUR_TRACE_CONCAT_(a, b) a##b
+#define FEMUR_TRACE_CONCAT(a, b) FEMUR_TRACE_CONCAT_(a, b)
+
+/** Trace the enclosing scope: FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "GenerateData") */
+#define FEMUR_TRACE_SCOPE(category, name) \
+  femur::TraceScope FEMUR_TRACE_CONCAT(femurTraceScope, __LINE__)(category, name)
+
+/** Trace the enclosing scope with one numeric argument: FEMUR_TRACE_SCOPE_ARG("", "Scale", "sigma", sigma) */
+#define FEMUR_TRACE_SCOPE_ARG(category, name, argumentName, argument) \
+  femur::TraceScope FEMUR_TRACE_CONCAT(femurTraceScope, __LINE__)(category, name, argumentName, argument)
+
+#endif /* femurTrace_h */
@@ -0,0 +1,215 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef itkBatchedGridCutImageFilter_h
+#define itkBatchedGridCutImageFilter_h
+
+#include "itkImageToImageFilter.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+
+#include "GridGraph_3D_6C_MT.h"
+#include "femurBufferPool.h"
+#include <vector>
+
+namespace itk {
+/** \class BatchedGridCutImageFilter
+ * \brief Abstract class for solving many small label ROIs in a single grid cut
+ *
+ * Each label in SetLabels( ) is segmented independently inside the bounding box
+ * of its marks in the mask image, padded by Padding voxels. Instead of running one
+ * graph cut per label, the boxes are stacked along the slowest axis of a single
+ * grid, separated by GapSize slices of unconnected nodes. Every n-link leaving a
+ * box has zero capacity, so the subgraphs do not interact and one parallel max flow
+ * solves all of them at once.
+ *
+ * After the cut, source voxels of each box are written back to their original
+ * position with the value of the box label. Boxes are unpacked in the order of
+ * SetLabels( ), and a voxel already claimed by an earlier label is not overwritten.
+ *
+ * Derived classes provide the data and smoothness terms. Both receive the label of
+ * the box being evaluated.
+ *
+ * \sa GridCutImageFilter
+ *
+ * \ingroup BoneEnhancement
+ */
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+class ITK_TEMPLATE_EXPORT BatchedGridCutImageFilter
+  : public ImageToImageFilter< TInputImage, TOutputImage >
+{
+public:
+  ITK_DISALLOW_COPY_AND_ASSIGN(BatchedGridCutImageFilter);
+
+  /** Standard Self typedef */
+  using Self          = BatchedGridCutImageFilter;
+  using Superclass    = ImageToImageFilter< TInputImage, TOutputImage >;
+  using Pointer       = SmartPointer< Self >;
+  using ConstPointer  = SmartPointer< const Self >;
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(BatchedGridCutImageFilter, ImageToImageFilter);
+
+  /** Input Image typedefs. */
+  using InputImageType          = TInputImage;
+  using InputImagePointer       = typename InputImageType::Pointer;
+  using InputImageConstPointer  = typename InputImageType::ConstPointer;
+  using InputImageRegionType    = typename InputImageType::RegionType;
+  using InputPixelType          = typename InputImageType::PixelType;
+  using SizeType                = typename InputImageType::SizeType;
+  using IndexType               = typename InputImageType::IndexType;
+  using OffsetType              = typename InputImageType::OffsetType;
+  itkStaticConstMacro(ImageDimension, unsigned int,  TInputImage::ImageDimension);
+
+  /** Mask image typedefs. */
+  using MaskImageType         = TMaskImage;
+  using MaskImageConstPointer = typename MaskImageType::ConstPointer;
+  using MaskPixelType         = typename MaskImageType::PixelType;
+
+  /** Output image typedefs. */
+  using OutputImageType       = TOutputImage;
+  using OutputImagePointer    = typename OutputImageType::Pointer;
+  using OutputImageRegionType = typename OutputImageType::RegionType;
+  using OutputImagePixelType  = typename OutputImageType::PixelType;
+
+  /** Grid cut definitions */
+  using LabelType     = int;
+  using CostType      = int;
+  using EnergyType    = typename NumericTraits< InputPixelType >::RealType;
+  using Grid          = GridGraph_3D_6C_MT< CostType, CostType, EnergyType >;
+  using VectorType    = std::vector< CostType, femur::PoolAllocator< CostType > >;
+  using NLinkType     = std::vector< VectorType >;
+  using TLinkType     = std::vector< VectorType >;
+  using RealType      = typename NumericTraits< InputPixelType >::RealType;
+  using DistanceType  = typename NumericTraits< InputPixelType >::RealType;
+
+  /** Batch definitions */
+  using LabelArrayType  = std::vector< MaskPixelType >;
+  using RegionArrayType = std::vector< InputImageRegionType >;
+  using NeighboursType  = std::vector< OffsetType >;
+
+  /** Methods to set/get the mask image */
+  itkSetInputMacro(Mask, MaskImageType);
+  itkGetInputMacro(Mask, MaskImageType);
+
+  /** Set/Get the labels segmented in this batch. */
+  void SetLabels(const LabelArrayType & labels)
+  {
+    m_Labels = labels;
+    this->Modified();
+  }
+  const LabelArrayType & GetLabels() const
+  {
+    return m_Labels;
+  }
+
+  /** Get the region solved for each label, in the order of GetLabels( ).
+   * Labels without any marks have an empty region. Valid after Update( ). */
+  const RegionArrayType & GetRegions() const
+  {
+    return m_Regions;
+  }
+
+  /** Set/Get macros for Padding around each label's bounding box, in voxels */
+  itkSetMacro(Padding, SizeValueType);
+  itkGetConstMacro(Padding, SizeValueType);
+
+  /** Set/Get macros for GapSize between packed boxes, in voxels */
+  itkSetMacro(GapSize, SizeValueType);
+  itkGetConstMacro(GapSize, SizeValueType);
+
+  /** Set/Get macros for the output value written outside every label */
+  itkSetMacro(OutsideValue, OutputImagePixelType);
+  itkGetConstMacro(OutsideValue, OutputImagePixelType);
+
+  /** Set/Get macros for BlockSize */
+  itkSetMacro(BlockSize, LabelType);
+  itkGetConstMacro(BlockSize, LabelType);
+
+  /** Set/Get macros for WeightScale */
+  itkSetMacro(WeightScale, DistanceType);
+  itkGetConstMacro(WeightScale, DistanceType);
+
+  /** Get max flow summed over every box */
+  itkGetConstMacro(MaxFlow, EnergyType);
+
+  /** Get number of nNeighbours */
+  itkGetConstMacro(nNeighbours, LabelType);
+
+  /** Get the size of the packed grid. Valid after Update( ). */
+  itkGetConstMacro(GridSize, SizeType);
+
+protected:
+  BatchedGridCutImageFilter();
+  virtual ~BatchedGridCutImageFilter() {}
+
+  void PrintSelf(std::ostream & os, Indent indent) const override;
+
+  /** Functions to be overwritten by inheritance. roiLabel is the label of the box being processed. */
+  virtual CostType ComputeDataTerm(const InputPixelType p, const LabelType l, const MaskPixelType m, const MaskPixelType roiLabel);
+  virtual CostType ComputeSmoothnessTerm(const InputPixelType p, const InputPixelType q, const DistanceType d,
+    const MaskPixelType m_p, const MaskPixelType m_q, const MaskPixelType roiLabel);
+
+  /** Find the padded bounding box of every label in a single pass over the mask */
+  virtual void ComputeRegions();
+
+  /** Compute the packed layout from m_Regions */
+  void ComputeLayout();
+
+  /** Map an image index inside box i to its node in the packed grid */
+  SizeValueType GetPackedIndex(const IndexType p, const unsigned int i) const;
+
+  /** The filter needs all of its input and produces all of its output */
+  void GenerateInputRequestedRegion() override;
+  void EnlargeOutputRequestedRegion(DataObject *data) override;
+
+  /** Single threaded since we are connecting data. Work inside each box is threaded. */
+  void GenerateData() override;
+
+private:
+  void SetupNeighbourhood();
+  void ComputeTerms(const unsigned int i);
+  void ReadOut(const unsigned int i);
+
+  /** Grid cut terms */
+  NLinkType             m_nLinks;
+  TLinkType             m_tLinks;
+  LabelType             m_nLabels;
+  LabelType             m_nNeighbours;
+  NeighboursType        m_Neighbors;
+  LabelType             m_BlockSize;
+  EnergyType            m_MaxFlow;
+  std::unique_ptr<Grid> m_Grid;
+  DistanceType          m_WeightScale;
+
+  /** Batch layout */
+  LabelArrayType              m_Labels;
+  RegionArrayType             m_Regions;
+  std::vector< SizeValueType > m_SliceOffsets;
+  SizeType                    m_GridSize;
+  SizeValueType               m_Padding;
+  SizeValueType               m_GapSize;
+  OutputImagePixelType        m_OutsideValue;
+}; // end class
+} /* end namespace */
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkBatchedGridCutImageFilter.hxx"
+#endif
+
+#endif /* itkBatchedGridCutImageFilter_h */
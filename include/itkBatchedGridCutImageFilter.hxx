@@ -0,0 +1,436 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef itkBatchedGridCutImageFilter_hxx
+#define itkBatchedGridCutImageFilter_hxx
+
+#include "itkBatchedGridCutImageFilter.h"
+#include "femurTrace.h"
+#include "femurThreadPool.h"
+#include "itkMultiThreaderBase.h"
+#include <mutex>
+
+namespace itk {
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+BatchedGridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
+::BatchedGridCutImageFilter() :
+  m_nLabels(2),
+  m_nNeighbours(0),
+  m_BlockSize(100),
+  m_MaxFlow(0.0),
+  m_Grid(nullptr),
+  m_WeightScale(1000.0),
+  m_Padding(5),
+  m_GapSize(1),
+  m_OutsideValue(NumericTraits< OutputImagePixelType >::ZeroValue())
+{
+  m_GridSize.Fill(0);
+}
+
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+void
+BatchedGridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
+::GenerateInputRequestedRegion()
+{
+  Superclass::GenerateInputRequestedRegion();
+
+  InputImagePointer input = const_cast< InputImageType * >( this->GetInput() );
+  if ( input )
+  {
+    input->SetRequestedRegionToLargestPossibleRegion();
+  }
+
+  MaskImageType * mask = const_cast< MaskImageType * >( this->GetMask() );
+  if ( mask )
+  {
+    mask->SetRequestedRegionToLargestPossibleRegion();
+  }
+}
+
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+void
+BatchedGridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
+::EnlargeOutputRequestedRegion(DataObject *data)
+{
+  Superclass::EnlargeOutputRequestedRegion(data);
+  data->SetRequestedRegionToLargestPossibleRegion();
+}
+
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+void
+BatchedGridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
+::GenerateData()
+{
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "GenerateData");
+
+  /* Allocate output, everything starts outside of every label */
+  OutputImagePointer output = this->GetOutput(0);
+  output->SetBufferedRegion(output->GetRequestedRegion());
+  output->Allocate();
+  output->FillBuffer(m_OutsideValue);
+
+  /* Reset max flow */
+  m_MaxFlow = 0.0;
+
+  if ( m_Labels.empty() )
+  {
+    itkWarningMacro(<< "No labels set, output is empty");
+    return;
+  }
+
+  /* Find and pack the boxes */
+  this->SetupNeighbourhood();
+  this->ComputeRegions();
+  this->ComputeLayout();
+
+  const SizeValueType nVoxels = m_GridSize[0]*m_GridSize[1]*m_GridSize[2];
+  if ( nVoxels == 0 )
+  {
+    itkWarningMacro(<< "None of the labels were found in the mask, output is empty");
+    return;
+  }
+  itkDebugMacro(<< "Packed " << m_Labels.size() << " labels into a grid of size " << m_GridSize);
+
+  /* Create arrays. Nodes in the gaps keep zero capacity on every edge. */
+  m_tLinks.resize(m_nLabels);
+  for (unsigned int i = 0; i < m_nLabels; ++i)
+  {
+    m_tLinks[i].assign(nVoxels, 0);
+  }
+
+  m_nLinks.resize(m_nNeighbours);
+  for (unsigned int i = 0; i < m_nNeighbours; ++i)
+  {
+    m_nLinks[i].assign(nVoxels, 0);
+  }
+
+  /* Compute terms for every box */
+  for (unsigned int i = 0; i < m_Regions.size(); ++i)
+  {
+    this->ComputeTerms(i);
+  }
+
+  /* Solve all boxes at once. The solver runs threads of its own, take them from the shared pool while it works. */
+  {
+    femur::ThreadReservation reservation(this->GetMultiThreader()->GetMaximumNumberOfThreads() - 1);
+    m_Grid = std::unique_ptr<Grid>(new Grid(
+      m_GridSize[0], m_GridSize[1], m_GridSize[2],
+      reservation.GetNumberOfThreads(), m_BlockSize
+    ));
+    m_Grid->set_caps(
+      m_tLinks[0].data(),  // cap_source
+      m_tLinks[1].data(),  // cap_sink
+
+      m_nLinks[0].data(),  // [-1, 0, 0]
+      m_nLinks[1].data(),  // [+1, 0, 0]
+      m_nLinks[2].data(),  // [ 0,-1, 0]
+      m_nLinks[3].data(),  // [ 0,+1, 0]
+      m_nLinks[4].data(),  // [ 0, 0,-1]
+      m_nLinks[5].data()   // [ 0, 0,+1]
+    );
+    m_Grid->compute_maxflow();
+  }
+  m_MaxFlow = m_Grid->get_flow() / m_WeightScale;
+
+  /* Unpack in label order so earlier labels win overlaps */
+  for (unsigned int i = 0; i < m_Regions.size(); ++i)
+  {
+    this->ReadOut(i);
+  }
+
+  /* Free memory */
+  m_tLinks.clear();
+  m_tLinks.shrink_to_fit();
+  m_nLinks.clear();
+  m_nLinks.shrink_to_fit();
+  m_Grid.reset();
+}
+
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+void
+BatchedGridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
+::ComputeRegions()
+{
+  MaskImageConstPointer mask = this->GetMask();
+  const typename MaskImageType::RegionType largest = mask->GetLargestPossibleRegion();
+  const unsigned int nBoxes = m_Labels.size();
+
+  /* Bounding box of every label, empty when min > max */
+  std::vector< IndexType > minIndex(nBoxes), maxIndex(nBoxes);
+  for (unsigned int i = 0; i < nBoxes; ++i)
+  {
+    minIndex[i].Fill(NumericTraits< IndexValueType >::max());
+    maxIndex[i].Fill(NumericTraits< IndexValueType >::NonpositiveMin());
+  }
+
+  std::mutex mutex;
+  this->GetMultiThreader()->template ParallelizeImageRegion< ImageDimension >(
+    largest,
+    [&](const typename MaskImageType::RegionType & region)
+    {
+      std::vector< IndexType > localMin(minIndex), localMax(maxIndex);
+      ImageRegionConstIteratorWithIndex< MaskImageType > it(mask, region);
+      for ( it.GoToBegin(); !it.IsAtEnd(); ++it )
+      {
+        const MaskPixelType m = it.Get();
+        for (unsigned int i = 0; i < nBoxes; ++i)
+        {
+          if ( m != m_Labels[i] )
+          {
+            continue;
+          }
+          const IndexType p = it.GetIndex();
+          for (unsigned int d = 0; d < ImageDimension; ++d)
+          {
+            localMin[i][d] = std::min(localMin[i][d], p[d]);
+            localMax[i][d] = std::max(localMax[i][d], p[d]);
+          }
+          break;
+        }
+      }
+
+      std::lock_guard< std::mutex > guard(mutex);
+      for (unsigned int i = 0; i < nBoxes; ++i)
+      {
+        for (unsigned int d = 0; d < ImageDimension; ++d)
+        {
+          minIndex[i][d] = std::min(minIndex[i][d], localMin[i][d]);
+          maxIndex[i][d] = std::max(maxIndex[i][d], localMax[i][d]);
+        }
+      }
+    },
+    nullptr);
+
+  /* Pad and crop each box */
+  m_Regions.assign(nBoxes, InputImageRegionType());
+  for (unsigned int i = 0; i < nBoxes; ++i)
+  {
+    if ( minIndex[i][0] > maxIndex[i][0] )
+    {
+      itkWarningMacro(<< "Label " << static_cast< typename NumericTraits< MaskPixelType >::PrintType >(m_Labels[i])
+        << " not found in mask, skipping");
+      continue;
+    }
+
+    IndexType start;
+    SizeType size;
+    for (unsigned int d = 0; d < ImageDimension; ++d)
+    {
+      start[d] = minIndex[i][d] - static_cast< IndexValueType >(m_Padding);
+      size[d] = static_cast< SizeValueType >(maxIndex[i][d] - minIndex[i][d] + 1) + 2*m_Padding;
+    }
+    InputImageRegionType region(start, size);
+    region.Crop(largest);
+    m_Regions[i] = region;
+  }
+}
+
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+void
+BatchedGridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
+::ComputeLayout()
+{
+  /* Stack boxes along the slowest axis, separated by m_GapSize slices */
+  m_GridSize.Fill(0);
+  m_SliceOffsets.assign(m_Regions.size(), 0);
+
+  SizeValueType offset = 0;
+  for (unsigned int i = 0; i < m_Regions.size(); ++i)
+  {
+    const SizeType size = m_Regions[i].GetSize();
+    if ( m_Regions[i].GetNumberOfPixels() == 0 )
+    {
+      continue;
+    }
+
+    if ( offset > 0 )
+    {
+      offset += m_GapSize;
+    }
+    m_SliceOffsets[i] = offset;
+    offset += size[2];
+
+    m_GridSize[0] = std::max(m_GridSize[0], size[0]);
+    m_GridSize[1] = std::max(m_GridSize[1], size[1]);
+  }
+  m_GridSize[2] = offset;
+}
+
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+SizeValueType
+BatchedGridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
+::GetPackedIndex(const IndexType p, const unsigned int i) const
+{
+  const IndexType start = m_Regions[i].GetIndex();
+  const SizeValueType x = p[0] - start[0];
+  const SizeValueType y = p[1] - start[1];
+  const SizeValueType z = p[2] - start[2] + m_SliceOffsets[i];
+
+  return x + y*m_GridSize[0] + z*m_GridSize[0]*m_GridSize[1];
+}
+
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+void
+BatchedGridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
+::ComputeTerms(const unsigned int i)
+{
+  const InputImageRegionType box = m_Regions[i];
+  if ( box.GetNumberOfPixels() == 0 )
+  {
+    return;
+  }
+
+  InputImageConstPointer input = this->GetInput(0);
+  MaskImageConstPointer mask = this->GetMask();
+  const MaskPixelType roiLabel = m_Labels[i];
+
+  /* Neighbours are axis aligned, so the distance is the spacing along that axis */
+  std::vector< DistanceType > distances(m_nNeighbours);
+  for (unsigned int n = 0; n < m_nNeighbours; ++n)
+  {
+    for (unsigned int d = 0; d < ImageDimension; ++d)
+    {
+      if ( m_Neighbors[n][d] != 0 )
+      {
+        distances[n] = input->GetSpacing()[d];
+      }
+    }
+  }
+
+  this->GetMultiThreader()->template ParallelizeImageRegion< ImageDimension >(
+    box,
+    [&](const InputImageRegionType & region)
+    {
+      ImageRegionConstIteratorWithIndex< InputImageType > it(input, region);
+      for ( it.GoToBegin(); !it.IsAtEnd(); ++it )
+      {
+        const IndexType p = it.GetIndex();
+        const InputPixelType p_value = it.Get();
+        const MaskPixelType m_p_value = mask->GetPixel(p);
+        const SizeValueType id = this->GetPackedIndex(p, i);
+
+        /* Process data term */
+        for (LabelType l = 0; l < m_nLabels; ++l)
+        {
+          m_tLinks[l][id] = this->ComputeDataTerm(p_value, l, m_p_value, roiLabel);
+        }
+
+        /* Process smooth term. Edges leaving the box stay at zero capacity. */
+        for (unsigned int n = 0; n < m_nNeighbours; ++n)
+        {
+          const IndexType q = p + m_Neighbors[n];
+          if ( !box.IsInside(q) )
+          {
+            continue;
+          }
+          m_nLinks[n][id] = this->ComputeSmoothnessTerm(
+            p_value, input->GetPixel(q), distances[n], m_p_value, mask->GetPixel(q), roiLabel);
+        }
+      }
+    },
+    nullptr);
+}
+
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+void
+BatchedGridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
+::ReadOut(const unsigned int i)
+{
+  const InputImageRegionType box = m_Regions[i];
+  if ( box.GetNumberOfPixels() == 0 )
+  {
+    return;
+  }
+
+  OutputImagePointer output = this->GetOutput(0);
+  const OutputImagePixelType label = static_cast< OutputImagePixelType >( m_Labels[i] );
+  const typename InputImageType::IndexType start = box.GetIndex();
+
+  this->GetMultiThreader()->template ParallelizeImageRegion< ImageDimension >(
+    box,
+    [&](const OutputImageRegionType & region)
+    {
+      ImageRegionIteratorWithIndex< OutputImageType > ot(output, region);
+      for ( ot.GoToBegin(); !ot.IsAtEnd(); ++ot )
+      {
+        const IndexType p = ot.GetIndex();
+        const auto id = m_Grid->node_id(
+          p[0] - start[0], p[1] - start[1], p[2] - start[2] + m_SliceOffsets[i]);
+
+        /* Source segment is the foreground */
+        if ( m_Grid->get_segment(id) == 0 && ot.Get() == m_OutsideValue )
+        {
+          ot.Set(label);
+        }
+      }
+    },
+    nullptr);
+}
+
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+void
+BatchedGridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
+::SetupNeighbourhood()
+{
+  m_nNeighbours = 6;
+  m_Neighbors.resize(m_nNeighbours);
+
+  m_Neighbors[0] = {{-1,0,0}};
+  m_Neighbors[1] = {{+1,0,0}};
+  m_Neighbors[2] = {{0,-1,0}};
+  m_Neighbors[3] = {{0,+1,0}};
+  m_Neighbors[4] = {{0,0,-1}};
+  m_Neighbors[5] = {{0,0,+1}};
+}
+
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+typename BatchedGridCutImageFilter< TInputImage, TMaskImage, TOutputImage >::CostType
+BatchedGridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
+::ComputeDataTerm(const InputPixelType p, const LabelType l, const MaskPixelType m, const MaskPixelType roiLabel)
+{
+  itkExceptionMacro(<< "ComputeDataTerm not overwritten");
+}
+
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+typename BatchedGridCutImageFilter< TInputImage, TMaskImage, TOutputImage >::CostType
+BatchedGridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
+::ComputeSmoothnessTerm(const InputPixelType p, const InputPixelType q, const DistanceType d,
+  const MaskPixelType m_p, const MaskPixelType m_q, const MaskPixelType roiLabel)
+{
+  itkExceptionMacro(<< "ComputeSmoothnessTerm not overwritten");
+}
+
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+void
+BatchedGridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "Number of labels: " << this->m_Labels.size() << std::endl;
+  os << indent << "Neighbourhood size: " << this->m_nNeighbours << std::endl;
+  os << indent << "Block size: " << this->m_BlockSize << std::endl;
+  os << indent << "Max flow: " << this->m_MaxFlow << std::endl;
+  os << indent << "Weight scale: " << this->m_WeightScale << std::endl;
+  os << indent << "Padding: " << this->m_Padding << std::endl;
+  os << indent << "Gap size: " << this->m_GapSize << std::endl;
+  os << indent << "Grid size: " << this->m_GridSize << std::endl;
+}
+
+} /* end namespace */
+
+#endif /* itkBatchedGridCutImageFilter_hxx */
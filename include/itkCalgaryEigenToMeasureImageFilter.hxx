@@ -20,6 +20,7 @@
 #define itkCalgaryEigenToMeasureImageFilter_hxx
 
 #include "itkCalgaryEigenToMeasureImageFilter.h"
+#include "femurTrace.h"
 #include "itkImageRegionConstIteratorWithIndex.h"
 #include "itkImageRegionIterator.h"
 
@@ -35,6 +36,8 @@ void
 CalgaryEigenToMeasureImageFilter< TInputImage, TOutputImage >
 ::BeforeThreadedGenerateData()
 {
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "BeforeThreadedGenerateData");
+
   ParameterArrayType parameters = this->GetParametersInput()->Get();
   if (parameters.GetSize() != 2)
   {
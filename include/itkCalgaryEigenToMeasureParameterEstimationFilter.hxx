@@ -20,6 +20,7 @@
 #define itkCalgaryEigenToMeasureParameterEstimationFilter_hxx
 
 #include "itkCalgaryEigenToMeasureParameterEstimationFilter.h"
+#include "femurTrace.h"
 
 namespace itk {
 
@@ -42,6 +43,8 @@ void
 CalgaryEigenToMeasureParameterEstimationFilter< TInputImage, TOutputImage >
 ::BeforeThreadedGenerateData()
 {
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "BeforeThreadedGenerateData");
+
   m_MaxFrobeniusNorm = NumericTraits< RealType >::NonpositiveMin();
 }
 
@@ -50,6 +53,8 @@ void
 CalgaryEigenToMeasureParameterEstimationFilter< TInputImage, TOutputImage >
 ::AfterThreadedGenerateData()
 {
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "AfterThreadedGenerateData");
+
   /* Determine default parameters */
   RealType alpha, c;
   alpha = 0.5f;
@@ -70,6 +75,8 @@ void
 CalgaryEigenToMeasureParameterEstimationFilter< TInputImage, TOutputImage >
 ::DynamicThreadedGenerateData(const OutputImageRegionType & outputRegionForThread)
 {
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "DynamicThreadedGenerateData");
+
   /* If size is zero, return */
   const SizeValueType size0 = outputRegionForThread.GetSize(0);
   if (size0 == 0)
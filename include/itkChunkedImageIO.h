@@ -0,0 +1,112 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef itkChunkedImageIO_h
+#define itkChunkedImageIO_h
+
+#include "itkImageIOBase.h"
+#include "femurChunkedFormat.h"
+
+namespace itk {
+/** \class ChunkedImageIO
+ * \brief Chunked, compressed intermediates (.fsc) that can be read by region
+ *
+ * Volumes are stored as fixed size chunks, each deflated at a fast level, behind
+ * a chunk index (see femurChunkedFormat.h). The IO can stream reads, so an
+ * ImageFileReader whose output is asked for a femur ROI only reads and inflates
+ * the chunks overlapping it.
+ *
+ * Float and double volumes can be quantized to int16 on write by setting a
+ * QuantizationScale; stored = round(value * scale) and values are divided by the
+ * scale again on read. A scale of 1000 keeps sheetness, which lies in [-1, 1], to
+ * within 5e-4.
+ */
+class ChunkedImageIO : public ImageIOBase
+{
+public:
+  ITK_DISALLOW_COPY_AND_ASSIGN(ChunkedImageIO);
+
+  /** Standard class typedefs. */
+  using Self          = ChunkedImageIO;
+  using Superclass    = ImageIOBase;
+  using Pointer       = SmartPointer< Self >;
+  using ConstPointer  = SmartPointer< const Self >;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(ChunkedImageIO, ImageIOBase);
+
+  /** Edge length of a chunk in voxels */
+  itkSetClampMacro(ChunkSize, unsigned int, 1, 4096);
+  itkGetConstMacro(ChunkSize, unsigned int);
+
+  /** zlib level used when writing */
+  itkSetClampMacro(CompressionLevel, int, 1, 9);
+  itkGetConstMacro(CompressionLevel, int);
+
+  /** Quantize float volumes to int16 with this scale, 0 disables */
+  itkSetClampMacro(QuantizationScale, double, 0.0, NumericTraits< double >::max());
+  itkGetConstMacro(QuantizationScale, double);
+
+  /** Number of threads for compression and decompression */
+  itkSetClampMacro(NumberOfThreads, unsigned int, 1, NumericTraits< unsigned int >::max());
+  itkGetConstMacro(NumberOfThreads, unsigned int);
+
+  bool CanReadFile(const char *fileName) override;
+
+  bool CanStreamRead() override
+  {
+    return true;
+  }
+
+  void ReadImageInformation() override;
+
+  void Read(void *buffer) override;
+
+  bool CanWriteFile(const char *fileName) override;
+
+  void WriteImageInformation() override {}
+
+  void Write(const void *buffer) override;
+
+protected:
+  ChunkedImageIO();
+  ~ChunkedImageIO() override {}
+
+  void PrintSelf(std::ostream & os, Indent indent) const override;
+
+  /** Map between ITK component types and the ones in the file */
+  femur::ChunkedComponentType ToChunkedComponentType(IOComponentType type) const;
+  IOComponentType FromChunkedComponentType(femur::ChunkedComponentType type) const;
+
+private:
+  unsigned int          m_ChunkSize;
+  int                   m_CompressionLevel;
+  double                m_QuantizationScale;
+  unsigned int          m_NumberOfThreads;
+  femur::ChunkedHeader  m_Header;
+}; // end class
+} /* end namespace */
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkChunkedImageIO.hxx"
+#endif
+
+#endif /* itkChunkedImageIO_h */
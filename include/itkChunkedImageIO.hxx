@@ -0,0 +1,236 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef itkChunkedImageIO_hxx
+#define itkChunkedImageIO_hxx
+
+#include "itkChunkedImageIO.h"
+#include "femurTrace.h"
+#include "itkMultiThreaderBase.h"
+
+#include <fstream>
+
+namespace itk {
+
+inline
+ChunkedImageIO
+::ChunkedImageIO() :
+  m_ChunkSize(64),
+  m_CompressionLevel(1),
+  m_QuantizationScale(0.0),
+  m_NumberOfThreads(MultiThreaderBase::GetGlobalDefaultNumberOfThreads())
+{
+  this->SetNumberOfDimensions(3);
+  this->AddSupportedReadExtension(".fsc");
+  this->AddSupportedWriteExtension(".fsc");
+}
+
+inline femur::ChunkedComponentType
+ChunkedImageIO
+::ToChunkedComponentType(IOComponentType type) const
+{
+  switch ( type )
+  {
+  case ImageIOBase::UCHAR:
+    return femur::ChunkedComponentType::UInt8;
+  case ImageIOBase::CHAR:
+    return femur::ChunkedComponentType::Int8;
+  case ImageIOBase::USHORT:
+    return femur::ChunkedComponentType::UInt16;
+  case ImageIOBase::SHORT:
+    return femur::ChunkedComponentType::Int16;
+  case ImageIOBase::UINT:
+    return femur::ChunkedComponentType::UInt32;
+  case ImageIOBase::INT:
+    return femur::ChunkedComponentType::Int32;
+  case ImageIOBase::ULONG:
+    return sizeof(unsigned long) == 8 ? femur::ChunkedComponentType::UInt64 : femur::ChunkedComponentType::UInt32;
+  case ImageIOBase::LONG:
+    return sizeof(long) == 8 ? femur::ChunkedComponentType::Int64 : femur::ChunkedComponentType::Int32;
+  case ImageIOBase::ULONGLONG:
+    return femur::ChunkedComponentType::UInt64;
+  case ImageIOBase::LONGLONG:
+    return femur::ChunkedComponentType::Int64;
+  case ImageIOBase::FLOAT:
+    return femur::ChunkedComponentType::Float32;
+  case ImageIOBase::DOUBLE:
+    return femur::ChunkedComponentType::Float64;
+  default:
+    itkExceptionMacro(<< "Unsupported component type " << ImageIOBase::GetComponentTypeAsString(type));
+  }
+}
+
+inline ImageIOBase::IOComponentType
+ChunkedImageIO
+::FromChunkedComponentType(femur::ChunkedComponentType type) const
+{
+  switch ( type )
+  {
+  case femur::ChunkedComponentType::UInt8:
+    return ImageIOBase::UCHAR;
+  case femur::ChunkedComponentType::Int8:
+    return ImageIOBase::CHAR;
+  case femur::ChunkedComponentType::UInt16:
+    return ImageIOBase::USHORT;
+  case femur::ChunkedComponentType::Int16:
+    return ImageIOBase::SHORT;
+  case femur::ChunkedComponentType::UInt32:
+    return ImageIOBase::UINT;
+  case femur::ChunkedComponentType::Int32:
+    return ImageIOBase::INT;
+  case femur::ChunkedComponentType::UInt64:
+    return ImageIOBase::ULONGLONG;
+  case femur::ChunkedComponentType::Int64:
+    return ImageIOBase::LONGLONG;
+  case femur::ChunkedComponentType::Float32:
+    return ImageIOBase::FLOAT;
+  case femur::ChunkedComponentType::Float64:
+    return ImageIOBase::DOUBLE;
+  }
+  itkExceptionMacro(<< "Unknown chunked component type " << static_cast< unsigned int >(type));
+}
+
+inline bool
+ChunkedImageIO
+::CanReadFile(const char *fileName)
+{
+  if ( !this->HasSupportedReadExtension(fileName) )
+  {
+    return false;
+  }
+
+  std::ifstream in(fileName, std::ios::binary);
+  char magic[8];
+  in.read(magic, sizeof(magic));
+  return in && std::memcmp(magic, "FEMURCH1", 8) == 0;
+}
+
+inline void
+ChunkedImageIO
+::ReadImageInformation()
+{
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "ReadImageInformation");
+
+  std::ifstream in(this->GetFileName(), std::ios::binary);
+  if ( !in || !femur::ReadChunkedHeader(in, m_Header) )
+  {
+    itkExceptionMacro(<< this->GetFileName() << " is not a chunked image");
+  }
+
+  this->SetNumberOfDimensions(m_Header.Dimension);
+  this->SetPixelType(ImageIOBase::SCALAR);
+  this->SetNumberOfComponents(1);
+  this->SetComponentType(this->FromChunkedComponentType(m_Header.ComponentType));
+
+  for (unsigned int i = 0; i < m_Header.Dimension; ++i)
+  {
+    this->SetDimensions(i, m_Header.Size[i]);
+    this->SetSpacing(i, m_Header.Spacing[i]);
+    this->SetOrigin(i, m_Header.Origin[i]);
+
+    std::vector< double > axis(m_Header.Dimension);
+    for (unsigned int j = 0; j < m_Header.Dimension; ++j)
+    {
+      axis[j] = m_Header.Direction[j * 3 + i];
+    }
+    this->SetDirection(i, axis);
+  }
+}
+
+inline void
+ChunkedImageIO
+::Read(void *buffer)
+{
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "Read");
+
+  std::uint64_t start[3] = {0, 0, 0};
+  std::uint64_t extent[3] = {1, 1, 1};
+  for (unsigned int i = 0; i < m_Header.Dimension; ++i)
+  {
+    start[i] = this->GetIORegion().GetIndex(i);
+    extent[i] = this->GetIORegion().GetSize(i);
+  }
+
+  femur::ReadChunkedRegion(this->GetFileName(), m_Header, start, extent, buffer, m_NumberOfThreads);
+}
+
+inline bool
+ChunkedImageIO
+::CanWriteFile(const char *fileName)
+{
+  return this->HasSupportedWriteExtension(fileName);
+}
+
+inline void
+ChunkedImageIO
+::Write(const void *buffer)
+{
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "Write");
+
+  if ( this->GetNumberOfDimensions() > 3 || this->GetNumberOfComponents() != 1 )
+  {
+    itkExceptionMacro(<< "Chunked images hold scalar volumes of up to 3 dimensions");
+  }
+
+  femur::ChunkedHeader header;
+  header.Dimension = this->GetNumberOfDimensions();
+  header.ComponentType = this->ToChunkedComponentType(this->GetComponentType());
+  header.StoredComponentType = header.ComponentType;
+
+  const bool isReal = this->GetComponentType() == ImageIOBase::FLOAT || this->GetComponentType() == ImageIOBase::DOUBLE;
+  if ( m_QuantizationScale > 0.0 && isReal )
+  {
+    header.StoredComponentType = femur::ChunkedComponentType::Int16;
+    header.QuantizationScale = m_QuantizationScale;
+  }
+
+  for (unsigned int i = 0; i < header.Dimension; ++i)
+  {
+    header.ChunkSize[i] = m_ChunkSize;
+    header.Size[i] = this->GetDimensions(i);
+    header.Spacing[i] = this->GetSpacing(i);
+    header.Origin[i] = this->GetOrigin(i);
+    for (unsigned int j = 0; j < header.Dimension; ++j)
+    {
+      header.Direction[j * 3 + i] = this->GetDirection(i)[j];
+    }
+  }
+
+  const std::uint64_t clamped =
+    femur::WriteChunkedFile(this->GetFileName(), header, buffer, m_CompressionLevel, m_NumberOfThreads);
+  if ( clamped > 0 )
+  {
+    itkWarningMacro(<< clamped << " values of " << this->GetFileName() << " fall outside the int16 range at quantization scale "
+                    << m_QuantizationScale << " and were clamped");
+  }
+}
+
+inline void
+ChunkedImageIO
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "ChunkSize: " << m_ChunkSize << std::endl;
+  os << indent << "CompressionLevel: " << m_CompressionLevel << std::endl;
+  os << indent << "QuantizationScale: " << m_QuantizationScale << std::endl;
+  os << indent << "NumberOfThreads: " << m_NumberOfThreads << std::endl;
+}
+
+} /* end namespace */
+
+#endif /* itkChunkedImageIO_hxx */
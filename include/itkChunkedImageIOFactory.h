@@ -0,0 +1,77 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef itkChunkedImageIOFactory_h
+#define itkChunkedImageIOFactory_h
+
+#include "itkObjectFactoryBase.h"
+#include "itkVersion.h"
+#include "itkChunkedImageIO.h"
+
+namespace itk {
+/** \class ChunkedImageIOFactory
+ * \brief Create instances of ChunkedImageIO objects using an object factory.
+ */
+class ChunkedImageIOFactory : public ObjectFactoryBase
+{
+public:
+  ITK_DISALLOW_COPY_AND_ASSIGN(ChunkedImageIOFactory);
+
+  /** Standard class typedefs. */
+  using Self          = ChunkedImageIOFactory;
+  using Superclass    = ObjectFactoryBase;
+  using Pointer       = SmartPointer< Self >;
+  using ConstPointer  = SmartPointer< const Self >;
+
+  const char * GetITKSourceVersion() const override
+  {
+    return ITK_SOURCE_VERSION;
+  }
+
+  const char * GetDescription() const override
+  {
+    return "Chunked ImageIO Factory, allows loading .fsc intermediates into insight";
+  }
+
+  /** Method for class instantiation. */
+  itkFactorylessNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(ChunkedImageIOFactory, ObjectFactoryBase);
+
+  /** Register one factory of this type */
+  static void RegisterOneFactory()
+  {
+    ChunkedImageIOFactory::Pointer factory = ChunkedImageIOFactory::New();
+    ObjectFactoryBase::RegisterFactory(factory);
+  }
+
+protected:
+  ChunkedImageIOFactory()
+  {
+    this->RegisterOverride("itkImageIOBase",
+                           "itkChunkedImageIO",
+                           "Chunked Image IO",
+                           true,
+                           CreateObjectFunction< ChunkedImageIO >::New());
+  }
+  ~ChunkedImageIOFactory() override {}
+}; // end class
+} /* end namespace */
+
+#endif /* itkChunkedImageIOFactory_h */
@@ -20,6 +20,7 @@
 #define itkEigenToMeasureImageFilter_hxx
 
 #include "itkEigenToMeasureImageFilter.h"
+#include "femurTrace.h"
 #include "itkImageRegionConstIteratorWithIndex.h"
 #include "itkImageRegionIterator.h"
 
@@ -30,6 +31,8 @@ void
 EigenToMeasureImageFilter< TInputImage, TOutputImage >
 ::DynamicThreadedGenerateData(const OutputImageRegionType & outputRegionForThread)
 {
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "DynamicThreadedGenerateData");
+
   /* Get Inputs */
   InputImageConstPointer  inputPtr = this->GetInput(0);
   OutputImagePointer outputPtr = this->GetOutput(0);
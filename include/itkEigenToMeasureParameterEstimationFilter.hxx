@@ -75,6 +75,13 @@ EigenToMeasureParameterEstimationFilter< TInputImage, TOutputImage >
 
   this->SetAbortGenerateData(0);
   this->UpdateProgress(0.0);
+
+  /** Cleared on every way out, an exception must not leave the filter refusing later updates */
+  struct UpdatingGuard
+  {
+    bool & updating;
+    ~UpdatingGuard() { updating = false; }
+  } updatingGuard{this->m_Updating};
   this->m_Updating = true;
 
   /** Allocate the output buffer. */
@@ -124,9 +131,13 @@ EigenToMeasureParameterEstimationFilter< TInputImage, TOutputImage >
     inputPtr->PropagateRequestedRegion();
     inputPtr->UpdateOutputData();
 
-    /* Process this chunk */
-    this->ThreadedGenerateData(streamRegion, piece);
-    
+    /* Process this chunk on the filter's threader. No thread ids, so several
+     * instances of the filter can run side by side. */
+    this->GetMultiThreader()->template ParallelizeImageRegion< ImageDimension >(
+      streamRegion,
+      [this](const OutputImageRegionType & region) { this->DynamicThreadedGenerateData(region); },
+      nullptr);
+
     /* Update progress and stream another chunk */
     this->UpdateProgress( static_cast<float>(piece) / static_cast<float>(numDivisions) );
   }
@@ -158,9 +169,6 @@ EigenToMeasureParameterEstimationFilter< TInputImage, TOutputImage >
 
   /** Release any inputs if marked for release */
   this->ReleaseInputs();
-
-  /** Mark that we are no longer updating the data in this filter */
-  this->m_Updating = false;
 }
 
 template< typename TInputImage, typename TOutputImage >
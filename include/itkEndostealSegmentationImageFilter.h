@@ -22,7 +22,6 @@
 
 #include "itkGridCutImageFilter.h"
 #include "itkSignedMaurerDistanceMapImageFilter.h"
-#include "itkMaskImageFilter.h"
 
 namespace itk {
 /** \class EndostealSegmentationImageFilter
@@ -69,18 +68,16 @@ public:
   using OffsetType = typename Superclass::OffsetType;
   using MaskIterator = typename Superclass::MaskIterator;
   using InputImageType = typename Superclass::InputImageType;
+  using OutputIteratorType = typename Superclass::OutputIteratorType;
+  using IndexType = typename Superclass::IndexType;
 
   /** Signed distance filter */
   using MaskImageType           = typename Superclass::MaskImageType;
   using DistanceImageType       = Image< RealType, MaskImageType::ImageDimension >;
-  using DistanceConstImageType  = typename DistanceImageType::ConstPointer; 
+  using DistanceImagePointer    = typename DistanceImageType::Pointer;
   using DistanceFilterType      = SignedMaurerDistanceMapImageFilter< MaskImageType, DistanceImageType >;
-  using DistanceIteratorType    = ConstShapedNeighborhoodIterator< DistanceImageType >;
   using DistanceImageRegionType = typename DistanceImageType::RegionType;
 
-  /** Masking filter */
-  using MaskFilterType = MaskImageFilter< MaskImageType, MaskImageType, MaskImageType >;
-
   /** Set/Get macros for BackgroundLabel */
   itkSetMacro(BackgroundLabel, MaskPixelType);
   itkGetConstMacro(BackgroundLabel, MaskPixelType);
@@ -121,6 +118,13 @@ protected:
 
   OutputImagePixelType GetLabel(const LabelType l) const override;
 
+  /** Bounding box of the nonzero mask voxels, padded so it holds every voxel within
+   * MaxDistance of them and cropped to the image. Empty for an empty mask. */
+  DistanceImageRegionType ComputeDistanceRegion();
+
+  /** Labels outside the mask are set to zero as they are read out */
+  void DynamicThreadedReadOutLabels(const OutputImageRegionType & outputRegionForThread) override;
+
   /** Multi-threading. */
   void BeforeThreadedGenerateData() override;
   void AfterThreadedGenerateData() override;
@@ -136,8 +140,10 @@ private:
   RealType                    m_MaxDistance;
 	RealType										m_MinDistance;
 
-  typename DistanceFilterType::Pointer m_DistanceFilter;
-  typename MaskFilterType::Pointer     m_MaskingFilter;
+  /* Signed distance to the mask over m_DistanceRegion, everything outside reads m_OutsideDistance */
+  DistanceImagePointer        m_Distance;
+  DistanceImageRegionType     m_DistanceRegion;
+  RealType                    m_OutsideDistance;
 }; // end class
 } /* end namespace */
 
@@ -20,6 +20,14 @@
 #define itkEndostealSegmentationImageFilter_hxx
 
 #include "itkEndostealSegmentationImageFilter.h"
+#include "femurTrace.h"
+#include "itkImageAlgorithm.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
 
 namespace itk {
 template< typename TInputImage, typename TMaskImage, typename TOutputImage >
@@ -31,10 +39,73 @@ EndostealSegmentationImageFilter< TInputImage, TMaskImage, TOutputImage >
   m_Lambda(5.0),
   m_Sigma(0.2),
   m_MaxDistance(2.0),
-	m_MinDistance(1.0)
+	m_MinDistance(1.0),
+  m_OutsideDistance(0.0)
+{
+  m_Distance = nullptr;
+}
+
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+typename EndostealSegmentationImageFilter< TInputImage, TMaskImage, TOutputImage >::DistanceImageRegionType
+EndostealSegmentationImageFilter< TInputImage, TMaskImage, TOutputImage >
+::ComputeDistanceRegion()
 {
-  m_DistanceFilter = nullptr;
-  m_MaskingFilter = nullptr;
+  const MaskImageType * mask = this->GetMask();
+  const MaskImageRegionType largest = mask->GetLargestPossibleRegion();
+  constexpr unsigned int Dimension = MaskImageType::ImageDimension;
+
+  /* Bounding box of the nonzero voxels, empty when min > max */
+  IndexType minIndex, maxIndex;
+  minIndex.Fill(NumericTraits< IndexValueType >::max());
+  maxIndex.Fill(NumericTraits< IndexValueType >::NonpositiveMin());
+
+  std::mutex mutex;
+  this->GetMultiThreader()->template ParallelizeImageRegion< Dimension >(
+    largest,
+    [&](const MaskImageRegionType & region)
+    {
+      IndexType localMin, localMax;
+      localMin.Fill(NumericTraits< IndexValueType >::max());
+      localMax.Fill(NumericTraits< IndexValueType >::NonpositiveMin());
+      ImageRegionConstIteratorWithIndex< MaskImageType > it(mask, region);
+      for ( it.GoToBegin(); !it.IsAtEnd(); ++it )
+      {
+        if ( it.Get() == NumericTraits< MaskPixelType >::ZeroValue() )
+        {
+          continue;
+        }
+        const IndexType p = it.GetIndex();
+        for (unsigned int d = 0; d < Dimension; ++d)
+        {
+          localMin[d] = std::min(localMin[d], p[d]);
+          localMax[d] = std::max(localMax[d], p[d]);
+        }
+      }
+
+      std::lock_guard< std::mutex > lock(mutex);
+      for (unsigned int d = 0; d < Dimension; ++d)
+      {
+        minIndex[d] = std::min(minIndex[d], localMin[d]);
+        maxIndex[d] = std::max(maxIndex[d], localMax[d]);
+      }
+    },
+    nullptr);
+
+  DistanceImageRegionType region;
+  if ( minIndex[0] > maxIndex[0] )
+  {
+    return region;
+  }
+
+  /* Pad by MaxDistance and one voxel, so every distance the data term tells apart is exact */
+  for (unsigned int d = 0; d < Dimension; ++d)
+  {
+    const IndexValueType pad = static_cast< IndexValueType >(std::ceil(m_MaxDistance / mask->GetSpacing()[d])) + 1;
+    region.SetIndex(d, minIndex[d] - pad);
+    region.SetSize(d, static_cast< SizeValueType >(maxIndex[d] - minIndex[d] + 1 + 2 * pad));
+  }
+  region.Crop(largest);
+  return region;
 }
 
 template< typename TInputImage, typename TMaskImage, typename TOutputImage >
@@ -42,16 +113,48 @@ void
 EndostealSegmentationImageFilter< TInputImage, TMaskImage, TOutputImage >
 ::BeforeThreadedGenerateData()
 {
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "BeforeThreadedGenerateData");
+
   /* Set everything up */
   Superclass::BeforeThreadedGenerateData();
 
+  /* The data term only tells d < MinDistance, d > MaxDistance and between apart, so the
+   * distance map is only needed near the mask. Voxels outside the padded box are further
+   * than MaxDistance from it and all read the nearest they can be. */
+  const MaskImageType * mask = this->GetMask();
+  m_DistanceRegion = this->ComputeDistanceRegion();
+  RealType nearest = NumericTraits< RealType >::max();
+  for (unsigned int d = 0; d < MaskImageType::ImageDimension; ++d)
+  {
+    const RealType spacing = mask->GetSpacing()[d];
+    nearest = std::min(nearest, (std::ceil(m_MaxDistance / spacing) + 1) * spacing);
+  }
+  m_OutsideDistance = -nearest;
+
+  m_Distance = nullptr;
+  if ( m_DistanceRegion.GetNumberOfPixels() == 0 )
+  {
+    return;
+  }
+
+  /* Copy the box out of the mask */
+  typename MaskImageType::Pointer box = MaskImageType::New();
+  box->CopyInformation(mask);
+  box->SetRegions(m_DistanceRegion);
+  box->Allocate();
+  ImageAlgorithm::Copy(mask, box.GetPointer(), m_DistanceRegion, m_DistanceRegion);
+
   /* Create the distance image */
-  m_DistanceFilter = DistanceFilterType::New();
-  m_DistanceFilter->SetInput(this->GetMask());
-  m_DistanceFilter->SquaredDistanceOff();
-  m_DistanceFilter->UseImageSpacingOn();
-  m_DistanceFilter->InsideIsPositiveOn();
-  m_DistanceFilter->Update();
+  typename DistanceFilterType::Pointer distanceFilter = DistanceFilterType::New();
+  distanceFilter->SetInput(box);
+  distanceFilter->SquaredDistanceOff();
+  distanceFilter->UseImageSpacingOn();
+  distanceFilter->InsideIsPositiveOn();
+  distanceFilter->SetNumberOfWorkUnits(this->GetNumberOfWorkUnits());
+  distanceFilter->Update();
+
+  m_Distance = distanceFilter->GetOutput();
+  m_Distance->DisconnectPipeline();
 }
 
 template< typename TInputImage, typename TMaskImage, typename TOutputImage >
@@ -59,21 +162,36 @@ void
 EndostealSegmentationImageFilter< TInputImage, TMaskImage, TOutputImage >
 ::AfterThreadedGenerateData()
 {
-  /* Set everything up */
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "AfterThreadedGenerateData");
+
+  /* Solve and read out, masked by DynamicThreadedReadOutLabels */
   Superclass::AfterThreadedGenerateData();
 
-  /* Mask by input */
-  m_MaskingFilter = MaskFilterType::New();
-  m_MaskingFilter->SetInput(this->GetOutput(0));
-  m_MaskingFilter->SetMaskImage(this->GetMask());
-  m_MaskingFilter->SetMaskingValue(0);
-  m_MaskingFilter->SetOutsideValue(0);
-  m_MaskingFilter->Update();
-  this->GraftOutput(m_MaskingFilter->GetOutput());
-
-  /* Clean up filters */
-  m_DistanceFilter = nullptr;
-  m_MaskingFilter = nullptr;
+  /* Clean up */
+  m_Distance = nullptr;
+}
+
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+void
+EndostealSegmentationImageFilter< TInputImage, TMaskImage, TOutputImage >
+::DynamicThreadedReadOutLabels(const OutputImageRegionType & outputRegionForThread)
+{
+  MaskImageRegionType maskRegionForThread;
+  this->CallCopyOutputRegionToInputRegion(maskRegionForThread, outputRegionForThread);
+
+  OutputIteratorType ot(this->GetOutput(0), outputRegionForThread);
+  ImageRegionConstIterator< MaskImageType > mt(this->GetMask(), maskRegionForThread);
+  for ( ot.GoToBegin(), mt.GoToBegin(); !ot.IsAtEnd(); ++ot, ++mt )
+  {
+    if ( mt.Get() == NumericTraits< MaskPixelType >::ZeroValue() )
+    {
+      ot.Set( NumericTraits< OutputImagePixelType >::ZeroValue() );
+    }
+    else
+    {
+      ot.Set( this->GetLabel( this->GetSegment(ot.GetIndex()) ) );
+    }
+  }
 }
 
 template< typename TInputImage, typename TMaskImage, typename TOutputImage >
@@ -81,19 +199,18 @@ void
 EndostealSegmentationImageFilter< TInputImage, TMaskImage, TOutputImage >
 ::DynamicThreadedGenerateData(const OutputImageRegionType & outputRegionForThread)
 {
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "DynamicThreadedGenerateData");
+
   /* Get Inputs */
   InputImageConstPointer input = this->GetInput(0);
   MaskImageConstPointer mask = this->GetMask();
   InputImageRegionType image_region = input->GetLargestPossibleRegion();
-  DistanceConstImageType dist = m_DistanceFilter->GetOutput();
 
   /* Setup regions */
-  DistanceImageRegionType distanceRegionForThread;
   InputImageRegionType inputRegionForThread;
   MaskImageRegionType maskRegionForThread;
   this->CallCopyOutputRegionToInputRegion(inputRegionForThread, outputRegionForThread);
   this->CallCopyOutputRegionToInputRegion(maskRegionForThread, outputRegionForThread);
-  this->CallCopyOutputRegionToInputRegion(distanceRegionForThread, outputRegionForThread);
 
   /* Setup Iterator */
   typename ShapedIteratorType::RadiusType radius;
@@ -103,16 +220,15 @@ EndostealSegmentationImageFilter< TInputImage, TMaskImage, TOutputImage >
   typename ShapedIteratorType::OffsetType center = {{0, 0, 0}};
 
   MaskIterator mi(radius, mask, maskRegionForThread);
-  DistanceIteratorType di(radius, dist, distanceRegionForThread);
 
   /* Iterate and perform logic */
   bool pixelIsValid;
-  for( it.GoToBegin(), mi.GoToBegin(), di.GoToBegin(); !it.IsAtEnd(); ++it, ++mi, ++di )
+  for( it.GoToBegin(), mi.GoToBegin(); !it.IsAtEnd(); ++it, ++mi )
   {
     /* Get index and iterator */
     auto p_value = it.GetPixel(center);
     auto p = it.GetIndex(center);
-    auto d_value = di.GetPixel(center);
+    const RealType d_value = m_DistanceRegion.IsInside(p) ? m_Distance->GetPixel(p) : m_OutsideDistance;
 
     auto m_p_value = mi.GetPixel(center);
 
@@ -27,6 +27,7 @@
 #include "itkImageRegionConstIteratorWithIndex.h"
 
 #include "GridGraph_3D_6C_MT.h"
+#include "femurBufferPool.h"
 #include <vector>
 
 namespace itk {
@@ -78,7 +79,7 @@ public:
   using CostType      = int;
   using EnergyType    = typename NumericTraits< InputPixelType >::RealType;
   using Grid          = GridGraph_3D_6C_MT< CostType, CostType, EnergyType >;
-  using VectorType    = std::vector< CostType >;
+  using VectorType    = std::vector< CostType, femur::PoolAllocator< CostType > >;
   using NLinkType     = std::vector< VectorType >;
   using TLinkType     = std::vector< VectorType >;
   using RealType      = typename NumericTraits< InputPixelType >::RealType;
@@ -135,6 +136,17 @@ protected:
   void SetDataTerm(const IndexType p, const LabelType l, const CostType cost);
   void SetSmoothTerm(const IndexType p, const LabelType n_i, const CostType cost);
 
+  /** Steps of AfterThreadedGenerateData: solve the max flow, write labels to the output, free the graph */
+  virtual void SolveGraph();
+  virtual void ReadOutLabels();
+  virtual void ReleaseGraph();
+
+  /** Write the labels of one region of the output, called in parallel by ReadOutLabels */
+  virtual void DynamicThreadedReadOutLabels(const OutputImageRegionType & outputRegionForThread);
+
+  /** Side of the cut voxel p ended on, valid between SolveGraph and ReleaseGraph */
+  LabelType GetSegment(const IndexType & p);
+
   /** Multi-threading. */
   void BeforeThreadedGenerateData() override;
   void AfterThreadedGenerateData() override;
@@ -146,7 +158,7 @@ private:
   TLinkType             m_tLinks;
   LabelType             m_nLabels;
   LabelType             m_nNeighbours;
-  LabelType             m_nVoxels;
+  SizeValueType         m_nVoxels;
   NeighboursType        m_Neighbors;
   LabelType             m_BlockSize;
   EnergyType            m_MaxFlow;
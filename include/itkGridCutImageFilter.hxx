@@ -20,6 +20,8 @@
 #define itkGridCutImageFilter_hxx
 
 #include "itkGridCutImageFilter.h"
+#include "femurTrace.h"
+#include "femurThreadPool.h"
 
 
 namespace itk {
@@ -41,6 +43,8 @@ void
 GridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
 ::BeforeThreadedGenerateData()
 {
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "BeforeThreadedGenerateData");
+
   /* May have specific inputs here */
   this->SetupNeighbourhood();
 
@@ -48,23 +52,18 @@ GridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
   this->m_Dimensions = this->GetInput(0)->GetLargestPossibleRegion().GetSize();
   this->m_nVoxels = this->m_Dimensions[0]*this->m_Dimensions[1]*this->m_Dimensions[2];
 
-  /* Create graph */
-  this->m_Grid = std::unique_ptr<Grid>(new Grid(
-    this->m_Dimensions[0], this->m_Dimensions[1], this->m_Dimensions[2],
-    this->GetMultiThreader()->GetMaximumNumberOfThreads(), this->m_BlockSize
-  ));
-
-  /* Create arrays */
+  /* Create arrays. Edges leaving the image are never set, so they must start at zero
+   * even if an earlier update threw before releasing the arrays. */
   this->m_tLinks.resize(this->m_nLabels);
   for (unsigned int i = 0; i < this->m_nLabels; ++i)
   {
-    this->m_tLinks[i].resize(this->m_nVoxels, 0);
+    this->m_tLinks[i].assign(this->m_nVoxels, 0);
   }
 
   this->m_nLinks.resize(this->m_nNeighbours);
   for (unsigned int i = 0; i < this->m_nNeighbours; ++i)
   {
-    this->m_nLinks[i].resize(this->m_nVoxels, 0);
+    this->m_nLinks[i].assign(this->m_nVoxels, 0);
   }
 
   /* Reset max flow */
@@ -76,7 +75,38 @@ void
 GridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
 ::AfterThreadedGenerateData()
 {
-  /* Solve the graph */
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "AfterThreadedGenerateData");
+
+  /* The graph and terms are per update, free them however the update ends */
+  try
+  {
+    this->SolveGraph();
+    this->ReadOutLabels();
+  }
+  catch (...)
+  {
+    this->ReleaseGraph();
+    throw;
+  }
+  this->ReleaseGraph();
+}
+
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+void
+GridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
+::SolveGraph()
+{
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "SolveGraph");
+
+  /* The solver runs threads of its own, take them from the shared pool while it works */
+  femur::ThreadReservation reservation(this->GetMultiThreader()->GetMaximumNumberOfThreads() - 1);
+
+  /* Create graph */
+  this->m_Grid = std::unique_ptr<Grid>(new Grid(
+    this->m_Dimensions[0], this->m_Dimensions[1], this->m_Dimensions[2],
+    reservation.GetNumberOfThreads(), this->m_BlockSize
+  ));
+
   m_Grid->set_caps(
     this->m_tLinks[0].data(),  // cap_source
     this->m_tLinks[1].data(),  // cap_sink
@@ -90,22 +120,48 @@ GridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
   );
   m_Grid->compute_maxflow();
 
-  /* Read out */
   this->m_MaxFlow = m_Grid->get_flow() / this->m_WeightScale;
+}
 
-  OutputImagePointer          output = this->GetOutput(0);
-  OutputIteratorType          ot(output, output->GetLargestPossibleRegion());
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+void
+GridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
+::ReadOutLabels()
+{
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "ReadOutLabels");
 
-  ot.GoToBegin();
-  while ( !ot.IsAtEnd() )
-  {
-    auto p = ot.GetIndex();
-    auto id = this->m_Grid->node_id(p[0], p[1], p[2]);
-    ot.Set( this->GetLabel( this->m_Grid->get_segment(id) ) );
+  /* The solved graph is only read from here on */
+  this->GetMultiThreader()->template ParallelizeImageRegion< ImageDimension >(
+    this->GetOutput(0)->GetLargestPossibleRegion(),
+    [this](const OutputImageRegionType & region) { this->DynamicThreadedReadOutLabels(region); },
+    nullptr);
+}
 
-    ++ot;
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+void
+GridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
+::DynamicThreadedReadOutLabels(const OutputImageRegionType & outputRegionForThread)
+{
+  OutputIteratorType ot(this->GetOutput(0), outputRegionForThread);
+  for ( ot.GoToBegin(); !ot.IsAtEnd(); ++ot )
+  {
+    ot.Set( this->GetLabel( this->GetSegment(ot.GetIndex()) ) );
   }
+}
+
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+typename GridCutImageFilter< TInputImage, TMaskImage, TOutputImage >::LabelType
+GridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
+::GetSegment(const IndexType & p)
+{
+  return this->m_Grid->get_segment( this->m_Grid->node_id(p[0], p[1], p[2]) );
+}
 
+template< typename TInputImage, typename TMaskImage, typename TOutputImage >
+void
+GridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
+::ReleaseGraph()
+{
   /* Free memory */
   for (unsigned int i = 0; i < this->m_nLabels; ++i)
   {
@@ -119,7 +175,7 @@ GridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
   }
   this->m_nLinks.resize(0);
 
-  this->m_Grid.release();
+  this->m_Grid.reset();
 }
 
 template< typename TInputImage, typename TMaskImage, typename TOutputImage >
@@ -127,6 +183,8 @@ void
 GridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
 ::DynamicThreadedGenerateData(const OutputImageRegionType & outputRegionForThread)
 {
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "DynamicThreadedGenerateData");
+
   /* Get Inputs */
   InputImageConstPointer input = this->GetInput(0);
   MaskImageConstPointer mask = this->GetMask();
@@ -234,7 +292,7 @@ unsigned long
 GridCutImageFilter< TInputImage, TMaskImage, TOutputImage >
 ::GetIndex(const IndexType p)
 {
-  unsigned int id = p[0] + 
+  const unsigned long id = p[0] + 
     p[1]*this->m_Dimensions[0] +
     p[2]*this->m_Dimensions[1] * this->m_Dimensions[0];
 
@@ -20,6 +20,7 @@
 #define itkHessianGaussianImageFilter_hxx
 
 #include "itkHessianGaussianImageFilter.h"
+#include "femurTrace.h"
 #include "itkImageRegionIteratorWithIndex.h"
 #include "itkProgressAccumulator.h"
 #include "itkGaussianDerivativeOperator.h"
@@ -183,6 +184,8 @@ void
 HessianGaussianImageFilter< TInputImage, TOutputImage >
 ::GenerateData(void)
 {
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "GenerateData");
+
   itkDebugMacro(<< "HessianGaussianImageFilter generating data ");
 
   // Create a process accumulator for tracking the progress of this
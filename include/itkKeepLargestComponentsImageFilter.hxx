@@ -0,0 +1,336 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef itkKeepLargestComponentsImageFilter_hxx
+#define itkKeepLargestComponentsImageFilter_hxx
+
+#include "itkKeepLargestComponentsImageFilter.h"
+#include "femurTrace.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace itk {
+template< typename TInputImage, typename TOutputImage >
+KeepLargestComponentsImageFilter< TInputImage, TOutputImage >
+::KeepLargestComponentsImageFilter() :
+  m_NumberOfObjects(1),
+  m_FillHoles(true),
+  m_InsideValue(NumericTraits< OutputPixelType >::OneValue()),
+  m_OutsideValue(NumericTraits< OutputPixelType >::ZeroValue()),
+  m_ObjectCount(0),
+  m_BackgroundObjectCount(0)
+{}
+
+template< typename TInputImage, typename TOutputImage >
+void
+KeepLargestComponentsImageFilter< TInputImage, TOutputImage >
+::GenerateInputRequestedRegion()
+{
+  Superclass::GenerateInputRequestedRegion();
+
+  InputImageType * input = const_cast< InputImageType * >(this->GetInput());
+  if ( input )
+  {
+    input->SetRequestedRegionToLargestPossibleRegion();
+  }
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+KeepLargestComponentsImageFilter< TInputImage, TOutputImage >
+::EnlargeOutputRequestedRegion(DataObject *output)
+{
+  Superclass::EnlargeOutputRequestedRegion(output);
+  output->SetRequestedRegionToLargestPossibleRegion();
+}
+
+template< typename TInputImage, typename TOutputImage >
+template< typename TPredicate >
+void
+KeepLargestComponentsImageFilter< TInputImage, TOutputImage >
+::LabelComponents(TPredicate inClass, ParentArray & parent, CountMapType & counts)
+{
+  const typename InputImageType::SizeType size = this->GetInput()->GetBufferedRegion().GetSize();
+  const std::size_t numberOfVoxels = parent.size();
+
+  /* Linear strides of each axis */
+  std::size_t stride[ImageDimension];
+  stride[0] = 1;
+  for (unsigned int d = 1; d < ImageDimension; ++d)
+  {
+    stride[d] = stride[d-1] * size[d-1];
+  }
+  const unsigned int last = ImageDimension - 1;
+  const std::size_t sliceSize = stride[last];
+
+  /* Slabs along the last axis, one per work unit */
+  const SizeValueType numberOfSlabs = std::max< SizeValueType >(1,
+    std::min< SizeValueType >(this->GetNumberOfWorkUnits(), size[last]));
+  std::vector< std::size_t > slabStart(numberOfSlabs + 1);
+  for (SizeValueType s = 0; s <= numberOfSlabs; ++s)
+  {
+    slabStart[s] = (size[last] * s / numberOfSlabs) * sliceSize;
+  }
+
+  /* Parents always point at a smaller index, so following them terminates */
+  auto findRoot = [&parent](ParentType i)
+  {
+    while ( parent[i] != i )
+    {
+      i = parent[i];
+    }
+    return i;
+  };
+
+  /* Union-find inside each slab, touching only voxels of that slab */
+  this->GetMultiThreader()->ParallelizeArray(0, numberOfSlabs,
+    [&](SizeValueType s)
+    {
+      const std::size_t begin = slabStart[s];
+      const std::size_t end = slabStart[s+1];
+
+      SizeValueType index[ImageDimension] = {};
+      index[last] = begin / sliceSize;
+      for (std::size_t i = begin; i < end; ++i)
+      {
+        if ( inClass(i) )
+        {
+          parent[i] = static_cast< ParentType >(i);
+          for (unsigned int d = 0; d < ImageDimension; ++d)
+          {
+            const bool hasNeighbour = d == last ? i >= begin + stride[d] : index[d] > 0;
+            if ( !hasNeighbour || parent[i - stride[d]] == Outside )
+            {
+              continue;
+            }
+
+            /* Path halving on both sides, then link the larger root under the smaller */
+            ParentType a = static_cast< ParentType >(i);
+            ParentType b = static_cast< ParentType >(i - stride[d]);
+            while ( parent[a] != a )
+            {
+              parent[a] = parent[parent[a]];
+              a = parent[a];
+            }
+            while ( parent[b] != b )
+            {
+              parent[b] = parent[parent[b]];
+              b = parent[b];
+            }
+            if ( a != b )
+            {
+              parent[std::max(a, b)] = std::min(a, b);
+            }
+          }
+        }
+        else
+        {
+          parent[i] = Outside;
+        }
+
+        /* Advance the index, the last axis is bounded by the slab */
+        for (unsigned int d = 0; d < ImageDimension; ++d)
+        {
+          if ( ++index[d] < size[d] || d == last )
+          {
+            break;
+          }
+          index[d] = 0;
+        }
+      }
+
+      /* Point every voxel straight at its slab root. Parents are smaller, so already flat. */
+      for (std::size_t i = begin; i < end; ++i)
+      {
+        if ( parent[i] != Outside )
+        {
+          parent[i] = parent[parent[i]];
+        }
+      }
+    }, nullptr);
+
+  /* Merge slabs across the planes between them. Only slab roots are relinked. */
+  std::vector< ParentType > relinked;
+  for (SizeValueType s = 1; s < numberOfSlabs; ++s)
+  {
+    const std::size_t plane = slabStart[s];
+    for (std::size_t i = plane; i < plane + sliceSize && i < numberOfVoxels; ++i)
+    {
+      if ( parent[i] == Outside || parent[i - sliceSize] == Outside )
+      {
+        continue;
+      }
+      const ParentType a = findRoot(parent[i]);
+      const ParentType b = findRoot(parent[i - sliceSize]);
+      if ( a != b )
+      {
+        parent[std::max(a, b)] = std::min(a, b);
+        relinked.push_back(std::max(a, b));
+      }
+    }
+  }
+
+  /* Resolve relinked roots smallest first, so each one's parent is already final */
+  std::sort(relinked.begin(), relinked.end());
+  for (ParentType r : relinked)
+  {
+    parent[r] = parent[parent[r]];
+  }
+
+  /* Point every voxel at its final root and count voxels per root */
+  std::vector< CountMapType > slabCounts(numberOfSlabs);
+  this->GetMultiThreader()->ParallelizeArray(0, numberOfSlabs,
+    [&](SizeValueType s)
+    {
+      CountMapType & slabCount = slabCounts[s];
+      for (std::size_t i = slabStart[s]; i < slabStart[s+1]; ++i)
+      {
+        const ParentType p = parent[i];
+        if ( p == Outside )
+        {
+          continue;
+        }
+        if ( p != i )
+        {
+          parent[i] = parent[p];
+        }
+        ++slabCount[parent[i]];
+      }
+    }, nullptr);
+
+  counts.clear();
+  for (const CountMapType & slabCount : slabCounts)
+  {
+    for (const auto & entry : slabCount)
+    {
+      counts[entry.first] += entry.second;
+    }
+  }
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+KeepLargestComponentsImageFilter< TInputImage, TOutputImage >
+::GenerateData()
+{
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "GenerateData");
+
+  const InputImageType * input = this->GetInput();
+  OutputImageType * output = this->GetOutput();
+  output->SetBufferedRegion(output->GetRequestedRegion());
+  output->Allocate();
+
+  const std::size_t numberOfVoxels = input->GetBufferedRegion().GetNumberOfPixels();
+  if ( numberOfVoxels >= static_cast< std::size_t >(Outside) )
+  {
+    itkExceptionMacro(<< "Image has " << numberOfVoxels << " voxels, more than 32 bit indices can label");
+  }
+
+  const InputPixelType * in = input->GetBufferPointer();
+  OutputPixelType * out = output->GetBufferPointer();
+  const InputPixelType zero = NumericTraits< InputPixelType >::ZeroValue();
+
+  /* Foreground components, largest first and ties broken by position */
+  ParentArray parent(numberOfVoxels);
+  CountMapType counts;
+  this->LabelComponents([in, zero](std::size_t i) { return in[i] != zero; }, parent, counts);
+  m_ObjectCount = counts.size();
+
+  std::vector< std::pair< SizeValueType, ParentType > > ranked;
+  ranked.reserve(counts.size());
+  for (const auto & entry : counts)
+  {
+    ranked.emplace_back(entry.second, entry.first);
+  }
+  const std::size_t numberKept = std::min< std::size_t >(m_NumberOfObjects, ranked.size());
+  std::partial_sort(ranked.begin(), ranked.begin() + numberKept, ranked.end(),
+    [](const std::pair< SizeValueType, ParentType > & a, const std::pair< SizeValueType, ParentType > & b)
+    {
+      return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
+
+  std::vector< ParentType > keptRoots;
+  for (std::size_t k = 0; k < numberKept; ++k)
+  {
+    keptRoots.push_back(ranked[k].second);
+  }
+  std::sort(keptRoots.begin(), keptRoots.end());
+
+  std::vector< unsigned char > kept(numberOfVoxels);
+  const SizeValueType numberOfSlices = input->GetBufferedRegion().GetSize(ImageDimension - 1);
+  const std::size_t sliceSize = numberOfVoxels / std::max< SizeValueType >(numberOfSlices, 1);
+  this->GetMultiThreader()->ParallelizeArray(0, numberOfSlices,
+    [&](SizeValueType z)
+    {
+      for (std::size_t i = z * sliceSize; i < (z + 1) * sliceSize; ++i)
+      {
+        kept[i] = parent[i] != Outside && std::binary_search(keptRoots.begin(), keptRoots.end(), parent[i]);
+      }
+    }, nullptr);
+
+  /* Background components of what was kept. All but the largest are holes. */
+  ParentType outsideRoot = Outside;
+  m_BackgroundObjectCount = 0;
+  if ( m_FillHoles )
+  {
+    this->LabelComponents([&kept](std::size_t i) { return kept[i] == 0; }, parent, counts);
+    m_BackgroundObjectCount = counts.size();
+
+    SizeValueType largest = 0;
+    for (const auto & entry : counts)
+    {
+      if ( entry.second > largest || (entry.second == largest && entry.first < outsideRoot) )
+      {
+        largest = entry.second;
+        outsideRoot = entry.first;
+      }
+    }
+  }
+
+  const bool fillHoles = m_FillHoles;
+  const OutputPixelType insideValue = m_InsideValue;
+  const OutputPixelType outsideValue = m_OutsideValue;
+  this->GetMultiThreader()->ParallelizeArray(0, numberOfSlices,
+    [&](SizeValueType z)
+    {
+      for (std::size_t i = z * sliceSize; i < (z + 1) * sliceSize; ++i)
+      {
+        const bool inside = kept[i] || ( fillHoles && parent[i] != Outside && parent[i] != outsideRoot );
+        out[i] = inside ? insideValue : outsideValue;
+      }
+    }, nullptr);
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+KeepLargestComponentsImageFilter< TInputImage, TOutputImage >
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfObjects: " << m_NumberOfObjects << std::endl;
+  os << indent << "FillHoles: " << m_FillHoles << std::endl;
+  os << indent << "InsideValue: " << static_cast< typename NumericTraits< OutputPixelType >::PrintType >(m_InsideValue) << std::endl;
+  os << indent << "OutsideValue: " << static_cast< typename NumericTraits< OutputPixelType >::PrintType >(m_OutsideValue) << std::endl;
+  os << indent << "ObjectCount: " << m_ObjectCount << std::endl;
+  os << indent << "BackgroundObjectCount: " << m_BackgroundObjectCount << std::endl;
+}
+
+} /* end namespace */
+
+#endif /* itkKeepLargestComponentsImageFilter_hxx */
@@ -0,0 +1,128 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef itkMemoryMappedImageFileReader_h
+#define itkMemoryMappedImageFileReader_h
+
+#include "itkImageFileReader.h"
+#include "itkImportImageContainer.h"
+
+namespace itk {
+/** \class MemoryMappedImageContainer
+ * \brief Pixel container whose memory is a private mapping of a file
+ *
+ * The container never owns the pixels in the ImportImageContainer sense,
+ * it unmaps the file when it is destroyed.
+ */
+template< typename TElement >
+class MemoryMappedImageContainer : public ImportImageContainer< SizeValueType, TElement >
+{
+public:
+  ITK_DISALLOW_COPY_AND_ASSIGN(MemoryMappedImageContainer);
+
+  /** Standard class typedefs. */
+  using Self          = MemoryMappedImageContainer;
+  using Superclass    = ImportImageContainer< SizeValueType, TElement >;
+  using Pointer       = SmartPointer< Self >;
+  using ConstPointer  = SmartPointer< const Self >;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(MemoryMappedImageContainer, ImportImageContainer);
+
+  /** Take ownership of a mapping created with mmap */
+  void SetMapping(void * address, std::size_t length);
+
+protected:
+  MemoryMappedImageContainer() : m_Address(nullptr), m_Length(0) {}
+  ~MemoryMappedImageContainer() override;
+
+private:
+  void *      m_Address;
+  std::size_t m_Length;
+}; // end class
+
+/** \class MemoryMappedImageFileReader
+ * \brief Read uncompressed NIfTI images by mapping the file instead of copying it
+ *
+ * Geometry is read by the ImageIO exactly as ImageFileReader does. When the file
+ * is an uncompressed single file NIfTI whose voxels are stored as PixelType, in
+ * native byte order and without scaling, the output's pixel container points
+ * into a private mapping of the file. Pages are only faulted in when touched and
+ * are shared with every other process mapping the same file until one of them
+ * writes to a page.
+ *
+ * In every other case, or when mapping fails, this is ImageFileReader.
+ * GetMemoryMapped( ) reports which path the last update took.
+ */
+template< typename TOutputImage >
+class MemoryMappedImageFileReader : public ImageFileReader< TOutputImage >
+{
+public:
+  ITK_DISALLOW_COPY_AND_ASSIGN(MemoryMappedImageFileReader);
+
+  /** Standard class typedefs. */
+  using Self          = MemoryMappedImageFileReader;
+  using Superclass    = ImageFileReader< TOutputImage >;
+  using Pointer       = SmartPointer< Self >;
+  using ConstPointer  = SmartPointer< const Self >;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(MemoryMappedImageFileReader, ImageFileReader);
+
+  /** Image related typedefs. */
+  using OutputImageType     = TOutputImage;
+  using PixelType           = typename OutputImageType::PixelType;
+  using PixelContainerType  = typename OutputImageType::PixelContainer;
+  using MappedContainerType = MemoryMappedImageContainer< PixelType >;
+
+  /** Set to false to always copy */
+  itkSetMacro(UseMemoryMapping, bool);
+  itkGetConstMacro(UseMemoryMapping, bool);
+  itkBooleanMacro(UseMemoryMapping);
+
+  /** True if the last update mapped the file */
+  itkGetConstMacro(MemoryMapped, bool);
+
+protected:
+  MemoryMappedImageFileReader();
+  ~MemoryMappedImageFileReader() override {}
+
+  void GenerateData() override;
+
+  /** Map the file into the output, returning false to defer to the superclass */
+  bool MapFile();
+
+  void PrintSelf(std::ostream & os, Indent indent) const override;
+
+private:
+  bool m_UseMemoryMapping;
+  bool m_MemoryMapped;
+}; // end class
+} /* end namespace */
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkMemoryMappedImageFileReader.hxx"
+#endif
+
+#endif /* itkMemoryMappedImageFileReader_h */
@@ -0,0 +1,169 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef itkMemoryMappedImageFileReader_hxx
+#define itkMemoryMappedImageFileReader_hxx
+
+#include "itkMemoryMappedImageFileReader.h"
+#include "femurTrace.h"
+#include "itkNiftiImageIO.h"
+#include "femurNiftiHeader.h"
+
+#include <type_traits>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define FEMUR_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace itk {
+
+template< typename TElement >
+void
+MemoryMappedImageContainer< TElement >
+::SetMapping(void * address, std::size_t length)
+{
+  m_Address = address;
+  m_Length = length;
+}
+
+template< typename TElement >
+MemoryMappedImageContainer< TElement >
+::~MemoryMappedImageContainer()
+{
+#ifdef FEMUR_HAVE_MMAP
+  if ( m_Address != nullptr )
+  {
+    munmap(m_Address, m_Length);
+  }
+#endif
+}
+
+template< typename TOutputImage >
+MemoryMappedImageFileReader< TOutputImage >
+::MemoryMappedImageFileReader() :
+  m_UseMemoryMapping(true),
+  m_MemoryMapped(false)
+{}
+
+template< typename TOutputImage >
+void
+MemoryMappedImageFileReader< TOutputImage >
+::GenerateData()
+{
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "GenerateData");
+
+  m_MemoryMapped = m_UseMemoryMapping && this->MapFile();
+  if ( !m_MemoryMapped )
+  {
+    /* Never let the superclass read into a mapping left from a previous update */
+    this->GetOutput()->SetPixelContainer(PixelContainerType::New());
+    Superclass::GenerateData();
+  }
+}
+
+template< typename TOutputImage >
+bool
+MemoryMappedImageFileReader< TOutputImage >
+::MapFile()
+{
+#ifdef FEMUR_HAVE_MMAP
+  const std::string fileName = this->GetFileName();
+  const std::string ending = ".nii";
+  if ( fileName.size() <= ending.size()
+    || fileName.compare(fileName.size() - ending.size(), ending.size(), ending) != 0 )
+  {
+    return false;
+  }
+
+  /* Stored pixels must be exactly PixelType */
+  const ImageIOBase * io = this->GetImageIO();
+  if ( !std::is_arithmetic< PixelType >::value
+    || dynamic_cast< const NiftiImageIO * >(io) == nullptr
+    || io->GetNumberOfComponents() != 1
+    || io->GetComponentType() != ImageIOBase::MapPixelType< PixelType >::CType )
+  {
+    return false;
+  }
+
+  OutputImageType * output = this->GetOutput();
+  const typename OutputImageType::RegionType region = output->GetRequestedRegion();
+  if ( region != output->GetLargestPossibleRegion()
+    || io->GetImageSizeInBytes() != region.GetNumberOfPixels() * sizeof(PixelType) )
+  {
+    return false;
+  }
+
+  const int fd = open(fileName.c_str(), O_RDONLY);
+  if ( fd < 0 )
+  {
+    return false;
+  }
+
+  struct stat status;
+  unsigned char header[femur::NiftiHeaderReadSize];
+  femur::NiftiHeaderInformation info;
+  const ssize_t headerSize = fstat(fd, &status) == 0 ? pread(fd, header, sizeof(header), 0) : -1;
+  if ( headerSize < 0
+    || !femur::ParseNiftiHeader(header, static_cast< std::size_t >(headerSize), info)
+    || info.IsScaled()
+    || info.VoxOffset % alignof(PixelType) != 0
+    || info.VoxOffset + io->GetImageSizeInBytes() > static_cast< std::size_t >(status.st_size) )
+  {
+    close(fd);
+    return false;
+  }
+
+  /* Private and writable so in place filters get copy on write pages */
+  const std::size_t length = static_cast< std::size_t >(status.st_size);
+  void * address = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if ( address == MAP_FAILED )
+  {
+    return false;
+  }
+
+  typename MappedContainerType::Pointer container = MappedContainerType::New();
+  container->SetMapping(address, length);
+  container->SetImportPointer(reinterpret_cast< PixelType * >(static_cast< char * >(address) + info.VoxOffset),
+                              region.GetNumberOfPixels(), false);
+
+  output->SetBufferedRegion(region);
+  output->SetPixelContainer(container);
+  return true;
+#else
+  return false;
+#endif
+}
+
+template< typename TOutputImage >
+void
+MemoryMappedImageFileReader< TOutputImage >
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "UseMemoryMapping: " << m_UseMemoryMapping << std::endl;
+  os << indent << "MemoryMapped: " << m_MemoryMapped << std::endl;
+}
+
+} /* end namespace */
+
+#endif /* itkMemoryMappedImageFileReader_hxx */
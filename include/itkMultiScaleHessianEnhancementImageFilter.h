@@ -24,6 +24,7 @@
 #include "itkMaximumAbsoluteValueImageFilter.h"
 #include "itkNumericTraits.h"
 #include "itkArray.h"
+#include "itkSymmetricSecondRankTensor.h"
 #include "itkSpatialObject.h"
 #include "itkEigenToMeasureImageFilter.h"
 #include "itkEigenToMeasureParameterEstimationFilter.h"
@@ -58,10 +59,15 @@ namespace itk
  * \sa SymmetricEigenAnalysisImageFilter
  * \sa HessianRecursiveGaussianImageFilter
  * 
+ * THessianRealType is the component type of the Hessian tensors. The default
+ * follows the input's RealType, usually double. float halves the memory of each
+ * streamed Hessian piece.
+ * 
  * \author: Bryce Besler
  * \ingroup BoneEnhancement
  */
-template< typename TInputImage, typename TOutputImage = TInputImage >
+template< typename TInputImage, typename TOutputImage = TInputImage,
+          typename THessianRealType = typename NumericTraits< typename TInputImage::PixelType >::RealType >
 class ITK_TEMPLATE_EXPORT MultiScaleHessianEnhancementImageFilter
   : public ImageToImageFilter< TInputImage, TOutputImage >
 {
@@ -105,7 +111,8 @@ public:
 
   /** Hessian related typedefs. */
   // using HessianFilterType = HessianRecursiveGaussianImageFilter< TInputImage >;
-  using HessianFilterType = HessianGaussianImageFilter< TInputImage >;
+  using HessianFilterType = HessianGaussianImageFilter< TInputImage,
+    Image< SymmetricSecondRankTensor< THessianRealType, TInputImage::ImageDimension >, TInputImage::ImageDimension > >;
   using HessianImageType  = typename HessianFilterType::OutputImageType;
   using HessianPixelType  = typename HessianImageType::PixelType;
   using InternalRealType  = typename HessianFilterType::InternalRealType;
@@ -19,14 +19,15 @@
 #define itkMultiScaleHessianEnhancementImageFilter_hxx
 
 #include "itkMultiScaleHessianEnhancementImageFilter.h"
+#include "femurTrace.h"
 #include "itkMath.h"
 #include "itkProgressAccumulator.h"
 #include "itkMacro.h"
 
 namespace itk
 {
-template< typename TInputImage, typename TOutputImage >
-MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >
+template< typename TInputImage, typename TOutputImage, typename THessianRealType >
+MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage, THessianRealType >
 ::MultiScaleHessianEnhancementImageFilter()
 {
   /* Sigma member variables */
@@ -43,9 +44,9 @@ MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >
   this->SetNumberOfRequiredInputs( 1 );
 }
 
-template< typename TInputImage, typename TOutputImage >
+template< typename TInputImage, typename TOutputImage, typename THessianRealType >
 void
-MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >
+MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage, THessianRealType >
 ::GenerateInputRequestedRegion()
 {
   Superclass::GenerateInputRequestedRegion();
@@ -62,9 +63,9 @@ MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >
   inputPtr->SetRequestedRegionToLargestPossibleRegion();
 }
 
-template< typename TInputImage, typename TOutputImage >
+template< typename TInputImage, typename TOutputImage, typename THessianRealType >
 void
-MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >
+MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage, THessianRealType >
 ::EnlargeOutputRequestedRegion(DataObject *data)
 {
   Superclass::EnlargeOutputRequestedRegion(data);
@@ -101,11 +102,13 @@ MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >
   }
 }
 
-template< typename TInputImage, typename TOutputImage >
+template< typename TInputImage, typename TOutputImage, typename THessianRealType >
 void
-MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >
+MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage, THessianRealType >
 ::GenerateData()
 {
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "GenerateData");
+
   /* Test all inputs are set */
   if ( !m_EigenToMeasureImageFilter )
   {
@@ -206,13 +209,14 @@ MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >
   this->GraftOutput(outputImagePointer);
 }
 
-template< typename TInputImage, typename TOutputImage >
+template< typename TInputImage, typename TOutputImage, typename THessianRealType >
 typename TOutputImage::Pointer
-MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >
+MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage, THessianRealType >
 ::generateResponseAtScale(SigmaStepsType scaleLevel)
 {
   /* Get this sigma value */
   SigmaType thisSigma = m_SigmaArray.GetElement(scaleLevel);
+  FEMUR_TRACE_SCOPE_ARG(this->GetNameOfClass(), "generateResponseAtScale", "sigma", thisSigma);
 
   /* Process pipeline and return */
   m_HessianFilter->SetSigma(thisSigma);
@@ -221,9 +225,9 @@ MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >
   return m_EigenToMeasureImageFilter->GetOutput();
 }
 
-template< typename TInputImage, typename TOutputImage >
-typename MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >::OutputImageRegionType
-MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >
+template< typename TInputImage, typename TOutputImage, typename THessianRealType >
+typename MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage, THessianRealType >::OutputImageRegionType
+MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage, THessianRealType >
 ::GetOutputRegion()
 {
   /* Create region */
@@ -253,9 +257,9 @@ MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >
   return region;
 }
 
-template< typename TInputImage, typename TOutputImage >
-typename MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >::SigmaArrayType
-MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >
+template< typename TInputImage, typename TOutputImage, typename THessianRealType >
+typename MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage, THessianRealType >::SigmaArrayType
+MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage, THessianRealType >
 ::GenerateSigmaArray(SigmaType SigmaMinimum, SigmaType SigmaMaximum, SigmaStepsType NumberOfSigmaSteps, SigmaStepMethodEnum SigmaStepMethod)
 {
   /* Quick check to make sure value is correct */
@@ -311,25 +315,25 @@ MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >
   return sigmaArray;
 }
 
-template< typename TInputImage, typename TOutputImage >
-typename MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >::SigmaArrayType
-MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >
+template< typename TInputImage, typename TOutputImage, typename THessianRealType >
+typename MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage, THessianRealType >::SigmaArrayType
+MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage, THessianRealType >
 ::GenerateEquispacedSigmaArray(SigmaType SigmaMinimum, SigmaType SigmaMaximum, SigmaStepsType NumberOfSigmaSteps)
 {
   return GenerateSigmaArray(SigmaMinimum, SigmaMaximum, NumberOfSigmaSteps, Self::EquispacedSigmaSteps);
 }
 
-template< typename TInputImage, typename TOutputImage >
-typename MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >::SigmaArrayType
-MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >
+template< typename TInputImage, typename TOutputImage, typename THessianRealType >
+typename MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage, THessianRealType >::SigmaArrayType
+MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage, THessianRealType >
 ::GenerateLogarithmicSigmaArray(SigmaType SigmaMinimum, SigmaType SigmaMaximum, SigmaStepsType NumberOfSigmaSteps)
 {
   return GenerateSigmaArray(SigmaMinimum, SigmaMaximum, NumberOfSigmaSteps, Self::LogarithmicSigmaSteps);
 }
 
-template< typename TInputImage, typename TOutputImage >
-typename MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >::InternalEigenValueOrderType
-MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >
+template< typename TInputImage, typename TOutputImage, typename THessianRealType >
+typename MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage, THessianRealType >::InternalEigenValueOrderType
+MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage, THessianRealType >
 ::ConvertType(ExternalEigenValueOrderType order)
 {
   switch(order)
@@ -345,9 +349,9 @@ MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >
   }
 }
 
-template< typename TInputImage, typename TOutputImage >
+template< typename TInputImage, typename TOutputImage, typename THessianRealType >
 void
-MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage >
+MultiScaleHessianEnhancementImageFilter< TInputImage, TOutputImage, THessianRealType >
 ::PrintSelf(std::ostream & os, Indent indent) const
 {
   Superclass::PrintSelf(os, indent);
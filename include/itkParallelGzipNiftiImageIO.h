@@ -0,0 +1,104 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef itkParallelGzipNiftiImageIO_h
+#define itkParallelGzipNiftiImageIO_h
+
+#include "itkNiftiImageIO.h"
+
+#include <vector>
+
+namespace itk {
+/** \class ParallelGzipNiftiImageIO
+ * \brief NIfTI IO whose .nii.gz compression and decompression run on all threads
+ *
+ * Writing a scalar image of up to three dimensions to .nii.gz builds the NIfTI-1
+ * header in memory and compresses it and the pixel buffer block by block in
+ * parallel (see femurParallelGzip.h), with no uncompressed copy on disk. The
+ * result is an ordinary gzip file. Other images are written by NiftiImageIO.
+ *
+ * Reading a .nii.gz file that carries a member index (written by this class or
+ * by bgzip) inflates the voxel data in parallel straight into the output buffer.
+ * A streamed region inflates only the members between its first and last voxel.
+ * Only scalar, unscaled, native byte order images take this path; everything
+ * else falls back to NiftiImageIO.
+ *
+ * Register with ParallelGzipNiftiImageIOFactory::RegisterOneFactory( ) so it is
+ * chosen ahead of the stock NIfTI IO.
+ */
+class ParallelGzipNiftiImageIO : public NiftiImageIO
+{
+public:
+  ITK_DISALLOW_COPY_AND_ASSIGN(ParallelGzipNiftiImageIO);
+
+  /** Standard class typedefs. */
+  using Self          = ParallelGzipNiftiImageIO;
+  using Superclass    = NiftiImageIO;
+  using Pointer       = SmartPointer< Self >;
+  using ConstPointer  = SmartPointer< const Self >;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(ParallelGzipNiftiImageIO, NiftiImageIO);
+
+  /** zlib level used when writing */
+  itkSetClampMacro(CompressionLevel, int, 1, 9);
+  itkGetConstMacro(CompressionLevel, int);
+
+  /** Number of threads for compression and decompression */
+  itkSetClampMacro(NumberOfThreads, unsigned int, 1, NumericTraits< unsigned int >::max());
+  itkGetConstMacro(NumberOfThreads, unsigned int);
+
+  /** Uncompressed bytes per gzip member */
+  itkSetClampMacro(BlockSize, SizeValueType, 1024, 1 << 30);
+  itkGetConstMacro(BlockSize, SizeValueType);
+
+  void Read(void *buffer) override;
+
+  void Write(const void *buffer) override;
+
+protected:
+  ParallelGzipNiftiImageIO();
+  ~ParallelGzipNiftiImageIO() override {}
+
+  void PrintSelf(std::ostream & os, Indent indent) const override;
+
+  /** True for names the fast paths handle */
+  bool IsGzipFileName(const std::string & fileName) const;
+
+  /** Try the parallel read, returning false to defer to the superclass */
+  bool ReadParallel(void *buffer);
+
+  /** The single file NIfTI-1 header and extension flag for the image, or false
+   * for images the NIfTI library has to write */
+  bool SerializeHeader(std::vector< unsigned char > & header) const;
+
+private:
+  int           m_CompressionLevel;
+  unsigned int  m_NumberOfThreads;
+  SizeValueType m_BlockSize;
+}; // end class
+} /* end namespace */
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkParallelGzipNiftiImageIO.hxx"
+#endif
+
+#endif /* itkParallelGzipNiftiImageIO_h */
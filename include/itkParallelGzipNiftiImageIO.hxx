@@ -0,0 +1,274 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef itkParallelGzipNiftiImageIO_hxx
+#define itkParallelGzipNiftiImageIO_hxx
+
+#include "itkParallelGzipNiftiImageIO.h"
+#include "femurTrace.h"
+#include "itkMultiThreaderBase.h"
+#include "femurNiftiHeader.h"
+#include "femurParallelGzip.h"
+#include "nifti1_io.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace itk {
+
+inline
+ParallelGzipNiftiImageIO
+::ParallelGzipNiftiImageIO() :
+  m_CompressionLevel(6),
+  m_NumberOfThreads(MultiThreaderBase::GetGlobalDefaultNumberOfThreads()),
+  m_BlockSize(femur::ParallelGzipDefaultBlockSize)
+{}
+
+inline bool
+ParallelGzipNiftiImageIO
+::IsGzipFileName(const std::string & fileName) const
+{
+  const std::string ending = ".nii.gz";
+  return fileName.size() > ending.size()
+    && fileName.compare(fileName.size() - ending.size(), ending.size(), ending) == 0;
+}
+
+inline void
+ParallelGzipNiftiImageIO
+::Read(void *buffer)
+{
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "Read");
+
+  if ( !this->ReadParallel(buffer) )
+  {
+    Superclass::Read(buffer);
+  }
+}
+
+inline bool
+ParallelGzipNiftiImageIO
+::ReadParallel(void *buffer)
+{
+  if ( !this->IsGzipFileName(this->GetFileName()) || this->GetNumberOfComponents() != 1 )
+  {
+    return false;
+  }
+
+  femur::ParallelGzipReader reader;
+  reader.Open(this->GetFileName());
+  if ( !reader.IsIndexed() )
+  {
+    return false;
+  }
+
+  /* Pull vox_offset and the scaling out of the NIfTI-1 or NIfTI-2 header */
+  unsigned char header[femur::NiftiHeaderReadSize];
+  const std::size_t headerSize = reader.Read(0, header, sizeof(header), 1);
+  femur::NiftiHeaderInformation info;
+  if ( !femur::ParseNiftiHeader(header, headerSize, info) || info.IsScaled() )
+  {
+    return false;
+  }
+
+  /* Byte offset of each axis step in the file, and the span from the first to the last voxel of the region */
+  const ImageIORegion & region = this->GetIORegion();
+  const unsigned int dimensions = this->GetNumberOfDimensions();
+  const std::size_t pixelSize = this->GetComponentSize();
+  std::vector< std::size_t > stride(dimensions);
+  std::size_t first = 0;
+  std::size_t last = 0;
+  bool whole = true;
+  for (unsigned int i = 0; i < dimensions; ++i)
+  {
+    stride[i] = i == 0 ? pixelSize : stride[i - 1] * this->GetDimensions(i - 1);
+    first += region.GetIndex(i) * stride[i];
+    last += (region.GetIndex(i) + region.GetSize(i) - 1) * stride[i];
+    whole = whole && region.GetIndex(i) == 0 && region.GetSize(i) == this->GetDimensions(i);
+  }
+  const std::size_t span = last + pixelSize - first;
+
+  if ( whole )
+  {
+    const std::size_t bytes = this->GetImageSizeInBytes();
+    const std::size_t read = reader.Read(info.VoxOffset, buffer, bytes, m_NumberOfThreads);
+    if ( read != bytes )
+    {
+      itkExceptionMacro(<< "Expected " << bytes << " bytes of voxel data in " << this->GetFileName() << " but found " << read);
+    }
+    return true;
+  }
+
+  /* A part: inflate the members the span touches, then keep the rows inside the region */
+  std::vector< unsigned char > data(span);
+  if ( reader.Read(info.VoxOffset + first, data.data(), span, m_NumberOfThreads) != span )
+  {
+    itkExceptionMacro(<< "Expected " << span << " bytes of voxel data in " << this->GetFileName());
+  }
+
+  const std::size_t rowBytes = region.GetSize(0) * pixelSize;
+  std::size_t rows = 1;
+  for (unsigned int i = 1; i < dimensions; ++i)
+  {
+    rows *= region.GetSize(i);
+  }
+  unsigned char * output = static_cast< unsigned char * >(buffer);
+  for (std::size_t row = 0; row < rows; ++row)
+  {
+    std::size_t offset = 0;
+    std::size_t rest = row;
+    for (unsigned int i = 1; i < dimensions; ++i)
+    {
+      offset += (rest % region.GetSize(i)) * stride[i];
+      rest /= region.GetSize(i);
+    }
+    std::memcpy(output + row * rowBytes, data.data() + offset, rowBytes);
+  }
+  return true;
+}
+
+inline void
+ParallelGzipNiftiImageIO
+::Write(const void *buffer)
+{
+  FEMUR_TRACE_SCOPE(this->GetNameOfClass(), "Write");
+
+  const std::string fileName = this->GetFileName();
+  if ( !this->IsGzipFileName(fileName) )
+  {
+    Superclass::Write(buffer);
+    return;
+  }
+
+  std::vector< unsigned char > header;
+  if ( !this->SerializeHeader(header) )
+  {
+    Superclass::Write(buffer);
+    return;
+  }
+
+  /* Header and voxels go straight from memory into gzip members */
+  try
+  {
+    femur::ParallelGzipCompress(header.data(), header.size(), buffer, this->GetImageSizeInBytes(),
+                                fileName, m_CompressionLevel, m_NumberOfThreads, m_BlockSize);
+  }
+  catch (...)
+  {
+    std::remove(fileName.c_str());
+    throw;
+  }
+}
+
+inline bool
+ParallelGzipNiftiImageIO
+::SerializeHeader(std::vector< unsigned char > & header) const
+{
+  const unsigned int dimensions = this->GetNumberOfDimensions();
+  if ( this->GetNumberOfComponents() != 1 || dimensions < 1 || dimensions > 3 )
+  {
+    return false;
+  }
+
+  int datatype = DT_UNKNOWN;
+  switch ( this->GetComponentType() )
+  {
+    case ImageIOBase::UCHAR:  datatype = DT_UINT8;   break;
+    case ImageIOBase::CHAR:   datatype = DT_INT8;    break;
+    case ImageIOBase::USHORT: datatype = DT_UINT16;  break;
+    case ImageIOBase::SHORT:  datatype = DT_INT16;   break;
+    case ImageIOBase::UINT:   datatype = DT_UINT32;  break;
+    case ImageIOBase::INT:    datatype = DT_INT32;   break;
+    case ImageIOBase::FLOAT:  datatype = DT_FLOAT32; break;
+    case ImageIOBase::DOUBLE: datatype = DT_FLOAT64; break;
+    default:
+      return false;
+  }
+
+  nifti_image * image = nifti_simple_init_nim();
+  image->nifti_type = NIFTI_FTYPE_NIFTI1_1;
+  image->datatype = datatype;
+  nifti_datatype_sizes(datatype, &image->nbyper, &image->swapsize);
+  image->ndim = image->dim[0] = dimensions;
+  int * sizes[3] = { &image->nx, &image->ny, &image->nz };
+  float * spacings[3] = { &image->dx, &image->dy, &image->dz };
+  image->nvox = 1;
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    *sizes[i] = image->dim[i + 1] = i < dimensions ? static_cast< int >(this->GetDimensions(i)) : 1;
+    *spacings[i] = image->pixdim[i + 1] = i < dimensions ? static_cast< float >(this->GetSpacing(i)) : 1.0f;
+    image->nvox *= *sizes[i];
+  }
+  image->xyz_units = NIFTI_UNITS_MM;
+  image->time_units = NIFTI_UNITS_SEC;
+  image->scl_slope = 1.0f;
+  image->scl_inter = 0.0f;
+  image->iname_offset = 352;
+
+  /* ITK is LPS, NIfTI is RAS: negate the first two rows, as NiftiImageIO does */
+  mat44 & transform = image->sto_xyz;
+  for (unsigned int i = 0; i < 4; ++i)
+  {
+    for (unsigned int j = 0; j < 4; ++j)
+    {
+      transform.m[i][j] = i == j ? 1.0f : 0.0f;
+    }
+  }
+  for (unsigned int i = 0; i < dimensions; ++i)
+  {
+    const float sign = i < 2 ? -1.0f : 1.0f;
+    for (unsigned int j = 0; j < dimensions; ++j)
+    {
+      transform.m[i][j] = sign * static_cast< float >(this->GetDirection(j)[i] * this->GetSpacing(j));
+    }
+    transform.m[i][3] = sign * static_cast< float >(this->GetOrigin(i));
+  }
+  image->sform_code = NIFTI_XFORM_SCANNER_ANAT;
+  image->sto_ijk = nifti_mat44_inverse(image->sto_xyz);
+
+  float dx, dy, dz;
+  nifti_mat44_to_quatern(transform, &image->quatern_b, &image->quatern_c, &image->quatern_d,
+                         &image->qoffset_x, &image->qoffset_y, &image->qoffset_z, &dx, &dy, &dz, &image->qfac);
+  image->qform_code = NIFTI_XFORM_SCANNER_ANAT;
+  image->qto_xyz = nifti_quatern_to_mat44(image->quatern_b, image->quatern_c, image->quatern_d,
+                                          image->qoffset_x, image->qoffset_y, image->qoffset_z,
+                                          image->dx, image->dy, image->dz, image->qfac);
+  image->qto_ijk = nifti_mat44_inverse(image->qto_xyz);
+
+  const nifti_1_header fields = nifti_convert_nim2nhdr(image);
+  nifti_image_free(image);
+
+  /* 348 byte header, then four zero bytes saying there are no extensions */
+  header.assign(352, 0);
+  std::memcpy(header.data(), &fields, sizeof(fields));
+  return true;
+}
+
+inline void
+ParallelGzipNiftiImageIO
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "CompressionLevel: " << m_CompressionLevel << std::endl;
+  os << indent << "NumberOfThreads: " << m_NumberOfThreads << std::endl;
+  os << indent << "BlockSize: " << m_BlockSize << std::endl;
+}
+
+} /* end namespace */
+
+#endif /* itkParallelGzipNiftiImageIO_hxx */
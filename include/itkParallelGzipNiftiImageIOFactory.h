@@ -0,0 +1,77 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef itkParallelGzipNiftiImageIOFactory_h
+#define itkParallelGzipNiftiImageIOFactory_h
+
+#include "itkObjectFactoryBase.h"
+#include "itkVersion.h"
+#include "itkParallelGzipNiftiImageIO.h"
+
+namespace itk {
+/** \class ParallelGzipNiftiImageIOFactory
+ * \brief Create instances of ParallelGzipNiftiImageIO objects using an object factory.
+ */
+class ParallelGzipNiftiImageIOFactory : public ObjectFactoryBase
+{
+public:
+  ITK_DISALLOW_COPY_AND_ASSIGN(ParallelGzipNiftiImageIOFactory);
+
+  /** Standard class typedefs. */
+  using Self          = ParallelGzipNiftiImageIOFactory;
+  using Superclass    = ObjectFactoryBase;
+  using Pointer       = SmartPointer< Self >;
+  using ConstPointer  = SmartPointer< const Self >;
+
+  const char * GetITKSourceVersion() const override
+  {
+    return ITK_SOURCE_VERSION;
+  }
+
+  const char * GetDescription() const override
+  {
+    return "NIfTI ImageIO Factory with parallel gzip, allows loading NIfTI images into insight";
+  }
+
+  /** Method for class instantiation. */
+  itkFactorylessNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(ParallelGzipNiftiImageIOFactory, ObjectFactoryBase);
+
+  /** Register one factory of this type ahead of the stock NIfTI factory */
+  static void RegisterOneFactory()
+  {
+    ParallelGzipNiftiImageIOFactory::Pointer factory = ParallelGzipNiftiImageIOFactory::New();
+    ObjectFactoryBase::RegisterFactory(factory, ObjectFactoryBase::INSERT_AT_FRONT);
+  }
+
+protected:
+  ParallelGzipNiftiImageIOFactory()
+  {
+    this->RegisterOverride("itkImageIOBase",
+                           "itkParallelGzipNiftiImageIO",
+                           "NIfTI Image IO with parallel gzip",
+                           true,
+                           CreateObjectFunction< ParallelGzipNiftiImageIO >::New());
+  }
+  ~ParallelGzipNiftiImageIOFactory() override {}
+}; // end class
+} /* end namespace */
+
+#endif /* itkParallelGzipNiftiImageIOFactory_h */
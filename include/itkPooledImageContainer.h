@@ -0,0 +1,202 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef itkPooledImageContainer_h
+#define itkPooledImageContainer_h
+
+#include "itkImportImageContainer.h"
+#include "itkObjectFactoryBase.h"
+#include "itkVersion.h"
+#include "itkFixedArray.h"
+#include "itkVector.h"
+#include "itkSymmetricSecondRankTensor.h"
+#include "femurBufferPool.h"
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <typeinfo>
+
+namespace itk {
+/** \class PooledImageContainer
+ * \brief Image pixel container that takes its buffer from femur::BufferPool.
+ *
+ * Buffers go back to the pool when the container frees them, so the next image of
+ * the same size, at the next scale or in the next stage, reuses the memory instead
+ * of mapping and faulting in a new one. Element types that need destruction, sizes
+ * the pool does not serve and a disabled pool all fall back to ImportImageContainer.
+ */
+template< typename TElementIdentifier, typename TElement >
+class PooledImageContainer : public ImportImageContainer< TElementIdentifier, TElement >
+{
+public:
+  ITK_DISALLOW_COPY_AND_ASSIGN(PooledImageContainer);
+
+  /** Standard class typedefs. */
+  using Self          = PooledImageContainer;
+  using Superclass    = ImportImageContainer< TElementIdentifier, TElement >;
+  using Pointer       = SmartPointer< Self >;
+  using ConstPointer  = SmartPointer< const Self >;
+
+  using ElementIdentifier = TElementIdentifier;
+  using Element           = TElement;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(PooledImageContainer, ImportImageContainer);
+
+protected:
+  PooledImageContainer() = default;
+
+  /* The superclass destructor would only call its own DeallocateManagedMemory */
+  ~PooledImageContainer() override
+  {
+    this->DeallocateManagedMemory();
+  }
+
+  TElement * AllocateElements(ElementIdentifier size, bool UseValueInitialization = false) const override
+  {
+    if ( !std::is_trivially_destructible< TElement >::value || !std::is_trivially_copyable< TElement >::value )
+    {
+      return Superclass::AllocateElements(size, UseValueInitialization);
+    }
+
+    bool zeroed = false;
+    void * buffer = nullptr;
+    try
+    {
+      buffer = femur::BufferPool::Instance().Acquire(static_cast< std::size_t >(size) * sizeof(TElement), zeroed);
+    }
+    catch ( std::bad_alloc & )
+    {
+      /* Let the superclass try and report the failure the way ITK does */
+      buffer = nullptr;
+    }
+    if ( buffer == nullptr )
+    {
+      return Superclass::AllocateElements(size, UseValueInitialization);
+    }
+
+    /* Construct what new[] would have, unless a fresh mapping already holds those zeros */
+    TElement * elements = static_cast< TElement * >(buffer);
+    const bool construct = UseValueInitialization || !std::is_trivially_default_constructible< TElement >::value;
+    if ( construct && !(zeroed && std::is_trivial< TElement >::value) )
+    {
+      std::uninitialized_fill_n(elements, size, TElement());
+    }
+    return elements;
+  }
+
+  void DeallocateManagedMemory() override
+  {
+    TElement * elements = this->GetImportPointer();
+    if ( elements != nullptr && this->GetContainerManageMemory()
+      && femur::BufferPool::Instance().Release(elements) )
+    {
+      /* Back in the pool, the superclass must not delete[] it */
+      this->SetContainerManageMemory(false);
+    }
+    Superclass::DeallocateManagedMemory();
+  }
+}; // end class
+
+/** \class PooledImageContainerFactory
+ * \brief Makes the pixel containers of our image types PooledImageContainers.
+ *
+ * Covers the scalar pixel types of the pipeline, the Hessian tensors and the
+ * eigenvalue vectors, which are the large per-scale temporaries.
+ */
+class PooledImageContainerFactory : public ObjectFactoryBase
+{
+public:
+  ITK_DISALLOW_COPY_AND_ASSIGN(PooledImageContainerFactory);
+
+  /** Standard class typedefs. */
+  using Self          = PooledImageContainerFactory;
+  using Superclass    = ObjectFactoryBase;
+  using Pointer       = SmartPointer< Self >;
+  using ConstPointer  = SmartPointer< const Self >;
+
+  const char * GetITKSourceVersion() const override
+  {
+    return ITK_SOURCE_VERSION;
+  }
+
+  const char * GetDescription() const override
+  {
+    return "Pooled ImportImageContainer Factory, recycles image buffers through femur::BufferPool";
+  }
+
+  /** Method for class instantiation. */
+  itkFactorylessNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(PooledImageContainerFactory, ObjectFactoryBase);
+
+  /** Register one factory of this type. Calling it again does nothing. */
+  static void RegisterOneFactory()
+  {
+    static bool registered = false;
+    if ( registered )
+    {
+      return;
+    }
+    registered = true;
+
+    PooledImageContainerFactory::Pointer factory = PooledImageContainerFactory::New();
+    ObjectFactoryBase::RegisterFactory(factory);
+  }
+
+protected:
+  PooledImageContainerFactory()
+  {
+    this->RegisterContainer< unsigned char >();
+    this->RegisterContainer< char >();
+    this->RegisterContainer< short >();
+    this->RegisterContainer< unsigned short >();
+    this->RegisterContainer< int >();
+    this->RegisterContainer< unsigned int >();
+    this->RegisterContainer< float >();
+    this->RegisterContainer< double >();
+    this->RegisterContainer< SymmetricSecondRankTensor< float, 3 > >();
+    this->RegisterContainer< SymmetricSecondRankTensor< double, 3 > >();
+    this->RegisterContainer< Vector< float, 3 > >();
+    this->RegisterContainer< Vector< double, 3 > >();
+    this->RegisterContainer< FixedArray< float, 3 > >();
+    this->RegisterContainer< FixedArray< double, 3 > >();
+  }
+  ~PooledImageContainerFactory() override {}
+
+  /** Image::Allocate creates its container through ObjectFactory, which looks it up by typeid name */
+  template< typename TElement >
+  void RegisterContainer()
+  {
+    using ContainerType = ImportImageContainer< SizeValueType, TElement >;
+    using PooledType    = PooledImageContainer< SizeValueType, TElement >;
+    this->RegisterOverride(typeid(ContainerType).name(),
+                           typeid(PooledType).name(),
+                           "Pooled image container",
+                           true,
+                           CreateObjectFunction< PooledType >::New());
+  }
+}; // end class
+} /* end namespace */
+
+#endif /* itkPooledImageContainer_h */
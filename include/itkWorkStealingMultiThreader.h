@@ -0,0 +1,152 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef itkWorkStealingMultiThreader_h
+#define itkWorkStealingMultiThreader_h
+
+#include "itkMultiThreaderBase.h"
+#include "itkObjectFactoryBase.h"
+#include "itkVersion.h"
+#include "femurThreadPool.h"
+
+#include <typeinfo>
+
+namespace itk {
+/** \class WorkStealingMultiThreader
+ * \brief Runs the work units of a filter on femur::ThreadPool.
+ *
+ * ParallelizeArray and ParallelizeImageRegion of MultiThreaderBase split their work
+ * into work units and hand them to SingleMethodExecute, so overriding that sends every
+ * filter's threaded work to the shared pool. Work units default to four per thread so
+ * stealing can even out slow ones. MaximumNumberOfThreads bounds how many threads
+ * one call may occupy.
+ */
+class WorkStealingMultiThreader : public MultiThreaderBase
+{
+public:
+  ITK_DISALLOW_COPY_AND_ASSIGN(WorkStealingMultiThreader);
+
+  /** Standard class typedefs. */
+  using Self          = WorkStealingMultiThreader;
+  using Superclass    = MultiThreaderBase;
+  using Pointer       = SmartPointer< Self >;
+  using ConstPointer  = SmartPointer< const Self >;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(WorkStealingMultiThreader, MultiThreaderBase);
+
+  void SetSingleMethod(ThreadFunctionType method, void * data) override
+  {
+    m_Method = method;
+    m_MethodData = data;
+  }
+
+  void SingleMethodExecute() override
+  {
+    if ( m_Method == nullptr )
+    {
+      itkExceptionMacro(<< "No single method set!");
+    }
+
+    const ThreadIdType workUnits = this->GetNumberOfWorkUnits();
+    femur::ThreadPool::Instance().ParallelFor(workUnits, this->GetMaximumNumberOfThreads(),
+      [this, workUnits](std::size_t i)
+      {
+        WorkUnitInfo info{};
+        info.WorkUnitID = static_cast< ThreadIdType >(i);
+        info.NumberOfWorkUnits = workUnits;
+        info.UserData = m_MethodData;
+        info.ThreadFunction = m_Method;
+        m_Method(&info);
+      });
+  }
+
+protected:
+  WorkStealingMultiThreader()
+  {
+    this->SetNumberOfWorkUnits(4 * this->GetMaximumNumberOfThreads());
+  }
+  ~WorkStealingMultiThreader() override {}
+
+private:
+  ThreadFunctionType  m_Method = nullptr;
+  void *              m_MethodData = nullptr;
+}; // end class
+
+/** \class WorkStealingMultiThreaderFactory
+ * \brief Makes MultiThreaderBase::New return a WorkStealingMultiThreader.
+ */
+class WorkStealingMultiThreaderFactory : public ObjectFactoryBase
+{
+public:
+  ITK_DISALLOW_COPY_AND_ASSIGN(WorkStealingMultiThreaderFactory);
+
+  /** Standard class typedefs. */
+  using Self          = WorkStealingMultiThreaderFactory;
+  using Superclass    = ObjectFactoryBase;
+  using Pointer       = SmartPointer< Self >;
+  using ConstPointer  = SmartPointer< const Self >;
+
+  const char * GetITKSourceVersion() const override
+  {
+    return ITK_SOURCE_VERSION;
+  }
+
+  const char * GetDescription() const override
+  {
+    return "Work stealing MultiThreader Factory, runs filters on the shared femur thread pool";
+  }
+
+  /** Method for class instantiation. */
+  itkFactorylessNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(WorkStealingMultiThreaderFactory, ObjectFactoryBase);
+
+  /** Register one factory of this type. Calling it again does nothing. */
+  static void RegisterOneFactory()
+  {
+    static bool registered = false;
+    if ( registered )
+    {
+      return;
+    }
+    registered = true;
+
+    WorkStealingMultiThreaderFactory::Pointer factory = WorkStealingMultiThreaderFactory::New();
+    ObjectFactoryBase::RegisterFactory(factory);
+  }
+
+protected:
+  /** MultiThreaderBase::New asks ObjectFactory, which looks the override up by typeid name */
+  WorkStealingMultiThreaderFactory()
+  {
+    this->RegisterOverride(typeid(MultiThreaderBase).name(),
+                           typeid(WorkStealingMultiThreader).name(),
+                           "Work stealing MultiThreader",
+                           true,
+                           CreateObjectFunction< WorkStealingMultiThreader >::New());
+  }
+  ~WorkStealingMultiThreaderFactory() override {}
+}; // end class
+} /* end namespace */
+
+#endif /* itkWorkStealingMultiThreader_h */
@@ -0,0 +1,274 @@
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#include "femurPipeline.h"
+#include "femurConfiguration.h"
+#include "femurCommandLine.h"
+
+namespace py = pybind11;
+
+namespace {
+
+/**
+ * An ITK image seen from Python.
+ *
+ * Arrays index (z, y, x) and spacing, origin and direction are in (x, y, z), as with
+ * SimpleITK's GetArrayViewFromImage, GetSpacing, GetOrigin and GetDirection.
+ * Neither direction copies pixels: an image built from an array reads the array's
+ * buffer, kept alive as long as the image, and .array is a view of the ITK buffer
+ * that keeps the image alive. Filters only read their inputs.
+ */
+template< typename TImage >
+class PythonImage
+{
+public:
+  using ImageType     = TImage;
+  using ImagePointer  = typename TImage::Pointer;
+  using PixelType     = typename TImage::PixelType;
+  using ArrayType     = py::array_t< PixelType, py::array::c_style >;
+  using VectorType    = std::array< double, femur::ImageDimension >;
+  using MatrixType    = std::array< double, femur::ImageDimension * femur::ImageDimension >;
+
+  explicit PythonImage(ImagePointer image)
+    : m_Image(image)
+  {}
+
+  /** Wrap array. It must be C contiguous and of exactly PixelType, no cast or copy is made:
+   * another dtype raises TypeError, a strided view ValueError. */
+  PythonImage(py::array array, const VectorType & spacing, const VectorType & origin, const MatrixType & direction)
+    : m_Array(array)
+  {
+    constexpr unsigned int Dimension = femur::ImageDimension;
+    if ( !py::array_t< PixelType >::check_(array) )
+    {
+      throw py::type_error("Expected a " + std::string(py::str(py::dtype::of< PixelType >())) + " array, got "
+                           + std::string(py::str(array.dtype())) + ", convert it with astype first");
+    }
+    if ( !(array.flags() & py::array::c_style) )
+    {
+      throw py::value_error("Expected a C contiguous array, copy it with numpy.ascontiguousarray first");
+    }
+    if ( array.ndim() != Dimension )
+    {
+      throw std::invalid_argument("Expected a " + std::to_string(Dimension) + "D array, got " + std::to_string(array.ndim()) + "D");
+    }
+
+    typename TImage::RegionType region;
+    typename TImage::SpacingType itkSpacing;
+    typename TImage::PointType itkOrigin;
+    typename TImage::DirectionType itkDirection;
+    for (unsigned int d = 0; d < Dimension; ++d)
+    {
+      region.SetSize(d, array.shape(Dimension - 1 - d));
+      itkSpacing[d] = spacing[d];
+      itkOrigin[d] = origin[d];
+      for (unsigned int e = 0; e < Dimension; ++e)
+      {
+        itkDirection[d][e] = direction[d * Dimension + e];
+      }
+    }
+
+    typename TImage::PixelContainer::Pointer container = TImage::PixelContainer::New();
+    container->SetImportPointer(const_cast< PixelType * >(array.data()), region.GetNumberOfPixels(), false);
+
+    m_Image = TImage::New();
+    m_Image->SetRegions(region);
+    m_Image->SetSpacing(itkSpacing);
+    m_Image->SetOrigin(itkOrigin);
+    m_Image->SetDirection(itkDirection);
+    m_Image->SetPixelContainer(container);
+  }
+
+  /** A new image object over the same buffer, so calls running side by side do not
+   * share the requested regions filters set on their inputs */
+  ImagePointer Share() const
+  {
+    ImagePointer image = TImage::New();
+    image->Graft(m_Image);
+    return image;
+  }
+
+  /** View of the pixels, holding self alive */
+  static ArrayType GetArray(py::object self)
+  {
+    const PythonImage & image = self.cast< const PythonImage & >();
+    const typename TImage::SizeType size = image.m_Image->GetBufferedRegion().GetSize();
+    const std::vector< py::ssize_t > shape = {
+      static_cast< py::ssize_t >(size[2]), static_cast< py::ssize_t >(size[1]), static_cast< py::ssize_t >(size[0]) };
+    return ArrayType(shape, image.m_Image->GetBufferPointer(), self);
+  }
+
+  VectorType GetSpacing() const
+  {
+    VectorType spacing;
+    std::copy(m_Image->GetSpacing().Begin(), m_Image->GetSpacing().End(), spacing.begin());
+    return spacing;
+  }
+
+  VectorType GetOrigin() const
+  {
+    VectorType origin;
+    std::copy(m_Image->GetOrigin().Begin(), m_Image->GetOrigin().End(), origin.begin());
+    return origin;
+  }
+
+  MatrixType GetDirection() const
+  {
+    MatrixType direction;
+    for (unsigned int d = 0; d < femur::ImageDimension; ++d)
+    {
+      for (unsigned int e = 0; e < femur::ImageDimension; ++e)
+      {
+        direction[d * femur::ImageDimension + e] = m_Image->GetDirection()[d][e];
+      }
+    }
+    return direction;
+  }
+
+private:
+  ImagePointer  m_Image;
+  py::object    m_Array;  /* Owner of the buffer when built from an array */
+};
+
+using HUPythonImage         = PythonImage< femur::HUImageType >;
+using SheetnessPythonImage  = PythonImage< femur::SheetnessImageType >;
+using LabelPythonImage      = PythonImage< femur::LabelImageType >;
+
+template< typename TPythonImage >
+void BindImage(py::module & m, const char * name, const char * doc)
+{
+  using VectorType = typename TPythonImage::VectorType;
+  using MatrixType = typename TPythonImage::MatrixType;
+
+  py::class_< TPythonImage >(m, name, doc)
+    .def(py::init< py::array, const VectorType &, const VectorType &, const MatrixType & >(),
+         py::arg("array").noconvert(),
+         py::arg("spacing") = VectorType{{1.0, 1.0, 1.0}},
+         py::arg("origin") = VectorType{{0.0, 0.0, 0.0}},
+         py::arg("direction") = MatrixType{{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0}},
+         "Wrap a C contiguous (z, y, x) array without copying it")
+    .def_property_readonly("array", &TPythonImage::GetArray, "(z, y, x) view of the pixels")
+    .def_property_readonly("spacing", &TPythonImage::GetSpacing)
+    .def_property_readonly("origin", &TPythonImage::GetOrigin)
+    .def_property_readonly("direction", &TPythonImage::GetDirection, "Row major, as SimpleITK's GetDirection");
+}
+
+} /* end namespace */
+
+PYBIND11_MODULE(femur, m)
+{
+  m.doc() = "Femur segmentation stages on in memory images. Each call releases the GIL while it runs.";
+
+  BindImage< HUPythonImage >(m, "HUImage", "int16 CT image in HU");
+  BindImage< SheetnessPythonImage >(m, "SheetnessImage", "float32 sheetness image");
+  BindImage< LabelPythonImage >(m, "LabelImage", "uint8 mask, marks or segmentation");
+
+  py::class_< femur::SheetnessParameters >(m, "SheetnessParameters")
+    .def(py::init<>())
+    .def_readwrite("enhance_bright_objects", &femur::SheetnessParameters::EnhanceBrightObjects)
+    .def_readwrite("number_of_sigma", &femur::SheetnessParameters::NumberOfSigma)
+    .def_readwrite("min_sigma", &femur::SheetnessParameters::MinSigma)
+    .def_readwrite("max_sigma", &femur::SheetnessParameters::MaxSigma)
+    .def_readwrite("low_threshold", &femur::SheetnessParameters::LowThreshold)
+    .def_readwrite("high_threshold", &femur::SheetnessParameters::HighThreshold)
+    .def_readwrite("weight", &femur::SheetnessParameters::Weight);
+
+  py::class_< femur::PeriostealParameters >(m, "PeriostealParameters")
+    .def(py::init<>())
+    .def_readwrite("lambda_", &femur::PeriostealParameters::Lambda)
+    .def_readwrite("sigma", &femur::PeriostealParameters::Sigma)
+    .def_readwrite("conn_filter", &femur::PeriostealParameters::ConnFilter)
+    .def_readwrite("labels", &femur::PeriostealParameters::Labels)
+    .def_readwrite("batched_labels", &femur::PeriostealParameters::BatchedLabels)
+    .def_readwrite("padding", &femur::PeriostealParameters::Padding);
+
+  py::class_< femur::EndostealParameters >(m, "EndostealParameters")
+    .def(py::init<>())
+    .def_readwrite("lambda_", &femur::EndostealParameters::Lambda)
+    .def_readwrite("sigma", &femur::EndostealParameters::Sigma)
+    .def_readwrite("lower_threshold", &femur::EndostealParameters::LowerThreshold)
+    .def_readwrite("upper_threshold", &femur::EndostealParameters::UpperThreshold)
+    .def_readwrite("cortical_label", &femur::EndostealParameters::CorticalLabel)
+    .def_readwrite("cancellous_label", &femur::EndostealParameters::CancellousLabel)
+    .def_readwrite("background_label", &femur::EndostealParameters::BackgroundLabel)
+    .def_readwrite("min_distance", &femur::EndostealParameters::MinDistance)
+    .def_readwrite("max_distance", &femur::EndostealParameters::MaxDistance);
+
+  m.def("read_parameters",
+    [](const std::string & fileName)
+    {
+      femur::Configuration config;
+      config.Read(fileName);
+      femur::SheetnessParameters sheetness;
+      femur::PeriostealParameters periosteal;
+      femur::EndostealParameters endosteal;
+      sheetness.Read(config);
+      periosteal.Read(config);
+      endosteal.Read(config);
+      return py::make_tuple(sheetness, periosteal, endosteal);
+    },
+    py::arg("file_name"),
+    "Sheetness, periosteal and endosteal parameters from a configuration file such as scripts/femur_pipeline.cfg");
+
+  m.def("configure_threading",
+    [](unsigned int threads, const std::string & pool)
+    {
+      if ( !femur::ConfigureThreading(threads, pool) )
+      {
+        throw std::invalid_argument("Unknown pool " + pool + ", expected stealing, itk, tbb or platform");
+      }
+    },
+    py::arg("threads") = 0, py::arg("pool") = "stealing",
+    "As --threads and --pool of the executables. Call before running any stage.");
+
+  m.def("compute_skin_masks",
+    [](const HUPythonImage & image, const femur::SheetnessParameters & parameters)
+    {
+      femur::SkinMasks masks;
+      {
+        py::gil_scoped_release release;
+        masks = femur::ComputeSkinMasks(image.Share(), parameters);
+      }
+      return py::make_tuple(LabelPythonImage(masks.Skin), LabelPythonImage(masks.Eroded));
+    },
+    py::arg("image"), py::arg("parameters") = femur::SheetnessParameters(),
+    "Body mask and eroded body mask, as (skin, eroded)");
+
+  m.def("compute_sheetness",
+    [](const HUPythonImage & image, const LabelPythonImage & skin, const LabelPythonImage & eroded,
+       const femur::SheetnessParameters & parameters)
+    {
+      py::gil_scoped_release release;
+      femur::SkinMasks masks;
+      masks.Skin = skin.Share();
+      masks.Eroded = eroded.Share();
+      return SheetnessPythonImage(femur::ComputeSheetness(image.Share(), masks, parameters));
+    },
+    py::arg("image"), py::arg("skin"), py::arg("eroded"), py::arg("parameters") = femur::SheetnessParameters(),
+    "Multiscale Hessian enhancement with the Calgary sheetness measure");
+
+  m.def("segment_periosteal",
+    [](const SheetnessPythonImage & sheetness, const LabelPythonImage & marks, const femur::PeriostealParameters & parameters)
+    {
+      py::gil_scoped_release release;
+      return LabelPythonImage(femur::SegmentPeriosteal(sheetness.Share(), marks.Share(), parameters));
+    },
+    py::arg("sheetness"), py::arg("marks"), py::arg("parameters") = femur::PeriostealParameters(),
+    "Grid cut of every marked label, merged into one label image");
+
+  m.def("segment_endosteal",
+    [](const SheetnessPythonImage & sheetness, const LabelPythonImage & periosteal, const femur::EndostealParameters & parameters)
+    {
+      py::gil_scoped_release release;
+      return LabelPythonImage(femur::SegmentEndosteal(sheetness.Share(), periosteal.Share(), parameters));
+    },
+    py::arg("sheetness"), py::arg("periosteal"), py::arg("parameters") = femur::EndostealParameters(),
+    "Grid cut of the periosteal segmentation into cortical and cancellous bone");
+}
@@ -0,0 +1,310 @@
+
+# Imports
+import os
+import sys
+import time
+import gzip
+import shlex
+import ctypes
+import signal
+import socket
+import struct
+import sqlite3
+import argparse
+import threading
+import subprocess
+
+# Argument Parsing
+parser = argparse.ArgumentParser(description='''Run one command per scan of a cohort from a SQLite
+  queue. Workers on any number of nodes share the queue file, take the largest remaining scan
+  first and hold a lease on it while it runs. A scan whose worker stops renewing its lease (crash,
+  kill, lost node) is handed to the next worker that asks.''')
+parser.add_argument('queue', help='Queue database, on storage every worker can reach')
+subparsers = parser.add_subparsers(dest='action')
+subparsers.required = True
+
+init_parser = subparsers.add_parser('init', help='Add the scans of a manifest to the queue')
+init_parser.add_argument('manifest', help='One scan base name per line (e.g. RETRO_00001), # comments')
+init_parser.add_argument('--command', required=True,
+  help='Command run for each scan, {base} is replaced (e.g. "python sheetness.py {base}")')
+init_parser.add_argument('--cost_image', default='',
+  help='Image whose header sizes a scan, {base} is replaced (e.g. MODELS/{base}.nii). Empty for equal costs')
+
+work_parser = subparsers.add_parser('work', help='Run scans until none are queued or running')
+work_parser.add_argument('--lease', default=120.0, type=float, help='Seconds a lease lasts without renewal')
+work_parser.add_argument('--max_attempts', default=3, type=int, help='Runs of a scan before it is marked failed')
+work_parser.add_argument('--log_dir', default='', help='Write <base>.log here (default: inherit output)')
+work_parser.add_argument('--worker_name', default='', help='Name in the queue (default: host:pid)')
+
+local_parser = subparsers.add_parser('local', help='Run several workers on this machine')
+local_parser.add_argument('--workers', default=2, type=int, help='Number of worker processes')
+local_parser.add_argument('--lease', default=120.0, type=float, help='Seconds a lease lasts without renewal')
+local_parser.add_argument('--max_attempts', default=3, type=int, help='Runs of a scan before it is marked failed')
+local_parser.add_argument('--log_dir', default='', help='Write <base>.log here (default: inherit output)')
+
+status_parser = subparsers.add_parser('status', help='Print the state of every scan')
+reset_parser = subparsers.add_parser('reset', help='Queue failed scans again')
+args = parser.parse_args()
+
+# Check inputs
+print('Arguments:')
+for arg in vars(args):
+  print('  {}: {}'.format(arg, getattr(args, arg)))
+print('')
+
+SCHEMA = '''
+CREATE TABLE IF NOT EXISTS jobs (
+  base          TEXT PRIMARY KEY,
+  command       TEXT NOT NULL,
+  cost          REAL NOT NULL,
+  state         TEXT NOT NULL DEFAULT 'queued',
+  worker        TEXT,
+  lease_expires REAL,
+  attempts      INTEGER NOT NULL DEFAULT 0,
+  seconds       REAL,
+  message       TEXT
+)'''
+
+def connect(queue):
+  '''Open the queue. Every write takes the database lock, so claims never race.'''
+  connection = sqlite3.connect(queue, timeout=60.0, isolation_level=None)
+  connection.execute('PRAGMA busy_timeout = 60000')
+  connection.execute(SCHEMA)
+  return connection
+
+def nifti_voxels(file_name):
+  '''Voxel count from a NIfTI-1 header, without reading the image'''
+  opener = gzip.open if file_name.endswith('.gz') else open
+  with opener(file_name, 'rb') as f:
+    header = f.read(348)
+  if len(header) < 348:
+    raise IOError('{} is too short for a NIfTI header'.format(file_name))
+  for order in ['<', '>']:
+    if struct.unpack(order + 'i', header[0:4])[0] == 348:
+      dims = struct.unpack(order + '8h', header[40:56])
+      voxels = 1
+      for d in dims[1:1 + max(1, min(dims[0], 7))]:
+        voxels *= max(1, d)
+      return voxels
+  raise IOError('{} has no NIfTI-1 header'.format(file_name))
+
+def image_voxels(file_name):
+  '''Voxel count from an image header, NIfTI directly and anything else through SimpleITK'''
+  if file_name.endswith('.nii') or file_name.endswith('.nii.gz'):
+    return nifti_voxels(file_name)
+  import SimpleITK as sitk
+  reader = sitk.ImageFileReader()
+  reader.SetFileName(file_name)
+  reader.ReadImageInformation()
+  voxels = 1
+  for d in reader.GetSize():
+    voxels *= d
+  return voxels
+
+def init(connection):
+  with open(args.manifest) as f:
+    bases = [line.split()[0] for line in f if line.strip() and not line.strip().startswith('#')]
+
+  added = 0
+  for base in bases:
+    cost = 1.0
+    if args.cost_image:
+      cost_image = args.cost_image.format(base=base)
+      try:
+        cost = float(image_voxels(cost_image))
+      except (IOError, OSError, RuntimeError) as e:
+        print('  {}: cannot size from {} ({}), queued last'.format(base, cost_image, e))
+        cost = 0.0
+    command = args.command.format(base=base)
+    cursor = connection.execute('INSERT OR IGNORE INTO jobs (base, command, cost) VALUES (?, ?, ?)',
+      (base, command, cost))
+    added += cursor.rowcount
+  print('Queued {} of {} scans ({} already in the queue)'.format(added, len(bases), len(bases) - added))
+
+def claim(connection, worker, lease, max_attempts):
+  '''Take the largest queued scan, or one whose lease ran out. None when nothing is left to take.'''
+  now = time.time()
+  connection.execute('BEGIN IMMEDIATE')
+  try:
+    connection.execute('''UPDATE jobs SET state = 'failed', worker = NULL,
+      message = 'lease expired after ' || attempts || ' attempts'
+      WHERE state = 'running' AND lease_expires < ? AND attempts >= ?''', (now, max_attempts))
+    row = connection.execute('''SELECT base, command, attempts FROM jobs
+      WHERE state = 'queued' OR (state = 'running' AND lease_expires < ?)
+      ORDER BY cost DESC, base LIMIT 1''', (now,)).fetchone()
+    if row is not None:
+      connection.execute('''UPDATE jobs SET state = 'running', worker = ?, lease_expires = ?,
+        attempts = attempts + 1 WHERE base = ?''', (worker, now + lease, row[0]))
+    connection.execute('COMMIT')
+  except Exception:
+    connection.execute('ROLLBACK')
+    raise
+  return row
+
+def finish(connection, worker, base, returncode, seconds, max_attempts, attempts):
+  '''Record a run, unless the lease was lost and another worker owns the scan now'''
+  if returncode == 0:
+    state, message = 'done', None
+  else:
+    state = 'failed' if attempts >= max_attempts else 'queued'
+    message = 'exit code {}'.format(returncode)
+  connection.execute('''UPDATE jobs SET state = ?, worker = NULL, lease_expires = NULL, seconds = ?, message = ?
+    WHERE base = ? AND worker = ? AND state = 'running' ''', (state, seconds, message, base, worker))
+  return state
+
+PR_SET_PDEATHSIG = 1
+
+def start_process(command, log):
+  '''Start a scan's command in its own process group, killed with its worker. Should the worker
+  be SIGKILLed the lease runs out and another worker starts the scan, so the child must not outlive
+  it. The parent death signal follows the thread that started the child, always the main thread.'''
+  parent = os.getpid()
+
+  def die_with_parent():
+    if sys.platform.startswith('linux'):
+      libc = ctypes.CDLL(None, use_errno=True)
+      if libc.prctl(PR_SET_PDEATHSIG, signal.SIGKILL, 0, 0, 0) != 0:
+        raise OSError(ctypes.get_errno(), 'prctl(PR_SET_PDEATHSIG) failed')
+    # The worker may have died before the signal was armed
+    if os.getppid() != parent:
+      os._exit(1)
+
+  return subprocess.Popen(shlex.split(command), stdout=log, stderr=subprocess.STDOUT if log else None,
+    start_new_session=True, preexec_fn=die_with_parent)
+
+def stop_process(process, grace=10.0):
+  '''Terminate a child and whatever it started, killing them if they do not exit within grace seconds'''
+  if process.poll() is not None:
+    return
+  try:
+    os.killpg(process.pid, signal.SIGTERM)
+    process.wait(timeout=grace)
+  except subprocess.TimeoutExpired:
+    os.killpg(process.pid, signal.SIGKILL)
+  except ProcessLookupError:
+    pass
+
+def renew(queue, worker, base, lease, stop, process, lost):
+  '''Keep the lease of a running scan, from its own connection. Once the lease is gone, because
+  another worker took the scan over or renewing kept failing until it ran out, the child is
+  stopped so two workers never write the same output.'''
+  connection = None
+  renewed = time.time()
+  while not stop.wait(lease / 3.0):
+    try:
+      if connection is None:
+        connection = connect(queue)
+      now = time.time()
+      cursor = connection.execute('''UPDATE jobs SET lease_expires = ? WHERE base = ? AND worker = ? AND state = 'running' ''',
+        (now + lease, base, worker))
+      if cursor.rowcount == 0:
+        print('{}: lost the lease of {}, stopping it'.format(worker, base))
+        lost.set()
+      renewed = now
+    except sqlite3.Error as e:
+      # Retried on the next tick with a fresh connection, the lease lasts three ticks
+      print('{}: cannot renew the lease of {}: {}'.format(worker, base, e))
+      if connection is not None:
+        connection.close()
+        connection = None
+      if time.time() - renewed >= lease:
+        print('{}: the lease of {} ran out, stopping it'.format(worker, base))
+        lost.set()
+    sys.stdout.flush()
+    if lost.is_set():
+      stop_process(process)
+      break
+
+  if connection is not None:
+    connection.close()
+
+def work(connection, lease, max_attempts, log_dir, worker):
+  if log_dir and not os.path.isdir(log_dir):
+    os.makedirs(log_dir)
+
+  while True:
+    row = claim(connection, worker, lease, max_attempts)
+    if row is None:
+      # Scans still running elsewhere may yet lose their lease, wait to take them over
+      expires = connection.execute('''SELECT MIN(lease_expires) FROM jobs WHERE state = 'running' ''').fetchone()[0]
+      if expires is None:
+        break
+      time.sleep(min(max(expires - time.time(), 0.0) + 1.0, lease))
+      continue
+    base, command, attempts = row
+    attempts += 1
+    print('{}: running {} (attempt {}): {}'.format(worker, base, attempts, command))
+    sys.stdout.flush()
+
+    start = time.time()
+    stop = threading.Event()
+    lost = threading.Event()
+    log = open(os.path.join(log_dir, base + '.log'), 'a') if log_dir else None
+    try:
+      process = start_process(command, log)
+    except OSError as e:
+      print('{}: cannot run {}: {}'.format(worker, base, e))
+      process = None
+      returncode = 127
+
+    if process is not None:
+      renewer = threading.Thread(target=renew, args=(args.queue, worker, base, lease, stop, process, lost))
+      renewer.daemon = True
+      renewer.start()
+      returncode = process.wait()
+      stop.set()
+      renewer.join()
+    if log:
+      log.close()
+    seconds = time.time() - start
+
+    if lost.is_set():
+      # Another worker owns the scan now, or will once the lease is seen to have run out
+      print('{}: {} abandoned after {:.1f}s'.format(worker, base, seconds))
+      sys.stdout.flush()
+      continue
+    state = finish(connection, worker, base, returncode, seconds, max_attempts, attempts)
+    print('{}: {} {} in {:.1f}s'.format(worker, base, state, seconds))
+    sys.stdout.flush()
+
+def local(connection):
+  '''Start workers as separate processes, so a crash takes down only one of them'''
+  workers = []
+  for i in range(args.workers):
+    cmd = [sys.executable, os.path.abspath(__file__), args.queue, 'work',
+      '--lease', str(args.lease), '--max_attempts', str(args.max_attempts),
+      '--worker_name', '{}:local{}'.format(socket.gethostname(), i)]
+    if args.log_dir:
+      cmd += ['--log_dir', args.log_dir]
+    workers.append(subprocess.Popen(cmd))
+  return max([w.wait() for w in workers] + [0])
+
+def status(connection):
+  rows = connection.execute('''SELECT base, state, worker, attempts, cost, seconds, message
+    FROM jobs ORDER BY cost DESC, base''').fetchall()
+  counts = {}
+  for base, state, worker, attempts, cost, seconds, message in rows:
+    counts[state] = counts.get(state, 0) + 1
+    print('  {:<20} {:<8} cost {:>12.0f}  attempts {}  {}{}{}'.format(base, state, cost, attempts,
+      '{:.1f}s'.format(seconds) if seconds is not None else '',
+      '  on ' + worker if worker else '', '  (' + message + ')' if message else ''))
+  print('Total: ' + ', '.join('{} {}'.format(n, s) for s, n in sorted(counts.items())))
+  return 1 if counts.get('failed', 0) > 0 else 0
+
+connection = connect(args.queue)
+result = 0
+if args.action == 'init':
+  init(connection)
+elif args.action == 'work':
+  worker = args.worker_name or '{}:{}'.format(socket.gethostname(), os.getpid())
+  work(connection, args.lease, args.max_attempts, args.log_dir, worker)
+elif args.action == 'local':
+  result = local(connection)
+  result = status(connection) or result
+elif args.action == 'status':
+  result = status(connection)
+elif args.action == 'reset':
+  cursor = connection.execute('''UPDATE jobs SET state = 'queued', attempts = 0, message = NULL WHERE state = 'failed' ''')
+  print('Queued {} failed scans again'.format(cursor.rowcount))
+connection.close()
+sys.exit(result)
@@ -0,0 +1,42 @@
+
+# Imports
+import socket
+import sys
+import argparse
+
+# Argument Parsing
+parser = argparse.ArgumentParser(description='Submit a job to a running SegmentationDaemon')
+parser.add_argument('socket', help='Unix socket the daemon listens on')
+parser.add_argument('stage', help='sheetness, periosteal, endosteal, pipeline or shutdown')
+parser.add_argument('parameters', nargs='*', help='Job parameters as key=value (e.g. input=RETRO_00001.nii periosteal.lambda=50)')
+parser.add_argument('--config', default=None, help='Configuration file sent ahead of the parameters')
+args = parser.parse_args()
+
+# Build the request, later keys win
+request = ''
+if args.config is not None:
+  with open(args.config) as f:
+    request += f.read() + '\n'
+request += '[]\n'
+request += 'stage = {}\n'.format(args.stage)
+for parameter in args.parameters:
+  if '=' not in parameter:
+    parser.error('Expected key=value, got {}'.format(parameter))
+  key, value = parameter.split('=', 1)
+  request += '{} = {}\n'.format(key.strip(), value.strip())
+
+# Send it and stream the replies
+client = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+client.connect(args.socket)
+client.sendall(request.encode())
+client.shutdown(socket.SHUT_WR)
+
+status = 1
+for line in client.makefile('r'):
+  line = line.rstrip('\n')
+  print(line)
+  if line.startswith('DONE'):
+    status = 0
+client.close()
+
+sys.exit(status)
@@ -0,0 +1,73 @@
+
+# Imports
+import os
+import time
+import argparse
+import numpy as np
+import SimpleITK as sitk
+import femur
+
+# Argument Parsing
+parser = argparse.ArgumentParser(description='Run sheetness, periosteal and endosteal segmentation in one process')
+parser.add_argument('image', help='HU image')
+parser.add_argument('marks', help='Periosteal marks image')
+parser.add_argument('output_prefix', help='Written as <prefix>_PERI.nii and <prefix>_ENDO.nii')
+parser.add_argument('--config', default='', help='Configuration file, e.g. femur_pipeline.cfg (defaults if empty)')
+parser.add_argument('--threads', default=0, type=int, help='Number of threads (0 = all)')
+parser.add_argument('--pool', default='stealing', help='Thread pool (stealing, itk, tbb or platform)')
+parser.add_argument('--write_sheetness', action='store_true', help='Also write <prefix>_SHEET.nii')
+args = parser.parse_args()
+
+# Check inputs
+print('Arguments:')
+for arg in vars(args):
+  print('  {}: {}'.format(arg, getattr(args, arg)))
+print('')
+
+femur.configure_threading(args.threads, args.pool)
+if args.config:
+  sheetness_parameters, periosteal_parameters, endosteal_parameters = femur.read_parameters(args.config)
+else:
+  sheetness_parameters = femur.SheetnessParameters()
+  periosteal_parameters = femur.PeriostealParameters()
+  endosteal_parameters = femur.EndostealParameters()
+
+def to_femur(sitk_image, image_class, dtype):
+  '''Wrap a SimpleITK image. Only copies when the pixel type has to change.'''
+  array = np.ascontiguousarray(sitk.GetArrayViewFromImage(sitk_image), dtype=dtype)
+  return image_class(array, sitk_image.GetSpacing(), sitk_image.GetOrigin(), sitk_image.GetDirection())
+
+def to_sitk(femur_image):
+  '''Copy a femur image into SimpleITK for writing'''
+  sitk_image = sitk.GetImageFromArray(femur_image.array)
+  sitk_image.SetSpacing(femur_image.spacing)
+  sitk_image.SetOrigin(femur_image.origin)
+  sitk_image.SetDirection(femur_image.direction)
+  return sitk_image
+
+def timed(name, function, *function_args):
+  start = time.time()
+  result = function(*function_args)
+  print('  {}: {:.2f}s'.format(name, time.time() - start))
+  return result
+
+# Read
+hu_image = sitk.ReadImage(args.image)
+marks_image = sitk.ReadImage(args.marks)
+hu = to_femur(hu_image, femur.HUImage, np.int16)
+marks = to_femur(marks_image, femur.LabelImage, np.uint8)
+
+# Run, every intermediate stays in memory
+print('Running:')
+skin, eroded = timed('Skin masks', femur.compute_skin_masks, hu, sheetness_parameters)
+sheetness = timed('Sheetness', femur.compute_sheetness, hu, skin, eroded, sheetness_parameters)
+periosteal = timed('Periosteal', femur.segment_periosteal, sheetness, marks, periosteal_parameters)
+endosteal = timed('Endosteal', femur.segment_endosteal, sheetness, periosteal, endosteal_parameters)
+print('')
+
+# Write
+if args.write_sheetness:
+  sitk.WriteImage(to_sitk(sheetness), args.output_prefix + '_SHEET.nii')
+sitk.WriteImage(to_sitk(periosteal), args.output_prefix + '_PERI.nii')
+sitk.WriteImage(to_sitk(endosteal), args.output_prefix + '_ENDO.nii')
+print('Wrote {}_PERI.nii and {}_ENDO.nii'.format(args.output_prefix, args.output_prefix))
@@ -0,0 +1,153 @@
+# Imports
+import os
+import sys
+import json
+import time
+import argparse
+import subprocess
+import SimpleITK as sitk
+import numpy as np
+
+# Argument Parsing
+parser = argparse.ArgumentParser(description='Run the segmentation executables on synthetic phantoms and compare time, peak memory and Dice to a baseline')
+parser.add_argument('--bin_dir', default=os.path.join('build', 'src'), help='Directory holding FemurPhantom, Sheetness2, PeriostealSegmentation and EndostealSegmentation')
+parser.add_argument('--work_dir', default='phantom_regression', help='Directory for phantoms and outputs')
+parser.add_argument('--baseline', default=os.path.join(os.path.dirname(os.path.abspath(__file__)), 'performance_baseline.json'),
+  help='Baseline with the phantom cases, tolerances and expected metrics')
+parser.add_argument('--cases', nargs='*', default=None, help='Run only these cases (default all)')
+parser.add_argument('--update_baseline', action='store_true', help='Store the measured metrics as the new baseline')
+args = parser.parse_args()
+
+# Check inputs
+print('Arguments:')
+for arg in vars(args):
+  print('  {}: {}'.format(arg, getattr(args, arg)))
+print('')
+
+with open(args.baseline) as f:
+  baseline = json.load(f)
+tolerances = baseline['tolerances']
+
+if not os.path.isdir(args.work_dir):
+  os.makedirs(args.work_dir)
+
+
+def run(name, cmd):
+  '''Run one executable. Returns wall time in seconds and peak RSS in MB.'''
+  cmd = [os.path.join(args.bin_dir, name)] + [str(x) for x in cmd]
+  print('CMD: {}'.format(cmd))
+  start = time.perf_counter()
+  with open(os.path.join(args.work_dir, name + '.log'), 'w') as log:
+    process = subprocess.Popen(cmd, stdout=log, stderr=subprocess.STDOUT)
+    _, status, usage = os.wait4(process.pid, 0)
+  seconds = time.perf_counter() - start
+  process.returncode = status
+  if not os.WIFEXITED(status) or os.WEXITSTATUS(status) != 0:
+    raise RuntimeError('{} failed with status {}, see {}.log'.format(name, status, name))
+  # ru_maxrss is kB on Linux, bytes on macOS
+  rss = usage.ru_maxrss / (1024.0 * 1024.0 if sys.platform == 'darwin' else 1024.0)
+  return seconds, rss
+
+
+def dice(fileName, truthFileName, labels, truthLabels=None):
+  '''Dice of the voxels in labels of a segmentation and in truthLabels (default labels) of the phantom truth.'''
+  segmentation = np.isin(sitk.GetArrayViewFromImage(sitk.ReadImage(fileName)), labels)
+  truth = np.isin(sitk.GetArrayViewFromImage(sitk.ReadImage(truthFileName)), labels if truthLabels is None else truthLabels)
+  total = segmentation.sum() + truth.sum()
+  return 2.0 * np.logical_and(segmentation, truth).sum() / total if total > 0 else 1.0
+
+
+def measure(case):
+  '''Generate the phantom of a case, run the three stages and collect the metrics.'''
+  prefix = os.path.join(args.work_dir, case['name'])
+  hu = prefix + '.nii'
+  marks = prefix + '_MARKS.nii'
+  truth = prefix + '_TRUTH.nii'
+  skin = prefix + '_SKIN.nii'
+  sheet = prefix + '_SHEET.nii'
+  peri = prefix + '_PERI.nii'
+  endo = prefix + '_ENDO.nii'
+
+  # {cmd} {prefix} {sizeX} {sizeY} {sizeZ} {spacing} {noise} {seed}
+  run('FemurPhantom', [prefix] + case['size'] + [case['spacing'], case['noise'], case['seed']])
+
+  metrics = {}
+  # {cmd} {input} {skin} {sheetness} {enhance} {N} {min} {max} {lowThreshold} {highThreshold} {weight}
+  metrics['Sheetness2'] = run('Sheetness2', [hu, skin, sheet, 1, 2, 0.5, 1.0, -400.0, 1200.0, 0.05])
+  # {cmd} {input} {marks} {output} {lambda} {sigma} {label} {connFilter}
+  metrics['PeriostealSegmentation'] = run('PeriostealSegmentation', [sheet, marks, peri, 50, 0.25, 1, 1])
+  # {cmd} {input} {mask} {output} {lambda} {sigma} {lower} {upper} {cortical} {cancellous} {background} {min} {max}
+  metrics['EndostealSegmentation'] = run('EndostealSegmentation', [sheet, peri, endo, 50, 0.25, 1, 1, 1, 2, 0, 1.0, 2.0])
+
+  result = {}
+  for name, (seconds, rss) in metrics.items():
+    result[name] = {'time': seconds, 'rss': rss}
+  # The periosteal surface encloses the whole femur, cortical and cancellous
+  result['dice'] = {
+    'periosteal': dice(peri, truth, [1], [1, 2]),
+    'cortical': dice(endo, truth, [1]),
+    'cancellous': dice(endo, truth, [2])
+  }
+  return result
+
+
+def compare(expected, measured):
+  '''List of regressions of measured against expected, each a printable string.'''
+  regressions = []
+  for name, values in measured.items():
+    for key, value in values.items():
+      reference = expected.get(name, {}).get(key)
+      if reference is None:
+        continue
+      if name == 'dice':
+        limit = reference - tolerances['dice']
+        failed = value < limit
+      else:
+        # Relative tolerance plus an absolute slack so short runs do not flag jitter
+        limit = reference * (1.0 + tolerances[key]) + tolerances.get(key + '_absolute', 0.0)
+        failed = value > limit
+      print('  {:<24} {:<12} {:>12.3f} {:>12.3f} {:>12.3f} {}'.format(
+        name, key, value, reference, limit, 'REGRESSION' if failed else 'ok'))
+      if failed:
+        regressions.append('{} {} {:.3f} vs {:.3f}'.format(name, key, value, reference))
+  return regressions
+
+
+regressions = []
+for case in baseline['cases']:
+  if args.cases is not None and case['name'] not in args.cases:
+    continue
+
+  print('Case {}'.format(case['name']))
+  measured = measure(case)
+  # The phantom is the same on every platform, so Dice measured once is checked on every
+  # machine, up to the tolerance floating point differences between toolchains need. Time
+  # and memory depend on the machine and are only checked once stored for it.
+  expected = dict(case.get('metrics') or {})
+  if case.get('dice'):
+    expected['dice'] = case['dice']
+  elif not args.update_baseline:
+    print('  No measured Dice, run with --update_baseline to store it')
+    regressions.append('{}: no measured Dice in the baseline'.format(case['name']))
+  if not case.get('metrics'):
+    print('  No baseline time and memory, run with --update_baseline to store them')
+  print('  {:<24} {:<12} {:>12} {:>12} {:>12}'.format('Stage', 'Metric', 'Measured', 'Baseline', 'Limit'))
+  regressions += ['{}: {}'.format(case['name'], r) for r in compare(expected, measured)]
+  case['dice'] = measured.pop('dice')
+  case['metrics'] = measured
+  print('')
+
+if args.update_baseline:
+  print('Writing baseline to {}'.format(args.baseline))
+  with open(args.baseline, 'w') as f:
+    json.dump(baseline, f, indent=2)
+    f.write('\n')
+  sys.exit(0)
+
+if regressions:
+  print('Regressions:')
+  for r in regressions:
+    print('  ' + r)
+  sys.exit(1)
+
+print('Finished!')
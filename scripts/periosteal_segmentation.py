@@ -22,6 +22,13 @@ parser.add_argument('--model_dir', default=os.path.join('MODELS'),
   help='Directory for MODEL files')
 parser.add_argument('--cpp_compiled', default=os.path.join('COM', 'CPP', 'PeriostealSegmentation'),
   help='The C++ code compiled to be ran')
+parser.add_argument('--batched_cpp_compiled', default=os.path.join('COM', 'CPP', 'BatchedPeriostealSegmentation'),
+  help='The C++ code compiled to be ran for batched labels')
+parser.add_argument('--batch_labels', default='',
+  help='Comma separated small labels solved together in one grid cut, e.g. Sacrum,L5,L4,L3,L2,L1. '
+  'Batched labels are cut inside their mark box plus padding and skip the connected component filter. '
+  'Default none, every label is solved on its own')
+parser.add_argument('--batch_padding', default=5, help='Padding in voxels around each batched label')
 args = parser.parse_args()
 
 # Check inputs
@@ -32,6 +39,7 @@ print('')
 
 MODEL_DIR = os.path.join(args.project_directory, args.model_dir)
 CPP = os.path.join(args.project_directory, args.cpp_compiled)
+BATCHED_CPP = os.path.join(args.project_directory, args.batched_cpp_compiled)
 SHEET_FILE_NAME = os.path.join(MODEL_DIR, args.base_name + args.sheet_ending)
 MARK_FILE_NAME = os.path.join(MODEL_DIR, args.base_name + args.mark_ending)
 PERI_FILE_NAME = os.path.join(MODEL_DIR, args.base_name + args.peri_ending)
@@ -49,7 +57,18 @@ labels = {
   "L1":           10
 }
 
+batched = [x for x in args.batch_labels.split(',') if x]
+for name in batched:
+  if name not in labels:
+    raise ValueError('Unknown batch label {}'.format(name))
+
+# Each temporary image holds the value 1 inside its label, except the batched
+# image which already holds the label values.
+temp_images = []
+
 for name, label in labels.items():
+  if name in batched:
+    continue
   print('Processing label {} ({})'.format(label, name))
   temp_name = os.path.join(MODEL_DIR, args.base_name + "_TEMP_" + name + ".nii")
 
@@ -60,20 +79,34 @@ for name, label in labels.items():
   res = subprocess.check_output(cmd)
   print('  Result: {}'.format(res))
   print('')
+  temp_images.append((temp_name, label))
 
-print('Combining each segmentation')
-first = list(labels)[0]
-temp_name = os.path.join(MODEL_DIR, args.base_name + "_TEMP_" + first + ".nii")
-seg = sitk.ReadImage(str(temp_name), sitk.sitkUInt8)
-seg = labels[first]*(seg>0)
-os.remove(temp_name)
+if len(batched) > 0:
+  print('Processing batched labels {}'.format(batched))
+  temp_name = os.path.join(MODEL_DIR, args.base_name + "_TEMP_BATCHED.nii")
 
-for name, label in labels.items():
-  if name == first:
-    continue
+  # ${prog} ${input} ${mask} ${output} ${lambda} ${sigma} ${padding} ${label} ...
+  cmd = [BATCHED_CPP, SHEET_FILE_NAME, MARK_FILE_NAME, temp_name, args.gc_lambda, args.sigma, args.batch_padding]
+  cmd += [labels[name] for name in batched]
+  cmd = [str(x) for x in cmd]
+  print('  CMD: {}'.format(cmd))
+  res = subprocess.check_output(cmd)
+  print('  Result: {}'.format(res))
+  print('')
+  temp_images.append((temp_name, None))
 
-  temp_name = os.path.join(MODEL_DIR, args.base_name + "_TEMP_" + name + ".nii")
+def read_labels(temp_name, label):
   this_label = sitk.ReadImage(str(temp_name), sitk.sitkUInt8)
+  os.remove(temp_name)
+  if label is None:
+    return this_label
+  return label*(this_label>0)
+
+print('Combining each segmentation')
+seg = read_labels(*temp_images[0])
+
+for temp_name, label in temp_images[1:]:
+  this_label = read_labels(temp_name, label)
 
   bin_seg = seg>0
   bin_this = this_label>0
@@ -81,8 +114,7 @@ for name, label in labels.items():
   mask = 1 - overlap
   this_label = sitk.Mask(this_label, mask)
 
-  seg = seg + label*(this_label>0)
-  os.remove(temp_name)
+  seg = seg + this_label
 
 print('Writing result to ' + PERI_FILE_NAME)
 sitk.WriteImage(seg, PERI_FILE_NAME)
@@ -18,6 +18,8 @@ parser.add_argument('--max_sigma', default=1.0, help='How many sigmas to use for
 parser.add_argument('--air_threshold', default=-400.0, help='Threshold for determining air')
 parser.add_argument('--metal_threshold', default=1200.0, help='Threshold for determining metal')
 parser.add_argument('--trace_weight', default=0.05, help='Weight for reducing noise')
+parser.add_argument('--quantization_scale', default=0, type=float,
+  help='Store a .fsc sheetness image as int16 with this scale (0 = float)')
 parser.add_argument('--project_directory', default=
   os.path.join(os.sep, *os.path.dirname(os.path.abspath(__file__)).split(os.sep)[:-2]),
   help='Base directory for project')
@@ -41,12 +43,14 @@ SKIN_FILE_NAME = os.path.join(MODEL_DIR, args.base_name + args.skin_ending)
 
 print('')
 
-# {cmd} {input} {skin} {sheetness} {enhance} {N} {min} {max} {lowThreshold} {highThreshold} {weight}
+# {cmd} {input} {skin} {sheetness} {enhance} {N} {min} {max} {lowThreshold} {highThreshold} {weight} [{quantization}]
 cmd = [
   CPP, HU_FILE_NAME, SKIN_FILE_NAME, SHEET_FILE_NAME, args.enhance_bright,
   args.number_of_sigma, args.min_sigma, args.max_sigma,
   args.air_threshold, args.metal_threshold, args.trace_weight
 ]
+if args.quantization_scale > 0:
+  cmd.append(args.quantization_scale)
 cmd = [str(x) for x in cmd]
 print('CMD: {}'.format(cmd))
 res = subprocess.check_output(cmd)
@@ -0,0 +1,147 @@
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "itkBatchedPeriostealSegmentationImageFilter.h"
+#include "femurImageIO.h"
+#include "femurCrop.h"
+#include "femurCommandLine.h"
+#include "femurLabelTypes.h"
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+
+#include <algorithm>
+
+/* Type definitions */
+constexpr unsigned int ImageDimension = 3;
+using InputPixelType  = float;
+using OutputPixelType = unsigned char;
+
+using InputImageType  = itk::Image< InputPixelType, ImageDimension >;
+using OutputImageType = itk::Image< OutputPixelType, ImageDimension >;
+
+using OutputWriterType  = itk::ImageFileWriter< OutputImageType >;
+
+/* The mask is read as the narrowest type holding its labels */
+template< typename TMaskPixel >
+int Segment(const std::string & inputFileName, const std::string & maskFileName, const std::string & outputFileName,
+            double lambda, double sigma, long padding, const std::vector< int > & labelValues)
+{
+  using MaskImageType   = itk::Image< TMaskPixel, ImageDimension >;
+  using MaskReaderType  = itk::ImageFileReader< MaskImageType >;
+  using BatchedPeriostealSegmentationFilterType = itk::BatchedPeriostealSegmentationImageFilter< InputImageType, MaskImageType, OutputImageType >;
+
+  typename BatchedPeriostealSegmentationFilterType::LabelArrayType labels(labelValues.begin(), labelValues.end());
+
+  std::cout << "Reading mask " << maskFileName << " as " << sizeof(TMaskPixel) * 8 << " bit labels" << std::endl;
+  typename MaskReaderType::Pointer mask_reader = MaskReaderType::New();
+  mask_reader->SetFileName(maskFileName);
+  mask_reader->Update();
+  const MaskImageType * mask = mask_reader->GetOutput();
+
+  /* Each label is cut in its own box padded by padding, so nothing outside the union of
+   * those boxes is ever looked at and only that part of the input is read */
+  const typename MaskImageType::RegionType region = femur::BoundingRegion(mask,
+    [&](TMaskPixel value) { return std::find(labelValues.begin(), labelValues.end(), static_cast< int >(value)) != labelValues.end(); },
+    padding);
+  std::cout << "Reading input " << inputFileName << " in " << region.GetSize() << " from " << region.GetIndex() << std::endl;
+  InputImageType::Pointer input = femur::ReadImageRegion< InputImageType >(inputFileName, region);
+  typename MaskImageType::Pointer cropMask = femur::CropImage(mask, region);
+
+  std::cout << "Running batched graph cut filter" << std::endl;
+  typename BatchedPeriostealSegmentationFilterType::Pointer filter = BatchedPeriostealSegmentationFilterType::New();
+  filter->SetLambda(lambda);
+  filter->SetSigma(sigma);
+  filter->SetBackgroundLabel(0);
+  filter->SetLabels(labels);
+  filter->SetPadding(padding);
+  filter->SetInput(input);
+  filter->SetMask(cropMask);
+  {
+    FEMUR_TRACE_SCOPE("main", "filter->Update");
+    filter->Update();
+  }
+
+  std::cout << "  Grid Size: " << filter->GetGridSize() << std::endl;
+  for (unsigned int i = 0; i < labels.size(); ++i)
+  {
+    std::cout << "  Label " << labelValues[i] << ": " << filter->GetRegions()[i].GetSize() << std::endl;
+  }
+  std::cout << "  Max Flow: " << filter->GetMaxFlow() << std::endl;
+
+  std::cout << "Writing result to " << outputFileName << std::endl;
+  OutputWriterType::Pointer writer = OutputWriterType::New();
+  writer->SetFileName(outputFileName);
+  writer->SetInput(femur::UncropImage(filter->GetOutput(), region, mask, 0));
+  {
+    FEMUR_TRACE_SCOPE("main", "writer->Update");
+    writer->Update();
+  }
+
+  std::cout << "Finished!" << std::endl;
+
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
+  /* Prefer our IO factories, e.g. parallel gzip for .nii.gz */
+  femur::RegisterImageIOFactories();
+  femur::ParseCommonOptions(argc, argv);
+
+  /* Padding is a voxel count, a negative one would wrap around to a huge box */
+  char * paddingEnd = nullptr;
+  errno = 0;
+  const long padding = argc >= 8 ? std::strtol(argv[6], &paddingEnd, 10) : -1;
+  const bool validPadding = paddingEnd != nullptr && paddingEnd != argv[6] && *paddingEnd == '\0'
+    && errno != ERANGE && padding >= 0;
+  if( argc < 8 || !validPadding )
+  {
+    if ( argc >= 8 )
+    {
+      std::cerr << argv[0] << ": <Padding> must be a whole number of voxels, 0 or more, got " << argv[6] << std::endl;
+    }
+    std::cerr << "Usage: "<< std::endl;
+    std::cerr << argv[0];
+    std::cerr << " <InputFileName> <MaskFileName> <OutputSegmentation> ";
+    std::cerr << " <Lambda> <Sigma> <Padding> <Label> [<Label> ...]";
+    std::cerr << " [--trace <file.json>] [--threads <N>] [--pool <stealing|itk|tbb|platform>]";
+    std::cerr << " [--buffer-pool <size>] [--huge-pages] [--perf <file.json>]";
+    std::cerr << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  /* Read input Parameters */
+  std::string inputFileName = argv[1];
+  std::string maskFileName = argv[2];
+  std::string outputFileName = argv[3];
+
+  double lambda = atof(argv[4]);
+  double sigma = atof(argv[5]);
+
+  std::vector< int > labels;
+  for (int i = 7; i < argc; ++i)
+  {
+    labels.push_back(atoi(argv[i]));
+  }
+
+  std::cout << "Parameters:" << std::endl;
+  std::cout << "  InputFilePath:    " << inputFileName << std::endl;
+  std::cout << "  MaskFilePath:     " << maskFileName << std::endl;
+  std::cout << "  OutputFilePath:   " << outputFileName << std::endl;
+  std::cout << "  Lambda:           " << lambda << std::endl;
+  std::cout << "  Sigma:            " << sigma << std::endl;
+  std::cout << "  Padding:          " << padding << std::endl;
+  std::cout << "  Labels:           ";
+  for (auto label : labels)
+  {
+    std::cout << label << " ";
+  }
+  std::cout << std::endl;
+  std::cout << std::endl;
+
+  return femur::DispatchOnLabelType(maskFileName, [&](auto pixel)
+    {
+      return Segment< decltype(pixel) >(inputFileName, maskFileName, outputFileName, lambda, sigma, padding, labels);
+    });
+}
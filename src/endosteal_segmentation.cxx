@@ -1,8 +1,12 @@
 #include <iostream>
 
 #include "itkEndostealSegmentationImageFilter.h"
-#include "itkImageFileReader.h"
-#include "itkImageFileWriter.h"
+#include "femurImageIO.h"
+#include "femurAsyncImageWriter.h"
+#include "femurCommandLine.h"
+#include "femurBatch.h"
+#include "femurImagePrefetcher.h"
+#include "femurCrop.h"
 #include "itkBinaryThresholdImageFilter.h"
 
 constexpr unsigned int ImageDimension = 3;
@@ -12,44 +16,43 @@ using MaskPixelType 	= unsigned char;
 using InputImageType	= itk::Image< InputPixelType, ImageDimension >;
 using MaskImageType		= itk::Image< MaskPixelType, ImageDimension >;
 
-using InputReaderType 	= itk::ImageFileReader< InputImageType >;
-using MaskWReaderType		= itk::ImageFileReader< MaskImageType >;
-using OutputWriterType	= itk::ImageFileWriter< MaskImageType >;
 
 using EndostealSegmentationFilterType = itk::EndostealSegmentationImageFilter< InputImageType, MaskImageType, MaskImageType >;
 using BinaryThresholdFilterType = itk::BinaryThresholdImageFilter< MaskImageType, MaskImageType >;
 
-int main(int argc, char** argv) {
-  if( argc != 13 )
+/* Filters of one worker, reused from scan to scan in batch mode, and its background writer */
+struct EndostealFilters
+{
+  femur::AsyncImageWriter writer;
+  BinaryThresholdFilterType::Pointer thresh = BinaryThresholdFilterType::New();
+  EndostealSegmentationFilterType::Pointer filter = EndostealSegmentationFilterType::New();
+};
+
+/* One scan, arguments as on the command line without the executable's name */
+int Endosteal(const femur::ManifestEntry & arguments, EndostealFilters & filters, femur::ImagePrefetcher & prefetcher)
+{
+  if ( arguments.size() != 12 )
   {
-    std::cerr << "Usage: "<< std::endl;
-    std::cerr << argv[0];
-    std::cerr << " <InputFileName> <MaskFileName> <OutputSegmentation> ";
-		std::cerr << " <Lambda> <Sigma>";
-		std::cerr << " <LowerThresh> <UpperThresh>";
-    std::cerr << " <CortcialLabel> <CancellousLabel> <BackgroundLabel>";
-		std::cerr << " <MinDistance> <MaxDistance>";
-    std::cerr << std::endl;
-    return EXIT_FAILURE;
+    itkGenericExceptionMacro(<< "Expected 12 arguments, got " << arguments.size());
   }
 
 	/* Read input Parameters */
-  std::string inputFileName = argv[1];
-  std::string maskFileName = argv[2];
-  std::string outputFileName = argv[3];
+  std::string inputFileName = arguments[0];
+  std::string maskFileName = arguments[1];
+  std::string outputFileName = arguments[2];
 
-  double lambda = atof(argv[4]);
-	double sigma = atof(argv[5]);
+  double lambda = atof(arguments[3].c_str());
+	double sigma = atof(arguments[4].c_str());
 
-	double lowerThresh = atof(argv[6]);
-	double upperThresh = atof(argv[7]);
+	double lowerThresh = atof(arguments[5].c_str());
+	double upperThresh = atof(arguments[6].c_str());
 
-  int corticalLabel = atoi(argv[8]);
-  int cancellousLabel = atoi(argv[9]);
-	int backgroundLabel = atoi(argv[10]);
+  int corticalLabel = atoi(arguments[7].c_str());
+  int cancellousLabel = atoi(arguments[8].c_str());
+	int backgroundLabel = atoi(arguments[9].c_str());
 
-	double minDistance = atof(argv[11]);
-	double maxDistance = atof(argv[12]);
+	double minDistance = atof(arguments[10].c_str());
+	double maxDistance = atof(arguments[11].c_str());
 
 	std::cout << "Parameters:" << std::endl;
   std::cout << "  InputFilePath:    " << inputFileName << std::endl;
@@ -66,27 +69,25 @@ int main(int argc, char** argv) {
 	std::cout << "  Max Distance:     " << maxDistance << std::endl;
   std::cout << std::endl;
 
-	std::cout << "Reading input " << inputFileName << std::endl;
-	InputReaderType::Pointer input_reader = InputReaderType::New();
-	input_reader->SetFileName(inputFileName);
-	input_reader->Update();
-
 	std::cout << "Reading mask " << maskFileName << std::endl;
-	MaskWReaderType::Pointer mask_reader = MaskWReaderType::New();
-	mask_reader->SetFileName(maskFileName);
-	mask_reader->Update();
+	MaskImageType::Pointer mask = prefetcher.Read< MaskImageType >(maskFileName);
 
-	std::cout << "Thresholding..." << std::endl;
-	BinaryThresholdFilterType::Pointer thresh = BinaryThresholdFilterType::New();
+	BinaryThresholdFilterType::Pointer thresh = filters.thresh;
 	thresh->SetLowerThreshold( lowerThresh );
-  thresh->SetUpperThreshold( upperThresh );
-  thresh->SetOutsideValue( 0 );
-  thresh->SetInsideValue( 1 );
-	thresh->SetInput( mask_reader->GetOutput());
+	thresh->SetUpperThreshold( upperThresh );
+	thresh->SetOutsideValue( 0 );
+	thresh->SetInsideValue( 1 );
+	thresh->SetInput( mask );
 	thresh->Update();
 
+	/* Only the bounding box of the mask is segmented, so only that part of the input is read */
+	const MaskImageType::RegionType cropRegion = femur::NonzeroBoundingRegion(thresh->GetOutput(), 1);
+	std::cout << "Reading input " << inputFileName << " in " << cropRegion.GetSize() << " from " << cropRegion.GetIndex() << std::endl;
+	InputImageType::Pointer input = femur::ReadImageRegion< InputImageType >(inputFileName, cropRegion);
+	MaskImageType::Pointer cropMask = femur::CropImage(thresh->GetOutput(), cropRegion);
+
 	std::cout << "Running graph cut filter" << std::endl;
-	EndostealSegmentationFilterType::Pointer filter = EndostealSegmentationFilterType::New();
+	EndostealSegmentationFilterType::Pointer filter = filters.filter;
 	filter->SetLambda(lambda);
 	filter->SetSigma(sigma);
 	filter->SetCorticalLabel(corticalLabel);
@@ -94,19 +95,70 @@ int main(int argc, char** argv) {
 	filter->SetBackgroundLabel(backgroundLabel);
 	filter->SetMinDistance(minDistance);
 	filter->SetMaxDistance(maxDistance);
-	filter->SetInput(input_reader->GetOutput());
-	filter->SetMask(thresh->GetOutput());
-	filter->Update();
+	filter->SetInput(input);
+	filter->SetMask(cropMask);
+	{
+	  FEMUR_TRACE_SCOPE("main", "filter->Update");
+	  filter->Update();
+	}
 
   std::cout << "  Max Flow: " << filter->GetMaxFlow() << std::endl;
 
 	std::cout << "Writing result to " << outputFileName << std::endl;
-	OutputWriterType::Pointer writer = OutputWriterType::New();
-	writer->SetFileName(outputFileName);
-	writer->SetInput(filter->GetOutput());
-	writer->Update();
+	MaskImageType::Pointer output = femur::UncropImage(filter->GetOutput(), cropRegion, mask.GetPointer(), 0);
+	filters.writer.Write(output.GetPointer(), outputFileName);
 
 	std::cout << "Finished!" << std::endl;
 
+  /* The filters outlive the scan, do not let them hold on to its images. The writer keeps its own reference. */
+  thresh->GetOutput()->ReleaseData();
+  filter->GetOutput()->ReleaseData();
+
 	return EXIT_SUCCESS;
 }
+
+int main(int argc, char** argv) {
+  /* Prefer our IO factories, e.g. parallel gzip for .nii.gz */
+  femur::RegisterImageIOFactories();
+  femur::ParseCommonOptions(argc, argv);
+  const femur::BatchOptions batch = femur::ParseBatchOptions(argc, argv);
+
+  if( batch.Manifest.empty() ? argc != 13 : argc != 1 )
+  {
+    std::cerr << "Usage: "<< std::endl;
+    std::cerr << argv[0];
+    std::cerr << " <InputFileName> <MaskFileName> <OutputSegmentation> ";
+		std::cerr << " <Lambda> <Sigma>";
+		std::cerr << " <LowerThresh> <UpperThresh>";
+    std::cerr << " <CortcialLabel> <CancellousLabel> <BackgroundLabel>";
+		std::cerr << " <MinDistance> <MaxDistance>";
+    std::cerr << " [--trace <file.json>] [--threads <N>] [--pool <stealing|itk|tbb|platform>]";
+    std::cerr << " [--buffer-pool <size>] [--huge-pages] [--perf <file.json>]";
+    std::cerr << std::endl;
+    std::cerr << argv[0] << " --manifest <file> [--jobs <N>] [--prefetch-memory <size>]  (one line of the arguments above per scan)";
+    std::cerr << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if ( !batch.Manifest.empty() )
+  {
+    std::vector< EndostealFilters > filters(batch.Jobs);
+    femur::ImagePrefetcher prefetcher(batch.PrefetchMemory);
+    int result = femur::RunManifest(femur::ReadManifest(batch.Manifest), batch.Jobs,
+      [&](const femur::ManifestEntry & scan, unsigned int worker) { return Endosteal(scan, filters[worker], prefetcher); },
+      [&](const femur::ManifestEntry & scan) { prefetcher.Prefetch< MaskImageType >(scan.at(1)); });
+    for (EndostealFilters & worker : filters)
+    {
+      if ( !worker.writer.Wait() )
+      {
+        result = EXIT_FAILURE;
+      }
+    }
+    return result;
+  }
+
+  EndostealFilters filters;
+  femur::ImagePrefetcher prefetcher;
+  const int result = Endosteal(femur::ManifestEntry(argv + 1, argv + argc), filters, prefetcher);
+  return filters.writer.Wait() ? result : EXIT_FAILURE;
+}
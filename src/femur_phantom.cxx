@@ -0,0 +1,64 @@
+#include <cstdlib>
+#include <iostream>
+
+#include "femurPhantom.h"
+#include "femurImageIO.h"
+#include "femurCommandLine.h"
+
+int main(int argc, char * argv[])
+{
+  /* Prefer our IO factories, e.g. parallel gzip for .nii.gz */
+  femur::RegisterImageIOFactories();
+  femur::ParseCommonOptions(argc, argv);
+
+  if( argc != 7 && argc != 8 )
+  {
+    std::cerr << "Usage: "<< std::endl;
+    std::cerr << argv[0];
+    std::cerr << " <OutputPrefix> <SizeX> <SizeY> <SizeZ> <Spacing> <NoiseSD> [<Seed>]";
+    std::cerr << " [--trace <file.json>] [--threads <N>] [--pool <stealing|itk|tbb|platform>]";
+    std::cerr << " [--buffer-pool <size>] [--huge-pages] [--perf <file.json>]";
+    std::cerr << std::endl;
+    std::cerr << "Writes <OutputPrefix>.nii, <OutputPrefix>_MARKS.nii and <OutputPrefix>_TRUTH.nii" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  /* Read input Parameters */
+  std::string prefix = argv[1];
+
+  femur::PhantomParameters parameters;
+  for (unsigned int d = 0; d < femur::ImageDimension; ++d)
+  {
+    parameters.Size[d] = std::strtoul(argv[2 + d], nullptr, 10);
+  }
+  parameters.Spacing = atof(argv[5]);
+  parameters.NoiseSD = atof(argv[6]);
+  if ( argc == 8 )
+  {
+    parameters.Seed = std::strtoul(argv[7], nullptr, 10);
+  }
+
+  std::cout << "Read in the following parameters:" << std::endl;
+  std::cout << "  OutputPrefix:     " << prefix << std::endl;
+  std::cout << "  Size:             " << parameters.Size[0] << " " << parameters.Size[1] << " " << parameters.Size[2] << std::endl;
+  std::cout << "  Spacing:          " << parameters.Spacing << std::endl;
+  std::cout << "  NoiseSD:          " << parameters.NoiseSD << std::endl;
+  std::cout << "  Seed:             " << parameters.Seed << std::endl;
+  std::cout << std::endl;
+
+  std::cout << "Generating phantom" << std::endl;
+  femur::Phantom phantom = femur::MakePhantom(parameters);
+
+  std::cout << "Writing image to " << prefix << ".nii" << std::endl;
+  femur::WriteImage(phantom.Image.GetPointer(), prefix + ".nii");
+
+  std::cout << "Writing marks to " << prefix << "_MARKS.nii" << std::endl;
+  femur::WriteImage(phantom.Marks.GetPointer(), prefix + "_MARKS.nii");
+
+  std::cout << "Writing ground truth to " << prefix << "_TRUTH.nii" << std::endl;
+  femur::WriteImage(phantom.Truth.GetPointer(), prefix + "_TRUTH.nii");
+
+  std::cout << "Finished!" << std::endl;
+
+  return EXIT_SUCCESS;
+}
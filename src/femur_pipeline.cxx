@@ -0,0 +1,239 @@
+#include <iostream>
+
+#include "femurConfiguration.h"
+#include "femurPipeline.h"
+#include "femurImageIO.h"
+#include "femurAsyncImageWriter.h"
+#include "femurStageCache.h"
+#include "femurCommandLine.h"
+#include "femurMemoryPlanner.h"
+#include "itkImageFileReader.h"
+#include "itkMemoryMappedImageFileReader.h"
+
+/* Type definitions */
+using HUReaderType        = itk::MemoryMappedImageFileReader< femur::HUImageType >;
+using LabelReaderType     = itk::ImageFileReader< femur::LabelImageType >;
+
+template< typename TImage >
+void WriteIntermediate(femur::AsyncImageWriter & writer, const TImage * image, const std::string & fileName,
+                       double quantizationScale = 0.0)
+{
+  std::cout << "Writing " << fileName << std::endl;
+  writer.Write(image, fileName, quantizationScale);
+}
+
+int main(int argc, char * argv[])
+{
+  /* Prefer our IO factories, e.g. parallel gzip for .nii.gz */
+  femur::RegisterImageIOFactories();
+  femur::ParseCommonOptions(argc, argv);
+  const std::uint64_t memoryBudget = femur::ParseMemoryOption(argc, argv);
+
+  if( argc != 5 && argc != 6 )
+  {
+    std::cerr << "Usage: "<< std::endl;
+    std::cerr << argv[0];
+    std::cerr << " <ConfigFile> <InputFileName> <MarkFileName> <OutputSegmentation> [<IntermediatePrefix>]";
+    std::cerr << " [--trace <file.json>] [--threads <N>] [--pool <stealing|itk|tbb|platform>]";
+    std::cerr << " [--buffer-pool <size>] [--huge-pages] [--perf <file.json>]";
+    std::cerr << " [--max-memory <size, e.g. 8G>]";
+    std::cerr << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  /* Read input Parameters */
+  std::string configFileName = argv[1];
+  std::string inputFileName = argv[2];
+  std::string markFileName = argv[3];
+  std::string outputFileName = argv[4];
+  std::string prefix = argc == 6 ? argv[5] : "";
+
+  femur::Configuration config;
+  config.Read(configFileName);
+
+  femur::SheetnessParameters sheetnessParameters;
+  femur::PeriostealParameters periostealParameters;
+  femur::EndostealParameters endostealParameters;
+  sheetnessParameters.Read(config);
+  periostealParameters.Read(config);
+  endostealParameters.Read(config);
+
+  /* Intermediates are only written when asked for */
+  const bool writeSkin = config.GetBool("output.write_skin", false);
+  const bool writeSheetness = config.GetBool("output.write_sheetness", false);
+  const bool writePeriosteal = config.GetBool("output.write_periosteal", false);
+  const std::string skinEnding = config.GetString("output.skin_ending", "_SKIN.nii");
+  const std::string sheetnessEnding = config.GetString("output.sheet_ending", "_SHEET.nii");
+  const std::string periostealEnding = config.GetString("output.peri_ending", "_PERI.nii.gz");
+  const double quantizationScale = config.GetDouble("output.sheet_quantization", 0.0);
+  const std::string cacheDirectory = config.GetString("cache.directory", "");
+  const double cacheSize = config.GetDouble("cache.max_size_gb", 20.0);
+  config.WarnUnusedKeys();
+
+  if ( (writeSkin || writeSheetness || writePeriosteal) && prefix.empty() )
+  {
+    std::cerr << "Writing intermediates requires <IntermediatePrefix>" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "Read in the following parameters:" << std::endl;
+  std::cout << "  ConfigFilePath:   " << configFileName << std::endl;
+  std::cout << "  InputFilePath:    " << inputFileName << std::endl;
+  std::cout << "  MarkFilePath:     " << markFileName << std::endl;
+  std::cout << "  OutputFilePath:   " << outputFileName << std::endl;
+  std::cout << "  Prefix:           " << prefix << std::endl;
+  std::cout << "  CacheDirectory:   " << cacheDirectory << std::endl;
+  std::cout << "  CacheSize:        " << cacheSize << " GB" << std::endl;
+  sheetnessParameters.Print(std::cout);
+  periostealParameters.Print(std::cout);
+  endostealParameters.Print(std::cout);
+
+  /* Sized from the header, before anything is read */
+  const femur::MemoryPlan plan =
+    femur::PlanMemory(femur::ReadImageGeometry(inputFileName), sheetnessParameters.MaxSigma, memoryBudget);
+  plan.Print(std::cout);
+  std::cout << std::endl;
+
+  /* Stage outputs are keyed by the input file contents and the parameters alone,
+   * so whatever is cached is found without reading the scan */
+  femur::StageCache cache;
+  femur::StageKey inputKey, markKey;
+  if ( !cacheDirectory.empty() )
+  {
+    cache = femur::StageCache(cacheDirectory, static_cast< std::uint64_t >(cacheSize * (1ULL << 30)));
+    inputKey = femur::HashFile(inputFileName);
+    markKey = femur::HashFile(markFileName);
+  }
+  const femur::StageKey skinKey = femur::SkinMaskKey(inputKey, sheetnessParameters);
+  const femur::StageKey erodedKey = femur::ErodedMaskKey(inputKey, sheetnessParameters);
+  femur::StageKey sheetnessKey = femur::SheetnessKey(inputKey, sheetnessParameters);
+  femur::StageKey periostealKey = femur::PeriostealKey(sheetnessKey, markKey, periostealParameters);
+
+  /* Float Hessians and cropped periosteal cuts change the result slightly, keep them apart.
+   * Cropping the endosteal cut does not. */
+  if ( plan.SinglePrecisionHessian )
+  {
+    sheetnessKey.Add("float");
+    periostealKey = femur::PeriostealKey(sheetnessKey, markKey, periostealParameters);
+  }
+  if ( plan.CropPeriosteal )
+  {
+    periostealKey.Add("cropped");
+  }
+  const femur::StageKey endostealKey = femur::EndostealKey(sheetnessKey, periostealKey, endostealParameters);
+
+  /* Outputs are written in the background while later stages run */
+  femur::AsyncImageWriter writer;
+
+  /* Each stage runs at most once, and only if an output that is not cached needs it */
+  HUReaderType::Pointer reader;
+  auto input = [&]() -> const femur::HUImageType *
+    {
+      if ( reader.IsNull() )
+      {
+        std::cout << "Reading in " << inputFileName << std::endl;
+        reader = HUReaderType::New();
+        reader->SetFileName(inputFileName);
+        FEMUR_TRACE_SCOPE("main", "reader->Update");
+        reader->Update();
+      }
+      return reader->GetOutput();
+    };
+
+  femur::SkinMasks masks;
+  auto skinMasks = [&]() -> const femur::SkinMasks &
+    {
+      if ( masks.Skin.IsNull() || masks.Eroded.IsNull() )
+      {
+        masks.Skin = cache.Load< femur::MaskImageType >(skinKey, "skin");
+        masks.Eroded = cache.Load< femur::MaskImageType >(erodedKey, "eroded");
+      }
+      if ( masks.Skin.IsNull() || masks.Eroded.IsNull() )
+      {
+        std::cout << "Computing skin masks" << std::endl;
+        masks = femur::ComputeSkinMasks(input(), sheetnessParameters);
+        cache.Store(skinKey, "skin", masks.Skin.GetPointer());
+        cache.Store(erodedKey, "eroded", masks.Eroded.GetPointer());
+      }
+      return masks;
+    };
+
+  femur::SheetnessImageType::Pointer sheetness;
+  auto sheetnessImage = [&]() -> femur::SheetnessImageType *
+    {
+      if ( sheetness.IsNull() )
+      {
+        sheetness = cache.GetOrCompute< femur::SheetnessImageType >(sheetnessKey, "sheetness", [&]()
+          {
+            const femur::SkinMasks & stageMasks = skinMasks();
+            std::cout << "Computing sheetness" << std::endl;
+            return femur::ComputeSheetness(input(), stageMasks, sheetnessParameters, plan);
+          });
+
+        /* The HU image and masks are not needed past this point */
+        masks.Skin = nullptr;
+        masks.Eroded = nullptr;
+        reader = nullptr;
+      }
+      return sheetness;
+    };
+
+  femur::LabelImageType::Pointer periosteal;
+  auto periostealImage = [&]() -> femur::LabelImageType *
+    {
+      if ( periosteal.IsNull() )
+      {
+        periosteal = cache.GetOrCompute< femur::LabelImageType >(periostealKey, "periosteal", [&]()
+          {
+            femur::SheetnessImageType * stageSheetness = sheetnessImage();
+
+            std::cout << "Reading marks " << markFileName << std::endl;
+            LabelReaderType::Pointer markReader = LabelReaderType::New();
+            markReader->SetFileName(markFileName);
+            {
+              FEMUR_TRACE_SCOPE("main", "markReader->Update");
+              markReader->Update();
+            }
+
+            std::cout << "Running periosteal segmentation" << std::endl;
+            return femur::SegmentPeriosteal(stageSheetness, markReader->GetOutput(), periostealParameters, plan);
+          });
+      }
+      return periosteal;
+    };
+
+  if ( writeSkin )
+  {
+    WriteIntermediate(writer, skinMasks().Skin.GetPointer(), prefix + skinEnding);
+  }
+  if ( writeSheetness )
+  {
+    WriteIntermediate(writer, sheetnessImage(), prefix + sheetnessEnding, quantizationScale);
+  }
+  if ( writePeriosteal )
+  {
+    WriteIntermediate(writer, periostealImage(), prefix + periostealEnding);
+  }
+
+  femur::LabelImageType::Pointer endosteal = cache.GetOrCompute< femur::LabelImageType >(endostealKey, "endosteal", [&]()
+    {
+      femur::SheetnessImageType * stageSheetness = sheetnessImage();
+      femur::LabelImageType * stagePeriosteal = periostealImage();
+      std::cout << "Running endosteal segmentation" << std::endl;
+      return femur::SegmentEndosteal(stageSheetness, stagePeriosteal, endostealParameters, plan);
+    });
+
+  std::cout << "Writing result to " << outputFileName << std::endl;
+  writer.Write(endosteal.GetPointer(), outputFileName);
+  {
+    FEMUR_TRACE_SCOPE("main", "writer.Wait");
+    if ( !writer.Wait() )
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::cout << "Finished!" << std::endl;
+
+  return EXIT_SUCCESS;
+}
@@ -1,39 +1,98 @@
 #include <iostream>
 
 #include "itkHUPeriostealSegmentationImageFilter.h"
+#include "femurConnectedComponents.h"
+#include "femurImageIO.h"
+#include "femurTaskGraph.h"
+#include "femurCommandLine.h"
+#include "femurLabelTypes.h"
 #include "itkImageFileReader.h"
+#include "itkMemoryMappedImageFileReader.h"
 #include "itkImageFileWriter.h"
-#include "itkConnectedComponentImageFilter.h"
-#include "itkLabelShapeKeepNObjectsImageFilter.h"
-#include "itkBinaryThresholdImageFilter.h"
 
 /* Type definitions */
 constexpr unsigned int ImageDimension = 3;
 using InputPixelType 	= float;
-using MaskPixelType 	= unsigned long;
 using OutputPixelType = unsigned char;
 
 using InputImageType	= itk::Image< InputPixelType, ImageDimension >;
-using MaskImageType		= itk::Image< MaskPixelType, ImageDimension >;
 using OutputImageType	= itk::Image< OutputPixelType, ImageDimension >;
 
-using InputReaderType 	= itk::ImageFileReader< InputImageType >;
-using MaskWReaderType		= itk::ImageFileReader< MaskImageType >;
+using InputReaderType 	= itk::MemoryMappedImageFileReader< InputImageType >;
 using OutputWriterType	= itk::ImageFileWriter< OutputImageType >;
 
-using PeriostealSegmentationFilterType = itk::HUPeriostealSegmentationImageFilter< InputImageType, MaskImageType, OutputImageType >;
+/* The mask is read as the narrowest type holding its labels */
+template< typename TMaskPixel >
+int Segment(const std::string & inputFileName, const std::string & maskFileName, const std::string & outputFileName,
+            double lambda, double sigma, int label)
+{
+  using MaskImageType		= itk::Image< TMaskPixel, ImageDimension >;
+  using MaskWReaderType		= itk::ImageFileReader< MaskImageType >;
+  using PeriostealSegmentationFilterType = itk::HUPeriostealSegmentationImageFilter< InputImageType, MaskImageType, OutputImageType >;
 
-using ConnectedComponentImageFilterType = itk::ConnectedComponentImageFilter< OutputImageType, MaskImageType >;
-using LabelShapeKeepNObjectsImageFilterType = itk::LabelShapeKeepNObjectsImageFilter< MaskImageType >;
-using ThresholdFilterType = itk::BinaryThresholdImageFilter< MaskImageType, OutputImageType >;
+	std::cout << "Reading input " << inputFileName << std::endl;
+	InputReaderType::Pointer input_reader = InputReaderType::New();
+	input_reader->SetFileName(inputFileName);
+
+	std::cout << "Reading mask " << maskFileName << " as " << sizeof(TMaskPixel) * 8 << " bit labels" << std::endl;
+	typename MaskWReaderType::Pointer mask_reader = MaskWReaderType::New();
+	mask_reader->SetFileName(maskFileName);
+
+	/* The input and the mask are read side by side */
+	femur::TaskGraph graph;
+	graph.Add("ReadInput", [&]() { input_reader->Update(); });
+	graph.Add("ReadMask", [&]() { mask_reader->Update(); });
+	graph.Run();
+
+	std::cout << "Running graph cut filter" << std::endl;
+	typename PeriostealSegmentationFilterType::Pointer filter = PeriostealSegmentationFilterType::New();
+	filter->SetLambda(lambda);
+	filter->SetSigma(sigma);
+	filter->SetForegroundLabel(label);
+	filter->SetBackgroundLabel(0);
+	filter->SetInput(input_reader->GetOutput());
+	filter->SetMask(mask_reader->GetOutput());
+	{
+	  FEMUR_TRACE_SCOPE("main", "filter->Update");
+	  filter->Update();
+	}
+
+	std::cout << "  Max Flow: " << filter->GetMaxFlow() << std::endl;
+
+	std::cout << "Running connectivity filter" << std::endl;
+  itk::SizeValueType foregroundCount = 0, backgroundCount = 0;
+  OutputImageType::Pointer segmentation = femur::KeepLargestComponents(filter->GetOutput(), 1, &foregroundCount, &backgroundCount);
+
+	std::cout << "  Found " << foregroundCount << " foreground objects" << std::endl;
+	std::cout << "  Found " << backgroundCount << " background objects" << std::endl;
+
+	std::cout << "Writing result to " << outputFileName << std::endl;
+	OutputWriterType::Pointer writer = OutputWriterType::New();
+	writer->SetFileName(outputFileName);
+	writer->SetInput(segmentation);
+	{
+	  FEMUR_TRACE_SCOPE("main", "writer->Update");
+	  writer->Update();
+	}
+
+	std::cout << "Finished!" << std::endl;
+
+	return EXIT_SUCCESS;
+}
 
 int main(int argc, char** argv) {
+  /* Prefer our IO factories, e.g. parallel gzip for .nii.gz */
+  femur::RegisterImageIOFactories();
+  femur::ParseCommonOptions(argc, argv);
+
   if( argc != 7 )
   {
     std::cerr << "Usage: "<< std::endl;
     std::cerr << argv[0];
     std::cerr << " <InputFileName> <MaskFileName> <OutputSegmentation> ";
 		std::cerr << " <Lambda> <Sigma> <Label>";
+    std::cerr << " [--trace <file.json>] [--threads <N>] [--pool <stealing|itk|tbb|platform>]";
+    std::cerr << " [--buffer-pool <size>] [--huge-pages] [--perf <file.json>]";
     std::cerr << std::endl;
     return EXIT_FAILURE;
   }
@@ -56,74 +115,8 @@ int main(int argc, char** argv) {
 	std::cout << "  Label:            " << label << std::endl;
   std::cout << std::endl;
 
-	std::cout << "Reading input " << inputFileName << std::endl;
-	InputReaderType::Pointer input_reader = InputReaderType::New();
-	input_reader->SetFileName(inputFileName);
-	input_reader->Update();
-
-	std::cout << "Reading mask " << maskFileName << std::endl;
-	MaskWReaderType::Pointer mask_reader = MaskWReaderType::New();
-	mask_reader->SetFileName(maskFileName);
-	mask_reader->Update();
-
-	std::cout << "Running graph cut filter" << std::endl;
-	PeriostealSegmentationFilterType::Pointer filter = PeriostealSegmentationFilterType::New();
-	filter->SetLambda(lambda);
-	filter->SetSigma(sigma);
-	filter->SetForegroundLabel(label);
-	filter->SetBackgroundLabel(0);
-	filter->SetInput(input_reader->GetOutput());
-	filter->SetMask(mask_reader->GetOutput());
-	filter->Update();
-
-	std::cout << "  Max Flow: " << filter->GetMaxFlow() << std::endl;
-
-	std::cout << "Running connectivity filter" << std::endl;
-  ConnectedComponentImageFilterType::Pointer fgConnected = ConnectedComponentImageFilterType::New ();
-  fgConnected->SetInput(filter->GetOutput());
-
-  LabelShapeKeepNObjectsImageFilterType::Pointer fgKeeper = LabelShapeKeepNObjectsImageFilterType::New();
-  fgKeeper->SetInput( fgConnected->GetOutput() );
-  fgKeeper->SetBackgroundValue( 0 );
-  fgKeeper->SetNumberOfObjects( 1 );
-  fgKeeper->SetAttribute( LabelShapeKeepNObjectsImageFilterType::LabelObjectType::NUMBER_OF_PIXELS);
-	fgKeeper->Update();
-
-	std::cout << "  Found " << fgConnected->GetObjectCount() << " foreground objects" << std::endl;
-
-	ThresholdFilterType::Pointer thresh = ThresholdFilterType::New();
-	thresh->SetInput(fgKeeper->GetOutput());
-	thresh->SetLowerThreshold(1);
-	thresh->SetInsideValue (0);
-	thresh->SetOutsideValue(1);
-	thresh->Update();
-
-  ConnectedComponentImageFilterType::Pointer bkgConnected = ConnectedComponentImageFilterType::New ();
-  bkgConnected->SetInput(thresh->GetOutput());
-
-  LabelShapeKeepNObjectsImageFilterType::Pointer bkgKeeper = LabelShapeKeepNObjectsImageFilterType::New();
-  bkgKeeper->SetInput( bkgConnected->GetOutput() );
-  bkgKeeper->SetBackgroundValue( 0 );
-  bkgKeeper->SetNumberOfObjects( 1 );
-  bkgKeeper->SetAttribute( LabelShapeKeepNObjectsImageFilterType::LabelObjectType::NUMBER_OF_PIXELS);
-	bkgKeeper->Update();
-
-	std::cout << "  Found " << bkgConnected->GetObjectCount() << " background objects" << std::endl;
-
-	ThresholdFilterType::Pointer thresh2 = ThresholdFilterType::New();
-	thresh2->SetInput(bkgKeeper->GetOutput());
-	thresh2->SetLowerThreshold(1);
-	thresh2->SetInsideValue (0);
-	thresh2->SetOutsideValue(1);
-	thresh2->Update();
-
-	std::cout << "Writing result to " << outputFileName << std::endl;
-	OutputWriterType::Pointer writer = OutputWriterType::New();
-	writer->SetFileName(outputFileName);
-	writer->SetInput(thresh2->GetOutput());
-	writer->Update();
-
-	std::cout << "Finished!" << std::endl;
-
-	return EXIT_SUCCESS;
+  return femur::DispatchOnLabelType(maskFileName, [&](auto pixel)
+    {
+      return Segment< decltype(pixel) >(inputFileName, maskFileName, outputFileName, lambda, sigma, label);
+    });
 }
@@ -0,0 +1,150 @@
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "femurConfiguration.h"
+#include "femurParameterSweep.h"
+#include "femurImageIO.h"
+#include "femurAsyncImageWriter.h"
+#include "femurCommandLine.h"
+#include "itkImageFileReader.h"
+#include "itkMemoryMappedImageFileReader.h"
+
+/* Type definitions */
+using HUReaderType        = itk::MemoryMappedImageFileReader< femur::HUImageType >;
+using LabelReaderType     = itk::ImageFileReader< femur::LabelImageType >;
+
+int main(int argc, char * argv[])
+{
+  /* Prefer our IO factories, e.g. parallel gzip for .nii.gz */
+  femur::RegisterImageIOFactories();
+  femur::ParseCommonOptions(argc, argv);
+
+  if( argc < 5 || argc > 7 )
+  {
+    std::cerr << "Usage: "<< std::endl;
+    std::cerr << argv[0];
+    std::cerr << " <ConfigFile> <InputFileName> <MarkFileName> <OutputTable> [<ReferenceSegmentation>] [<OutputPrefix>]";
+    std::cerr << " [--trace <file.json>] [--threads <N>] [--pool <stealing|itk|tbb|platform>]";
+    std::cerr << " [--buffer-pool <size>] [--huge-pages] [--perf <file.json>]";
+    std::cerr << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  /* Read input Parameters */
+  std::string configFileName = argv[1];
+  std::string inputFileName = argv[2];
+  std::string markFileName = argv[3];
+  std::string tableFileName = argv[4];
+  std::string referenceFileName = argc >= 6 ? argv[5] : "";
+  std::string prefix = argc == 7 ? argv[6] : "";
+
+  femur::Configuration config;
+  config.Read(configFileName);
+
+  femur::SheetnessParameters sheetnessParameters;
+  femur::PeriostealParameters periostealParameters;
+  femur::SweepParameters sweepParameters;
+  sheetnessParameters.Read(config);
+  periostealParameters.Read(config);
+  sweepParameters.Read(config, sheetnessParameters, periostealParameters);
+  const std::string segmentationEnding = config.GetString("output.segmentation_ending", ".nii.gz");
+  config.WarnUnusedKeys();
+
+  std::cout << "Read in the following parameters:" << std::endl;
+  std::cout << "  ConfigFilePath:   " << configFileName << std::endl;
+  std::cout << "  InputFilePath:    " << inputFileName << std::endl;
+  std::cout << "  MarkFilePath:     " << markFileName << std::endl;
+  std::cout << "  OutputTable:      " << tableFileName << std::endl;
+  std::cout << "  Reference:        " << referenceFileName << std::endl;
+  std::cout << "  Prefix:           " << prefix << std::endl;
+  sheetnessParameters.Print(std::cout);
+  periostealParameters.Print(std::cout);
+  sweepParameters.Print(std::cout);
+  std::cout << std::endl;
+
+  std::cout << "Reading in " << inputFileName << std::endl;
+  HUReaderType::Pointer reader = HUReaderType::New();
+  reader->SetFileName(inputFileName);
+  {
+    FEMUR_TRACE_SCOPE("main", "reader->Update");
+    reader->Update();
+  }
+
+  std::cout << "Reading marks " << markFileName << std::endl;
+  LabelReaderType::Pointer markReader = LabelReaderType::New();
+  markReader->SetFileName(markFileName);
+  {
+    FEMUR_TRACE_SCOPE("main", "markReader->Update");
+    markReader->Update();
+  }
+
+  femur::LabelImageType::Pointer reference;
+  if ( !referenceFileName.empty() )
+  {
+    std::cout << "Reading reference " << referenceFileName << std::endl;
+    LabelReaderType::Pointer referenceReader = LabelReaderType::New();
+    referenceReader->SetFileName(referenceFileName);
+    {
+      FEMUR_TRACE_SCOPE("main", "referenceReader->Update");
+      referenceReader->Update();
+    }
+    reference = referenceReader->GetOutput();
+
+    /* Dice is taken voxel by voxel against the segmentation, which is on the grid of the marks.
+     * Check before the sweep rather than fail after its most expensive stages. */
+    const std::string mismatch = femur::DescribeGridMismatch(markReader->GetOutput(), reference);
+    if ( !mismatch.empty() )
+    {
+      std::cerr << "Reference " << referenceFileName << " is not on the grid of the marks " << markFileName
+                << ": " << mismatch << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  /* Segmentations are only written when a prefix is given, in the background so sweep jobs do not wait on the disk */
+  femur::AsyncImageWriter writer;
+  auto onResult = [&](const femur::SweepResult & result, const femur::LabelImageType * segmentation)
+  {
+    std::cout << "  Weight " << result.Weight << " Lambda " << result.Lambda << " Sigma " << result.Sigma
+              << ": " << result.Voxels << " voxels in " << result.Seconds << "s" << std::endl;
+    if ( prefix.empty() )
+    {
+      return;
+    }
+
+    std::ostringstream fileName;
+    fileName << prefix << "_w" << result.Weight << "_l" << result.Lambda << "_s" << result.Sigma << segmentationEnding;
+    writer.Write(segmentation, fileName.str());
+  };
+
+  std::vector< femur::SweepResult > results = femur::RunSweep(reader->GetOutput(), markReader->GetOutput(), reference.GetPointer(),
+                                                              sheetnessParameters, periostealParameters, sweepParameters, onResult);
+
+  std::cout << "Writing table to " << tableFileName << std::endl;
+  std::ofstream table(tableFileName);
+  if ( !table )
+  {
+    std::cerr << "Cannot write " << tableFileName << std::endl;
+    return EXIT_FAILURE;
+  }
+  table << "trace_weight,lambda,sigma,voxels,dice,seconds" << std::endl;
+  for (const femur::SweepResult & result : results)
+  {
+    table << result.Weight << "," << result.Lambda << "," << result.Sigma << "," << result.Voxels << ",";
+    if ( result.Dice >= 0 )
+    {
+      table << result.Dice;
+    }
+    table << "," << result.Seconds << std::endl;
+  }
+
+  if ( !writer.Wait() )
+  {
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "Finished!" << std::endl;
+
+  return EXIT_SUCCESS;
+}
@@ -1,131 +1,153 @@
 #include <iostream>
 
 #include "itkPeriostealSegmentationImageFilter.h"
+#include "femurConnectedComponents.h"
+#include "femurImageIO.h"
+#include "femurAsyncImageWriter.h"
+#include "femurCommandLine.h"
+#include "femurBatch.h"
+#include "femurImagePrefetcher.h"
+#include "femurTaskGraph.h"
+#include "femurLabelTypes.h"
 #include "itkImageFileReader.h"
-#include "itkImageFileWriter.h"
-#include "itkConnectedComponentImageFilter.h"
-#include "itkLabelShapeKeepNObjectsImageFilter.h"
-#include "itkBinaryThresholdImageFilter.h"
 
 /* Type definitions */
 constexpr unsigned int ImageDimension = 3;
 using InputPixelType 	= float;
-using MaskPixelType 	= unsigned long;
 using OutputPixelType = unsigned char;
 
 using InputImageType	= itk::Image< InputPixelType, ImageDimension >;
-using MaskImageType		= itk::Image< MaskPixelType, ImageDimension >;
 using OutputImageType	= itk::Image< OutputPixelType, ImageDimension >;
 
-using InputReaderType 	= itk::ImageFileReader< InputImageType >;
-using MaskWReaderType		= itk::ImageFileReader< MaskImageType >;
-using OutputWriterType	= itk::ImageFileWriter< OutputImageType >;
 
-using PeriostealSegmentationFilterType = itk::PeriostealSegmentationImageFilter< InputImageType, MaskImageType, OutputImageType >;
+/* The mask is read as the narrowest type holding its labels */
+template< typename TMaskPixel >
+int Segment(const std::string & inputFileName, const std::string & maskFileName, const std::string & outputFileName,
+            double lambda, double sigma, int label, int connFilter, femur::AsyncImageWriter & writer,
+            femur::ImagePrefetcher & prefetcher)
+{
+  using MaskImageType		= itk::Image< TMaskPixel, ImageDimension >;
+  using MaskWReaderType		= itk::ImageFileReader< MaskImageType >;
+  using PeriostealSegmentationFilterType = itk::PeriostealSegmentationImageFilter< InputImageType, MaskImageType, OutputImageType >;
 
-using ConnectedComponentImageFilterType = itk::ConnectedComponentImageFilter< OutputImageType, MaskImageType >;
-using LabelShapeKeepNObjectsImageFilterType = itk::LabelShapeKeepNObjectsImageFilter< MaskImageType >;
-using ThresholdFilterType = itk::BinaryThresholdImageFilter< MaskImageType, OutputImageType >;
-
-int main(int argc, char** argv) {
-  if( argc != 8 )
-  {
-    std::cerr << "Usage: "<< std::endl;
-    std::cerr << argv[0];
-    std::cerr << " <InputFileName> <MaskFileName> <OutputSegmentation> ";
-		std::cerr << " <Lambda> <Sigma> <Label> <ConnFilter>";
-    std::cerr << std::endl;
-    return EXIT_FAILURE;
-  }
-
-	/* Read input Parameters */
-  std::string inputFileName = argv[1];
-  std::string maskFileName = argv[2];
-  std::string outputFileName = argv[3];
-
-  double lambda = atof(argv[4]);
-	double sigma = atof(argv[5]);
-	int label = atoi(argv[6]);
-	int connFilter = atoi(argv[7]);
-
-	std::cout << "Parameters:" << std::endl;
-  std::cout << "  InputFilePath:    " << inputFileName << std::endl;
-  std::cout << "  MaskFilePath:     " << maskFileName << std::endl;
-  std::cout << "  OutputFilePath:   " << outputFileName << std::endl;
-  std::cout << "  Lambda:           " << lambda << std::endl;
-  std::cout << "  Sigma:            " << sigma << std::endl;
-	std::cout << "  Label:            " << label << std::endl;
-	std::cout << "  ConnFilter:       " << connFilter << std::endl;
-  std::cout << std::endl;
+	/* The input and the mask are read side by side */
+	femur::TaskGraph graph;
 
 	std::cout << "Reading input " << inputFileName << std::endl;
-	InputReaderType::Pointer input_reader = InputReaderType::New();
-	input_reader->SetFileName(inputFileName);
-	input_reader->Update();
+	InputImageType::Pointer input;
+	graph.Add("ReadInput", [&]() { input = prefetcher.Read< InputImageType >(inputFileName); });
 
-	std::cout << "Reading mask " << maskFileName << std::endl;
-	MaskWReaderType::Pointer mask_reader = MaskWReaderType::New();
+	std::cout << "Reading mask " << maskFileName << " as " << sizeof(TMaskPixel) * 8 << " bit labels" << std::endl;
+	typename MaskWReaderType::Pointer mask_reader = MaskWReaderType::New();
 	mask_reader->SetFileName(maskFileName);
-	mask_reader->Update();
+	graph.Add("ReadMask", [&]() { mask_reader->Update(); });
+
+	graph.Run();
 
 	std::cout << "Running graph cut filter" << std::endl;
-	PeriostealSegmentationFilterType::Pointer filter = PeriostealSegmentationFilterType::New();
+	typename PeriostealSegmentationFilterType::Pointer filter = PeriostealSegmentationFilterType::New();
 	filter->SetLambda(lambda);
 	filter->SetSigma(sigma);
 	filter->SetForegroundLabel(label);
 	filter->SetBackgroundLabel(0);
-	filter->SetInput(input_reader->GetOutput());
+	filter->SetInput(input);
 	filter->SetMask(mask_reader->GetOutput());
-	filter->Update();
+	{
+	  FEMUR_TRACE_SCOPE("main", "filter->Update");
+	  filter->Update();
+	}
 
 	std::cout << "  Max Flow: " << filter->GetMaxFlow() << std::endl;
 
 	std::cout << "Running connectivity filter" << std::endl;
-  ConnectedComponentImageFilterType::Pointer fgConnected = ConnectedComponentImageFilterType::New ();
-  fgConnected->SetInput(filter->GetOutput());
-
-  LabelShapeKeepNObjectsImageFilterType::Pointer fgKeeper = LabelShapeKeepNObjectsImageFilterType::New();
-  fgKeeper->SetInput( fgConnected->GetOutput() );
-  fgKeeper->SetBackgroundValue( 0 );
-  fgKeeper->SetNumberOfObjects( connFilter );
-  fgKeeper->SetAttribute( LabelShapeKeepNObjectsImageFilterType::LabelObjectType::NUMBER_OF_PIXELS);
-	fgKeeper->Update();
-
-	std::cout << "  Found " << fgConnected->GetObjectCount() << " foreground objects" << std::endl;
-
-	ThresholdFilterType::Pointer thresh = ThresholdFilterType::New();
-	thresh->SetInput(fgKeeper->GetOutput());
-	thresh->SetLowerThreshold(1);
-	thresh->SetInsideValue (0);
-	thresh->SetOutsideValue(1);
-	thresh->Update();
-
-  ConnectedComponentImageFilterType::Pointer bkgConnected = ConnectedComponentImageFilterType::New ();
-  bkgConnected->SetInput(thresh->GetOutput());
-
-  LabelShapeKeepNObjectsImageFilterType::Pointer bkgKeeper = LabelShapeKeepNObjectsImageFilterType::New();
-  bkgKeeper->SetInput( bkgConnected->GetOutput() );
-  bkgKeeper->SetBackgroundValue( 0 );
-  bkgKeeper->SetNumberOfObjects( 1 );
-  bkgKeeper->SetAttribute( LabelShapeKeepNObjectsImageFilterType::LabelObjectType::NUMBER_OF_PIXELS);
-	bkgKeeper->Update();
-
-	std::cout << "  Found " << bkgConnected->GetObjectCount() << " background objects" << std::endl;
-
-	ThresholdFilterType::Pointer thresh2 = ThresholdFilterType::New();
-	thresh2->SetInput(bkgKeeper->GetOutput());
-	thresh2->SetLowerThreshold(1);
-	thresh2->SetInsideValue (0);
-	thresh2->SetOutsideValue(1);
-	thresh2->Update();
+  itk::SizeValueType foregroundCount = 0, backgroundCount = 0;
+  OutputImageType::Pointer segmentation = femur::KeepLargestComponents(filter->GetOutput(), connFilter, &foregroundCount, &backgroundCount);
+
+	std::cout << "  Found " << foregroundCount << " foreground objects" << std::endl;
+	std::cout << "  Found " << backgroundCount << " background objects" << std::endl;
 
 	std::cout << "Writing result to " << outputFileName << std::endl;
-	OutputWriterType::Pointer writer = OutputWriterType::New();
-	writer->SetFileName(outputFileName);
-	writer->SetInput(thresh2->GetOutput());
-	writer->Update();
+	writer.Write(segmentation.GetPointer(), outputFileName);
 
 	std::cout << "Finished!" << std::endl;
 
 	return EXIT_SUCCESS;
 }
+
+/* One scan, arguments as on the command line without the executable's name */
+int Periosteal(const femur::ManifestEntry & arguments, femur::AsyncImageWriter & writer, femur::ImagePrefetcher & prefetcher)
+{
+  if ( arguments.size() != 7 )
+  {
+    itkGenericExceptionMacro(<< "Expected 7 arguments, got " << arguments.size());
+  }
+
+	/* Read input Parameters */
+  std::string inputFileName = arguments[0];
+  std::string maskFileName = arguments[1];
+  std::string outputFileName = arguments[2];
+
+  double lambda = atof(arguments[3].c_str());
+	double sigma = atof(arguments[4].c_str());
+	int label = atoi(arguments[5].c_str());
+	int connFilter = atoi(arguments[6].c_str());
+
+	std::cout << "Parameters:" << std::endl;
+  std::cout << "  InputFilePath:    " << inputFileName << std::endl;
+  std::cout << "  MaskFilePath:     " << maskFileName << std::endl;
+  std::cout << "  OutputFilePath:   " << outputFileName << std::endl;
+  std::cout << "  Lambda:           " << lambda << std::endl;
+  std::cout << "  Sigma:            " << sigma << std::endl;
+	std::cout << "  Label:            " << label << std::endl;
+	std::cout << "  ConnFilter:       " << connFilter << std::endl;
+  std::cout << std::endl;
+
+  return femur::DispatchOnLabelType(maskFileName, [&](auto pixel)
+    {
+      return Segment< decltype(pixel) >(inputFileName, maskFileName, outputFileName, lambda, sigma, label, connFilter, writer, prefetcher);
+    });
+}
+
+int main(int argc, char** argv) {
+  /* Prefer our IO factories, e.g. parallel gzip for .nii.gz */
+  femur::RegisterImageIOFactories();
+  femur::ParseCommonOptions(argc, argv);
+  const femur::BatchOptions batch = femur::ParseBatchOptions(argc, argv);
+
+  if( batch.Manifest.empty() ? argc != 8 : argc != 1 )
+  {
+    std::cerr << "Usage: "<< std::endl;
+    std::cerr << argv[0];
+    std::cerr << " <InputFileName> <MaskFileName> <OutputSegmentation> ";
+		std::cerr << " <Lambda> <Sigma> <Label> <ConnFilter>";
+    std::cerr << " [--trace <file.json>] [--threads <N>] [--pool <stealing|itk|tbb|platform>]";
+    std::cerr << " [--buffer-pool <size>] [--huge-pages] [--perf <file.json>]";
+    std::cerr << std::endl;
+    std::cerr << argv[0] << " --manifest <file> [--jobs <N>] [--prefetch-memory <size>]  (one line of the arguments above per scan)";
+    std::cerr << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  /* The mask type is chosen per scan, so the filters are too */
+  if ( !batch.Manifest.empty() )
+  {
+    std::vector< femur::AsyncImageWriter > writers(batch.Jobs);
+    femur::ImagePrefetcher prefetcher(batch.PrefetchMemory);
+    int result = femur::RunManifest(femur::ReadManifest(batch.Manifest), batch.Jobs,
+      [&](const femur::ManifestEntry & scan, unsigned int worker) { return Periosteal(scan, writers[worker], prefetcher); },
+      [&](const femur::ManifestEntry & scan) { prefetcher.Prefetch< InputImageType >(scan.at(0)); });
+    for (femur::AsyncImageWriter & writer : writers)
+    {
+      if ( !writer.Wait() )
+      {
+        result = EXIT_FAILURE;
+      }
+    }
+    return result;
+  }
+
+  femur::AsyncImageWriter writer;
+  femur::ImagePrefetcher prefetcher;
+  const int result = Periosteal(femur::ManifestEntry(argv + 1, argv + argc), writer, prefetcher);
+  return writer.Wait() ? result : EXIT_FAILURE;
+}
@@ -0,0 +1,191 @@
+#include <iostream>
+#include <sstream>
+
+#include "femurConfiguration.h"
+#include "femurDaemon.h"
+#include "femurPipeline.h"
+#include "femurImageIO.h"
+#include "femurCommandLine.h"
+#include "itkImageFileReader.h"
+#include "itkMemoryMappedImageFileReader.h"
+#include "itkImageFileWriter.h"
+
+/* Type definitions */
+using HUReaderType        = itk::MemoryMappedImageFileReader< femur::HUImageType >;
+using SheetnessReaderType = itk::ImageFileReader< femur::SheetnessImageType >;
+using LabelReaderType     = itk::ImageFileReader< femur::LabelImageType >;
+
+/** New image object over the buffer of a cached image.
+ * Jobs share cached images, but filters set the requested region of their inputs. */
+template< typename TImage >
+typename TImage::Pointer Share(const TImage * image)
+{
+  typename TImage::Pointer shared = TImage::New();
+  shared->Graft(image);
+  return shared;
+}
+
+template< typename TImage, typename TReader >
+typename TImage::Pointer ReadCached(femur::ImageCache & cache, const std::string & fileName)
+{
+  return Share< TImage >(cache.Get< TImage >(femur::ImageCache::FileKey(fileName), [&fileName]()
+  {
+    typename TReader::Pointer reader = TReader::New();
+    reader->SetFileName(fileName);
+    {
+      FEMUR_TRACE_SCOPE("main", "reader->Update");
+      reader->Update();
+    }
+
+    typename TImage::Pointer image = reader->GetOutput();
+    image->DisconnectPipeline();
+    return image;
+  }));
+}
+
+/** Sheetness of an HU file, cached by file and parameters */
+femur::SheetnessImageType::Pointer
+CachedSheetness(femur::ImageCache & cache, const std::string & inputFileName,
+                const femur::SheetnessParameters & parameters, const femur::StatusFunction & status)
+{
+  std::ostringstream key;
+  key << "sheetness:" << femur::ImageCache::FileKey(inputFileName);
+  parameters.Print(key);
+
+  return Share< femur::SheetnessImageType >(cache.Get< femur::SheetnessImageType >(key.str(), [&]()
+  {
+    femur::HUImageType::Pointer image = ReadCached< femur::HUImageType, HUReaderType >(cache, inputFileName);
+    status("computing skin masks");
+    femur::SkinMasks masks = femur::ComputeSkinMasks(image, parameters);
+    status("computing sheetness");
+    return femur::ComputeSheetness(image, masks, parameters);
+  }));
+}
+
+/** Run one request. Inputs and sheetness images are kept in cache between requests. */
+void RunJob(femur::ImageCache & cache, const femur::Configuration & request, const femur::StatusFunction & status)
+{
+  const std::string stage = request.GetString("stage", "");
+  const std::string inputFileName = request.GetString("input", "");
+  const std::string markFileName = request.GetString("marks", "");
+  const std::string outputFileName = request.GetString("output", "");
+  const double quantizationScale = request.GetDouble("quantization", 0.0);
+
+  femur::SheetnessParameters sheetnessParameters;
+  femur::PeriostealParameters periostealParameters;
+  femur::EndostealParameters endostealParameters;
+  sheetnessParameters.Read(request);
+  periostealParameters.Read(request);
+  endostealParameters.Read(request);
+
+  std::ostringstream unused;
+  request.WarnUnusedKeys(unused);
+  std::string line;
+  for (std::istringstream lines(unused.str()); std::getline(lines, line); )
+  {
+    status(line);
+  }
+
+  if ( inputFileName.empty() || outputFileName.empty() )
+  {
+    itkGenericExceptionMacro(<< "Requests need input and output");
+  }
+  if ( stage != "sheetness" && markFileName.empty() )
+  {
+    itkGenericExceptionMacro(<< "Stage " << stage << " needs marks");
+  }
+
+  if ( stage == "sheetness" )
+  {
+    femur::SheetnessImageType::Pointer sheetness = CachedSheetness(cache, inputFileName, sheetnessParameters, status);
+    status("writing " + outputFileName);
+    femur::WriteImage(sheetness.GetPointer(), outputFileName, quantizationScale);
+  }
+  else if ( stage == "periosteal" )
+  {
+    femur::SheetnessImageType::Pointer sheetness = ReadCached< femur::SheetnessImageType, SheetnessReaderType >(cache, inputFileName);
+    femur::LabelImageType::Pointer marks = ReadCached< femur::LabelImageType, LabelReaderType >(cache, markFileName);
+    status("running periosteal segmentation");
+    femur::LabelImageType::Pointer periosteal = femur::SegmentPeriosteal(sheetness, marks, periostealParameters);
+    status("writing " + outputFileName);
+    femur::WriteImage(periosteal.GetPointer(), outputFileName);
+  }
+  else if ( stage == "endosteal" )
+  {
+    femur::SheetnessImageType::Pointer sheetness = ReadCached< femur::SheetnessImageType, SheetnessReaderType >(cache, inputFileName);
+    femur::LabelImageType::Pointer periosteal = ReadCached< femur::LabelImageType, LabelReaderType >(cache, markFileName);
+    status("running endosteal segmentation");
+    femur::LabelImageType::Pointer endosteal = femur::SegmentEndosteal(sheetness, periosteal, endostealParameters);
+    status("writing " + outputFileName);
+    femur::WriteImage(endosteal.GetPointer(), outputFileName);
+  }
+  else if ( stage == "pipeline" )
+  {
+    femur::SheetnessImageType::Pointer sheetness = CachedSheetness(cache, inputFileName, sheetnessParameters, status);
+    femur::LabelImageType::Pointer marks = ReadCached< femur::LabelImageType, LabelReaderType >(cache, markFileName);
+    status("running periosteal segmentation");
+    femur::LabelImageType::Pointer periosteal = femur::SegmentPeriosteal(sheetness, marks, periostealParameters);
+    status("running endosteal segmentation");
+    femur::LabelImageType::Pointer endosteal = femur::SegmentEndosteal(sheetness, periosteal, endostealParameters);
+    status("writing " + outputFileName);
+    femur::WriteImage(endosteal.GetPointer(), outputFileName);
+  }
+  else
+  {
+    itkGenericExceptionMacro(<< "Unknown stage " << stage);
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  /* Prefer our IO factories, e.g. parallel gzip for .nii.gz */
+  femur::RegisterImageIOFactories();
+  femur::ParseCommonOptions(argc, argv);
+
+  if( argc < 2 || argc > 4 )
+  {
+    std::cerr << "Usage: "<< std::endl;
+    std::cerr << argv[0];
+    std::cerr << " <SocketPath> [<Jobs>] [<CachedImages>]";
+    std::cerr << " [--trace <file.json>] [--threads <N>] [--pool <stealing|itk|tbb|platform>]";
+    std::cerr << " [--buffer-pool <size>] [--huge-pages] [--perf <file.json>]";
+    std::cerr << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  /* Read input Parameters */
+  std::string socketPath = argv[1];
+  int jobs = argc >= 3 ? atoi(argv[2]) : 1;
+  int cachedImages = argc >= 4 ? atoi(argv[3]) : 8;
+
+  std::cout << "Read in the following parameters:" << std::endl;
+  std::cout << "  SocketPath:       " << socketPath << std::endl;
+  std::cout << "  Jobs:             " << jobs << std::endl;
+  std::cout << "  CachedImages:     " << cachedImages << std::endl;
+  std::cout << std::endl;
+
+  if ( jobs < 1 || cachedImages < 0 )
+  {
+    std::cerr << "Jobs must be at least 1 and CachedImages not negative" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  femur::ImageCache cache(static_cast< std::size_t >(cachedImages));
+  try
+  {
+    femur::RunDaemon(socketPath, static_cast< unsigned int >(jobs),
+      [&cache](const femur::Configuration & request, const femur::StatusFunction & status)
+      {
+        RunJob(cache, request, status);
+      });
+  }
+  catch (const std::exception & e)
+  {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "Finished!" << std::endl;
+
+  return EXIT_SUCCESS;
+}
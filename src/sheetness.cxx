@@ -1,18 +1,19 @@
 #include <iostream>
 
 #include "itkArray.h"
+#include "femurImageIO.h"
+#include "femurAsyncImageWriter.h"
+#include "femurCommandLine.h"
 #include "itkImageFileReader.h"
-#include "itkImageFileWriter.h"
+#include "itkMemoryMappedImageFileReader.h"
 #include "itkMultiScaleHessianEnhancementImageFilter.h"
 #include "itkCalgaryEigenToMeasureImageFilter.h"
 #include "itkCalgaryEigenToMeasureParameterEstimationFilter.h"
 #include "itkCommand.h"
 #include "itkBinaryThresholdImageFilter.h"
 #include "itkImageMaskSpatialObject.h"
-#include "itkConnectedComponentImageFilter.h"
-#include "itkLabelShapeKeepNObjectsImageFilter.h"
-#include "itkBinaryErodeImageFilter.h"
-#include "itkFlatStructuringElement.h"
+#include "femurConnectedComponents.h"
+#include "femurDistanceErosion.h"
 
 /* Setup Types */
 constexpr unsigned int ImageDimension = 3;
@@ -20,24 +21,12 @@ using InputPixelType = short;
 using InputImageType = itk::Image<InputPixelType, ImageDimension>;
 using MaskPixelType = unsigned char;
 using MaskImageType = itk::Image<MaskPixelType, ImageDimension>;
-using CCPixelType = unsigned long;
-using CCImageType = itk::Image< CCPixelType, ImageDimension >;
 using OutputPixelType = float;
 using OutputImageType = itk::Image<OutputPixelType, ImageDimension>;
 
-using ReaderType = itk::ImageFileReader< InputImageType >;
-using MaskWriterType = itk::ImageFileWriter< MaskImageType >;
-using MeasureWriterType = itk::ImageFileWriter< OutputImageType >;
+using ReaderType = itk::MemoryMappedImageFileReader< InputImageType >;
 using MaskSpatialObject = itk::ImageMaskSpatialObject< ImageDimension >;
 
-using ConnectedComponentImageFilterType = itk::ConnectedComponentImageFilter< MaskImageType, CCImageType >;
-using LabelShapeKeepNObjectsImageFilterType = itk::LabelShapeKeepNObjectsImageFilter< CCImageType >;
-using MaskThesholdFilter = itk::BinaryThresholdImageFilter< CCImageType, MaskImageType >;
-using MaskThesholdFilter2 = itk::BinaryThresholdImageFilter< MaskImageType, MaskImageType >;
-
-using StructuringElementType = itk::FlatStructuringElement< ImageDimension  >;
-using ErodeFilterType = itk::BinaryErodeImageFilter< MaskImageType, MaskImageType, StructuringElementType >;
-
 using BinaryThesholdFilter = itk::BinaryThresholdImageFilter< InputImageType, MaskImageType >;
 using MultiScaleHessianFilterType = itk::MultiScaleHessianEnhancementImageFilter< InputImageType, OutputImageType >;
 using CalgaryEigenToMeasureImageFilterType = itk::CalgaryEigenToMeasureImageFilter< MultiScaleHessianFilterType::EigenValueImageType, OutputImageType >;
@@ -45,6 +34,10 @@ using CalgaryEigenToMeasureParameterEstimationFilterType = itk::CalgaryEigenToMe
 
 int main(int argc, char * argv[])
 {
+  /* Prefer our IO factories, e.g. parallel gzip for .nii.gz */
+  femur::RegisterImageIOFactories();
+  femur::ParseCommonOptions(argc, argv);
+
   if( argc != 10 )
   {
     std::cerr << "Usage: "<< std::endl;
@@ -53,6 +46,8 @@ int main(int argc, char * argv[])
     std::cerr << " <SetEnhanceBrightObjects[0,1]> ";
     std::cerr << " <NumberOfSigma> <MinSigma> <MaxSigma> ";
     std::cerr << " <Threshold> <Weight>";
+    std::cerr << " [--trace <file.json>] [--threads <N>] [--pool <stealing|itk|tbb|platform>]";
+    std::cerr << " [--buffer-pool <size>] [--huge-pages] [--perf <file.json>]";
     std::cerr << std::endl;
     return EXIT_FAILURE;
   }
@@ -85,66 +80,44 @@ int main(int argc, char * argv[])
   std::cout << "  Weight:                      " << weight << std::endl;
   std::cout << std::endl;
 
+  /* Outputs are written in the background, main only waits for them before returning */
+  femur::AsyncImageWriter writer;
+
   /* Do preprocessing */
   std::cout << "Reading in " << inputFileName << std::endl;
   ReaderType::Pointer  reader = ReaderType::New();
   reader->SetFileName(inputFileName);
-  reader->Update();
+  {
+    FEMUR_TRACE_SCOPE("main", "reader->Update");
+    reader->Update();
+  }
 
   std::cout << "Creating mask by thresholding below " << threshold << std::endl;
   BinaryThesholdFilter::Pointer thresholder = BinaryThesholdFilter::New();
   thresholder->SetInput(reader->GetOutput());
   thresholder->SetUpperThreshold(threshold);
-  thresholder->Update();
+  {
+    FEMUR_TRACE_SCOPE("main", "thresholder->Update");
+    thresholder->Update();
+  }
 
 	std::cout << "Connected components filter on background" << std::endl;
-  ConnectedComponentImageFilterType::Pointer connected = ConnectedComponentImageFilterType::New ();
-  connected->SetInput(thresholder->GetOutput());
-
-  LabelShapeKeepNObjectsImageFilterType::Pointer labelShapeKeepNObjectsImageFilter = LabelShapeKeepNObjectsImageFilterType::New();
-  labelShapeKeepNObjectsImageFilter->SetInput( connected->GetOutput() );
-  labelShapeKeepNObjectsImageFilter->SetBackgroundValue( 0 );
-  labelShapeKeepNObjectsImageFilter->SetNumberOfObjects( 1 );
-  labelShapeKeepNObjectsImageFilter->SetAttribute( LabelShapeKeepNObjectsImageFilterType::LabelObjectType::NUMBER_OF_PIXELS);
-
-  MaskThesholdFilter::Pointer inverter = MaskThesholdFilter::New();
-  inverter->SetInput(labelShapeKeepNObjectsImageFilter->GetOutput());
-	inverter->SetUpperThreshold(0);
-	inverter->Update();
+  itk::SizeValueType objectCount = 0;
+  MaskImageType::Pointer skinMask = femur::KeepLargestObjects< MaskImageType >(thresholder->GetOutput(), 1, 0, 255, &objectCount);
+  std::cout << "  Found " << objectCount << " background objects" << std::endl;
 
   std::cout << "Writing mask to " << maskFileName << std::endl;
-  MaskWriterType::Pointer maskWriter = MaskWriterType::New();
-  maskWriter->SetInput(inverter->GetOutput());
-  maskWriter->SetFileName(maskFileName);
-  maskWriter->Write();
+  writer.Write(skinMask.GetPointer(), maskFileName);
 
   std::cout << "Eroding skin image" << std::endl;
-  std::cout << "  Radius: ";
-  StructuringElementType::RadiusType radius;
-  radius.Fill( 1 );
-  for (unsigned int i = 0; i < ImageDimension; ++i)
-  {
-    radius[i] = static_cast< unsigned int >(maxSigma / inverter->GetOutput()->GetSpacing()[i]);
-    std::cout << radius[i] << " ";
-  }
-  std::cout << std::endl;
-
-  MaskThesholdFilter2::Pointer inverter2 = MaskThesholdFilter2::New();
-  inverter2->SetInput(thresholder->GetOutput());
-	inverter2->SetUpperThreshold(0);
-	inverter2->Update();
-
-  StructuringElementType structuringElement = StructuringElementType::Ball( radius );
-  ErodeFilterType::Pointer erodeFilter = ErodeFilterType::New();
-  erodeFilter->SetInput( inverter2->GetOutput() );
-  erodeFilter->SetKernel( structuringElement );
-  erodeFilter->Update();
+  std::cout << "  Radius: " << maxSigma << std::endl;
+  MaskImageType::Pointer erodedMask = femur::ErodeByDistance< MaskImageType >(thresholder->GetOutput(), 0, maxSigma);
 
 	MaskSpatialObject::Pointer skinMaskSpatialObject = MaskSpatialObject::New();
-	skinMaskSpatialObject->SetImage(inverter->GetOutput());
+	skinMaskSpatialObject->SetImage(skinMask);
 
 	MaskSpatialObject::Pointer erodedMaskSpatialObject = MaskSpatialObject::New();
-	erodedMaskSpatialObject->SetImage(erodeFilter->GetOutput());
+	erodedMaskSpatialObject->SetImage(erodedMask);
 
   /* Multiscale measure */
   MultiScaleHessianFilterType::Pointer multiScaleFilter = MultiScaleHessianFilterType::New();
@@ -165,13 +138,14 @@ int main(int argc, char * argv[])
   multiScaleFilter->SetEigenToMeasureImageFilter(calgaryFilter);
   multiScaleFilter->SetEigenToMeasureParameterEstimationFilter(estimationFilter);
   multiScaleFilter->SetSigmaArray(sigmaArray);
-  multiScaleFilter->Update();
+  {
+    FEMUR_TRACE_SCOPE("main", "multiScaleFilter->Update");
+    multiScaleFilter->Update();
+  }
 
   std::cout << "Writing results to " << outputMeasureFileName << std::endl;
-  MeasureWriterType::Pointer measureWriter = MeasureWriterType::New();
-  measureWriter->SetInput(multiScaleFilter->GetOutput());
-  measureWriter->SetFileName(outputMeasureFileName);
-  measureWriter->Write();
+  writer.Write(multiScaleFilter->GetOutput(), outputMeasureFileName);
 
-  return EXIT_SUCCESS;
+  FEMUR_TRACE_SCOPE("main", "writer.Wait");
+  return writer.Wait() ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -1,18 +1,20 @@
 #include <iostream>
 
 #include "itkArray.h"
-#include "itkImageFileReader.h"
-#include "itkImageFileWriter.h"
+#include "femurImageIO.h"
+#include "femurAsyncImageWriter.h"
+#include "femurCommandLine.h"
+#include "femurBatch.h"
+#include "femurImagePrefetcher.h"
+#include "femurTaskGraph.h"
 #include "itkMultiScaleHessianEnhancementImageFilter.h"
 #include "itkCalgaryEigenToMeasureImageFilter.h"
 #include "itkCalgaryEigenToMeasureParameterEstimationFilter.h"
 #include "itkCommand.h"
 #include "itkBinaryThresholdImageFilter.h"
 #include "itkImageMaskSpatialObject.h"
-#include "itkConnectedComponentImageFilter.h"
-#include "itkLabelShapeKeepNObjectsImageFilter.h"
-#include "itkBinaryErodeImageFilter.h"
-#include "itkFlatStructuringElement.h"
+#include "femurConnectedComponents.h"
+#include "femurDistanceErosion.h"
 
 /* Setup Types */
 constexpr unsigned int ImageDimension = 3;
@@ -20,55 +22,46 @@ using InputPixelType = short;
 using InputImageType = itk::Image<InputPixelType, ImageDimension>;
 using MaskPixelType = unsigned char;
 using MaskImageType = itk::Image<MaskPixelType, ImageDimension>;
-using CCPixelType = unsigned long;
-using CCImageType = itk::Image< CCPixelType, ImageDimension >;
 using OutputPixelType = float;
 using OutputImageType = itk::Image<OutputPixelType, ImageDimension>;
 
-using ReaderType = itk::ImageFileReader< InputImageType >;
-using MaskWriterType = itk::ImageFileWriter< MaskImageType >;
-using MeasureWriterType = itk::ImageFileWriter< OutputImageType >;
 using MaskSpatialObject = itk::ImageMaskSpatialObject< ImageDimension >;
 
-using ConnectedComponentImageFilterType = itk::ConnectedComponentImageFilter< MaskImageType, CCImageType >;
-using LabelShapeKeepNObjectsImageFilterType = itk::LabelShapeKeepNObjectsImageFilter< CCImageType >;
-using MaskThesholdFilter = itk::BinaryThresholdImageFilter< CCImageType, MaskImageType >;
-using MaskThesholdFilter2 = itk::BinaryThresholdImageFilter< MaskImageType, MaskImageType >;
-
-using StructuringElementType = itk::FlatStructuringElement< ImageDimension  >;
-using ErodeFilterType = itk::BinaryErodeImageFilter< MaskImageType, MaskImageType, StructuringElementType >;
-
 using BinaryThesholdFilter = itk::BinaryThresholdImageFilter< InputImageType, MaskImageType >;
 using MultiScaleHessianFilterType = itk::MultiScaleHessianEnhancementImageFilter< InputImageType, OutputImageType >;
 using CalgaryEigenToMeasureImageFilterType = itk::CalgaryEigenToMeasureImageFilter< MultiScaleHessianFilterType::EigenValueImageType, OutputImageType >;
 using CalgaryEigenToMeasureParameterEstimationFilterType = itk::CalgaryEigenToMeasureParameterEstimationFilter< MultiScaleHessianFilterType::EigenValueImageType >;
 
-int main(int argc, char * argv[])
+/* Filters of one worker, reused from scan to scan in batch mode, and its background writer */
+struct SheetnessFilters
 {
-  if( argc != 11 )
+  femur::AsyncImageWriter writer;
+  MultiScaleHessianFilterType::Pointer multiScaleFilter = MultiScaleHessianFilterType::New();
+  CalgaryEigenToMeasureParameterEstimationFilterType::Pointer estimationFilter = CalgaryEigenToMeasureParameterEstimationFilterType::New();
+  CalgaryEigenToMeasureImageFilterType::Pointer calgaryFilter = CalgaryEigenToMeasureImageFilterType::New();
+};
+
+/* One scan, arguments as on the command line without the executable's name */
+int Sheetness(const femur::ManifestEntry & arguments, SheetnessFilters & filters, femur::ImagePrefetcher & prefetcher)
+{
+  if ( arguments.size() != 10 && arguments.size() != 11 )
   {
-    std::cerr << "Usage: "<< std::endl;
-    std::cerr << argv[0];
-    std::cerr << " <InputFileName> <OutputMask> <OutputMeasure> ";
-    std::cerr << " <SetEnhanceBrightObjects[0,1]> ";
-    std::cerr << " <NumberOfSigma> <MinSigma> <MaxSigma> ";
-    std::cerr << " <LowThreshold> <HighThreshold> <Weight>";
-    std::cerr << std::endl;
-    return EXIT_FAILURE;
+    itkGenericExceptionMacro(<< "Expected 10 or 11 arguments, got " << arguments.size());
   }
 
   /* Read input Parameters */
-  std::string inputFileName = argv[1];
-  std::string maskFileName = argv[2];
-  std::string outputMeasureFileName = argv[3];
-
-  int enhanceBrightObjects = atoi(argv[4]);
-  int numberOfSigma = atoi(argv[5]);
-  double minSigma = atof(argv[6]);
-  double maxSigma = atof(argv[7]);
-  double lowThreshold = atof(argv[8]);
-  double highThreshold = atof(argv[9]);
-  double weight = atof(argv[10]);
+  std::string inputFileName = arguments[0];
+  std::string maskFileName = arguments[1];
+  std::string outputMeasureFileName = arguments[2];
+
+  int enhanceBrightObjects = atoi(arguments[3].c_str());
+  int numberOfSigma = atoi(arguments[4].c_str());
+  double minSigma = atof(arguments[5].c_str());
+  double maxSigma = atof(arguments[6].c_str());
+  double lowThreshold = atof(arguments[7].c_str());
+  double highThreshold = atof(arguments[8].c_str());
+  double weight = atof(arguments[9].c_str());
+  double quantizationScale = arguments.size() == 11 ? atof(arguments[10].c_str()) : 0.0;
 
   std::cout << "Read in the following parameters:" << std::endl;
   std::cout << "  InputFilePath:               " << inputFileName << std::endl;
@@ -85,98 +78,129 @@ int main(int argc, char * argv[])
   std::cout << "  Low Threshold:               " << lowThreshold << std::endl;
   std::cout << "  High Threshold:              " << highThreshold << std::endl;
   std::cout << "  Weight:                      " << weight << std::endl;
+  std::cout << "  QuantizationScale:           " << quantizationScale << std::endl;
   std::cout << std::endl;
 
-  /* Do preprocessing */
-  std::cout << "Reading in " << inputFileName << std::endl;
-  ReaderType::Pointer  reader = ReaderType::New();
-  reader->SetFileName(inputFileName);
-  reader->Update();
+  /* Steps of the scan and what each needs first. The skin mask and the eroded mask
+   * only share the thresholded image, so they are computed side by side. */
+  femur::TaskGraph graph;
+
+  InputImageType::Pointer input;
+  const auto read = graph.Add("Read", [&]()
+    {
+      std::cout << "Reading in " << inputFileName << std::endl;
+      input = prefetcher.Read< InputImageType >(inputFileName);
+    });
 
-  std::cout << "Creating mask by thresholding outside [" << lowThreshold << "-" << highThreshold << "]" << std::endl;
   BinaryThesholdFilter::Pointer thresholder = BinaryThesholdFilter::New();
-  thresholder->SetInput(reader->GetOutput());
-  thresholder->SetLowerThreshold(lowThreshold);
-  thresholder->SetUpperThreshold(highThreshold);
-	thresholder->SetInsideValue(0);
-	thresholder->SetOutsideValue(1);
-  thresholder->Update();
-
-	std::cout << "Connected components filter on background" << std::endl;
-  ConnectedComponentImageFilterType::Pointer connected = ConnectedComponentImageFilterType::New ();
-  connected->SetInput(thresholder->GetOutput());
-
-  LabelShapeKeepNObjectsImageFilterType::Pointer labelShapeKeepNObjectsImageFilter = LabelShapeKeepNObjectsImageFilterType::New();
-  labelShapeKeepNObjectsImageFilter->SetInput( connected->GetOutput() );
-  labelShapeKeepNObjectsImageFilter->SetBackgroundValue( 0 );
-  labelShapeKeepNObjectsImageFilter->SetNumberOfObjects( 1 );
-  labelShapeKeepNObjectsImageFilter->SetAttribute( LabelShapeKeepNObjectsImageFilterType::LabelObjectType::NUMBER_OF_PIXELS);
-
-  MaskThesholdFilter::Pointer inverter = MaskThesholdFilter::New();
-  inverter->SetInput(labelShapeKeepNObjectsImageFilter->GetOutput());
-	inverter->SetUpperThreshold(0);
-	inverter->Update();
-
-  std::cout << "Writing mask to " << maskFileName << std::endl;
-  MaskWriterType::Pointer maskWriter = MaskWriterType::New();
-  maskWriter->SetInput(inverter->GetOutput());
-  maskWriter->SetFileName(maskFileName);
-  maskWriter->Write();
-
-  std::cout << "Eroding skin image" << std::endl;
-  std::cout << "  Radius: ";
-  StructuringElementType::RadiusType radius;
-  radius.Fill( 1 );
-  for (unsigned int i = 0; i < ImageDimension; ++i)
-  {
-    radius[i] = static_cast< unsigned int >(maxSigma / inverter->GetOutput()->GetSpacing()[i]);
-    std::cout << radius[i] << " ";
-  }
-  std::cout << std::endl;
+  const auto threshold = graph.Add("Threshold", [&]()
+    {
+      std::cout << "Creating mask by thresholding outside [" << lowThreshold << "-" << highThreshold << "]" << std::endl;
+      thresholder->SetInput(input);
+      thresholder->SetLowerThreshold(lowThreshold);
+      thresholder->SetUpperThreshold(highThreshold);
+      thresholder->SetInsideValue(0);
+      thresholder->SetOutsideValue(1);
+      thresholder->Update();
+    }, {read});
+
+  MaskSpatialObject::Pointer skinMaskSpatialObject = MaskSpatialObject::New();
+  const auto skin = graph.Add("SkinMask", [&]()
+    {
+      itk::SizeValueType objectCount = 0;
+      MaskImageType::Pointer background = femur::ShareImage(thresholder->GetOutput());
+      MaskImageType::Pointer skinMask = femur::KeepLargestObjects< MaskImageType >(background, 1, 0, 255, &objectCount);
+      std::cout << "Connected components filter on background found " << objectCount << " objects" << std::endl;
+
+      std::cout << "Writing mask to " << maskFileName << std::endl;
+      filters.writer.Write(skinMask.GetPointer(), maskFileName);
+      skinMaskSpatialObject->SetImage(skinMask);
+    }, {threshold});
+
+  MaskSpatialObject::Pointer erodedMaskSpatialObject = MaskSpatialObject::New();
+  const auto eroded = graph.Add("ErodedMask", [&]()
+    {
+      std::cout << "Eroding skin image by " << maxSigma << std::endl;
+      MaskImageType::Pointer background = femur::ShareImage(thresholder->GetOutput());
+      erodedMaskSpatialObject->SetImage(femur::ErodeByDistance< MaskImageType >(background, 0, maxSigma));
+    }, {threshold});
 
-  MaskThesholdFilter2::Pointer inverter2 = MaskThesholdFilter2::New();
-  inverter2->SetInput(thresholder->GetOutput());
-	inverter2->SetUpperThreshold(0);
-	inverter2->Update();
+  /* Multiscale measure */
+  MultiScaleHessianFilterType::Pointer multiScaleFilter = filters.multiScaleFilter;
+  graph.Add("MultiScale", [&]()
+    {
+      MultiScaleHessianFilterType::SigmaArrayType sigmaArray = multiScaleFilter->GenerateLogarithmicSigmaArray(minSigma, maxSigma, numberOfSigma);
+      std::cout << "Sigma Array: " << sigmaArray << std::endl;
 
-  StructuringElementType structuringElement = StructuringElementType::Ball( radius );
-  ErodeFilterType::Pointer erodeFilter = ErodeFilterType::New();
-  erodeFilter->SetInput( inverter2->GetOutput() );
-  erodeFilter->SetKernel( structuringElement );
-  erodeFilter->Update();
+      CalgaryEigenToMeasureParameterEstimationFilterType::Pointer estimationFilter = filters.estimationFilter;
+      CalgaryEigenToMeasureImageFilterType::Pointer calgaryFilter = filters.calgaryFilter;
 
-	MaskSpatialObject::Pointer skinMaskSpatialObject = MaskSpatialObject::New();
-	skinMaskSpatialObject->SetImage(inverter->GetOutput());
+      estimationFilter->SetMask(erodedMaskSpatialObject);
+      calgaryFilter->SetMask(skinMaskSpatialObject);
 
-	MaskSpatialObject::Pointer erodedMaskSpatialObject = MaskSpatialObject::New();
-	erodedMaskSpatialObject->SetImage(erodeFilter->GetOutput());
+      estimationFilter->SetFrobeniusNormWeight(weight);
 
-  /* Multiscale measure */
-  MultiScaleHessianFilterType::Pointer multiScaleFilter = MultiScaleHessianFilterType::New();
+      std::cout << "Running multiScaleFilter..." << std::endl;
+      multiScaleFilter->SetInput(input);
+      multiScaleFilter->SetEigenToMeasureImageFilter(calgaryFilter);
+      multiScaleFilter->SetEigenToMeasureParameterEstimationFilter(estimationFilter);
+      multiScaleFilter->SetSigmaArray(sigmaArray);
+      multiScaleFilter->Update();
+    }, {skin, eroded});
 
-  MultiScaleHessianFilterType::SigmaArrayType sigmaArray = multiScaleFilter->GenerateLogarithmicSigmaArray(minSigma, maxSigma, numberOfSigma);
-  std::cout << "Sigma Array: " << sigmaArray << std::endl;
+  graph.Run();
 
-  CalgaryEigenToMeasureParameterEstimationFilterType::Pointer estimationFilter = CalgaryEigenToMeasureParameterEstimationFilterType::New();
-  CalgaryEigenToMeasureImageFilterType::Pointer calgaryFilter = CalgaryEigenToMeasureImageFilterType::New();
+  std::cout << "Writing results to " << outputMeasureFileName << std::endl;
+  filters.writer.Write(multiScaleFilter->GetOutput(), outputMeasureFileName, quantizationScale);
 
-  estimationFilter->SetMask(erodedMaskSpatialObject);
-	calgaryFilter->SetMask(skinMaskSpatialObject);
+  /* The filters outlive the scan, do not let them hold on to its images. The writer keeps its own reference. */
+  multiScaleFilter->GetOutput()->ReleaseData();
 
-  estimationFilter->SetFrobeniusNormWeight(weight);
+  return EXIT_SUCCESS;
+}
 
-  std::cout << "Running multiScaleFilter..." << std::endl;
-  multiScaleFilter->SetInput(reader->GetOutput());
-  multiScaleFilter->SetEigenToMeasureImageFilter(calgaryFilter);
-  multiScaleFilter->SetEigenToMeasureParameterEstimationFilter(estimationFilter);
-  multiScaleFilter->SetSigmaArray(sigmaArray);
-  multiScaleFilter->Update();
+int main(int argc, char * argv[])
+{
+  /* Prefer our IO factories, e.g. parallel gzip for .nii.gz */
+  femur::RegisterImageIOFactories();
+  femur::ParseCommonOptions(argc, argv);
+  const femur::BatchOptions batch = femur::ParseBatchOptions(argc, argv);
 
-  std::cout << "Writing results to " << outputMeasureFileName << std::endl;
-  MeasureWriterType::Pointer measureWriter = MeasureWriterType::New();
-  measureWriter->SetInput(multiScaleFilter->GetOutput());
-  measureWriter->SetFileName(outputMeasureFileName);
-  measureWriter->Write();
+  if( batch.Manifest.empty() ? (argc != 11 && argc != 12) : argc != 1 )
+  {
+    std::cerr << "Usage: "<< std::endl;
+    std::cerr << argv[0];
+    std::cerr << " <InputFileName> <OutputMask> <OutputMeasure> ";
+    std::cerr << " <SetEnhanceBrightObjects[0,1]> ";
+    std::cerr << " <NumberOfSigma> <MinSigma> <MaxSigma> ";
+    std::cerr << " <LowThreshold> <HighThreshold> <Weight> [<QuantizationScale>]";
+    std::cerr << " [--trace <file.json>] [--threads <N>] [--pool <stealing|itk|tbb|platform>]";
+    std::cerr << " [--buffer-pool <size>] [--huge-pages] [--perf <file.json>]";
+    std::cerr << std::endl;
+    std::cerr << argv[0] << " --manifest <file> [--jobs <N>] [--prefetch-memory <size>]  (one line of the arguments above per scan)";
+    std::cerr << std::endl;
+    return EXIT_FAILURE;
+  }
 
-  return EXIT_SUCCESS;
+  if ( !batch.Manifest.empty() )
+  {
+    std::vector< SheetnessFilters > filters(batch.Jobs);
+    femur::ImagePrefetcher prefetcher(batch.PrefetchMemory);
+    int result = femur::RunManifest(femur::ReadManifest(batch.Manifest), batch.Jobs,
+      [&](const femur::ManifestEntry & scan, unsigned int worker) { return Sheetness(scan, filters[worker], prefetcher); },
+      [&](const femur::ManifestEntry & scan) { prefetcher.Prefetch< InputImageType >(scan.at(0)); });
+    for (SheetnessFilters & worker : filters)
+    {
+      if ( !worker.writer.Wait() )
+      {
+        result = EXIT_FAILURE;
+      }
+    }
+    return result;
+  }
+
+  SheetnessFilters filters;
+  femur::ImagePrefetcher prefetcher;
+  const int result = Sheetness(femur::ManifestEntry(argv + 1, argv + argc), filters, prefetcher);
+  return filters.writer.Wait() ? result : EXIT_FAILURE;
 }